@@ -0,0 +1,280 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "bench.h"
+
+// Stack of the thread the peak stack is measured on, and the byte it is painted with
+#define BENCH_STACK_SIZE    (256 * 1024)
+#define BENCH_STACK_PAINT   0xa5
+
+// Time budget of a case, and of a case with --quick
+#define BENCH_BUDGET_NS         200000000LL
+#define BENCH_QUICK_ITERATIONS  3
+
+/// A case run once on the measurement thread
+struct bench_probe {
+    bench_fn fn;
+    void *arg;
+    int ret;
+    uint8_t *entry_sp;      // stack pointer when the case was entered
+};
+
+static bool quick;
+static int failures;
+static int stdout_fd = -1;
+
+// Heap accounting of the wrapped allocator, only updated while a probe runs
+static bool heap_tracking;
+static size_t heap_current;
+static size_t heap_peak;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+/// Nanoseconds of the monotonic clock
+static int64_t now_ns(void);
+
+/// Entry of the measurement thread
+static void *probe_thread(void *arg);
+
+/// Run a case once on a painted stack, sets peak stack and heap
+static int probe(bench_fn fn, void *arg, size_t *peak_stack, size_t *peak_heap);
+
+void bench_init(int argc, char **argv)
+{
+    int i;
+
+    for(i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        }
+    }
+
+    printf("%-44s %12s %8s %12s %12s\n", "case", "ns/op", "iters", "stack [B]", "heap [B]");
+}
+
+double bench_run(const char *name, bench_fn fn, void *arg)
+{
+    int64_t start;
+    int64_t elapsed;
+    long iterations = 0;
+    long batch = 1;
+    long i;
+    size_t peak_stack = 0;
+    size_t peak_heap = 0;
+    int ret = 0;
+
+    bench_silence(true);
+    // Double the batch until the budget is spent, the clock is only read between batches
+    start = now_ns();
+    do {
+        for(i = 0; i < batch && ret == 0; i++) {
+            ret = fn(arg);
+        }
+        iterations += i;
+        elapsed = now_ns() - start;
+        batch *= 2;
+    } while(ret == 0 && (quick ? iterations < BENCH_QUICK_ITERATIONS : elapsed < BENCH_BUDGET_NS));
+
+    if(ret == 0) {
+        ret = probe(fn, arg, &peak_stack, &peak_heap);
+    }
+    bench_silence(false);
+
+    if(ret != 0) {
+        printf("%-44s FAILED (%d)\n", name, ret);
+        failures++;
+        return -1;
+    }
+
+    printf("%-44s %12.1f %8ld %12zu %12zu\n", name, (double)elapsed / iterations, iterations, peak_stack, peak_heap);
+    return (double)elapsed / iterations;
+}
+
+void bench_report(const char *name, double value, const char *unit)
+{
+    printf("%-44s %12.1f %s\n", name, value, unit);
+}
+
+void bench_section(const char *title)
+{
+    printf("\n-- %s\n", title);
+}
+
+char *bench_read_fixture(const char *name, size_t *len)
+{
+    char path[512];
+    FILE *f;
+    long size;
+    char *buf;
+
+    snprintf(path, sizeof path, "%s/%s", FIXTURE_DIR, name);
+    f = fopen(path, "rb");
+    if(f == NULL) {
+        fprintf(stderr, "Can't open fixture %s\n", path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    buf = malloc(size + 1);
+    if(buf == NULL || fread(buf, 1, size, f) != (size_t)size) {
+        fprintf(stderr, "Can't read fixture %s\n", path);
+        exit(1);
+    }
+    buf[size] = '\0';
+    fclose(f);
+
+    if(len != NULL) {
+        *len = size;
+    }
+    return buf;
+}
+
+int bench_finish(void)
+{
+    if(failures > 0) {
+        printf("\n%d case(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void bench_silence(bool on)
+{
+    int null_fd;
+
+    fflush(stdout);
+    if(on) {
+        null_fd = open("/dev/null", O_WRONLY);
+        stdout_fd = dup(STDOUT_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    } else if(stdout_fd >= 0) {
+        dup2(stdout_fd, STDOUT_FILENO);
+        close(stdout_fd);
+        stdout_fd = -1;
+    }
+}
+
+static __attribute__((noinline)) void *probe_thread(void *arg)
+{
+    struct bench_probe *p = arg;
+    uint8_t marker;
+
+    p->entry_sp = &marker;
+    heap_current = 0;
+    heap_peak = 0;
+    heap_tracking = true;
+    p->ret = p->fn(p->arg);
+    heap_tracking = false;
+
+    return NULL;
+}
+
+static int probe(bench_fn fn, void *arg, size_t *peak_stack, size_t *peak_heap)
+{
+    struct bench_probe p = { .fn = fn, .arg = arg };
+    pthread_attr_t attr;
+    pthread_t thread;
+    uint8_t *stack;
+    size_t i;
+
+    stack = __real_malloc(BENCH_STACK_SIZE);
+    if(stack == NULL) {
+        return -1;
+    }
+    memset(stack, BENCH_STACK_PAINT, BENCH_STACK_SIZE);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack, BENCH_STACK_SIZE);
+    if(pthread_create(&thread, &attr, probe_thread, &p) != 0) {
+        pthread_attr_destroy(&attr);
+        __real_free(stack);
+        return -1;
+    }
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+
+    // Stack grows down, the deepest byte that is no longer painted is the peak
+    for(i = 0; i < BENCH_STACK_SIZE && stack[i] == BENCH_STACK_PAINT; i++) {
+    }
+    *peak_stack = p.entry_sp > stack + i ? (size_t)(p.entry_sp - (stack + i)) : 0;
+    *peak_heap = heap_peak;
+
+    __real_free(stack);
+    return p.ret;
+}
+
+/// Account an allocation of @param ptr, or a release when @param sign is negative
+static void heap_account(void *ptr, int sign)
+{
+    size_t size;
+
+    if(!heap_tracking || ptr == NULL) {
+        return;
+    }
+    size = malloc_usable_size(ptr);
+    if(sign > 0) {
+        heap_current += size;
+        if(heap_current > heap_peak) {
+            heap_peak = heap_current;
+        }
+    } else {
+        heap_current = size > heap_current ? 0 : heap_current - size;
+    }
+}
+
+void *__wrap_malloc(size_t size)
+{
+    void *ptr = __real_malloc(size);
+
+    heap_account(ptr, 1);
+    return ptr;
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    void *ptr = __real_calloc(nmemb, size);
+
+    heap_account(ptr, 1);
+    return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    void *new_ptr;
+
+    heap_account(ptr, -1);
+    new_ptr = __real_realloc(ptr, size);
+    if(new_ptr == NULL && size > 0) {
+        // Old block is still allocated
+        heap_account(ptr, 1);
+    }
+    heap_account(new_ptr, 1);
+    return new_ptr;
+}
+
+void __wrap_free(void *ptr)
+{
+    heap_account(ptr, -1);
+    __real_free(ptr);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    Host benchmark runner.
+    Every case is timed over enough iterations to fill the time budget and reported as ns/op,
+    then run once more on a painted stack with malloc wrapped to report the peak stack and heap
+    it needed. Peak stack is measured from the entry of the case, so it is comparable to what the
+    case adds to the stack of the calling task on the target.
+    Output of the code under test (printf) is sent to /dev/null while a case runs.
+    With --quick every case runs a few iterations only, ctest uses it to check the cases still pass.
+ */
+
+/// A benchmark case, returns 0 on success, anything else fails the run
+typedef int (*bench_fn)(void *arg);
+
+/// Parse the command line of the runner (--quick)
+void bench_init(int argc, char **argv);
+
+/**
+ *  Time a case and measure its peak stack and heap, prints one line of the report
+ * @return  ns/op on success, e.g. to derive a throughput,
+ *          -1 if the case failed
+*/
+double bench_run(const char *name, bench_fn fn, void *arg);
+
+/// Print a derived figure of the report (a size, a count) next to the timed cases
+void bench_report(const char *name, double value, const char *unit);
+
+/// Send stdout to /dev/null while @param on, for setup code that prints
+void bench_silence(bool on);
+
+/// Start a section of the report
+void bench_section(const char *title);
+
+/**
+ *  Read a file of the fixtures directory, NUL-terminated
+ * @param len set to the length without the NUL, may be NULL
+ * @return  malloc'd contents, aborts the runner if the file can't be read
+*/
+char *bench_read_fixture(const char *name, size_t *len);
+
+/// Exit code of the runner, non zero if any case failed
+int bench_finish(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include "bench.h"
+#include "duty_cycle_sim.h"
+
+/*
+    Energy per sample and battery life of the low power mode, one simulated day per case on the
+    energy model of duty_cycle_sim.h. The figures are only as good as the model, measure the board's
+    currents and timings and put them in the model before drawing conclusions for field trials.
+ */
+
+#define PERIOD_MS       10000
+#define WAKES_PER_DAY   (24 * 3600 * 1000 / PERIOD_MS)
+
+static const struct duty_cycle_energy_model model = DUTY_CYCLE_ENERGY_MODEL_ESP32C3;
+
+/// Every tenth publish runs into the timeout, e.g. a weak AP
+static bool publish_one_in_ten_fails(uint32_t attempt, void *arg)
+{
+    return attempt % 10 != 9;
+}
+
+static void run_day(const char *title, uint32_t publish_every, duty_cycle_sim_publish_fn publish)
+{
+    struct duty_cycle_config config = { .sample_period_ms = PERIOD_MS, .publish_every = publish_every };
+    struct duty_cycle_sim_scenario scenario = {
+        .config = &config, .model = &model, .num_wakes = WAKES_PER_DAY, .publish = publish,
+    };
+    struct duty_cycle_sim_result result;
+
+    duty_cycle_sim_run(&scenario, &result);
+
+    bench_section(title);
+    bench_report("  publishes", result.stats.publishes, "");
+    bench_report("  failed publishes", result.stats.failed_publishes, "");
+    bench_report("  samples dropped", result.stats.dropped, "");
+    bench_report("  charge per day", result.charge_uah / 1000, "mAh");
+    bench_report("  average current", result.average_ua, "uA");
+    bench_report("  energy per sample", result.energy_per_sample_mj, "mJ");
+    bench_report("  battery life", result.battery_days, "days");
+}
+
+int main(int argc, char **argv)
+{
+    const uint32_t publish_every[] = { 1, 10, 30, DUTY_CYCLE_MAX_SAMPLES };
+    char title[64];
+    size_t i;
+
+    bench_init(argc, argv);
+
+    bench_section("Always on, wifi and mqtt connected");
+    bench_report("  average current", model.always_on_ma * 1000, "uA");
+    bench_report("  battery life", model.battery_mah / model.always_on_ma / 24, "days");
+
+    for(i = 0; i < sizeof publish_every / sizeof publish_every[0]; i++) {
+        snprintf(title, sizeof title, "Publish every %u samples", (unsigned)publish_every[i]);
+        run_day(title, publish_every[i], NULL);
+    }
+    run_day("Publish every 30 samples, one in ten publishes fails", 30, publish_one_in_ten_fails);
+
+    return bench_finish();
+}
@@ -0,0 +1,105 @@
+#include <string.h>
+#include "bench.h"
+#include "fleet_response.h"
+#include "fleet_prov.h"
+#include "mqtt.h"
+#include "mqtt_reassembly.h"
+
+/*
+    Fleet provisioning as the claim client runs it, whole responses and fragmented ones gathered
+    with mqtt_reassembly before parsing.
+ */
+
+static char certificate_id[CERTIFICATE_ID_SIZE];
+static char certificate_pem[CERTIFICATE_PEM_SIZE];
+static char private_key[PRIVATE_KEY_SIZE];
+static char ownership_token[CERTIFICATE_OWNERSHIP_TOKEN];
+
+static const struct fleet_prov_keys keys = {
+    .certificate_id = certificate_id,
+    .certificate_id_size = sizeof certificate_id,
+    .certificate_pem = certificate_pem,
+    .certificate_pem_size = sizeof certificate_pem,
+    .private_key = private_key,
+    .private_key_size = sizeof private_key,
+    .certificate_ownership_token = ownership_token,
+    .certificate_ownership_token_size = sizeof ownership_token,
+};
+
+/// Check the decoded credentials against the fixtures
+static int check_keys(const struct fleet_response *r)
+{
+    if(strcmp(certificate_pem, r->cert_pem) != 0 || strcmp(private_key, r->key_pem) != 0
+        || strlen(ownership_token) != FLEET_RESPONSE_TOKEN_LEN) {
+        return -1;
+    }
+    return 0;
+}
+
+static int bench_parse_whole(void *arg)
+{
+    const struct fleet_response *r = arg;
+
+    if(fleet_prov_parse_create_keys_response(r->json, r->len, &keys) != 0) {
+        return -1;
+    }
+    return check_keys(r);
+}
+
+static int bench_parse_fragmented(void *arg)
+{
+    const struct fleet_response *r = arg;
+    struct mqtt_reassembly reassembly;
+    enum mqtt_reassembly_status status = MQTT_REASSEMBLY_INCOMPLETE;
+    int ret = -1;
+    int i;
+
+    mqtt_reassembly_init(&reassembly, CREATE_KEYS_AND_CERT_RESPONSE_SIZE);
+    for(i = 0; i < r->num_fragments && status == MQTT_REASSEMBLY_INCOMPLETE; i++) {
+        status = mqtt_reassembly_feed(&reassembly, &r->fragments[i]);
+    }
+
+    if(status == MQTT_REASSEMBLY_COMPLETE && mqtt_reassembly_topic_is(&reassembly, TOPIC_CREATE_KEYS_AND_CERT_ACCEPTED)
+        && fleet_prov_parse_create_keys_response(reassembly.data, reassembly.len, &keys) == 0) {
+        ret = check_keys(r);
+    }
+    mqtt_reassembly_reset(&reassembly);
+
+    return ret;
+}
+
+static int bench_format_register_thing(void *arg)
+{
+    char payload[REGISTER_THING_PAYLOAD_SIZE];
+
+    (void)arg;
+    return fleet_prov_format_register_thing(payload, sizeof payload, ownership_token, "temperature-sensor-0042") > 0
+        ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    struct fleet_response rsa;
+    struct fleet_response ec;
+
+    bench_init(argc, argv);
+    fleet_response_build(&rsa, "rsa2048_cert.pem", "rsa2048_key.pem");
+    fleet_response_build(&ec, "ec_cert.pem", "ec_key.pem");
+
+    bench_section("CreateKeysAndCertificate response, RSA-2048");
+    bench_report("response size", rsa.len, "B");
+    bench_report("fragments", rsa.num_fragments, "");
+    bench_run("parse whole", bench_parse_whole, &rsa);
+    bench_run("reassemble and parse fragments", bench_parse_fragmented, &rsa);
+
+    bench_section("CreateKeysAndCertificate response, EC P-256");
+    bench_report("response size", ec.len, "B");
+    bench_report("fragments", ec.num_fragments, "");
+    bench_run("parse whole", bench_parse_whole, &ec);
+    bench_run("reassemble and parse fragments", bench_parse_fragmented, &ec);
+
+    bench_section("RegisterThing request");
+    bench_run("format payload", bench_format_register_thing, NULL);
+
+    return bench_finish();
+}
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+#include "fleet_response.h"
+#include "json_parser.h"
+#include "fleet_prov.h"
+#include "mqtt.h"
+
+/*
+    Decoding the PEMs of a CreateKeysAndCertificate response.
+    The legacy cases are the path the claim handler used before json_parser: strstr to find the key,
+    a copy of the value to a static tmp_buf, str_replace building the result in a 4 KiB stack buffer
+    and a strncpy to the destination. The current path finds every field in one pass and decodes
+    the escapes straight into the destination.
+ */
+
+// Sizes of the legacy path
+#define TMPBUFFER_SIZE              CERTIFICATE_PEM_SIZE
+#define STR_REPLACE_BUFFER_SIZE     CERTIFICATE_PEM_SIZE
+
+/// A field of a response to decode
+struct pem_case {
+    const struct fleet_response *response;
+    const char *key;
+    const char *expected;
+};
+
+static char tmp_buf[TMPBUFFER_SIZE];
+static char out[CERTIFICATE_PEM_SIZE];
+
+/// Legacy: get value of key from json object
+static int json_get_string(const char *json, const char *key, char *value)
+{
+    char *pch;
+    int len;
+    // GET KEY IN JSON
+    pch = strstr(json, key);
+
+    // IF KEY EXISTS IN json
+    if(pch != NULL) {
+        // Locate end of key
+        pch = strchr(pch, ':');
+
+        // Locate start of value
+        pch = strchr(pch, '\"');
+
+        // Locate end of value
+        len = strcspn(pch+1, "\"");
+
+        // +1 to not include the "
+        strncpy(value, pch+1, len);
+        value[len] = '\0';
+        return 0;
+    }
+    else {
+        return -1;
+    }
+}
+
+/// Legacy: replace every @param rep of @param orig with @param with
+static int str_replace(char *dest, int size_of_dest, char *orig, char *rep, char *with)
+{
+    char result[STR_REPLACE_BUFFER_SIZE];   // the return string
+    char *ins;                              // the next insert point
+    char *tmp;                              // varies
+    int len_rep;                            // length of rep (the string to remove)
+    int len_with;                           // length of with (the string to replace rep with)
+    int len_front;                          // distance between rep and end of last rep
+    int count;                              // number of replacements
+
+    // sanity checks and initialization
+    if (!orig || !rep)
+        return -1;
+    len_rep = strlen(rep);
+    if (len_rep == 0)
+        return -1; // empty rep causes infinite loop during count
+    if (!with)
+        with = "";
+    len_with = strlen(with);
+
+    // count the number of replacements needed
+    ins = orig;
+    for (count = 0; (tmp = strstr(ins, rep)); ++count) {
+        ins = tmp + len_rep;
+    }
+
+    tmp = result;
+
+    while (count--) {
+        ins = strstr(orig, rep);
+        len_front = ins - orig;
+        tmp = strncpy(tmp, orig, len_front) + len_front;
+        tmp = strcpy(tmp, with) + len_with;
+        orig += len_front + len_rep; // move to next "end of rep"
+    }
+    strcpy(tmp, orig);
+
+    strncpy(dest, result, size_of_dest);
+
+    return 0;
+}
+
+static int bench_legacy(void *arg)
+{
+    const struct pem_case *c = arg;
+    char *tmp;
+
+    if(json_get_string(c->response->json, c->key, tmp_buf) != 0
+        || str_replace(out, sizeof out, tmp_buf, "\\n", "\n") != 0) {
+        return -1;
+    }
+
+    // replace last newline ('\n') with \0, assuming it exists
+    tmp = strrchr(out, '\n');
+    *tmp = '\0';
+
+    return strcmp(out, c->expected) == 0 ? 0 : -1;
+}
+
+static int bench_decode(void *arg)
+{
+    const struct pem_case *c = arg;
+    struct json_field field = { .key = c->key };
+    int len;
+
+    if(json_parse_fields(c->response->json, c->response->len, &field, 1) != 0) {
+        return -1;
+    }
+    len = json_decode_field(&field, out, sizeof out);
+    if(len <= 0) {
+        return -1;
+    }
+    if(out[len - 1] == '\n') {
+        out[len - 1] = '\0';
+    }
+
+    return strcmp(out, c->expected) == 0 ? 0 : -1;
+}
+
+static int bench_parse_fields(void *arg)
+{
+    const struct fleet_response *r = arg;
+    struct json_field fields[] = {
+        { .key = JSON_KEY_CERTIFICATE_ID },
+        { .key = JSON_KEY_CERTIFICATE_PEM },
+        { .key = JSON_KEY_PRIVATE_KEY },
+        { .key = JSON_KEY_CERTIFICATE_OWNERSHIP_TOKEN },
+    };
+
+    if(json_parse_fields(r->json, r->len, fields, sizeof fields / sizeof fields[0]) != 0) {
+        return -1;
+    }
+    return fields[3].found ? 0 : -1;
+}
+
+/// Legacy and current decoding of one field, with the throughput over the escaped value
+static void run_pem_case(const char *title, const struct fleet_response *r, const char *key, const char *expected)
+{
+    struct pem_case c = { r, key, expected };
+    char name[64];
+    double ns;
+
+    snprintf(name, sizeof name, "%s, legacy", title);
+    bench_run(name, bench_legacy, &c);
+    snprintf(name, sizeof name, "%s, in place", title);
+    ns = bench_run(name, bench_decode, &c);
+    if(ns > 0) {
+        snprintf(name, sizeof name, "  %s throughput", title);
+        bench_report(name, strlen(expected) * 1000.0 / ns, "MB/s");
+    }
+}
+
+/// Throughput of the single pass over a whole response
+static void run_parse_case(const char *title, const struct fleet_response *r)
+{
+    char name[64];
+    double ns;
+
+    snprintf(name, sizeof name, "%s, json_parse_fields", title);
+    ns = bench_run(name, bench_parse_fields, (void *)r);
+    if(ns > 0) {
+        snprintf(name, sizeof name, "  %s throughput", title);
+        bench_report(name, r->len * 1000.0 / ns, "MB/s");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct fleet_response rsa;
+    struct fleet_response ec;
+
+    bench_init(argc, argv);
+    fleet_response_build(&rsa, "rsa2048_cert.pem", "rsa2048_key.pem");
+    fleet_response_build(&ec, "ec_cert.pem", "ec_key.pem");
+
+    bench_section("RSA-2048");
+    run_parse_case("response", &rsa);
+    run_pem_case("certificate", &rsa, JSON_KEY_CERTIFICATE_PEM, rsa.cert_pem);
+    run_pem_case("private key", &rsa, JSON_KEY_PRIVATE_KEY, rsa.key_pem);
+
+    bench_section("EC P-256");
+    run_parse_case("response", &ec);
+    run_pem_case("certificate", &ec, JSON_KEY_CERTIFICATE_PEM, ec.cert_pem);
+    run_pem_case("private key", &ec, JSON_KEY_PRIVATE_KEY, ec.key_pem);
+
+    return bench_finish();
+}
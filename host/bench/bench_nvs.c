@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "nvs_sim.h"
+#include "nvs_ops.h"
+#include "nvs_batch.h"
+#include "my_nvs.h"
+#include "credentials.h"
+
+/*
+    NVS traffic of the firmware's boot and provisioning paths on the flash model of nvs_sim.
+    The counts are what the device does on every boot, the timings are those of the model,
+    they only compare the paths with each other.
+ */
+
+// Config rewrites of the wear case, a device reprovisioned this often is an extreme
+#define CHURN_COMMITS   1000
+
+static const struct device_config config = {
+    .ssid = "home-network", .pwd = "correct horse battery", .aws_uuid = "2f1c7d9e-5a4b-4c3d-9e8f-7a6b5c4d3e2f",
+    .thing_name = "temperature-sensor-0042",
+};
+
+static uint8_t client_cert[2048];
+static int client_cert_len;
+static uint8_t client_key[2048];
+static int client_key_len;
+
+/// Report NVS operations and flash traffic between two snapshots
+static void report_traffic(const struct nvs_ops_stats *before, const struct nvs_ops_stats *after,
+    const struct nvs_sim_stats *sim, double per);
+
+/// Flash the server and claim credentials like the factory does
+static void factory(void)
+{
+    char *pem;
+    size_t len;
+    nvs_handle_t handle;
+
+    nvs_sim_reset();
+    nvs_flash_init();
+
+    nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    pem = bench_read_fixture("rsa2048_cert.pem", &len);
+    nvs_set_blob(handle, NVS_KEY_SERVER_CERT, pem, len);
+    nvs_set_blob(handle, NVS_KEY_CLAIM_CLIENT_CERT, pem, len);
+    free(pem);
+    pem = bench_read_fixture("rsa2048_key.pem", &len);
+    nvs_set_blob(handle, NVS_KEY_CLAIM_CLIENT_KEY, pem, len);
+    free(pem);
+    nvs_close(handle);
+}
+
+/// Provision over BLE and register thing, the config and the connection credentials are committed
+static void provision(void)
+{
+    nvs_config_load();
+    nvs_config_flush(&config);
+    nvs_set_tls_certs(client_cert, client_cert_len, NVS_KEY_CON_CLIENT_CERT,
+        client_key, client_key_len, NVS_KEY_CON_CLIENT_KEY);
+}
+
+/// NVS calls of a boot of a provisioned device, in the order app_main(), wifi and mqtt make them
+static int boot(void *arg)
+{
+    uint8_t ssid[WIFI_SSID_MAX_SIZE];
+    uint8_t pwd[WIFI_PWD_MAX_SIZE];
+    char thing_name[AWS_THING_NAME_MAX_SIZE];
+    struct wifi_ap_cache ap;
+    struct wifi_aps aps;
+    struct tls_certs certs = { 0 };
+    uint32_t gen;
+
+    nvs_sim_reboot();
+    nvs_flash_init();
+    if(nvs_config_load() != ESP_OK || nvs_get_wifi_data(ssid, pwd) != ESP_OK) {
+        return -1;
+    }
+
+    // Wifi, connect and remember the AP
+    nvs_get_wifi_aps(&aps);
+    if(nvs_get_wifi_ap_cache(&ap) != ESP_OK) {
+        memset(&ap, 0, sizeof ap);
+        ap.channel = 6;
+    }
+    nvs_set_wifi_aps(&aps);
+    nvs_set_wifi_ap_cache(&ap);
+
+    // Mqtt, load the connection credentials
+    if(nvs_get_thing_name(thing_name) != ESP_OK || nvs_batch_get_generation(NVS_SET_TLS, &gen) != ESP_OK
+        || nvs_get_tls_certs(&certs, NVS_KEY_SERVER_CERT, NVS_KEY_CON_CLIENT_CERT, NVS_KEY_CON_CLIENT_KEY) != ESP_OK) {
+        return -1;
+    }
+    nvs_free_tls_certs(&certs);
+
+    return nvs_sim_open_handles() == 0 ? 0 : -1;
+}
+
+/// Reprovision with a new password, the rest of the config stays the same
+static int config_flush(void *arg)
+{
+    static unsigned count;
+    struct device_config new_config = config;
+
+    snprintf(new_config.pwd, sizeof new_config.pwd, "password-%u", count++);
+    return nvs_config_flush(&new_config) == ESP_OK ? 0 : -1;
+}
+
+static int config_load(void *arg)
+{
+    return nvs_config_load() == ESP_OK ? 0 : -1;
+}
+
+/// Read one string with its own open, the way every accessor did before nvs_config_load()
+static esp_err_t read_str_own_open(const char *key, char *out_value, size_t size)
+{
+    nvs_handle_t handle;
+    esp_err_t err;
+
+    err = nvs_batch_open(NVS_SET_CONFIG, &handle);
+    if(err == ESP_OK) {
+        err = nvs_ops_get_str(handle, key, out_value, &size);
+        nvs_close(handle);
+    }
+    return err;
+}
+
+/**
+ *  Config reads of a boot before nvs_config_load(), from the slot the config is stored in now:
+ *  wifi data with one open, the thing name with an other
+*/
+static int config_read_per_accessor(void *arg)
+{
+    struct device_config read;
+    nvs_handle_t handle;
+    size_t size;
+    esp_err_t err;
+
+    err = nvs_batch_open(NVS_SET_CONFIG, &handle);
+    if(err == ESP_OK) {
+        size = sizeof read.ssid;
+        err = nvs_ops_get_str(handle, NVS_KEY_WIFI_SSID, read.ssid, &size);
+        if(err == ESP_OK) {
+            size = sizeof read.pwd;
+            err = nvs_ops_get_str(handle, NVS_KEY_WIFI_PWD, read.pwd, &size);
+        }
+        nvs_close(handle);
+    }
+    if(err == ESP_OK) {
+        err = read_str_own_open(NVS_KEY_AWS_THING_NAME, read.thing_name, sizeof read.thing_name);
+    }
+    return err == ESP_OK ? 0 : -1;
+}
+
+/// Traffic of one call of @param fn on a booted device
+static void report_one(bench_fn fn)
+{
+    struct nvs_ops_stats before, after;
+    struct nvs_sim_stats sim;
+
+    bench_silence(true);
+    nvs_sim_clear_stats();
+    nvs_ops_get_stats(&before);
+    fn(NULL);
+    nvs_ops_get_stats(&after);
+    bench_silence(false);
+    nvs_sim_get_stats(&sim);
+    report_traffic(&before, &after, &sim, 1);
+}
+
+/// Report NVS operations and flash traffic between two snapshots
+static void report_traffic(const struct nvs_ops_stats *before, const struct nvs_ops_stats *after,
+    const struct nvs_sim_stats *sim, double per)
+{
+    bench_report("  nvs_open", (after->count[NVS_OP_OPEN] - before->count[NVS_OP_OPEN]) / per, "");
+    bench_report("  reads (incl. length probes)", (after->count[NVS_OP_READ] - before->count[NVS_OP_READ]) / per, "");
+    bench_report("  writes", (after->count[NVS_OP_WRITE] - before->count[NVS_OP_WRITE]) / per, "");
+    bench_report("  erases", (after->count[NVS_OP_ERASE] - before->count[NVS_OP_ERASE]) / per, "");
+    bench_report("  commits", (after->count[NVS_OP_COMMIT] - before->count[NVS_OP_COMMIT]) / per, "");
+    bench_report("  flash entries read", sim->entries_read / per, "");
+    bench_report("  flash entries written", sim->entries_written / per, "");
+    bench_report("  writes skipped (value unchanged)", sim->writes_skipped / per, "");
+    bench_report("  page erases", sim->page_erases / per, "");
+}
+
+int main(int argc, char **argv)
+{
+    struct nvs_ops_stats before, after;
+    struct nvs_sim_stats sim;
+    char title[64];
+    char *pem;
+    int i;
+
+    bench_init(argc, argv);
+
+    pem = bench_read_fixture("rsa2048_cert.pem", NULL);
+    client_cert_len = credentials_pem_to_der(pem, client_cert, sizeof client_cert);
+    free(pem);
+    pem = bench_read_fixture("rsa2048_key.pem", NULL);
+    client_key_len = credentials_pem_to_der(pem, client_key, sizeof client_key);
+    free(pem);
+
+    bench_section("Provisioning, config and connection credentials committed");
+    bench_silence(true);
+    factory();
+    nvs_sim_clear_stats();
+    nvs_ops_get_stats(&before);
+    provision();
+    nvs_ops_get_stats(&after);
+    bench_silence(false);
+    nvs_sim_get_stats(&sim);
+    report_traffic(&before, &after, &sim, 1);
+
+    bench_section("Boot of a provisioned device");
+    bench_silence(true);
+    boot(NULL);
+    nvs_sim_clear_stats();
+    nvs_ops_get_stats(&before);
+    boot(NULL);
+    nvs_ops_get_stats(&after);
+    bench_silence(false);
+    nvs_sim_get_stats(&sim);
+    report_traffic(&before, &after, &sim, 1);
+    bench_run("boot", boot, NULL);
+
+    // Up to the config_loaded mark of the boot timeline, against the reads it replaced
+    bench_section("Device config read at boot, nvs_config_load()");
+    report_one(config_load);
+    bench_run("nvs_config_load", config_load, NULL);
+    bench_section("Device config read at boot, one open per accessor (before nvs_config_load())");
+    report_one(config_read_per_accessor);
+    bench_run("config read per accessor", config_read_per_accessor, NULL);
+
+    snprintf(title, sizeof title, "Config rewritten %d times with a new password, per commit", CHURN_COMMITS);
+    bench_section(title);
+    bench_silence(true);
+    factory();
+    provision();
+    nvs_sim_clear_stats();
+    nvs_ops_get_stats(&before);
+    for(i = 0; i < CHURN_COMMITS && config_flush(NULL) == 0; i++) {
+    }
+    nvs_ops_get_stats(&after);
+    bench_silence(false);
+    if(i < CHURN_COMMITS) {
+        printf("Commit %d failed\n", i);
+        return 1;
+    }
+    nvs_sim_get_stats(&sim);
+    report_traffic(&before, &after, &sim, CHURN_COMMITS);
+    bench_report("  page erases, total", sim.page_erases, "");
+    bench_report("  erases of the most worn page", sim.max_page_erases, "");
+    bench_run("nvs_config_flush", config_flush, NULL);
+
+    return bench_finish();
+}
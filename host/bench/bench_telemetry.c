@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+#include "telemetry.h"
+
+/*
+    Size and encoding time of a batch of temperature samples, and the bytes one sample costs on the wire.
+    Built once per encoding, bench_telemetry_json and bench_telemetry_cbor.
+    Wire bytes are the payload plus the framing of one publish, assuming every publish goes out on its own:
+    MQTT PUBLISH header, a TLS 1.2 AES-GCM record and the TCP/IPv4 headers of every segment.
+    The reference is the per sample publish batching replaced, { "temperature": 30} at QoS 0.
+ */
+
+#define THING_NAME              "temperature-sensor-0042"
+#define REFERENCE_TOPIC         "device/temperature-sensor-0042/temperature/data"
+#define REFERENCE_PAYLOAD       "{ \"temperature\": 30}"
+
+// TLS record header, explicit nonce and tag of AES-GCM
+#define TLS_RECORD_OVERHEAD     (5 + 8 + 16)
+// IPv4 and TCP headers without options
+#define TCP_IP_OVERHEAD         (20 + 20)
+#define TCP_MSS                 1460
+// Largest batch of the bench
+#define MAX_BATCH               50
+
+struct batch_case {
+    const struct telemetry_sample *samples;
+    size_t num_samples;
+};
+
+static struct telemetry_sample samples[MAX_BATCH];
+static char data_topic[128];
+static char payload[MAX_BATCH * TELEMETRY_SAMPLE_MAX_LEN + TELEMETRY_PAYLOAD_OVERHEAD];
+
+/// Bytes of a publish of @param payload_len bytes to @param topic on the wire
+static size_t wire_bytes(const char *topic, size_t payload_len, int qos)
+{
+    size_t remaining = 2 + strlen(topic) + (qos > 0 ? 2 : 0) + payload_len;
+    size_t mqtt = 1 + remaining;
+    size_t tls;
+    size_t n;
+
+    // Remaining length is a varint of 7 bits per byte
+    for(n = remaining; n >= 128; n >>= 7) {
+        mqtt++;
+    }
+    mqtt++;
+
+    tls = mqtt + TLS_RECORD_OVERHEAD;
+    return tls + (tls + TCP_MSS - 1) / TCP_MSS * TCP_IP_OVERHEAD;
+}
+
+static int bench_encode(void *arg)
+{
+    const struct batch_case *c = arg;
+    size_t num_samples;
+    int len;
+
+    len = telemetry_encode_array(c->samples, c->num_samples, payload, sizeof payload, &num_samples);
+    return len > 0 && num_samples == c->num_samples ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    const size_t batch_sizes[] = { 1, 5, 10, 20, MAX_BATCH };
+    struct batch_case c;
+    size_t num_samples;
+    char name[64];
+    size_t i;
+    int len;
+
+    bench_init(argc, argv);
+    snprintf(data_topic, sizeof data_topic, TELEMETRY_TOPIC_FORMAT, THING_NAME);
+
+    // A reading every sample period, slowly changing temperature
+    for(i = 0; i < MAX_BATCH; i++) {
+        samples[i].timestamp_ms = 3600000 + i * TELEMETRY_SAMPLE_PERIOD_MS;
+        samples[i].seq = 360 + i;
+        samples[i].channel = TELEMETRY_CHANNEL_TEMPERATURE;
+        samples[i].temperature = 21.5f + (i % 7) * 0.25f;
+    }
+
+    bench_section("Reference, one publish per sample");
+    bench_report("payload bytes per sample", strlen(REFERENCE_PAYLOAD), "B");
+    bench_report("wire bytes per sample", wire_bytes(REFERENCE_TOPIC, strlen(REFERENCE_PAYLOAD), 0), "B");
+
+    for(i = 0; i < sizeof batch_sizes / sizeof batch_sizes[0]; i++) {
+        snprintf(name, sizeof name, "Batch of %zu, %s, QoS %d", batch_sizes[i], TELEMETRY_ENCODING, TELEMETRY_QOS);
+        bench_section(name);
+
+        c.samples = samples;
+        c.num_samples = batch_sizes[i];
+        len = telemetry_encode_array(c.samples, c.num_samples, payload, sizeof payload, &num_samples);
+        if(len <= 0 || num_samples != c.num_samples) {
+            printf("Encoding a batch of %zu failed\n", c.num_samples);
+            return 1;
+        }
+
+        bench_run("telemetry_encode_array", bench_encode, &c);
+        bench_report("  payload bytes", len, "B");
+        bench_report("  payload bytes per sample", (double)len / c.num_samples, "B");
+        bench_report("  wire bytes per sample", (double)wire_bytes(data_topic, len, TELEMETRY_QOS) / c.num_samples, "B");
+    }
+
+    return bench_finish();
+}
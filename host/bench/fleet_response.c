@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "fleet_prov.h"
+#include "mqtt.h"
+#include "fleet_response.h"
+
+/// Append @param pem to @param out json escaped, returns the new end
+static char *append_escaped(char *out, const char *pem)
+{
+    for(; *pem != '\0'; pem++) {
+        if(*pem == '\n') {
+            *out++ = '\\';
+            *out++ = 'n';
+        } else {
+            *out++ = *pem;
+        }
+    }
+    return out;
+}
+
+/// Strip the trailing newline of a PEM, the parser does the same
+static char *strip_newline(char *pem)
+{
+    size_t len = strlen(pem);
+
+    if(len > 0 && pem[len - 1] == '\n') {
+        pem[len - 1] = '\0';
+    }
+    return pem;
+}
+
+void fleet_response_build(struct fleet_response *r, const char *cert_fixture, const char *key_fixture)
+{
+    char *cert = bench_read_fixture(cert_fixture, NULL);
+    char *key = bench_read_fixture(key_fixture, NULL);
+    char *p;
+    int i;
+
+    r->json = malloc(2 * (strlen(cert) + strlen(key)) + FLEET_RESPONSE_TOKEN_LEN + 512);
+    p = r->json;
+    p += sprintf(p, "{\"%s\":\"%s\",\"%s\":\"", JSON_KEY_CERTIFICATE_ID,
+        "4f9b7c1e2d3a5b6c7d8e9f0a1b2c3d4e5f6a7b8c9d0e1f2a3b4c5d6e7f8a9b0c", JSON_KEY_CERTIFICATE_PEM);
+    p = append_escaped(p, cert);
+    p += sprintf(p, "\",\"%s\":\"", JSON_KEY_PRIVATE_KEY);
+    p = append_escaped(p, key);
+    p += sprintf(p, "\",\"%s\":\"", JSON_KEY_CERTIFICATE_OWNERSHIP_TOKEN);
+    for(i = 0; i < FLEET_RESPONSE_TOKEN_LEN; i++) {
+        *p++ = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"[(i * 7) % 64];
+    }
+    p += sprintf(p, "\"}");
+    r->len = p - r->json;
+
+    r->cert_pem = strip_newline(cert);
+    r->key_pem = strip_newline(key);
+
+    r->num_fragments = (r->len + FLEET_RESPONSE_FRAGMENT_SIZE - 1) / FLEET_RESPONSE_FRAGMENT_SIZE;
+    r->fragments = calloc(r->num_fragments, sizeof *r->fragments);
+    for(i = 0; i < r->num_fragments; i++) {
+        r->fragments[i].event_id = MQTT_EVENT_DATA;
+        r->fragments[i].msg_id = 42;
+        r->fragments[i].data = r->json + i * FLEET_RESPONSE_FRAGMENT_SIZE;
+        r->fragments[i].data_len = i == r->num_fragments - 1 ? r->len - i * FLEET_RESPONSE_FRAGMENT_SIZE : FLEET_RESPONSE_FRAGMENT_SIZE;
+        r->fragments[i].total_data_len = r->len;
+        r->fragments[i].current_data_offset = i * FLEET_RESPONSE_FRAGMENT_SIZE;
+        // Esp-mqtt sets the topic on the first fragment only
+        if(i == 0) {
+            r->fragments[i].topic = TOPIC_CREATE_KEYS_AND_CERT_ACCEPTED;
+            r->fragments[i].topic_len = strlen(TOPIC_CREATE_KEYS_AND_CERT_ACCEPTED);
+        }
+    }
+}
+
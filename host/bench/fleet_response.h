@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include "mqtt_client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    CreateKeysAndCertificate responses as AWS IoT sends them, built from the fixture credentials:
+    the PEMs json escaped with \n line breaks and an ownership token of the usual length.
+    Esp-mqtt hands out a message larger than its buffer (1024 bytes by default) in fragments.
+ */
+
+// Receive buffer of esp-mqtt, size of the fragments of a large message
+#define FLEET_RESPONSE_FRAGMENT_SIZE    1024
+
+// Ownership tokens of AWS IoT are around 500 characters of base64
+#define FLEET_RESPONSE_TOKEN_LEN        560
+
+/// A response and the fragments esp-mqtt delivers it in
+struct fleet_response {
+    char *json;                         // NUL-terminated
+    size_t len;
+    char *cert_pem;                     // expected decoded certificate, without the trailing newline
+    char *key_pem;                      // expected decoded key
+    esp_mqtt_event_t *fragments;
+    int num_fragments;
+};
+
+/// Build the response of the fixture certificate and key, aborts the runner if they can't be read
+void fleet_response_build(struct fleet_response *r, const char *cert_fixture, const char *key_fixture);
+
+#ifdef __cplusplus
+}
+#endif
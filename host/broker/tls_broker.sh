@@ -0,0 +1,64 @@
+#!/bin/sh
+# Local mosquitto TLS broker standing in for AWS IoT, to try CONFIG_MQTT_TLS_SESSION_RESUMPTION on a device
+# against a server we control. Creates a test CA, a broker certificate and a device certificate in out/
+# on the first run, then starts mosquitto. See README.md for flashing the device.
+#
+# usage: tls_broker.sh <ip or hostname of this machine as the device sees it> [port]
+set -e
+
+HOST=${1:?usage: $0 <ip or hostname of this machine> [port]}
+PORT=${2:-8883}
+# Client id the device connects with before it is registered, CONFIG_MQTT_CLAIM_CLIENT_ID
+CLIENT_ID=${CLIENT_ID:-claim-client}
+DIR=$(cd "$(dirname "$0")" && pwd)/out
+
+mkdir -p "$DIR"
+cd "$DIR"
+
+case "$HOST" in
+    *[!0-9.]*) SAN="DNS:$HOST" ;;
+    *)         SAN="IP:$HOST" ;;
+esac
+
+# P-256 keys like the certificates of AWS IoT
+if [ ! -f ca.pem ]; then
+    openssl ecparam -name prime256v1 -genkey -noout -out ca.key
+    openssl req -x509 -new -key ca.key -sha256 -days 365 -subj "/CN=Local test CA" -out ca.pem
+fi
+
+# Broker certificate is made again when the host changes
+if [ ! -f server.pem ] || [ "$(cat server.san 2>/dev/null)" != "$SAN" ]; then
+    openssl ecparam -name prime256v1 -genkey -noout -out server.key
+    openssl req -new -key server.key -subj "/CN=$HOST" -out server.csr
+    printf "subjectAltName=%s\nextendedKeyUsage=serverAuth\n" "$SAN" > server.ext
+    openssl x509 -req -in server.csr -CA ca.pem -CAkey ca.key -CAcreateserial -sha256 -days 365 \
+        -extfile server.ext -out server.pem
+    echo "$SAN" > server.san
+fi
+
+if [ ! -f client.pem ]; then
+    openssl ecparam -name prime256v1 -genkey -noout -out client.key
+    openssl req -new -key client.key -subj "/CN=$CLIENT_ID" -out client.csr
+    printf "extendedKeyUsage=clientAuth\n" > client.ext
+    openssl x509 -req -in client.csr -CA ca.pem -CAkey ca.key -CAcreateserial -sha256 -days 365 \
+        -extfile client.ext -out client.pem
+fi
+
+# Client certificate required like AWS IoT, anyone with one may publish and subscribe
+cat > mosquitto.conf <<CONF
+per_listener_settings true
+listener $PORT
+cafile $DIR/ca.pem
+certfile $DIR/server.pem
+keyfile $DIR/server.key
+require_certificate true
+use_identity_as_username true
+allow_anonymous false
+log_type all
+CONF
+
+echo "Broker on $HOST:$PORT, flash the device with"
+echo "    $DIR/ca.pem     as main/certs/AmazonCA1.pem"
+echo "    $DIR/client.pem as main/certs/client.pem.crt"
+echo "    $DIR/client.key as main/certs/client.pem.key"
+exec mosquitto -c mosquitto.conf -v
@@ -0,0 +1,63 @@
+#include <string.h>
+#include "duty_cycle_sim.h"
+
+#define TEMPERATURE_DEFAULT 21.5f
+
+static struct duty_cycle_state rtc_state;
+static struct telemetry_sample publish_samples[DUTY_CYCLE_MAX_SAMPLES];
+
+void duty_cycle_sim_run(const struct duty_cycle_sim_scenario *scenario, struct duty_cycle_sim_result *result)
+{
+    const struct duty_cycle_energy_model *model = scenario->model;
+    double charge_ma_ms = 0;
+    uint32_t attempts = 0;
+    int64_t now_ms = 0;
+    int64_t awake_ms;
+    uint32_t sleep_ms;
+    size_t num_samples;
+    float temperature;
+    bool published;
+    uint32_t i;
+
+    // RTC memory after power on
+    memset(&rtc_state, 0xa5, sizeof rtc_state);
+
+    for(i = 0; i < scenario->num_wakes; i++) {
+        duty_cycle_init(&rtc_state, now_ms);
+
+        temperature = scenario->temperature != NULL
+            ? scenario->temperature(now_ms, scenario->arg) : TEMPERATURE_DEFAULT;
+        awake_ms = model->wake_ms;
+        charge_ma_ms += model->wake_ma * model->wake_ms;
+
+        if(duty_cycle_add_sample(&rtc_state, scenario->config, 0, temperature, now_ms)) {
+            num_samples = duty_cycle_peek(&rtc_state, publish_samples, DUTY_CYCLE_MAX_SAMPLES);
+            published = scenario->publish != NULL ? scenario->publish(attempts, scenario->arg) : true;
+            attempts++;
+
+            if(published) {
+                awake_ms += model->publish_ms;
+                charge_ma_ms += model->publish_ma * model->publish_ms;
+            }
+            else {
+                awake_ms += model->failed_publish_ms;
+                charge_ma_ms += model->publish_ma * model->failed_publish_ms;
+            }
+            duty_cycle_published(&rtc_state, published ? num_samples : 0);
+        }
+
+        sleep_ms = duty_cycle_sleep_ms(&rtc_state, scenario->config, now_ms + awake_ms);
+        charge_ma_ms += model->sleep_ua / 1000 * sleep_ms;
+        now_ms += awake_ms + sleep_ms;
+    }
+
+    result->stats = rtc_state.stats;
+    result->pending = duty_cycle_pending(&rtc_state);
+    result->elapsed_ms = now_ms;
+    result->charge_uah = charge_ma_ms / 3600.0;
+    result->average_ua = now_ms > 0 ? charge_ma_ms * 1000 / now_ms : 0;
+    result->energy_per_sample_mj = rtc_state.stats.wakes > 0
+        ? charge_ma_ms / 1000 * model->battery_v / rtc_state.stats.wakes : 0;
+    result->battery_days = result->average_ua > 0 ? model->battery_mah * 1000 / result->average_ua / 24 : 0;
+    result->always_on_days = model->battery_mah / model->always_on_ma / 24;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "duty_cycle.h"
+
+/*
+    Simulated clock and energy model of the duty cycled low power mode.
+    Every wake runs the firmware's schedule (duty_cycle.c) the way low_power_run() does: init, add a sample,
+    publish when due, sleep until the next sample. Instead of sleeping the clock jumps ahead, and the charge of
+    every phase is added up with the currents of the model.
+ */
+
+/// Current and duration of every phase of a wake, at the battery
+struct duty_cycle_energy_model {
+    double sleep_ua;            // deep sleep, RTC memory and timer on
+    uint32_t wake_ms;           // boot from deep sleep, read the sensor, back to sleep
+    double wake_ma;
+    uint32_t publish_ms;        // wifi, TLS and mqtt up, batch published and acked
+    double publish_ma;
+    uint32_t failed_publish_ms; // publish that runs into LOW_POWER_CONNECT_TIMEOUT_MS
+    double always_on_ma;        // wifi and mqtt kept connected, the mode low power replaces
+    double battery_mah;
+    double battery_v;
+};
+
+/**
+ *  ESP32-C3 figures of the datasheet and typical esp-idf timings, replace with measurements of the board:
+ *  5 uA deep sleep, 150 ms at 22 mA for a wake, 2.5 s at 80 mA for a publish with a full TLS handshake,
+ *  a failed publish takes the 20 s timeout. Always on is modem sleep with DTIM 1, about 20 mA.
+ *  2600 mAh at 3.7 V, a single 18650 cell.
+*/
+#define DUTY_CYCLE_ENERGY_MODEL_ESP32C3 {                                           \
+        .sleep_ua = 5, .wake_ms = 150, .wake_ma = 22, .publish_ms = 2500, .publish_ma = 80,  \
+        .failed_publish_ms = 20000, .always_on_ma = 20, .battery_mah = 2600, .battery_v = 3.7,  \
+    }
+
+/// Outcome of a publish attempt, @param attempt counts from 0
+typedef bool (*duty_cycle_sim_publish_fn)(uint32_t attempt, void *arg);
+
+/// Temperature read at @param now_ms
+typedef float (*duty_cycle_sim_temperature_fn)(int64_t now_ms, void *arg);
+
+/// A scenario to simulate, NULL callbacks publish successfully and read a constant 21.5 celsius
+struct duty_cycle_sim_scenario {
+    const struct duty_cycle_config *config;
+    const struct duty_cycle_energy_model *model;
+    uint32_t num_wakes;
+    duty_cycle_sim_publish_fn publish;
+    duty_cycle_sim_temperature_fn temperature;
+    void *arg;
+};
+
+struct duty_cycle_sim_result {
+    struct duty_cycle_stats stats;
+    uint32_t pending;           // samples still buffered at the end
+    int64_t elapsed_ms;         // simulated time
+    double charge_uah;          // total charge drawn
+    double average_ua;
+    double energy_per_sample_mj;
+    double battery_days;
+    double always_on_days;      // battery life of the always on mode for comparison
+};
+
+/// Run @param scenario from power on, the state in RTC memory starts as garbage
+void duty_cycle_sim_run(const struct duty_cycle_sim_scenario *scenario, struct duty_cycle_sim_result *result);
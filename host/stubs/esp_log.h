@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdio.h>
+
+// Host stand-in of the ESP-IDF log macros, everything goes to stdout
+#define ESP_LOGE(tag, format, ...)  printf("E (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...)  printf("W (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...)  printf("I (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)  do { } while(0)
+#define ESP_LOGV(tag, format, ...)  do { } while(0)
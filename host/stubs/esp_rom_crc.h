@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+/// Host stand-in of the ROM crc32, same polynomial and conventions as on the chip
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+/// Host stand-in, microseconds of the monotonic clock since the first call
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,11 @@
+#pragma once
+
+/*
+    Host stand-in of FreeRTOS, only the critical sections. Host tests run on one thread, so they are no-ops.
+ */
+
+typedef int portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    0
+#define portENTER_CRITICAL(mux)         ((void)(mux))
+#define portEXIT_CRITICAL(mux)          ((void)(mux))
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in of the NimBLE GATT header, only the types ble_prov_gatt.h names
+struct ble_gatt_register_ctxt;
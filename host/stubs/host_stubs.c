@@ -0,0 +1,168 @@
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+#include "mbedtls/base64.h"
+
+static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+int64_t esp_timer_get_time(void)
+{
+    static int64_t start_us;
+    struct timespec ts;
+    int64_t now_us;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now_us = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    if(start_us == 0) {
+        start_us = now_us;
+    }
+
+    return now_us - start_us;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    uint32_t i;
+    int bit;
+
+    crc = ~crc;
+    for(i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for(bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
+
+int mbedtls_base64_encode(unsigned char *dst, size_t dlen, size_t *olen, const unsigned char *src, size_t slen)
+{
+    size_t n = (slen + 2) / 3 * 4;
+    size_t i;
+    uint32_t v;
+    unsigned char *p = dst;
+
+    if(dlen < n + 1) {
+        *olen = n + 1;
+        return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+    }
+
+    for(i = 0; i < slen; i += 3) {
+        v = src[i] << 16;
+        if(i + 1 < slen) {
+            v |= src[i + 1] << 8;
+        }
+        if(i + 2 < slen) {
+            v |= src[i + 2];
+        }
+        *p++ = base64_chars[(v >> 18) & 0x3f];
+        *p++ = base64_chars[(v >> 12) & 0x3f];
+        *p++ = i + 1 < slen ? base64_chars[(v >> 6) & 0x3f] : '=';
+        *p++ = i + 2 < slen ? base64_chars[v & 0x3f] : '=';
+    }
+    *p = '\0';
+
+    *olen = n;
+    return 0;
+}
+
+/// Value of a base64 digit, -1 if it is none
+static int base64_value(unsigned char c)
+{
+    const char *p;
+
+    if(c == '\0') {
+        return -1;
+    }
+    p = strchr(base64_chars, c);
+    return p == NULL ? -1 : p - base64_chars;
+}
+
+int mbedtls_base64_decode(unsigned char *dst, size_t dlen, size_t *olen, const unsigned char *src, size_t slen)
+{
+    size_t i;
+    size_t digits = 0;
+    size_t pad = 0;
+    size_t n;
+    uint32_t v = 0;
+    int accumulated = 0;
+    int value;
+    unsigned char *p = dst;
+
+    // First pass, validate and count like mbedTLS: spaces and line breaks are skipped, padding only at the end
+    for(i = 0; i < slen; i++) {
+        if(src[i] == ' ' || src[i] == '\r' || src[i] == '\n') {
+            continue;
+        }
+        if(src[i] == '=') {
+            if(++pad > 2) {
+                return MBEDTLS_ERR_BASE64_INVALID_CHARACTER;
+            }
+        } else if(pad > 0 || base64_value(src[i]) < 0) {
+            return MBEDTLS_ERR_BASE64_INVALID_CHARACTER;
+        }
+        digits++;
+    }
+
+    if(digits == 0) {
+        *olen = 0;
+        return 0;
+    }
+    if(digits % 4 != 0) {
+        return MBEDTLS_ERR_BASE64_INVALID_CHARACTER;
+    }
+
+    n = digits / 4 * 3 - pad;
+    if(dst == NULL || dlen < n) {
+        *olen = n;
+        return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+    }
+
+    for(i = 0; i < slen; i++) {
+        if(src[i] == ' ' || src[i] == '\r' || src[i] == '\n') {
+            continue;
+        }
+        value = src[i] == '=' ? 0 : base64_value(src[i]);
+        v = (v << 6) | value;
+        if(++accumulated == 4) {
+            *p++ = v >> 16;
+            *p++ = v >> 8;
+            *p++ = v;
+            accumulated = 0;
+            v = 0;
+        }
+    }
+
+    *olen = n;
+    return 0;
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch(code) {
+    case ESP_OK:                        return "ESP_OK";
+    case ESP_FAIL:                      return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:                return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:           return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:         return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:          return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:             return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_TIMEOUT:               return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_NVS_NOT_INITIALIZED:   return "ESP_ERR_NVS_NOT_INITIALIZED";
+    case ESP_ERR_NVS_NOT_FOUND:         return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_TYPE_MISMATCH:     return "ESP_ERR_NVS_TYPE_MISMATCH";
+    case ESP_ERR_NVS_READ_ONLY:         return "ESP_ERR_NVS_READ_ONLY";
+    case ESP_ERR_NVS_NOT_ENOUGH_SPACE:  return "ESP_ERR_NVS_NOT_ENOUGH_SPACE";
+    case ESP_ERR_NVS_INVALID_NAME:      return "ESP_ERR_NVS_INVALID_NAME";
+    case ESP_ERR_NVS_INVALID_HANDLE:    return "ESP_ERR_NVS_INVALID_HANDLE";
+    case ESP_ERR_NVS_KEY_TOO_LONG:      return "ESP_ERR_NVS_KEY_TOO_LONG";
+    case ESP_ERR_NVS_INVALID_LENGTH:    return "ESP_ERR_NVS_INVALID_LENGTH";
+    case ESP_ERR_NVS_NO_FREE_PAGES:     return "ESP_ERR_NVS_NO_FREE_PAGES";
+    case ESP_ERR_NVS_VALUE_TOO_LONG:    return "ESP_ERR_NVS_VALUE_TOO_LONG";
+    default:                            return "UNKNOWN ERROR";
+    }
+}
@@ -0,0 +1,559 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nvs_flash.h"
+#include "nvs_sim.h"
+
+// Items and handles the model can hold, far more than the firmware uses
+#define NVS_SIM_MAX_ITEMS       512
+#define NVS_SIM_MAX_HANDLES     32
+// Namespace index 0 holds the namespace entries, 255 is reserved by NVS
+#define NVS_SIM_MAX_NAMESPACES  254
+
+enum entry_state {
+    ENTRY_EMPTY = 0,
+    ENTRY_WRITTEN,
+    ENTRY_ERASED,
+};
+
+enum page_state {
+    PAGE_EMPTY = 0,
+    PAGE_ACTIVE,
+    PAGE_FULL,
+};
+
+enum item_type {
+    ITEM_NAMESPACE = 0,
+    ITEM_STR,
+    ITEM_BLOB,
+};
+
+struct sim_entry {
+    uint8_t state;          // enum entry_state
+    int16_t item;           // index into items of the item the entry belongs to
+};
+
+struct sim_page {
+    uint8_t state;          // enum page_state
+    uint16_t next_free;     // entries are appended, never rewritten
+    uint32_t erase_count;
+    struct sim_entry entries[NVS_SIM_ENTRIES_PER_PAGE];
+};
+
+struct sim_item {
+    bool used;
+    uint8_t ns;             // namespace index, 0 for namespace entries
+    uint8_t type;           // enum item_type
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint8_t *data;
+    size_t len;
+    uint32_t entries;       // flash entries of the item, headers and index included
+};
+
+struct sim_handle {
+    bool used;
+    uint8_t ns;
+    bool readonly;
+};
+
+static bool initialized;
+static struct sim_page pages[NVS_SIM_PAGES];
+static struct sim_item items[NVS_SIM_MAX_ITEMS];
+static struct sim_handle handles[NVS_SIM_MAX_HANDLES];
+static int active = -1;         // page entries are appended to, -1 before the first write
+static uint8_t namespace_count;
+static struct nvs_sim_stats stats;
+
+/// Look up an item of @param type, any type with ITEM_NAMESPACE excluded when @param type is -1
+static int sim_find(uint8_t ns, const char *key, int type)
+{
+    int i;
+
+    for(i = 0; i < NVS_SIM_MAX_ITEMS; i++) {
+        if(items[i].used && items[i].ns == ns && strcmp(items[i].key, key) == 0
+            && (type < 0 ? items[i].type != ITEM_NAMESPACE : items[i].type == type)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int sim_empty_pages(void)
+{
+    int count = 0;
+    int i;
+
+    for(i = 0; i < NVS_SIM_PAGES; i++) {
+        count += pages[i].state == PAGE_EMPTY;
+    }
+    return count;
+}
+
+static void sim_erase_page(struct sim_page *page)
+{
+    uint32_t erase_count = page->erase_count + 1;
+
+    memset(page, 0, sizeof *page);
+    page->erase_count = erase_count;
+    stats.page_erases++;
+    if(erase_count > stats.max_page_erases) {
+        stats.max_page_erases = erase_count;
+    }
+}
+
+/// Make an empty page active, reclaims a full page when only the reserved page is left
+static esp_err_t sim_next_page(void)
+{
+    struct sim_page *victim = NULL;
+    struct sim_page *target;
+    int erased;
+    int most_erased = 0;
+    int start;
+    int i;
+    int j;
+
+    if(active >= 0) {
+        pages[active].state = PAGE_FULL;
+    }
+    start = active;
+    active = -1;
+
+    // Spread writes over the partition, the page after the last active one is taken first
+    for(i = 1; i <= NVS_SIM_PAGES; i++) {
+        j = (start + i + NVS_SIM_PAGES) % NVS_SIM_PAGES;
+        if(pages[j].state == PAGE_EMPTY) {
+            break;
+        }
+    }
+    if(i > NVS_SIM_PAGES) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+
+    if(sim_empty_pages() >= 2) {
+        active = j;
+        pages[active].state = PAGE_ACTIVE;
+        return ESP_OK;
+    }
+
+    // Only the reserved page is left, move the live entries of the most erased page to it
+    for(i = 0; i < NVS_SIM_PAGES; i++) {
+        if(pages[i].state != PAGE_FULL) {
+            continue;
+        }
+        for(erased = 0, j = 0; j < NVS_SIM_ENTRIES_PER_PAGE; j++) {
+            erased += pages[i].entries[j].state == ENTRY_ERASED;
+        }
+        if(erased > most_erased) {
+            most_erased = erased;
+            victim = &pages[i];
+        }
+    }
+    if(victim == NULL) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+
+    for(i = 0; pages[i].state != PAGE_EMPTY; i++) {
+    }
+    active = i;
+    target = &pages[active];
+    target->state = PAGE_ACTIVE;
+    for(j = 0; j < NVS_SIM_ENTRIES_PER_PAGE; j++) {
+        if(victim->entries[j].state == ENTRY_WRITTEN) {
+            target->entries[target->next_free++] = victim->entries[j];
+            stats.entries_written++;
+        }
+    }
+    sim_erase_page(victim);
+    return ESP_OK;
+}
+
+/// Make sure the active page has @param count free entries
+static esp_err_t sim_reserve(int count)
+{
+    esp_err_t err;
+
+    while(active < 0 || NVS_SIM_ENTRIES_PER_PAGE - pages[active].next_free < count) {
+        err = sim_next_page();
+        if(err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+/// Append @param count entries of @param item to the active page
+static esp_err_t sim_program(int item, int count)
+{
+    struct sim_page *page;
+    esp_err_t err;
+    int i;
+
+    err = sim_reserve(count);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    page = &pages[active];
+    for(i = 0; i < count; i++) {
+        page->entries[page->next_free].state = ENTRY_WRITTEN;
+        page->entries[page->next_free].item = item;
+        page->next_free++;
+    }
+    items[item].entries += count;
+    stats.entries_written += count;
+    return ESP_OK;
+}
+
+/// Mark the entries of an item erased and drop it
+static void sim_erase_item(int item)
+{
+    int i;
+    int j;
+
+    for(i = 0; i < NVS_SIM_PAGES; i++) {
+        for(j = 0; j < NVS_SIM_ENTRIES_PER_PAGE; j++) {
+            if(pages[i].entries[j].state == ENTRY_WRITTEN && pages[i].entries[j].item == item) {
+                pages[i].entries[j].state = ENTRY_ERASED;
+                stats.entries_erased++;
+            }
+        }
+    }
+    free(items[item].data);
+    memset(&items[item], 0, sizeof items[item]);
+}
+
+/// Store a new item, strings in one page, blobs in chunks that each fit a page followed by an index entry
+static esp_err_t sim_write(uint8_t ns, const char *key, uint8_t type, const void *value, size_t len)
+{
+    size_t data_entries = (len + NVS_SIM_ENTRY_SIZE - 1) / NVS_SIM_ENTRY_SIZE;
+    size_t chunk;
+    esp_err_t err;
+    int old = sim_find(ns, key, type == ITEM_NAMESPACE ? ITEM_NAMESPACE : -1);
+    int item;
+
+    // Same value is not written again
+    if(old >= 0 && items[old].type == type && items[old].len == len && memcmp(items[old].data, value, len) == 0) {
+        stats.writes_skipped++;
+        return ESP_OK;
+    }
+
+    if(type == ITEM_STR && 1 + data_entries > NVS_SIM_ENTRIES_PER_PAGE) {
+        return ESP_ERR_NVS_VALUE_TOO_LONG;
+    }
+
+    for(item = 0; item < NVS_SIM_MAX_ITEMS && items[item].used; item++) {
+    }
+    if(item == NVS_SIM_MAX_ITEMS) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+
+    items[item].used = true;
+    items[item].ns = ns;
+    items[item].type = type;
+    strcpy(items[item].key, key);
+    items[item].len = len;
+    items[item].data = malloc(len > 0 ? len : 1);
+    memcpy(items[item].data, value, len);
+
+    if(type != ITEM_BLOB) {
+        err = sim_program(item, 1 + data_entries);
+    } else {
+        do {
+            err = sim_reserve(2);
+            if(err != ESP_OK) {
+                break;
+            }
+            chunk = NVS_SIM_ENTRIES_PER_PAGE - pages[active].next_free - 1;
+            if(chunk > data_entries) {
+                chunk = data_entries;
+            }
+            err = sim_program(item, 1 + chunk);
+            data_entries -= chunk;
+        } while(err == ESP_OK && data_entries > 0);
+        if(err == ESP_OK) {
+            err = sim_program(item, 1);
+        }
+    }
+
+    if(err != ESP_OK) {
+        // Partly written item is discarded, the old value stays
+        sim_erase_item(item);
+        return err;
+    }
+
+    // New value is in place before the old one is erased
+    if(old >= 0) {
+        sim_erase_item(old);
+    }
+    return ESP_OK;
+}
+
+static struct sim_handle *sim_handle(nvs_handle_t handle)
+{
+    if(handle == 0 || handle > NVS_SIM_MAX_HANDLES || !handles[handle - 1].used) {
+        return NULL;
+    }
+    return &handles[handle - 1];
+}
+
+static esp_err_t sim_check_key(const char *key)
+{
+    if(key == NULL || key[0] == '\0') {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+    if(strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t sim_read(nvs_handle_t handle, const char *key, uint8_t type, void *out_value, size_t *length)
+{
+    struct sim_handle *h = sim_handle(handle);
+    esp_err_t err;
+    int item;
+
+    if(h == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    err = sim_check_key(key);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    item = sim_find(h->ns, key, -1);
+    if(item < 0) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if(items[item].type != type) {
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+
+    stats.entries_read += items[item].entries;
+    if(out_value == NULL) {
+        *length = items[item].len;
+        return ESP_OK;
+    }
+    if(*length < items[item].len) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    memcpy(out_value, items[item].data, items[item].len);
+    *length = items[item].len;
+    return ESP_OK;
+}
+
+static esp_err_t sim_set(nvs_handle_t handle, const char *key, uint8_t type, const void *value, size_t len)
+{
+    struct sim_handle *h = sim_handle(handle);
+    esp_err_t err;
+
+    if(h == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if(h->readonly) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    err = sim_check_key(key);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    return sim_write(h->ns, key, type, value, len);
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    initialized = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    int i;
+
+    for(i = 0; i < NVS_SIM_MAX_ITEMS; i++) {
+        free(items[i].data);
+    }
+    memset(items, 0, sizeof items);
+    memset(handles, 0, sizeof handles);
+    for(i = 0; i < NVS_SIM_PAGES; i++) {
+        if(pages[i].state != PAGE_EMPTY) {
+            sim_erase_page(&pages[i]);
+        }
+    }
+    active = -1;
+    namespace_count = 0;
+    initialized = false;
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    esp_err_t err;
+    uint8_t ns;
+    int item;
+    int i;
+
+    if(!initialized) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    err = sim_check_key(namespace_name);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    item = sim_find(0, namespace_name, ITEM_NAMESPACE);
+    if(item >= 0) {
+        ns = items[item].data[0];
+    } else if(open_mode == NVS_READONLY) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    } else if(namespace_count >= NVS_SIM_MAX_NAMESPACES) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    } else {
+        ns = namespace_count + 1;
+        err = sim_write(0, namespace_name, ITEM_NAMESPACE, &ns, 1);
+        if(err != ESP_OK) {
+            return err;
+        }
+        namespace_count++;
+    }
+
+    for(i = 0; i < NVS_SIM_MAX_HANDLES && handles[i].used; i++) {
+    }
+    if(i == NVS_SIM_MAX_HANDLES) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+
+    handles[i].used = true;
+    handles[i].ns = ns;
+    handles[i].readonly = open_mode == NVS_READONLY;
+    *out_handle = i + 1;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    struct sim_handle *h = sim_handle(handle);
+
+    if(h != NULL) {
+        h->used = false;
+    }
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+{
+    return sim_read(handle, key, ITEM_STR, out_value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    return sim_read(handle, key, ITEM_BLOB, out_value, length);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    return sim_set(handle, key, ITEM_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return sim_set(handle, key, ITEM_BLOB, value, length);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    struct sim_handle *h = sim_handle(handle);
+    int item;
+
+    if(h == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if(h->readonly) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+
+    item = sim_find(h->ns, key, -1);
+    if(item < 0) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    sim_erase_item(item);
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+    struct sim_handle *h = sim_handle(handle);
+    int i;
+
+    if(h == NULL) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if(h->readonly) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+
+    for(i = 0; i < NVS_SIM_MAX_ITEMS; i++) {
+        if(items[i].used && items[i].type != ITEM_NAMESPACE && items[i].ns == h->ns) {
+            sim_erase_item(i);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    // Every write is on flash when it returns, like in ESP-IDF
+    return sim_handle(handle) == NULL ? ESP_ERR_NVS_INVALID_HANDLE : ESP_OK;
+}
+
+esp_err_t nvs_get_stats(const char *part_name, nvs_stats_t *nvs_stats)
+{
+    int i;
+    int j;
+
+    memset(nvs_stats, 0, sizeof *nvs_stats);
+    for(i = 0; i < NVS_SIM_PAGES; i++) {
+        for(j = 0; j < NVS_SIM_ENTRIES_PER_PAGE; j++) {
+            nvs_stats->used_entries += pages[i].entries[j].state == ENTRY_WRITTEN;
+            nvs_stats->free_entries += pages[i].entries[j].state == ENTRY_EMPTY;
+        }
+    }
+    nvs_stats->total_entries = NVS_SIM_PAGES * NVS_SIM_ENTRIES_PER_PAGE;
+    nvs_stats->namespace_count = namespace_count;
+    return ESP_OK;
+}
+
+void nvs_sim_reset(void)
+{
+    nvs_flash_erase();
+    memset(pages, 0, sizeof pages);
+    nvs_sim_clear_stats();
+}
+
+void nvs_sim_reboot(void)
+{
+    memset(handles, 0, sizeof handles);
+    initialized = false;
+}
+
+void nvs_sim_clear_stats(void)
+{
+    memset(&stats, 0, sizeof stats);
+}
+
+void nvs_sim_get_stats(struct nvs_sim_stats *out)
+{
+    *out = stats;
+}
+
+int nvs_sim_open_handles(void)
+{
+    int count = 0;
+    int i;
+
+    for(i = 0; i < NVS_SIM_MAX_HANDLES; i++) {
+        count += handles[i].used;
+    }
+    return count;
+}
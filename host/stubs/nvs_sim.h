@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    In-memory model of the NVS partition, laid out like ESP-IDF NVS:
+    - the partition is NVS_SIM_PAGES pages of 4096 bytes, a page holds NVS_SIM_ENTRIES_PER_PAGE 32 byte entries,
+    - entries are appended to the active page and never rewritten, an overwritten or erased item
+      only has its entries marked erased,
+    - a string is a header entry and its data entries in one page, a blob is split into chunks
+      (header and data entries) that each fit a page, followed by an index entry,
+    - opening a new namespace for writing stores a namespace entry,
+    - writing the value an item already holds writes nothing, like ESP-IDF does,
+    - one page is always kept empty, when the active page fills up and only that page is left
+      the full page with most erased entries has its live entries moved to it and is erased.
+    Flash traffic is counted per entry and per page erase, so callers can measure what a sequence
+    of NVS calls costs in writes and wear.
+ */
+
+// 64 KiB partition of partitions.csv
+#define NVS_SIM_PAGES               16
+#define NVS_SIM_ENTRIES_PER_PAGE    126
+#define NVS_SIM_ENTRY_SIZE          32
+
+/// Flash traffic since nvs_sim_reset()
+struct nvs_sim_stats {
+    uint32_t entries_read;      // entries of the items that were read, headers included
+    uint32_t entries_written;   // entries programmed, including items moved by garbage collection
+    uint32_t entries_erased;    // entries marked erased (overwrite, erase_key, erase_all)
+    uint32_t writes_skipped;    // writes of an unchanged value
+    uint32_t page_erases;
+    uint32_t max_page_erases;   // erase count of the most worn page
+};
+
+/// Erase the partition, close all handles and clear the statistics
+void nvs_sim_reset(void);
+
+/// Simulate a reboot, every handle is closed and the flash is kept
+void nvs_sim_reboot(void);
+
+/// Clear the statistics, the flash is kept
+void nvs_sim_clear_stats(void);
+
+/// Copy flash traffic statistics
+void nvs_sim_get_stats(struct nvs_sim_stats *stats);
+
+/// Number of open handles, to catch a handle that is never closed
+int nvs_sim_open_handles(void);
+
+#ifdef __cplusplus
+}
+#endif
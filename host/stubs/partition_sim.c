@@ -0,0 +1,149 @@
+#include <string.h>
+#include "esp_partition.h"
+#include "partition_sim.h"
+
+static uint8_t flash[PARTITION_SIM_MAX_SIZE];
+static esp_partition_t partition;
+static bool present;
+static bool power_lost;
+static uint32_t cut_after = PARTITION_SIM_NO_CUT;   // bytes left until the power cut
+static struct partition_sim_stats stats;
+
+/// Bytes of an operation of @param size that are applied before the cut, cuts the power when it is reached
+static size_t sim_budget(size_t size)
+{
+    if(cut_after == PARTITION_SIM_NO_CUT) {
+        return size;
+    }
+
+    if(size >= cut_after) {
+        size = cut_after;
+        cut_after = PARTITION_SIM_NO_CUT;
+        power_lost = true;
+        return size;
+    }
+
+    cut_after -= size;
+    return size;
+}
+
+/// Common checks of every call, a call without power fails like a device that is off
+static esp_err_t sim_check(const esp_partition_t *p, size_t offset, size_t size)
+{
+    if(power_lost) {
+        return ESP_FAIL;
+    }
+    if(p != &partition || !present) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if(offset > partition.size || size > partition.size - offset) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+void partition_sim_reset(const char *label, uint8_t subtype, size_t size)
+{
+    memset(flash, 0xff, sizeof flash);
+    memset(&partition, 0, sizeof partition);
+    memset(&stats, 0, sizeof stats);
+
+    if(size > PARTITION_SIM_MAX_SIZE) {
+        size = PARTITION_SIM_MAX_SIZE;
+    }
+    partition.type = ESP_PARTITION_TYPE_DATA;
+    partition.subtype = subtype;
+    partition.size = size - size % PARTITION_SIM_SECTOR_SIZE;
+    partition.erase_size = PARTITION_SIM_SECTOR_SIZE;
+    strncpy(partition.label, label, sizeof partition.label - 1);
+    present = partition.size > 0;
+
+    power_lost = false;
+    cut_after = PARTITION_SIM_NO_CUT;
+}
+
+void partition_sim_reboot(void)
+{
+    power_lost = false;
+    cut_after = PARTITION_SIM_NO_CUT;
+}
+
+void partition_sim_cut_power_after(uint32_t bytes)
+{
+    cut_after = bytes;
+}
+
+bool partition_sim_power_lost(void)
+{
+    return power_lost;
+}
+
+void partition_sim_get_stats(struct partition_sim_stats *out)
+{
+    *out = stats;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+    const char *label)
+{
+    if(!present || type != partition.type
+        || (subtype != ESP_PARTITION_SUBTYPE_ANY && subtype != partition.subtype)
+        || (label != NULL && strcmp(label, partition.label) != 0)) {
+        return NULL;
+    }
+
+    return &partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t src_offset, void *dst, size_t size)
+{
+    esp_err_t err = sim_check(p, src_offset, size);
+
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    memcpy(dst, flash + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *p, size_t dst_offset, const void *src, size_t size)
+{
+    const uint8_t *data = src;
+    esp_err_t err = sim_check(p, dst_offset, size);
+    size_t n;
+    size_t i;
+
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    // NOR flash, programming only clears bits
+    n = sim_budget(size);
+    for(i = 0; i < n; i++) {
+        flash[dst_offset + i] &= data[i];
+    }
+    stats.writes++;
+    stats.bytes_written += n;
+
+    return n == size ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *p, size_t offset, size_t size)
+{
+    esp_err_t err = sim_check(p, offset, size);
+    size_t n;
+
+    if(err != ESP_OK) {
+        return err;
+    }
+    if(offset % PARTITION_SIM_SECTOR_SIZE != 0 || size % PARTITION_SIM_SECTOR_SIZE != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    n = sim_budget(size);
+    memset(flash + offset, 0xff, n);
+    stats.sector_erases += size / PARTITION_SIM_SECTOR_SIZE;
+
+    return n == size ? ESP_OK : ESP_FAIL;
+}
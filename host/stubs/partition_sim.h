@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    In-memory model of one data partition on NOR flash, behind the esp_partition API:
+    - an erase sets a whole number of PARTITION_SIM_SECTOR_SIZE sectors to 0xff,
+    - a write can only clear bits, the flash becomes the AND of what it held and what is written,
+    - power can be cut after a given number of bytes: the write or erase that runs into the cut is applied
+      up to it and every later call fails until partition_sim_reboot().
+      A cut erase leaves the sector erased from its start up to the cut and unchanged after it.
+    Flash traffic is counted, so callers can measure what a sequence of calls costs in writes and wear.
+ */
+
+#define PARTITION_SIM_SECTOR_SIZE   4096
+// Largest partition the model holds, the telemetry partition of partitions.csv
+#define PARTITION_SIM_MAX_SIZE      0x10000
+
+// No power cut pending
+#define PARTITION_SIM_NO_CUT        UINT32_MAX
+
+/// Flash traffic since partition_sim_reset()
+struct partition_sim_stats {
+    uint32_t writes;
+    uint32_t bytes_written;
+    uint32_t sector_erases;
+};
+
+/**
+ *  Erase the flash and create the partition, sizes that are not a whole number of sectors are rounded down.
+ *  A @param size of 0 leaves the device without the partition.
+*/
+void partition_sim_reset(const char *label, uint8_t subtype, size_t size);
+
+/// Power on again after a cut, the flash is kept
+void partition_sim_reboot(void);
+
+/// Cut power once @param bytes more bytes have been written or erased, PARTITION_SIM_NO_CUT to never cut it
+void partition_sim_cut_power_after(uint32_t bytes);
+
+/// Check if power was cut and not restored by partition_sim_reboot()
+bool partition_sim_power_lost(void);
+
+/// Copy flash traffic statistics
+void partition_sim_get_stats(struct partition_sim_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+
+/*
+    Host build configuration, the defaults of main/Kconfig.projbuild.
+    Options a target builds with other values (e.g. the telemetry encoding) can be overridden with -D.
+ */
+
+#define CONFIG_BLE_DEVICE_NAME                  "Temperature sensor"
+#define CONFIG_MQTT_ENDPOINT                    "localhost"
+#define CONFIG_MQTT_PORT                        "8883"
+#define CONFIG_AWS_TEMPLATE_NAME                "TemperatureSensorTemplate"
+#define CONFIG_MQTT_CLAIM_CLIENT_ID             "claim-client"
+#define CONFIG_WIFI_MAXIMUM_RETRY               5
+#define CONFIG_WIFI_AP_LIST_SIZE                4
+
+#ifndef CONFIG_TELEMETRY_SAMPLE_PERIOD_MS
+#define CONFIG_TELEMETRY_SAMPLE_PERIOD_MS       10000
+#endif
+#ifndef CONFIG_TELEMETRY_BATCH_MAX_SAMPLES
+#define CONFIG_TELEMETRY_BATCH_MAX_SAMPLES      10
+#endif
+#ifndef CONFIG_TELEMETRY_BATCH_MAX_BYTES
+#define CONFIG_TELEMETRY_BATCH_MAX_BYTES        1024
+#endif
+#ifndef CONFIG_TELEMETRY_BATCH_MAX_AGE_MS
+#define CONFIG_TELEMETRY_BATCH_MAX_AGE_MS       60000
+#endif
+#define CONFIG_TELEMETRY_QOS                    0
+#define CONFIG_MQTT_STATS_LOG_INTERVAL_MS       0
+#define CONFIG_SAMPLE_STORE_REPLAY_MAX_SAMPLES  20
+
+// Tests make NVS operations fail on purpose
+#define CONFIG_NVS_FAULT_INJECTION              1
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdio.h>
+
+/*
+    Minimal test runner of the host tests: a test is a void function using TEST_ASSERT,
+    the first failed assertion ends the test, main() runs every test with RUN_TEST and returns TEST_RESULT().
+ */
+
+extern int test_failures;
+
+#define TEST_ASSERT(cond) do {                                                  \
+        if(!(cond)) {                                                           \
+            printf("%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                                    \
+            return;                                                             \
+        }                                                                       \
+    } while(0)
+
+#define TEST_ASSERT_EQUAL(expected, actual) do {                                \
+        long long expected_ = (long long)(expected);                            \
+        long long actual_ = (long long)(actual);                                \
+        if(expected_ != actual_) {                                              \
+            printf("%s:%d: %s: expected %lld, got %lld\n", __FILE__, __LINE__,  \
+                #actual, expected_, actual_);                                   \
+            test_failures++;                                                    \
+            return;                                                             \
+        }                                                                       \
+    } while(0)
+
+#define RUN_TEST(fn) do {                                                       \
+        int failures_ = test_failures;                                          \
+        fn();                                                                   \
+        printf("%-56s %s\n", #fn, test_failures == failures_ ? "ok" : "FAILED");\
+    } while(0)
+
+#define TEST_RESULT()   (test_failures == 0 ? 0 : 1)
+
+// Defines test_failures, in the file with main()
+#define TEST_MAIN_STATE int test_failures
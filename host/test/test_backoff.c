@@ -0,0 +1,91 @@
+#include <stdint.h>
+#include "test.h"
+#include "backoff.h"
+
+TEST_MAIN_STATE;
+
+/// Delay before jitter of the next attempt, random 0 gives exactly half of it
+static uint32_t next_delay(struct backoff *b)
+{
+    return backoff_next(b, 0) * 2;
+}
+
+static void test_delay_doubles_up_to_max(void)
+{
+    const uint32_t expected[] = { 1000, 2000, 4000, 8000, 16000, 32000, 60000, 60000, 60000 };
+    struct backoff b;
+    size_t i;
+
+    backoff_init(&b, 1000, 60000);
+    for(i = 0; i < sizeof expected / sizeof expected[0]; i++) {
+        TEST_ASSERT_EQUAL(expected[i], next_delay(&b));
+    }
+    TEST_ASSERT_EQUAL(sizeof expected / sizeof expected[0], b.attempt);
+
+    // Cap below base is raised to base
+    backoff_init(&b, 5000, 1000);
+    TEST_ASSERT_EQUAL(5000, next_delay(&b));
+    TEST_ASSERT_EQUAL(5000, next_delay(&b));
+}
+
+static void test_jitter_stays_within_half_and_full_delay(void)
+{
+    const uint32_t delays[] = { 0, 1, 2, 3, 1000, 60001, UINT32_MAX };
+    uint32_t random = 12345;
+    uint32_t jittered;
+    size_t i;
+    int n;
+
+    for(i = 0; i < sizeof delays / sizeof delays[0]; i++) {
+        TEST_ASSERT_EQUAL(delays[i] / 2, backoff_jitter(delays[i], 0));
+        TEST_ASSERT_EQUAL(delays[i], backoff_jitter(delays[i], delays[i] - delays[i] / 2));
+
+        for(n = 0; n < 1000; n++) {
+            // Numerical Recipes LCG, deterministic
+            random = random * 1664525 + 1013904223;
+            jittered = backoff_jitter(delays[i], random);
+            TEST_ASSERT(jittered >= delays[i] / 2 && jittered <= delays[i]);
+        }
+        jittered = backoff_jitter(delays[i], UINT32_MAX);
+        TEST_ASSERT(jittered >= delays[i] / 2 && jittered <= delays[i]);
+    }
+}
+
+static void test_reset_starts_over_from_base(void)
+{
+    struct backoff b;
+    int i;
+
+    backoff_init(&b, 1000, 60000);
+    for(i = 0; i < 5; i++) {
+        backoff_next(&b, 0);
+    }
+    backoff_reset(&b);
+    TEST_ASSERT_EQUAL(0, b.attempt);
+    TEST_ASSERT_EQUAL(1000, next_delay(&b));
+    TEST_ASSERT_EQUAL(2000, next_delay(&b));
+}
+
+static void test_large_attempt_counts_do_not_overflow(void)
+{
+    struct backoff b;
+
+    backoff_init(&b, 1000, 60000);
+    b.attempt = UINT32_MAX - 1;
+    TEST_ASSERT_EQUAL(60000, next_delay(&b));
+
+    // Doubling past 2^31 would wrap, the cap is taken instead
+    backoff_init(&b, 3, UINT32_MAX);
+    b.attempt = 100;
+    TEST_ASSERT_EQUAL(UINT32_MAX / 2, backoff_next(&b, 0));
+    TEST_ASSERT_EQUAL(UINT32_MAX, backoff_next(&b, UINT32_MAX - UINT32_MAX / 2));
+}
+
+int main(void)
+{
+    RUN_TEST(test_delay_doubles_up_to_max);
+    RUN_TEST(test_jitter_stays_within_half_and_full_delay);
+    RUN_TEST(test_reset_starts_over_from_base);
+    RUN_TEST(test_large_attempt_counts_do_not_overflow);
+    return TEST_RESULT();
+}
@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "mbedtls/base64.h"
+#include "credentials.h"
+
+TEST_MAIN_STATE;
+
+// Characters of base64 on one PEM line
+#define PEM_LINE_LEN    64
+#define MAX_FIXTURE     4096
+
+static const char *const fixtures[] = { "rsa2048_cert", "rsa2048_key", "ec_cert", "ec_key" };
+
+static char pem[MAX_FIXTURE];
+static uint8_t der[MAX_FIXTURE];
+static uint8_t stored[MAX_FIXTURE];
+static char pem_out[MAX_FIXTURE];
+
+/// Read @param name.@param ext of the fixtures directory to @param buf, NUL-terminated
+static size_t read_fixture(const char *name, const char *ext, void *buf, size_t size)
+{
+    char path[512];
+    FILE *f;
+    size_t len;
+
+    snprintf(path, sizeof path, "%s/%s.%s", FIXTURE_DIR, name, ext);
+    f = fopen(path, "rb");
+    if(f == NULL) {
+        return 0;
+    }
+    len = fread(buf, 1, size - 1, f);
+    fclose(f);
+    ((char *)buf)[len] = '\0';
+    return len;
+}
+
+/// Encode DER as PEM with the BEGIN/END label of @param label_of, the way openssl writes it
+static size_t der_to_pem(const uint8_t *data, size_t len, const char *label_of, char *out, size_t size)
+{
+    unsigned char b64[MAX_FIXTURE];
+    const char *label = label_of + strlen("-----BEGIN ");
+    int label_len = strchr(label, '-') - label;
+    size_t b64_len;
+    size_t pos;
+    size_t n;
+    size_t i;
+
+    if(mbedtls_base64_encode(b64, sizeof b64, &b64_len, data, len) != 0) {
+        return 0;
+    }
+
+    n = snprintf(out, size, "-----BEGIN %.*s-----\n", label_len, label);
+    for(pos = 0; pos < b64_len; pos += PEM_LINE_LEN) {
+        for(i = pos; i < b64_len && i < pos + PEM_LINE_LEN; i++) {
+            out[n++] = b64[i];
+        }
+        out[n++] = '\n';
+    }
+    n += snprintf(out + n, size - n, "-----END %.*s-----\n", label_len, label);
+    return n;
+}
+
+static void test_pem_to_der_matches_openssl(void)
+{
+    size_t der_len;
+    int len;
+    size_t i;
+
+    for(i = 0; i < sizeof fixtures / sizeof fixtures[0]; i++) {
+        TEST_ASSERT(read_fixture(fixtures[i], "pem", pem, sizeof pem) > 0);
+        der_len = read_fixture(fixtures[i], "der", der, sizeof der);
+        TEST_ASSERT(der_len > 0);
+
+        len = credentials_pem_to_der(pem, stored, sizeof stored);
+        TEST_ASSERT_EQUAL(sizeof(struct credentials_header) + der_len, len);
+        TEST_ASSERT(memcmp(stored + sizeof(struct credentials_header), der, der_len) == 0);
+    }
+}
+
+static void test_der_to_pem_round_trip_is_identical(void)
+{
+    const uint8_t *data;
+    size_t data_len;
+    size_t pem_len;
+    size_t out_len;
+    int len;
+    size_t i;
+
+    for(i = 0; i < sizeof fixtures / sizeof fixtures[0]; i++) {
+        pem_len = read_fixture(fixtures[i], "pem", pem, sizeof pem);
+        TEST_ASSERT(pem_len > 0);
+
+        len = credentials_pem_to_der(pem, stored, sizeof stored);
+        TEST_ASSERT(len > 0);
+        TEST_ASSERT_EQUAL(CREDENTIALS_FORMAT_DER, credentials_check(stored, len, &data, &data_len));
+
+        out_len = der_to_pem(data, data_len, pem, pem_out, sizeof pem_out);
+        TEST_ASSERT_EQUAL(pem_len, out_len);
+        TEST_ASSERT(memcmp(pem, pem_out, pem_len) == 0);
+    }
+}
+
+static void test_corrupted_der_is_rejected(void)
+{
+    const uint8_t *data;
+    size_t data_len;
+    int len;
+
+    read_fixture("ec_cert", "pem", pem, sizeof pem);
+    len = credentials_pem_to_der(pem, stored, sizeof stored);
+    TEST_ASSERT(len > 0);
+
+    stored[len - 1] ^= 0x01;
+    TEST_ASSERT_EQUAL(-1, credentials_check(stored, len, &data, &data_len));
+    stored[len - 1] ^= 0x01;
+
+    // Truncated blob, the length in the header no longer matches
+    TEST_ASSERT_EQUAL(-1, credentials_check(stored, len - 1, &data, &data_len));
+}
+
+static void test_pem_of_older_firmware_is_detected(void)
+{
+    const uint8_t *data;
+    size_t data_len;
+    size_t pem_len;
+
+    pem_len = read_fixture("rsa2048_cert", "pem", pem, sizeof pem);
+    TEST_ASSERT_EQUAL(CREDENTIALS_FORMAT_PEM, credentials_check(pem, pem_len, &data, &data_len));
+    TEST_ASSERT_EQUAL(CREDENTIALS_FORMAT_PEM, credentials_check(pem, 4, &data, &data_len));
+}
+
+static void test_pem_to_der_rejects_malformed_input(void)
+{
+    size_t der_len;
+
+    read_fixture("rsa2048_cert", "pem", pem, sizeof pem);
+    der_len = read_fixture("rsa2048_cert", "der", der, sizeof der);
+
+    // Output one byte too small
+    TEST_ASSERT_EQUAL(-1, credentials_pem_to_der(pem, stored, sizeof(struct credentials_header) + der_len - 1));
+    TEST_ASSERT_EQUAL(-1, credentials_pem_to_der(pem, stored, sizeof(struct credentials_header) - 1));
+
+    TEST_ASSERT_EQUAL(-1, credentials_pem_to_der("no pem here", stored, sizeof stored));
+    TEST_ASSERT_EQUAL(-1, credentials_pem_to_der("-----BEGIN CERTIFICATE-----\nAAAA\n", stored, sizeof stored));
+    TEST_ASSERT_EQUAL(-1, credentials_pem_to_der("-----BEGIN CERTIFICATE-----\n*not base64*\n-----END CERTIFICATE-----\n",
+        stored, sizeof stored));
+}
+
+int main(void)
+{
+    RUN_TEST(test_pem_to_der_matches_openssl);
+    RUN_TEST(test_der_to_pem_round_trip_is_identical);
+    RUN_TEST(test_corrupted_der_is_rejected);
+    RUN_TEST(test_pem_of_older_firmware_is_detected);
+    RUN_TEST(test_pem_to_der_rejects_malformed_input);
+    return TEST_RESULT();
+}
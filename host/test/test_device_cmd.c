@@ -0,0 +1,74 @@
+#include <string.h>
+#include "test.h"
+#include "device_cmd.h"
+
+TEST_MAIN_STATE;
+
+/// Parse a NUL-terminated command
+static int parse(const char *json, struct device_cmd *cmd)
+{
+    return device_cmd_parse(json, strlen(json), cmd);
+}
+
+static void test_boot_timeline_is_parsed(void)
+{
+    struct device_cmd cmd;
+
+    TEST_ASSERT_EQUAL(0, parse("{\"cmd\":\"boot_timeline\"}", &cmd));
+    TEST_ASSERT_EQUAL(DEVICE_CMD_BOOT_TIMELINE, cmd.type);
+
+    // Unknown arguments are ignored
+    TEST_ASSERT_EQUAL(0, parse("{ \"id\": \"42\", \"cmd\": \"boot_timeline\" }", &cmd));
+}
+
+static void test_add_ap_is_parsed(void)
+{
+    struct device_cmd cmd;
+
+    TEST_ASSERT_EQUAL(0, parse("{\"cmd\":\"add_ap\",\"ssid\":\"office \\\"2nd\\\" floor\",\"pwd\":\"secret42\"}", &cmd));
+    TEST_ASSERT_EQUAL(DEVICE_CMD_ADD_AP, cmd.type);
+    TEST_ASSERT(strcmp(cmd.ssid, "office \"2nd\" floor") == 0);
+    TEST_ASSERT(strcmp(cmd.pwd, "secret42") == 0);
+
+    // Open network
+    TEST_ASSERT_EQUAL(0, parse("{\"cmd\":\"add_ap\",\"ssid\":\"guest\"}", &cmd));
+    TEST_ASSERT(strcmp(cmd.ssid, "guest") == 0);
+    TEST_ASSERT(strcmp(cmd.pwd, "") == 0);
+}
+
+static void test_add_ap_rejects_bad_credentials(void)
+{
+    struct device_cmd cmd;
+
+    TEST_ASSERT_EQUAL(-1, parse("{\"cmd\":\"add_ap\"}", &cmd));
+    TEST_ASSERT_EQUAL(-1, parse("{\"cmd\":\"add_ap\",\"ssid\":\"\"}", &cmd));
+    TEST_ASSERT_EQUAL(-1, parse("{\"cmd\":\"add_ap\",\"ssid\":\"bad \\q escape\"}", &cmd));
+
+    // 32 characters fit, 33 do not
+    TEST_ASSERT_EQUAL(0, parse("{\"cmd\":\"add_ap\",\"ssid\":\"0123456789abcdef0123456789abcdef\"}", &cmd));
+    TEST_ASSERT_EQUAL(-1, parse("{\"cmd\":\"add_ap\",\"ssid\":\"0123456789abcdef0123456789abcdefX\"}", &cmd));
+    TEST_ASSERT_EQUAL(-1, parse("{\"cmd\":\"add_ap\",\"ssid\":\"guest\",\"pwd\":"
+        "\"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdefX\"}", &cmd));
+}
+
+static void test_invalid_commands_are_rejected(void)
+{
+    struct device_cmd cmd;
+
+    TEST_ASSERT_EQUAL(-1, parse("{\"cmd\":\"format_flash\"}", &cmd));
+    TEST_ASSERT_EQUAL(-1, parse("{\"cmd\":\"boot\"}", &cmd));
+    TEST_ASSERT_EQUAL(-1, parse("{\"cmd\":\"boot_timeline_all\"}", &cmd));
+    TEST_ASSERT_EQUAL(-1, parse("{\"command\":\"boot_timeline\"}", &cmd));
+    TEST_ASSERT_EQUAL(-1, parse("{\"args\":{\"cmd\":\"boot_timeline\"}}", &cmd));
+    TEST_ASSERT_EQUAL(-1, parse("{\"cmd\":\"boot_timeline\"", &cmd));
+    TEST_ASSERT_EQUAL(-1, parse("", &cmd));
+}
+
+int main(void)
+{
+    RUN_TEST(test_boot_timeline_is_parsed);
+    RUN_TEST(test_add_ap_is_parsed);
+    RUN_TEST(test_add_ap_rejects_bad_credentials);
+    RUN_TEST(test_invalid_commands_are_rejected);
+    return TEST_RESULT();
+}
@@ -0,0 +1,201 @@
+#include <string.h>
+#include "test.h"
+#include "duty_cycle.h"
+#include "duty_cycle_sim.h"
+
+TEST_MAIN_STATE;
+
+#define PERIOD_MS   10000
+
+static const struct duty_cycle_config config_every_10 = {
+    .sample_period_ms = PERIOD_MS, .publish_every = 10,
+};
+
+static const struct duty_cycle_config config_threshold = {
+    .sample_period_ms = PERIOD_MS, .publish_every = 30,
+    .threshold_enabled = true, .threshold_low = 0.0f, .threshold_high = 30.0f,
+};
+
+static const struct duty_cycle_energy_model model = DUTY_CYCLE_ENERGY_MODEL_ESP32C3;
+
+static struct duty_cycle_state state;
+
+static bool publish_never(uint32_t attempt, void *arg)
+{
+    return false;
+}
+
+static bool publish_first_fails(uint32_t attempt, void *arg)
+{
+    return attempt > 0;
+}
+
+/// Above the high threshold for the samples of the 15th to 19th wake
+static float temperature_spike(int64_t now_ms, void *arg)
+{
+    int64_t wake = now_ms / PERIOD_MS;
+
+    return wake >= 15 && wake < 20 ? 35.0f : 21.5f;
+}
+
+static void test_publishes_every_n_samples(void)
+{
+    struct duty_cycle_sim_scenario scenario = {
+        .config = &config_every_10, .model = &model, .num_wakes = 100,
+    };
+    struct duty_cycle_sim_result result;
+
+    duty_cycle_sim_run(&scenario, &result);
+
+    TEST_ASSERT_EQUAL(100, result.stats.wakes);
+    TEST_ASSERT_EQUAL(10, result.stats.publishes);
+    TEST_ASSERT_EQUAL(0, result.stats.failed_publishes);
+    TEST_ASSERT_EQUAL(100, result.stats.published);
+    TEST_ASSERT_EQUAL(0, result.pending);
+    TEST_ASSERT_EQUAL(100 * PERIOD_MS, result.elapsed_ms);
+}
+
+static void test_failed_publish_keeps_samples_until_next_attempt(void)
+{
+    struct duty_cycle_sim_scenario scenario = {
+        .config = &config_every_10, .model = &model, .num_wakes = 20, .publish = publish_first_fails,
+    };
+    struct duty_cycle_sim_result result;
+
+    duty_cycle_sim_run(&scenario, &result);
+
+    // First attempt fails, the second one 10 samples later publishes all 20
+    TEST_ASSERT_EQUAL(2, result.stats.publishes);
+    TEST_ASSERT_EQUAL(1, result.stats.failed_publishes);
+    TEST_ASSERT_EQUAL(20, result.stats.published);
+    TEST_ASSERT_EQUAL(0, result.stats.dropped);
+}
+
+static void test_full_buffer_drops_oldest_samples(void)
+{
+    struct duty_cycle_sim_scenario scenario = {
+        .config = &config_every_10, .model = &model, .num_wakes = 100, .publish = publish_never,
+    };
+    struct duty_cycle_sim_result result;
+
+    // The failed publishes outlast two sample periods, the samples of the skipped periods are not taken
+    duty_cycle_sim_run(&scenario, &result);
+
+    TEST_ASSERT_EQUAL(0, result.stats.published);
+    TEST_ASSERT_EQUAL(DUTY_CYCLE_MAX_SAMPLES, result.pending);
+    TEST_ASSERT_EQUAL(100 - DUTY_CYCLE_MAX_SAMPLES, result.stats.dropped);
+    TEST_ASSERT(result.elapsed_ms > 100 * PERIOD_MS);
+}
+
+static void test_oldest_samples_are_dropped_first(void)
+{
+    struct telemetry_sample samples[DUTY_CYCLE_MAX_SAMPLES];
+    int i;
+
+    memset(&state, 0, sizeof state);
+    duty_cycle_init(&state, 0);
+    for(i = 0; i < 100; i++) {
+        duty_cycle_add_sample(&state, &config_every_10, 0, 21.5f, (int64_t)i * PERIOD_MS);
+    }
+
+    TEST_ASSERT_EQUAL(DUTY_CYCLE_MAX_SAMPLES, duty_cycle_peek(&state, samples, DUTY_CYCLE_MAX_SAMPLES));
+    TEST_ASSERT_EQUAL(100 - DUTY_CYCLE_MAX_SAMPLES, samples[0].seq);
+    TEST_ASSERT_EQUAL(99, samples[DUTY_CYCLE_MAX_SAMPLES - 1].seq);
+}
+
+static void test_threshold_crossing_publishes_at_once(void)
+{
+    struct duty_cycle_sim_scenario scenario = {
+        .config = &config_threshold, .model = &model, .num_wakes = 30, .temperature = temperature_spike,
+    };
+    struct duty_cycle_sim_result result;
+
+    duty_cycle_sim_run(&scenario, &result);
+
+    // Crossing at the 15th wake, then the regular publish 30 samples after power on is not due yet
+    TEST_ASSERT_EQUAL(1, result.stats.threshold_publishes);
+    TEST_ASSERT_EQUAL(1, result.stats.publishes);
+    TEST_ASSERT_EQUAL(16, result.stats.published);
+    TEST_ASSERT_EQUAL(14, result.pending);
+}
+
+static void test_schedule_stays_on_grid_after_overrun(void)
+{
+    uint32_t sleep_ms;
+
+    memset(&state, 0, sizeof state);
+    duty_cycle_init(&state, 1000);
+
+    // On time
+    sleep_ms = duty_cycle_sleep_ms(&state, &config_every_10, 1150);
+    TEST_ASSERT_EQUAL(PERIOD_MS - 150, sleep_ms);
+
+    // A publish overran two and a half periods, next wake is the next point on the grid
+    sleep_ms = duty_cycle_sleep_ms(&state, &config_every_10, 1000 + PERIOD_MS + 25000);
+    TEST_ASSERT_EQUAL(5000, sleep_ms);
+}
+
+static void test_state_survives_deep_sleep(void)
+{
+    memset(&state, 0xa5, sizeof state);
+    TEST_ASSERT(duty_cycle_init(&state, 0));
+    TEST_ASSERT_EQUAL(0, duty_cycle_pending(&state));
+
+    duty_cycle_add_sample(&state, &config_every_10, 0, 21.5f, 0);
+    duty_cycle_add_sample(&state, &config_every_10, 0, 21.5f, PERIOD_MS);
+
+    // Wake up from deep sleep, RTC memory holds the state
+    TEST_ASSERT(!duty_cycle_init(&state, 2 * PERIOD_MS));
+    TEST_ASSERT_EQUAL(2, duty_cycle_pending(&state));
+    TEST_ASSERT_EQUAL(2, state.seq);
+}
+
+static void test_energy_model_adds_up_phases(void)
+{
+    struct duty_cycle_sim_scenario scenario = {
+        .config = &config_every_10, .model = &model, .num_wakes = 100,
+    };
+    struct duty_cycle_sim_result result;
+    double awake_ms = 100.0 * model.wake_ms + 10.0 * model.publish_ms;
+    double expected_ma_ms = 100.0 * model.wake_ms * model.wake_ma + 10.0 * model.publish_ms * model.publish_ma
+        + (100.0 * PERIOD_MS - awake_ms) * model.sleep_ua / 1000;
+
+    duty_cycle_sim_run(&scenario, &result);
+
+    TEST_ASSERT(result.charge_uah > expected_ma_ms / 3600 * 0.999 && result.charge_uah < expected_ma_ms / 3600 * 1.001);
+    TEST_ASSERT(result.battery_days > result.always_on_days);
+}
+
+static void test_fewer_publishes_use_less_energy(void)
+{
+    struct duty_cycle_config config = { .sample_period_ms = PERIOD_MS };
+    struct duty_cycle_sim_scenario scenario = { .config = &config, .model = &model, .num_wakes = 600 };
+    struct duty_cycle_sim_result result;
+    double last_ua = 0;
+    const uint32_t publish_every[] = { 1, 10, 30, 60 };
+    size_t i;
+
+    for(i = 0; i < sizeof publish_every / sizeof publish_every[0]; i++) {
+        config.publish_every = publish_every[i];
+        duty_cycle_sim_run(&scenario, &result);
+        TEST_ASSERT_EQUAL(600 / publish_every[i], result.stats.publishes);
+        if(i > 0) {
+            TEST_ASSERT(result.average_ua < last_ua);
+        }
+        last_ua = result.average_ua;
+    }
+}
+
+int main(void)
+{
+    RUN_TEST(test_publishes_every_n_samples);
+    RUN_TEST(test_failed_publish_keeps_samples_until_next_attempt);
+    RUN_TEST(test_full_buffer_drops_oldest_samples);
+    RUN_TEST(test_oldest_samples_are_dropped_first);
+    RUN_TEST(test_threshold_crossing_publishes_at_once);
+    RUN_TEST(test_schedule_stays_on_grid_after_overrun);
+    RUN_TEST(test_state_survives_deep_sleep);
+    RUN_TEST(test_energy_model_adds_up_phases);
+    RUN_TEST(test_fewer_publishes_use_less_energy);
+    return TEST_RESULT();
+}
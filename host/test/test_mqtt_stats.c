@@ -0,0 +1,170 @@
+#include "test.h"
+#include "mqtt_stats.h"
+
+TEST_MAIN_STATE;
+
+#define TOPIC   "device/sensor/temperature/data"
+
+// Next msg_id esp_mqtt_client_publish() returns
+static int next_msg_id = 1;
+
+// Set to deliver the ack while esp_mqtt_client_publish() is still returning, like the MQTT task can
+static bool ack_during_publish;
+
+static void send_event(esp_mqtt_event_id_t event_id, int msg_id)
+{
+    esp_mqtt_event_t event = { .event_id = event_id, .msg_id = msg_id };
+
+    mqtt_stats_event(&event);
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos,
+    int retain)
+{
+    int msg_id = qos > 0 ? next_msg_id++ : 0;
+
+    if(ack_during_publish && qos > 0) {
+        send_event(MQTT_EVENT_PUBLISHED, msg_id);
+    }
+    return msg_id;
+}
+
+/// Clear statistics, every test acks what it leaves in flight
+static void reset(void)
+{
+    ack_during_publish = false;
+    mqtt_stats_reset();
+}
+
+static void test_ack_after_publish_is_matched(void)
+{
+    struct mqtt_stats stats;
+    int msg_id;
+
+    reset();
+    msg_id = mqtt_stats_publish(NULL, TOPIC, "{}", 0, 1, 0);
+    mqtt_stats_get(&stats);
+    TEST_ASSERT_EQUAL(1, stats.in_flight);
+
+    send_event(MQTT_EVENT_PUBLISHED, msg_id);
+    mqtt_stats_get(&stats);
+    TEST_ASSERT_EQUAL(1, stats.published);
+    TEST_ASSERT_EQUAL(1, stats.acked);
+    TEST_ASSERT_EQUAL(0, stats.in_flight);
+    TEST_ASSERT_EQUAL(0, stats.untracked);
+    TEST_ASSERT_EQUAL(2, stats.bytes_sent);
+}
+
+static void test_ack_before_publish_returned_is_matched(void)
+{
+    struct mqtt_stats stats;
+
+    reset();
+    ack_during_publish = true;
+    mqtt_stats_publish(NULL, TOPIC, "{}", 0, 1, 0);
+    ack_during_publish = false;
+
+    mqtt_stats_get(&stats);
+    TEST_ASSERT_EQUAL(1, stats.acked);
+    TEST_ASSERT_EQUAL(0, stats.in_flight);
+    TEST_ASSERT_EQUAL(0, stats.untracked);
+}
+
+static void test_disconnect_counts_messages_in_flight(void)
+{
+    struct mqtt_stats stats;
+    int first;
+    int second;
+
+    reset();
+    first = mqtt_stats_publish(NULL, TOPIC, "{}", 0, 1, 0);
+    second = mqtt_stats_publish(NULL, TOPIC, "{}", 0, 1, 0);
+    mqtt_stats_publish(NULL, TOPIC, "{}", 0, 0, 0);
+    send_event(MQTT_EVENT_DISCONNECTED, 0);
+
+    mqtt_stats_get(&stats);
+    TEST_ASSERT_EQUAL(1, stats.disconnects);
+    TEST_ASSERT_EQUAL(2, stats.interrupted);
+    TEST_ASSERT_EQUAL(2, stats.in_flight);
+
+    // Resent from the outbox after reconnecting, one is acked and the other one expires
+    send_event(MQTT_EVENT_PUBLISHED, first);
+    send_event(MQTT_EVENT_DELETED, second);
+    mqtt_stats_get(&stats);
+    TEST_ASSERT_EQUAL(1, stats.acked);
+    TEST_ASSERT_EQUAL(1, stats.expired);
+    TEST_ASSERT_EQUAL(0, stats.in_flight);
+}
+
+static void test_unmatched_ack_is_counted_once_evicted(void)
+{
+    struct mqtt_stats stats;
+    int first;
+    int i;
+
+    reset();
+    send_event(MQTT_EVENT_PUBLISHED, 60000);
+    mqtt_stats_get(&stats);
+    TEST_ASSERT_EQUAL(0, stats.in_flight);
+    TEST_ASSERT_EQUAL(0, stats.acked);
+
+    // Every slot in use, the oldest entry is the unmatched ack
+    first = next_msg_id;
+    for(i = 0; i < MQTT_STATS_MAX_TRACKED; i++) {
+        mqtt_stats_publish(NULL, TOPIC, "{}", 0, 1, 0);
+    }
+    mqtt_stats_get(&stats);
+    for(i = first; i < next_msg_id; i++) {
+        send_event(MQTT_EVENT_PUBLISHED, i);
+    }
+    TEST_ASSERT_EQUAL(1, stats.untracked);
+    TEST_ASSERT_EQUAL(MQTT_STATS_MAX_TRACKED, stats.in_flight);
+}
+
+static void test_duplicate_ack_is_ignored(void)
+{
+    struct mqtt_stats stats;
+    int msg_id;
+
+    reset();
+    ack_during_publish = true;
+    msg_id = mqtt_stats_publish(NULL, TOPIC, "{}", 0, 1, 0);
+    ack_during_publish = false;
+    send_event(MQTT_EVENT_PUBLISHED, msg_id);
+
+    mqtt_stats_get(&stats);
+    TEST_ASSERT_EQUAL(1, stats.acked);
+    TEST_ASSERT_EQUAL(0, stats.in_flight);
+}
+
+static void test_tls_handshakes_are_counted(void)
+{
+    struct mqtt_stats stats;
+
+    reset();
+    mqtt_stats_tls_handshake(false, 1800000);
+    mqtt_stats_tls_handshake(true, 350000);
+    mqtt_stats_tls_handshake(true, 300000);
+
+    mqtt_stats_get(&stats);
+    TEST_ASSERT_EQUAL(1, stats.tls_full);
+    TEST_ASSERT_EQUAL(2, stats.tls_resumed);
+    TEST_ASSERT_EQUAL(1800, stats.tls_full_last_ms);
+    TEST_ASSERT_EQUAL(300, stats.tls_resumed_last_ms);
+
+    reset();
+    mqtt_stats_get(&stats);
+    TEST_ASSERT_EQUAL(0, stats.tls_full);
+    TEST_ASSERT_EQUAL(0, stats.tls_resumed);
+}
+
+int main(void)
+{
+    RUN_TEST(test_ack_after_publish_is_matched);
+    RUN_TEST(test_ack_before_publish_returned_is_matched);
+    RUN_TEST(test_disconnect_counts_messages_in_flight);
+    RUN_TEST(test_unmatched_ack_is_counted_once_evicted);
+    RUN_TEST(test_duplicate_ack_is_ignored);
+    RUN_TEST(test_tls_handshakes_are_counted);
+    return TEST_RESULT();
+}
@@ -0,0 +1,382 @@
+#include <string.h>
+#include "test.h"
+#include "nvs_sim.h"
+#include "nvs_ops.h"
+#include "nvs_batch.h"
+#include "my_nvs.h"
+#include "credentials.h"
+
+TEST_MAIN_STATE;
+
+static const struct device_config config_a = {
+    .ssid = "home", .pwd = "secret-a", .aws_uuid = "uuid-a", .thing_name = "sensor-a",
+};
+
+static const struct device_config config_b = {
+    .ssid = "office", .pwd = "", .aws_uuid = "uuid-b", .thing_name = "sensor-b",
+};
+
+/// Fresh partition, like a device out of the factory
+static void factory(void)
+{
+    nvs_sim_reset();
+    nvs_flash_init();
+}
+
+/// Reboot, NVS is initialized again and the config loaded like app_main() does
+static esp_err_t reboot(void)
+{
+    nvs_sim_reboot();
+    nvs_flash_init();
+    return nvs_config_load();
+}
+
+static bool config_equal(const struct device_config *a, const struct device_config *b)
+{
+    return strcmp(a->ssid, b->ssid) == 0 && strcmp(a->pwd, b->pwd) == 0
+        && strcmp(a->aws_uuid, b->aws_uuid) == 0 && strcmp(a->thing_name, b->thing_name) == 0;
+}
+
+static void test_sim_unchanged_write_is_skipped(void)
+{
+    struct nvs_sim_stats stats;
+    nvs_handle_t handle;
+
+    factory();
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_open("test", NVS_READWRITE, &handle));
+    nvs_sim_clear_stats();
+
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_set_str(handle, "key", "value"));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_set_str(handle, "key", "value"));
+    nvs_close(handle);
+
+    // Header and one data entry, the second write is skipped
+    nvs_sim_get_stats(&stats);
+    TEST_ASSERT_EQUAL(2, stats.entries_written);
+    TEST_ASSERT_EQUAL(1, stats.writes_skipped);
+    TEST_ASSERT_EQUAL(0, stats.entries_erased);
+}
+
+static void test_sim_garbage_collection_erases_pages(void)
+{
+    static uint8_t blob[1000];
+    struct nvs_sim_stats stats;
+    nvs_stats_t nvs_stats;
+    nvs_handle_t handle;
+    int i;
+
+    factory();
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_open("test", NVS_READWRITE, &handle));
+    for(i = 0; i < 200; i++) {
+        blob[0] = i;
+        TEST_ASSERT_EQUAL(ESP_OK, nvs_set_blob(handle, "blob", blob, sizeof blob));
+    }
+    nvs_close(handle);
+
+    // 200 versions of 35 entries don't fit 16 pages, erased ones were reclaimed
+    nvs_sim_get_stats(&stats);
+    TEST_ASSERT(stats.page_erases > 0);
+    nvs_get_stats(NULL, &nvs_stats);
+    TEST_ASSERT(nvs_stats.used_entries < 2 * NVS_SIM_ENTRIES_PER_PAGE);
+}
+
+static void test_ops_counts_operations_and_bytes(void)
+{
+    struct nvs_ops_stats before, after;
+    nvs_handle_t handle;
+    char value[16];
+    size_t len = 0;
+
+    factory();
+    nvs_ops_get_stats(&before);
+
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_ops_open("test", NVS_READWRITE, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_ops_set_str(handle, "key", "abc"));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_ops_commit(handle));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_ops_get_str(handle, "key", NULL, &len));
+    TEST_ASSERT_EQUAL(4, len);
+    len = sizeof value;
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_ops_get_str(handle, "key", value, &len));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, nvs_ops_get_blob(handle, "missing", NULL, &len));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_TYPE_MISMATCH, nvs_ops_get_blob(handle, "key", NULL, &len));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_ops_erase_key(handle, "key"));
+    nvs_close(handle);
+
+    nvs_ops_get_stats(&after);
+    TEST_ASSERT_EQUAL(1, after.count[NVS_OP_OPEN] - before.count[NVS_OP_OPEN]);
+    TEST_ASSERT_EQUAL(1, after.count[NVS_OP_WRITE] - before.count[NVS_OP_WRITE]);
+    TEST_ASSERT_EQUAL(1, after.count[NVS_OP_COMMIT] - before.count[NVS_OP_COMMIT]);
+    TEST_ASSERT_EQUAL(4, after.count[NVS_OP_READ] - before.count[NVS_OP_READ]);
+    TEST_ASSERT_EQUAL(1, after.count[NVS_OP_ERASE] - before.count[NVS_OP_ERASE]);
+    // Missing key is not a failure, a type mismatch is
+    TEST_ASSERT_EQUAL(1, after.failed[NVS_OP_READ] - before.failed[NVS_OP_READ]);
+    // Length probe reads no bytes
+    TEST_ASSERT_EQUAL(4, after.bytes_read - before.bytes_read);
+    TEST_ASSERT_EQUAL(4, after.bytes_written - before.bytes_written);
+}
+
+static void test_injected_failure_fails_once(void)
+{
+    nvs_handle_t handle;
+
+    factory();
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_ops_open("test", NVS_READWRITE, &handle));
+
+    nvs_ops_inject_failure(NVS_OP_WRITE, 1, ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_ops_set_str(handle, "a", "1"));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_ENOUGH_SPACE, nvs_ops_set_str(handle, "b", "2"));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_ops_set_str(handle, "c", "3"));
+    nvs_close(handle);
+}
+
+static void test_config_survives_reboot(void)
+{
+    factory();
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_config_load());
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_config_flush(&config_a));
+    TEST_ASSERT_EQUAL(ESP_OK, reboot());
+    TEST_ASSERT(config_equal(nvs_config_get(), &config_a));
+
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_config_flush(&config_b));
+    TEST_ASSERT_EQUAL(ESP_OK, reboot());
+    TEST_ASSERT(config_equal(nvs_config_get(), &config_b));
+    TEST_ASSERT_EQUAL(0, nvs_sim_open_handles());
+}
+
+static void test_config_of_older_firmware_is_migrated(void)
+{
+    nvs_handle_t handle;
+    size_t len = 0;
+
+    // Keys where firmware before the config set stored them
+    factory();
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle));
+    nvs_set_str(handle, NVS_KEY_WIFI_SSID, config_a.ssid);
+    nvs_set_str(handle, NVS_KEY_WIFI_PWD, config_a.pwd);
+    nvs_set_str(handle, NVS_KEY_AWS_UUID, config_a.aws_uuid);
+    nvs_set_str(handle, NVS_KEY_AWS_THING_NAME, config_a.thing_name);
+    nvs_close(handle);
+
+    TEST_ASSERT_EQUAL(ESP_OK, reboot());
+    TEST_ASSERT(config_equal(nvs_config_get(), &config_a));
+
+    // First write moves them to the set
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_config_flush(&config_b));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle));
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, nvs_get_str(handle, NVS_KEY_WIFI_SSID, NULL, &len));
+    nvs_close(handle);
+    TEST_ASSERT_EQUAL(ESP_OK, reboot());
+    TEST_ASSERT(config_equal(nvs_config_get(), &config_b));
+}
+
+/**
+ *  Fail every operation of @param op in turn while the config is rewritten, either the whole old or the whole new
+ *  config is read back after a reboot. NVS writes are on flash before the commit, a failure after the write that
+ *  switches the generation can't take it back, so a failed flush may still leave the new config current.
+*/
+static void check_config_flush_is_atomic(enum nvs_op op, esp_err_t injected)
+{
+    struct nvs_ops_stats before, after;
+    uint32_t ops;
+    uint32_t skip;
+    esp_err_t err;
+
+    // Operations of that kind one flush does
+    factory();
+    nvs_config_load();
+    nvs_config_flush(&config_a);
+    nvs_ops_get_stats(&before);
+    nvs_config_flush(&config_b);
+    nvs_ops_get_stats(&after);
+    ops = after.count[op] - before.count[op];
+    TEST_ASSERT(ops > 0);
+
+    for(skip = 0; skip < ops; skip++) {
+        factory();
+        nvs_config_load();
+        TEST_ASSERT_EQUAL(ESP_OK, nvs_config_flush(&config_a));
+
+        nvs_ops_inject_failure(op, skip, injected);
+        err = nvs_config_flush(&config_b);
+        TEST_ASSERT_EQUAL(0, nvs_sim_open_handles());
+
+        TEST_ASSERT_EQUAL(ESP_OK, reboot());
+        TEST_ASSERT(config_equal(nvs_config_get(), &config_b)
+            || (err != ESP_OK && config_equal(nvs_config_get(), &config_a)));
+    }
+}
+
+static void test_config_flush_is_atomic_on_failed_open(void)
+{
+    check_config_flush_is_atomic(NVS_OP_OPEN, ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+}
+
+static void test_config_flush_is_atomic_on_failed_write(void)
+{
+    check_config_flush_is_atomic(NVS_OP_WRITE, ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+}
+
+static void test_config_flush_is_atomic_on_failed_erase(void)
+{
+    check_config_flush_is_atomic(NVS_OP_ERASE, ESP_ERR_NVS_REMOVE_FAILED);
+}
+
+static void test_config_flush_is_atomic_on_failed_commit(void)
+{
+    check_config_flush_is_atomic(NVS_OP_COMMIT, ESP_FAIL);
+}
+
+static void test_batch_open_uses_remembered_slot(void)
+{
+    struct nvs_ops_stats before, after;
+    nvs_handle_t handle;
+    uint32_t gen;
+
+    factory();
+    nvs_config_load();
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_config_flush(&config_a));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_config_flush(&config_b));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_batch_get_generation(NVS_SET_CONFIG, &gen));
+
+    // Current slot is known after the commits, generation and open need no NVS_NAMESPACE lookup
+    nvs_ops_get_stats(&before);
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_batch_get_generation(NVS_SET_CONFIG, &gen));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_batch_open(NVS_SET_CONFIG, &handle));
+    nvs_close(handle);
+    nvs_ops_get_stats(&after);
+    TEST_ASSERT(gen >= 2);
+    TEST_ASSERT_EQUAL(1, after.count[NVS_OP_OPEN] - before.count[NVS_OP_OPEN]);
+
+    // Erased behind its back, the remembered slot is not trusted
+    factory();
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, nvs_batch_open(NVS_SET_CONFIG, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_config_load());
+    TEST_ASSERT(nvs_config_get()->ssid[0] == '\0');
+    TEST_ASSERT_EQUAL(0, nvs_sim_open_handles());
+}
+
+static void test_tls_certs_round_trip(void)
+{
+    static const char pem[] = "-----BEGIN TEST-----\nAAECAwQF\n-----END TEST-----\n";
+    static const uint8_t der[] = { 0, 1, 2, 3, 4, 5 };
+    uint8_t stored[sizeof pem];
+    struct tls_certs certs = { 0 };
+    nvs_handle_t handle;
+    int stored_len;
+
+    // Server certificate is flashed with the firmware
+    factory();
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_set_blob(handle, NVS_KEY_SERVER_CERT, "server", 6));
+    nvs_close(handle);
+
+    stored_len = credentials_pem_to_der(pem, stored, sizeof stored);
+    TEST_ASSERT(stored_len > 0);
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_set_tls_certs(stored, stored_len, NVS_KEY_CON_CLIENT_CERT,
+        "key", 3, NVS_KEY_CON_CLIENT_KEY));
+
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_get_tls_certs(&certs, NVS_KEY_SERVER_CERT,
+        NVS_KEY_CON_CLIENT_CERT, NVS_KEY_CON_CLIENT_KEY));
+    TEST_ASSERT_EQUAL(0, nvs_sim_open_handles());
+
+    // PEM lengths include the NUL, DER is handed out without its header
+    TEST_ASSERT_EQUAL(7, certs.server_cert_len);
+    TEST_ASSERT(strcmp(certs.server_cert, "server") == 0);
+    TEST_ASSERT_EQUAL(sizeof der, certs.client_cert_len);
+    TEST_ASSERT(memcmp(certs.client_cert, der, sizeof der) == 0);
+    TEST_ASSERT_EQUAL(4, certs.client_key_len);
+    nvs_free_tls_certs(&certs);
+
+    // A failed read leaves nothing open or allocated
+    nvs_ops_inject_failure(NVS_OP_READ, 4, ESP_ERR_NVS_INVALID_LENGTH);
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_INVALID_LENGTH, nvs_get_tls_certs(&certs, NVS_KEY_SERVER_CERT,
+        NVS_KEY_CON_CLIENT_CERT, NVS_KEY_CON_CLIENT_KEY));
+    TEST_ASSERT(certs.buf == NULL);
+    TEST_ASSERT_EQUAL(0, nvs_sim_open_handles());
+}
+
+static void test_wifi_aps_unchanged_list_is_not_written(void)
+{
+    struct nvs_sim_stats stats;
+    struct wifi_aps aps;
+
+    factory();
+    nvs_config_load();
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_FOUND, nvs_get_wifi_aps(&aps));
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_config_flush(&config_a));
+
+    // Provisioned ssid is always part of the list
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_get_wifi_aps(&aps));
+    TEST_ASSERT_EQUAL(1, aps.count);
+    TEST_ASSERT(wifi_aps_add(&aps, "guest", "guest-pwd") >= 0);
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_set_wifi_aps(&aps));
+
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_get_wifi_aps(&aps));
+    TEST_ASSERT_EQUAL(2, aps.count);
+    nvs_sim_clear_stats();
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_set_wifi_aps(&aps));
+    nvs_sim_get_stats(&stats);
+    TEST_ASSERT_EQUAL(0, stats.entries_written);
+}
+
+static void test_seq_numbers_increase_across_reboots(void)
+{
+    uint32_t next = 0;
+    uint32_t limit = 0;
+
+    factory();
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_seq_reserve(&next, &limit));
+    TEST_ASSERT_EQUAL(0, next);
+    TEST_ASSERT_EQUAL(NVS_SEQ_BLOCK, limit);
+
+    // Block used up, the next one is reserved, next is left to the caller
+    next = limit;
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_seq_reserve(&next, &limit));
+    TEST_ASSERT_EQUAL(NVS_SEQ_BLOCK, next);
+    TEST_ASSERT_EQUAL(2 * NVS_SEQ_BLOCK, limit);
+
+    // Power loss somewhere in the second block, the new boot continues after it
+    reboot();
+    next = 0;
+    limit = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_seq_reserve(&next, &limit));
+    TEST_ASSERT_EQUAL(2 * NVS_SEQ_BLOCK, next);
+    TEST_ASSERT_EQUAL(3 * NVS_SEQ_BLOCK, limit);
+}
+
+static void test_seq_failed_reservation_reserves_nothing(void)
+{
+    uint32_t next = 0;
+    uint32_t limit = 0;
+
+    factory();
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_seq_reserve(&next, &limit));
+
+    nvs_ops_inject_failure(NVS_OP_WRITE, 0, ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+    TEST_ASSERT_EQUAL(ESP_ERR_NVS_NOT_ENOUGH_SPACE, nvs_seq_reserve(&next, &limit));
+    TEST_ASSERT_EQUAL(NVS_SEQ_BLOCK, limit);
+
+    // Retried with the next sample
+    TEST_ASSERT_EQUAL(ESP_OK, nvs_seq_reserve(&next, &limit));
+    TEST_ASSERT_EQUAL(2 * NVS_SEQ_BLOCK, limit);
+}
+
+int main(void)
+{
+    RUN_TEST(test_sim_unchanged_write_is_skipped);
+    RUN_TEST(test_sim_garbage_collection_erases_pages);
+    RUN_TEST(test_ops_counts_operations_and_bytes);
+    RUN_TEST(test_injected_failure_fails_once);
+    RUN_TEST(test_config_survives_reboot);
+    RUN_TEST(test_config_of_older_firmware_is_migrated);
+    RUN_TEST(test_config_flush_is_atomic_on_failed_open);
+    RUN_TEST(test_config_flush_is_atomic_on_failed_write);
+    RUN_TEST(test_config_flush_is_atomic_on_failed_erase);
+    RUN_TEST(test_config_flush_is_atomic_on_failed_commit);
+    RUN_TEST(test_batch_open_uses_remembered_slot);
+    RUN_TEST(test_tls_certs_round_trip);
+    RUN_TEST(test_wifi_aps_unchanged_list_is_not_written);
+    RUN_TEST(test_seq_numbers_increase_across_reboots);
+    RUN_TEST(test_seq_failed_reservation_reserves_nothing);
+    return TEST_RESULT();
+}
@@ -0,0 +1,205 @@
+#include <string.h>
+#include "test.h"
+#include "esp_rom_crc.h"
+#include "prov_tlv.h"
+
+TEST_MAIN_STATE;
+
+static uint8_t blob[PROV_TLV_MAX_SIZE];
+static uint8_t tlvs[PROV_TLV_MAX_SIZE];
+static size_t tlvs_len;
+
+/// Append a TLV with a value of @param value_len bytes of @param value, repeated if it is shorter
+static void add_tlv(uint8_t type, const char *value, size_t value_len)
+{
+    size_t i;
+
+    tlvs[tlvs_len++] = type;
+    tlvs[tlvs_len++] = value_len;
+    for(i = 0; i < value_len; i++) {
+        tlvs[tlvs_len++] = value[i % strlen(value)];
+    }
+}
+
+/// Start the TLVs with the fields every blob needs
+static void start(void)
+{
+    tlvs_len = 0;
+    add_tlv(PROV_TLV_SSID, "home", 4);
+    add_tlv(PROV_TLV_AWS_THING, "sensor-1", 8);
+}
+
+/// Wrap the TLVs in header and crc, returns the length of the blob
+static size_t build(void)
+{
+    size_t len = 0;
+    uint32_t crc;
+
+    blob[len++] = PROV_TLV_VERSION;
+    blob[len++] = tlvs_len & 0xff;
+    blob[len++] = tlvs_len >> 8;
+    memcpy(blob + len, tlvs, tlvs_len);
+    len += tlvs_len;
+
+    crc = esp_rom_crc32_le(0, blob, len);
+    blob[len++] = crc & 0xff;
+    blob[len++] = (crc >> 8) & 0xff;
+    blob[len++] = (crc >> 16) & 0xff;
+    blob[len++] = crc >> 24;
+    return len;
+}
+
+/// Recompute the crc after the blob was changed
+static void fix_crc(size_t len)
+{
+    uint32_t crc = esp_rom_crc32_le(0, blob, len - PROV_TLV_CRC_SIZE);
+
+    blob[len - 4] = crc & 0xff;
+    blob[len - 3] = (crc >> 8) & 0xff;
+    blob[len - 2] = (crc >> 16) & 0xff;
+    blob[len - 1] = crc >> 24;
+}
+
+static void test_all_fields_are_parsed(void)
+{
+    struct prov_data pdata;
+
+    start();
+    add_tlv(PROV_TLV_PWD, "secret42", 8);
+    add_tlv(PROV_TLV_AWS_UUID, "0123-4567", 9);
+
+    TEST_ASSERT_EQUAL(PROV_TLV_OK, prov_tlv_parse(blob, build(), &pdata));
+    TEST_ASSERT(strcmp((char *)pdata.ssid, "home") == 0);
+    TEST_ASSERT(strcmp((char *)pdata.pwd, "secret42") == 0);
+    TEST_ASSERT(strcmp((char *)pdata.aws_uuid, "0123-4567") == 0);
+    TEST_ASSERT(strcmp((char *)pdata.aws_thing, "sensor-1") == 0);
+}
+
+static void test_length_has_to_match_the_blob(void)
+{
+    struct prov_data pdata;
+    size_t len;
+
+    start();
+    len = build();
+    TEST_ASSERT_EQUAL(PROV_TLV_ERR_LENGTH, prov_tlv_parse(blob, len - 1, &pdata));
+    TEST_ASSERT_EQUAL(PROV_TLV_ERR_LENGTH, prov_tlv_parse(blob, len + 1, &pdata));
+    TEST_ASSERT_EQUAL(PROV_TLV_ERR_LENGTH, prov_tlv_parse(blob, PROV_TLV_HEADER_SIZE + PROV_TLV_CRC_SIZE - 1, &pdata));
+
+    // Length field larger than what was sent
+    blob[1]++;
+    fix_crc(len);
+    TEST_ASSERT_EQUAL(PROV_TLV_ERR_LENGTH, prov_tlv_parse(blob, len, &pdata));
+}
+
+static void test_bad_crc_is_rejected(void)
+{
+    struct prov_data pdata;
+    size_t len;
+
+    start();
+    len = build();
+    blob[PROV_TLV_HEADER_SIZE + 2] ^= 0x01;
+    TEST_ASSERT_EQUAL(PROV_TLV_ERR_CRC, prov_tlv_parse(blob, len, &pdata));
+
+    blob[PROV_TLV_HEADER_SIZE + 2] ^= 0x01;
+    blob[len - 1] ^= 0x80;
+    TEST_ASSERT_EQUAL(PROV_TLV_ERR_CRC, prov_tlv_parse(blob, len, &pdata));
+}
+
+static void test_truncated_tlv_is_rejected(void)
+{
+    struct prov_data pdata;
+
+    // Value runs past the end of the TLVs
+    start();
+    tlvs[tlvs_len++] = PROV_TLV_PWD;
+    tlvs[tlvs_len++] = 8;
+    memcpy(tlvs + tlvs_len, "secret", 6);
+    tlvs_len += 6;
+    TEST_ASSERT_EQUAL(PROV_TLV_ERR_MALFORMED, prov_tlv_parse(blob, build(), &pdata));
+
+    // Type without length
+    start();
+    tlvs[tlvs_len++] = PROV_TLV_PWD;
+    TEST_ASSERT_EQUAL(PROV_TLV_ERR_MALFORMED, prov_tlv_parse(blob, build(), &pdata));
+}
+
+static void test_duplicate_type_is_rejected(void)
+{
+    struct prov_data pdata;
+
+    start();
+    add_tlv(PROV_TLV_SSID, "office", 6);
+    TEST_ASSERT_EQUAL(PROV_TLV_ERR_MALFORMED, prov_tlv_parse(blob, build(), &pdata));
+}
+
+static void test_unknown_type_is_skipped(void)
+{
+    struct prov_data pdata;
+
+    start();
+    add_tlv(0x7f, "future field", 12);
+    add_tlv(0xff, "x", 255);
+    add_tlv(PROV_TLV_PWD, "secret42", 8);
+    TEST_ASSERT_EQUAL(PROV_TLV_OK, prov_tlv_parse(blob, build(), &pdata));
+    TEST_ASSERT(strcmp((char *)pdata.pwd, "secret42") == 0);
+}
+
+static void test_oversize_value_is_rejected(void)
+{
+    struct prov_data pdata;
+
+    // Longest that leaves room for the NUL
+    start();
+    add_tlv(PROV_TLV_PWD, "p", sizeof pdata.pwd - 1);
+    TEST_ASSERT_EQUAL(PROV_TLV_OK, prov_tlv_parse(blob, build(), &pdata));
+    TEST_ASSERT_EQUAL(sizeof pdata.pwd - 1, strlen((char *)pdata.pwd));
+
+    start();
+    add_tlv(PROV_TLV_PWD, "p", sizeof pdata.pwd);
+    TEST_ASSERT_EQUAL(PROV_TLV_ERR_MALFORMED, prov_tlv_parse(blob, build(), &pdata));
+
+    tlvs_len = 0;
+    add_tlv(PROV_TLV_SSID, "s", sizeof pdata.ssid);
+    add_tlv(PROV_TLV_AWS_THING, "sensor-1", 8);
+    TEST_ASSERT_EQUAL(PROV_TLV_ERR_MALFORMED, prov_tlv_parse(blob, build(), &pdata));
+
+    tlvs_len = 0;
+    add_tlv(PROV_TLV_SSID, "home", 4);
+    add_tlv(PROV_TLV_AWS_THING, "t", sizeof pdata.aws_thing);
+    TEST_ASSERT_EQUAL(PROV_TLV_ERR_MALFORMED, prov_tlv_parse(blob, build(), &pdata));
+}
+
+static void test_bad_version_and_missing_fields(void)
+{
+    struct prov_data pdata;
+    size_t len;
+
+    start();
+    len = build();
+    blob[0] = PROV_TLV_VERSION + 1;
+    fix_crc(len);
+    TEST_ASSERT_EQUAL(PROV_TLV_ERR_MALFORMED, prov_tlv_parse(blob, len, &pdata));
+
+    tlvs_len = 0;
+    add_tlv(PROV_TLV_SSID, "home", 4);
+    TEST_ASSERT_EQUAL(PROV_TLV_ERR_MISSING, prov_tlv_parse(blob, build(), &pdata));
+
+    tlvs_len = 0;
+    add_tlv(PROV_TLV_AWS_THING, "sensor-1", 8);
+    TEST_ASSERT_EQUAL(PROV_TLV_ERR_MISSING, prov_tlv_parse(blob, build(), &pdata));
+}
+
+int main(void)
+{
+    RUN_TEST(test_all_fields_are_parsed);
+    RUN_TEST(test_length_has_to_match_the_blob);
+    RUN_TEST(test_bad_crc_is_rejected);
+    RUN_TEST(test_truncated_tlv_is_rejected);
+    RUN_TEST(test_duplicate_type_is_rejected);
+    RUN_TEST(test_unknown_type_is_skipped);
+    RUN_TEST(test_oversize_value_is_rejected);
+    RUN_TEST(test_bad_version_and_missing_fields);
+    return TEST_RESULT();
+}
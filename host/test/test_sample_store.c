@@ -0,0 +1,234 @@
+#include <string.h>
+#include "test.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "partition_sim.h"
+#include "sample_store.h"
+
+TEST_MAIN_STATE;
+
+// Smaller than the partition of partitions.csv, so the ring wraps after a few hundred samples
+#define SECTORS             4
+#define RECORDS_PER_SECTOR  (SAMPLE_STORE_SECTOR_SIZE / sizeof(struct sample_record))
+#define NUM_SLOTS           (SECTORS * RECORDS_PER_SECTOR)
+
+static struct telemetry_sample samples[NUM_SLOTS];
+static uint32_t next_seq;
+
+/// Empty partition and a store initialized on it
+static void factory(void)
+{
+    partition_sim_reset(SAMPLE_STORE_PARTITION_LABEL, SAMPLE_STORE_PARTITION_SUBTYPE, SECTORS * SAMPLE_STORE_SECTOR_SIZE);
+    sample_store_init();
+    next_seq = 0;
+}
+
+/// Power comes back after a cut, the store recovers from what is in flash
+static void power_cycle(void)
+{
+    partition_sim_reboot();
+    sample_store_init();
+}
+
+/// Append @param count samples with consecutive sequence numbers, returns the error of the first failed append
+static esp_err_t append(size_t count)
+{
+    struct telemetry_sample sample = { .temperature = 21.5f };
+    esp_err_t err;
+
+    while(count--) {
+        sample.seq = next_seq++;
+        sample.timestamp_ms = (int64_t)sample.seq * 10000;
+        err = sample_store_append(&sample);
+        if(err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+/// Highest log_seq of the intact records in flash, what recovery has to find as the end of the log
+static bool newest_log_seq(uint32_t *log_seq)
+{
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+        SAMPLE_STORE_PARTITION_SUBTYPE, SAMPLE_STORE_PARTITION_LABEL);
+    struct sample_record record;
+    const uint8_t *start = (const uint8_t *)&record.log_seq;
+    const uint8_t *end = (const uint8_t *)&record.crc;
+    bool found = false;
+    size_t slot;
+
+    for(slot = 0; slot < NUM_SLOTS; slot++) {
+        esp_partition_read(partition, slot * sizeof record, &record, sizeof record);
+        if((record.state != SAMPLE_RECORD_VALID && record.state != SAMPLE_RECORD_SENT)
+            || record.crc != esp_rom_crc32_le(0, start, end - start)) {
+            continue;
+        }
+        if(!found || (int32_t)(record.log_seq - *log_seq) > 0) {
+            *log_seq = record.log_seq;
+            found = true;
+        }
+    }
+    return found;
+}
+
+/// Check that the pending samples run without a gap from @param first to @param last
+static void check_pending(uint32_t first, uint32_t last)
+{
+    size_t n;
+    size_t i;
+
+    TEST_ASSERT_EQUAL(last - first + 1, sample_store_pending());
+    n = sample_store_peek(samples, NUM_SLOTS);
+    TEST_ASSERT_EQUAL(last - first + 1, n);
+    for(i = 0; i < n; i++) {
+        TEST_ASSERT_EQUAL(first + i, samples[i].seq);
+    }
+}
+
+/// Check that the end of the log is @param newest and that the next append goes after it
+static void check_appends_at_end(uint32_t newest)
+{
+    uint32_t log_seq;
+    size_t n;
+
+    TEST_ASSERT(newest_log_seq(&log_seq));
+    TEST_ASSERT_EQUAL(newest, log_seq);
+
+    TEST_ASSERT_EQUAL(ESP_OK, append(1));
+    TEST_ASSERT(newest_log_seq(&log_seq));
+    TEST_ASSERT_EQUAL(newest + 1, log_seq);
+    n = sample_store_peek(samples, NUM_SLOTS);
+    TEST_ASSERT(n > 0);
+    TEST_ASSERT_EQUAL(next_seq - 1, samples[n - 1].seq);
+}
+
+/**
+ *  Check the store after recovery: pending samples run from @param first to @param last, so nothing acked
+ *  before @param first comes back, and the log continues after @param newest
+*/
+static void check_recovered(uint32_t first, uint32_t last, uint32_t newest)
+{
+    int failures = test_failures;
+
+    check_pending(first, last);
+    if(test_failures == failures) {
+        check_appends_at_end(newest);
+    }
+}
+
+static void test_samples_survive_a_reboot(void)
+{
+    factory();
+    TEST_ASSERT_EQUAL(ESP_OK, append(10));
+    TEST_ASSERT_EQUAL(ESP_OK, sample_store_consume(4));
+
+    power_cycle();
+    check_recovered(4, 9, 9);
+}
+
+static void test_missing_partition_is_reported(void)
+{
+    partition_sim_reset(SAMPLE_STORE_PARTITION_LABEL, SAMPLE_STORE_PARTITION_SUBTYPE, 0);
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, sample_store_init());
+    TEST_ASSERT(!sample_store_ready());
+}
+
+static void test_torn_record_is_skipped(void)
+{
+    uint32_t cut;
+
+    // Cut at every byte of the record, a cut after the last byte is a complete append
+    for(cut = 0; cut <= sizeof(struct sample_record); cut++) {
+        factory();
+        TEST_ASSERT_EQUAL(ESP_OK, append(10));
+        TEST_ASSERT_EQUAL(ESP_OK, sample_store_consume(4));
+
+        partition_sim_cut_power_after(cut);
+        TEST_ASSERT_EQUAL(cut < sizeof(struct sample_record) ? ESP_FAIL : ESP_OK, append(1));
+        power_cycle();
+
+        if(cut < sizeof(struct sample_record)) {
+            check_recovered(4, 9, 9);
+        } else {
+            check_recovered(4, 10, 10);
+        }
+    }
+}
+
+static void test_torn_state_word_never_replays_acked_samples(void)
+{
+    uint32_t acked;
+    uint32_t cut;
+
+    // Cut at every byte of the state words of three samples being marked sent
+    for(cut = 0; cut <= 3 * sizeof(uint32_t); cut++) {
+        factory();
+        TEST_ASSERT_EQUAL(ESP_OK, append(10));
+        TEST_ASSERT_EQUAL(ESP_OK, sample_store_consume(3));
+
+        // The device is off after the cut, what consume returns does not matter
+        partition_sim_cut_power_after(cut);
+        sample_store_consume(3);
+        power_cycle();
+
+        // Samples whose state word was written completely are acked, the one that was cut may come back
+        acked = 3 + cut / sizeof(uint32_t);
+        TEST_ASSERT(sample_store_peek(samples, 1) == 1);
+        TEST_ASSERT(samples[0].seq == acked || (cut % sizeof(uint32_t) != 0 && samples[0].seq == acked + 1));
+        check_recovered(samples[0].seq, 9, 9);
+    }
+}
+
+static void test_torn_sector_erase_keeps_the_rest_of_the_log(void)
+{
+    uint32_t first;
+    uint32_t cut;
+
+    // Ring full, the next append erases sector 0 which still holds pending samples from seq 100 on
+    for(cut = 0; cut < SAMPLE_STORE_SECTOR_SIZE; cut++) {
+        factory();
+        TEST_ASSERT_EQUAL(ESP_OK, append(NUM_SLOTS));
+        TEST_ASSERT_EQUAL(ESP_OK, sample_store_consume(100));
+
+        partition_sim_cut_power_after(cut);
+        TEST_ASSERT_EQUAL(ESP_FAIL, append(1));
+        power_cycle();
+
+        // Records up to the cut are erased, the one the cut went through is torn
+        first = (cut + sizeof(struct sample_record) - 1) / sizeof(struct sample_record);
+        if(first < 100) {
+            first = 100;
+        }
+        check_pending(first, NUM_SLOTS - 1);
+        check_appends_at_end(NUM_SLOTS - 1);
+
+        // The append erased the sector again, its remaining pending samples are dropped
+        TEST_ASSERT_EQUAL(NUM_SLOTS - RECORDS_PER_SECTOR + 1, sample_store_pending());
+        TEST_ASSERT_EQUAL(1, sample_store_peek(samples, 1));
+        TEST_ASSERT_EQUAL(RECORDS_PER_SECTOR, samples[0].seq);
+    }
+}
+
+static void test_full_store_drops_oldest_sector(void)
+{
+    uint32_t dropped = sample_store_dropped();
+
+    factory();
+    TEST_ASSERT_EQUAL(ESP_OK, append(NUM_SLOTS + 1));
+    TEST_ASSERT_EQUAL(RECORDS_PER_SECTOR, sample_store_dropped() - dropped);
+
+    power_cycle();
+    check_recovered(RECORDS_PER_SECTOR, NUM_SLOTS, NUM_SLOTS);
+}
+
+int main(void)
+{
+    RUN_TEST(test_samples_survive_a_reboot);
+    RUN_TEST(test_missing_partition_is_reported);
+    RUN_TEST(test_torn_record_is_skipped);
+    RUN_TEST(test_torn_state_word_never_replays_acked_samples);
+    RUN_TEST(test_torn_sector_erase_keeps_the_rest_of_the_log);
+    RUN_TEST(test_full_store_drops_oldest_sector);
+    return TEST_RESULT();
+}
@@ -0,0 +1,94 @@
+#include <stddef.h>
+#include "test.h"
+#include "sensor.h"
+
+TEST_MAIN_STATE;
+
+// Readings of the fake driver, ESP_FAIL where a reading fails
+static const int32_t *fake_readings;
+static const esp_err_t *fake_errors;
+static size_t fake_next;
+
+static esp_err_t fake_read(int32_t *raw)
+{
+    size_t i = fake_next++;
+
+    if(fake_errors != NULL && fake_errors[i] != ESP_OK) {
+        return fake_errors[i];
+    }
+    *raw = fake_readings[i];
+    return ESP_OK;
+}
+
+static const struct sensor_driver fake_driver = {
+    .name = "fake",
+    .read = fake_read,
+};
+
+/// Average @param count readings of the fake driver
+static int average(const int32_t *readings, const esp_err_t *errors, int count, int32_t *raw)
+{
+    fake_readings = readings;
+    fake_errors = errors;
+    fake_next = 0;
+    return sensor_read_average(&fake_driver, count, raw);
+}
+
+static void test_average_rounds_to_nearest(void)
+{
+    const int32_t up[] = { 2000, 2001 };
+    const int32_t down[] = { 2000, 2000, 2001 };
+    const int32_t negative[] = { -2000, -2001 };
+    int32_t raw;
+
+    TEST_ASSERT_EQUAL(2, average(up, NULL, 2, &raw));
+    TEST_ASSERT_EQUAL(2001, raw);
+    TEST_ASSERT_EQUAL(3, average(down, NULL, 3, &raw));
+    TEST_ASSERT_EQUAL(2000, raw);
+    TEST_ASSERT_EQUAL(2, average(negative, NULL, 2, &raw));
+    TEST_ASSERT_EQUAL(-2001, raw);
+}
+
+static void test_average_skips_failed_readings(void)
+{
+    const int32_t readings[] = { 2000, 9999, 2200, 9999 };
+    const esp_err_t errors[] = { ESP_OK, ESP_FAIL, ESP_OK, ESP_FAIL };
+    const esp_err_t all_fail[] = { ESP_FAIL, ESP_FAIL };
+    int32_t raw;
+
+    TEST_ASSERT_EQUAL(2, average(readings, errors, 4, &raw));
+    TEST_ASSERT_EQUAL(2100, raw);
+
+    // Nothing read, raw is left alone
+    raw = 42;
+    TEST_ASSERT_EQUAL(0, average(readings, all_fail, 2, &raw));
+    TEST_ASSERT_EQUAL(42, raw);
+}
+
+static void test_mock_steps_per_period_not_per_reading(void)
+{
+    int32_t raw;
+    int i;
+
+    // The test takes far less than a sample period, every reading is the start value
+    TEST_ASSERT_EQUAL(ESP_OK, sensor_mock_driver.init());
+    for(i = 0; i < 1000; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, sensor_mock_driver.read(&raw));
+        TEST_ASSERT_EQUAL(3000, raw);
+    }
+
+    // Any oversampling averages to the same sample
+    TEST_ASSERT_EQUAL(1, sensor_read_average(&sensor_mock_driver, 1, &raw));
+    TEST_ASSERT_EQUAL(3000, raw);
+    TEST_ASSERT_EQUAL(256, sensor_read_average(&sensor_mock_driver, 256, &raw));
+    TEST_ASSERT_EQUAL(3000, raw);
+    TEST_ASSERT(sensor_mock_driver.convert(raw) == 30.0f);
+}
+
+int main(void)
+{
+    RUN_TEST(test_average_rounds_to_nearest);
+    RUN_TEST(test_average_skips_failed_readings);
+    RUN_TEST(test_mock_steps_per_period_not_per_reading);
+    return TEST_RESULT();
+}
@@ -0,0 +1,122 @@
+#include <stdint.h>
+#include "test.h"
+#include "spsc_ring.h"
+
+TEST_MAIN_STATE;
+
+#define CAPACITY    8
+
+static uint32_t buf[CAPACITY];
+
+static void test_capacity_has_to_be_a_power_of_two(void)
+{
+    struct spsc_ring ring;
+
+    TEST_ASSERT_EQUAL(-1, spsc_ring_init(&ring, buf, sizeof buf[0], 0));
+    TEST_ASSERT_EQUAL(-1, spsc_ring_init(&ring, buf, sizeof buf[0], 6));
+    TEST_ASSERT_EQUAL(0, spsc_ring_init(&ring, buf, sizeof buf[0], 1));
+    TEST_ASSERT_EQUAL(0, spsc_ring_init(&ring, buf, sizeof buf[0], CAPACITY));
+}
+
+static void test_empty_ring_pops_nothing(void)
+{
+    struct spsc_ring ring;
+    uint32_t value = 42;
+
+    spsc_ring_init(&ring, buf, sizeof buf[0], CAPACITY);
+    TEST_ASSERT_EQUAL(0, spsc_ring_count(&ring));
+    TEST_ASSERT(!spsc_ring_pop(&ring, &value));
+    TEST_ASSERT_EQUAL(42, value);
+
+    // Empty again once everything was taken
+    value = 7;
+    TEST_ASSERT(spsc_ring_push(&ring, &value));
+    TEST_ASSERT(spsc_ring_pop(&ring, &value));
+    TEST_ASSERT(!spsc_ring_pop(&ring, &value));
+    TEST_ASSERT_EQUAL(0, spsc_ring_count(&ring));
+}
+
+static void test_full_ring_rejects_push(void)
+{
+    struct spsc_ring ring;
+    uint32_t value;
+
+    spsc_ring_init(&ring, buf, sizeof buf[0], CAPACITY);
+    for(value = 0; value < CAPACITY; value++) {
+        TEST_ASSERT(spsc_ring_push(&ring, &value));
+    }
+    TEST_ASSERT_EQUAL(CAPACITY, spsc_ring_count(&ring));
+
+    // Newest is rejected, the queued elements are kept
+    value = 100;
+    TEST_ASSERT(!spsc_ring_push(&ring, &value));
+    TEST_ASSERT_EQUAL(CAPACITY, spsc_ring_count(&ring));
+    TEST_ASSERT(spsc_ring_pop(&ring, &value));
+    TEST_ASSERT_EQUAL(0, value);
+
+    // One slot free again
+    value = 100;
+    TEST_ASSERT(spsc_ring_push(&ring, &value));
+    TEST_ASSERT(!spsc_ring_push(&ring, &value));
+}
+
+static void test_elements_keep_their_order_across_wraparound(void)
+{
+    struct spsc_ring ring;
+    uint32_t next_push = 0;
+    uint32_t next_pop = 0;
+    uint32_t value;
+    int round;
+    int i;
+
+    spsc_ring_init(&ring, buf, sizeof buf[0], CAPACITY);
+
+    // Fill levels that do not divide the capacity, so the slots wrap at every position
+    for(round = 0; round < 100; round++) {
+        for(i = 0; i < 5; i++) {
+            TEST_ASSERT(spsc_ring_push(&ring, &next_push));
+            next_push++;
+        }
+        for(i = 0; i < 5; i++) {
+            TEST_ASSERT(spsc_ring_pop(&ring, &value));
+            TEST_ASSERT_EQUAL(next_pop, value);
+            next_pop++;
+        }
+    }
+    TEST_ASSERT_EQUAL(0, spsc_ring_count(&ring));
+}
+
+static void test_counters_wrap_on_overflow(void)
+{
+    struct spsc_ring ring;
+    uint32_t popped;
+    uint32_t value;
+
+    // Head and tail run freely, start them just below the overflow
+    spsc_ring_init(&ring, buf, sizeof buf[0], CAPACITY);
+    atomic_store(&ring.head, SIZE_MAX - 2);
+    atomic_store(&ring.tail, SIZE_MAX - 2);
+
+    for(value = 0; value < CAPACITY; value++) {
+        TEST_ASSERT(spsc_ring_push(&ring, &value));
+    }
+    TEST_ASSERT(!spsc_ring_push(&ring, &value));
+    TEST_ASSERT_EQUAL(CAPACITY, spsc_ring_count(&ring));
+
+    for(value = 0; value < CAPACITY; value++) {
+        TEST_ASSERT(spsc_ring_pop(&ring, &popped));
+        TEST_ASSERT_EQUAL(value, popped);
+    }
+    TEST_ASSERT(!spsc_ring_pop(&ring, &value));
+    TEST_ASSERT_EQUAL(0, spsc_ring_count(&ring));
+}
+
+int main(void)
+{
+    RUN_TEST(test_capacity_has_to_be_a_power_of_two);
+    RUN_TEST(test_empty_ring_pops_nothing);
+    RUN_TEST(test_full_ring_rejects_push);
+    RUN_TEST(test_elements_keep_their_order_across_wraparound);
+    RUN_TEST(test_counters_wrap_on_overflow);
+    return TEST_RESULT();
+}
@@ -0,0 +1,34 @@
+#include <math.h>
+#include <string.h>
+#include "test.h"
+#include "telemetry.h"
+
+TEST_MAIN_STATE;
+
+static void test_non_finite_temperature_is_null(void)
+{
+    const struct telemetry_sample samples[] = {
+        { .timestamp_ms = 1000, .seq = 1, .temperature = 21.5f },
+        { .timestamp_ms = 2000, .seq = 2, .temperature = NAN },
+        { .timestamp_ms = 3000, .seq = 3, .temperature = INFINITY },
+        { .timestamp_ms = 4000, .seq = 4, .temperature = -INFINITY },
+    };
+    char payload[512];
+    size_t num_samples;
+    int len;
+
+    len = telemetry_encode_array(samples, 4, payload, sizeof payload, &num_samples);
+    TEST_ASSERT_EQUAL(4, num_samples);
+    TEST_ASSERT_EQUAL(strlen(payload), len);
+    TEST_ASSERT(strcmp(payload, "{\"samples\":["
+        "{\"ts\":1000,\"seq\":1,\"ch\":0,\"temperature\":21.50},"
+        "{\"ts\":2000,\"seq\":2,\"ch\":0,\"temperature\":null},"
+        "{\"ts\":3000,\"seq\":3,\"ch\":0,\"temperature\":null},"
+        "{\"ts\":4000,\"seq\":4,\"ch\":0,\"temperature\":null}]}") == 0);
+}
+
+int main(void)
+{
+    RUN_TEST(test_non_finite_temperature_is_null);
+    return TEST_RESULT();
+}
@@ -0,0 +1,125 @@
+#include <string.h>
+#include "test.h"
+#include "wifi_aps.h"
+
+TEST_MAIN_STATE;
+
+/// Record @param successes successful and @param failures failed attempts of the AP at @param index
+static void record(struct wifi_aps *aps, int index, int successes, int failures)
+{
+    while(successes--) {
+        wifi_aps_record(aps, index, true);
+    }
+    while(failures--) {
+        wifi_aps_record(aps, index, false);
+    }
+}
+
+/// List of @param count APs named "ap0", "ap1"... without history
+static void fill(struct wifi_aps *aps, int count)
+{
+    char ssid[8] = "ap0";
+    int i;
+
+    memset(aps, 0, sizeof *aps);
+    for(i = 0; i < count; i++) {
+        ssid[2] = '0' + i;
+        TEST_ASSERT_EQUAL(i, wifi_aps_add(aps, ssid, "secret"));
+    }
+}
+
+static void test_rank_orders_by_rssi_and_success_rate(void)
+{
+    struct wifi_aps aps;
+    int8_t rssi[WIFI_APS_MAX] = { -70, -60, WIFI_APS_RSSI_NONE, -65 };
+    uint8_t order[WIFI_APS_MAX];
+
+    fill(&aps, 4);
+
+    // Same history, the strongest first and APs that were not seen are left out
+    TEST_ASSERT_EQUAL(3, wifi_aps_rank(&aps, rssi, order));
+    TEST_ASSERT_EQUAL(1, order[0]);
+    TEST_ASSERT_EQUAL(3, order[1]);
+    TEST_ASSERT_EQUAL(0, order[2]);
+
+    // The strongest AP keeps failing, a weaker one that always connects goes first
+    record(&aps, 1, 0, 10);
+    record(&aps, 0, 10, 0);
+    TEST_ASSERT_EQUAL(3, wifi_aps_rank(&aps, rssi, order));
+    TEST_ASSERT_EQUAL(0, order[0]);
+    TEST_ASSERT_EQUAL(3, order[1]);
+    TEST_ASSERT_EQUAL(1, order[2]);
+
+    // Nothing seen
+    memset(rssi, WIFI_APS_RSSI_NONE, sizeof rssi);
+    TEST_ASSERT_EQUAL(0, wifi_aps_rank(&aps, rssi, order));
+}
+
+static void test_add_to_full_list_replaces_lowest_success_rate(void)
+{
+    struct wifi_aps aps;
+
+    fill(&aps, WIFI_APS_MAX);
+    record(&aps, 0, 3, 0);
+    record(&aps, 1, 0, 3);
+    record(&aps, 2, 1, 1);
+
+    TEST_ASSERT_EQUAL(1, wifi_aps_add(&aps, "office", "pwd42"));
+    TEST_ASSERT_EQUAL(WIFI_APS_MAX, aps.count);
+    TEST_ASSERT_EQUAL(-1, wifi_aps_find(&aps, "ap1"));
+    TEST_ASSERT_EQUAL(1, wifi_aps_find(&aps, "office"));
+    TEST_ASSERT(strcmp(aps.entries[1].pwd, "pwd42") == 0);
+    TEST_ASSERT_EQUAL(0, aps.entries[1].attempts);
+    TEST_ASSERT_EQUAL(0, aps.entries[1].successes);
+    TEST_ASSERT_EQUAL(3, aps.entries[0].successes);
+}
+
+static void test_add_known_ap_keeps_history_unless_the_password_changed(void)
+{
+    struct wifi_aps aps;
+
+    fill(&aps, 2);
+    record(&aps, 1, 2, 1);
+
+    TEST_ASSERT_EQUAL(1, wifi_aps_add(&aps, "ap1", "secret"));
+    TEST_ASSERT_EQUAL(2, aps.count);
+    TEST_ASSERT_EQUAL(3, aps.entries[1].attempts);
+
+    TEST_ASSERT_EQUAL(1, wifi_aps_add(&aps, "ap1", "new secret"));
+    TEST_ASSERT(strcmp(aps.entries[1].pwd, "new secret") == 0);
+    TEST_ASSERT_EQUAL(0, aps.entries[1].attempts);
+    TEST_ASSERT_EQUAL(0, aps.entries[1].successes);
+}
+
+static void test_record_halves_counters_at_history_size(void)
+{
+    struct wifi_aps aps;
+
+    fill(&aps, 1);
+    record(&aps, 0, WIFI_APS_HISTORY - 1, 1);
+    TEST_ASSERT_EQUAL(WIFI_APS_HISTORY, aps.entries[0].attempts);
+    TEST_ASSERT_EQUAL(WIFI_APS_HISTORY - 1, aps.entries[0].successes);
+
+    record(&aps, 0, 0, 1);
+    TEST_ASSERT_EQUAL(WIFI_APS_HISTORY / 2 + 1, aps.entries[0].attempts);
+    TEST_ASSERT_EQUAL((WIFI_APS_HISTORY - 1) / 2, aps.entries[0].successes);
+
+    // Counters stay bounded however long the device runs
+    record(&aps, 0, 1000, 0);
+    TEST_ASSERT(aps.entries[0].attempts <= WIFI_APS_HISTORY);
+    TEST_ASSERT(aps.entries[0].successes <= aps.entries[0].attempts);
+
+    // Unknown index is ignored
+    wifi_aps_record(&aps, 1, true);
+    wifi_aps_record(&aps, -1, true);
+    TEST_ASSERT_EQUAL(1, aps.count);
+}
+
+int main(void)
+{
+    RUN_TEST(test_rank_orders_by_rssi_and_success_rate);
+    RUN_TEST(test_add_to_full_list_replaces_lowest_success_rate);
+    RUN_TEST(test_add_known_ap_keeps_history_unless_the_password_changed);
+    RUN_TEST(test_record_halves_counters_at_history_size);
+    return TEST_RESULT();
+}
@@ -0,0 +1,128 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "main.h"
+#include "sensor.h"
+#include "spsc_ring.h"
+#include "telemetry.h"
+#include "acquisition.h"
+
+static struct acquisition_sample queue_buf[ACQUISITION_QUEUE_SIZE];
+static struct spsc_ring queue;
+
+static TaskHandle_t acquisition_handle = NULL;
+static bool driver_ready = false;
+static volatile uint32_t dropped;
+
+/// @brief Task that reads the sensor every sample period and queues the decimated samples
+/// @param pvParameters
+static void acquisition_task( void * pvParameters );
+
+/// Initialize the sensor driver once
+static esp_err_t acquisition_init_driver(const struct sensor_driver *driver);
+
+esp_err_t acquisition_start(void)
+{
+    const struct sensor_driver *driver = &SENSOR_DRIVER;
+    esp_err_t err;
+
+    if(acquisition_handle != NULL) {
+        return ESP_OK;
+    }
+
+    err = acquisition_init_driver(driver);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    spsc_ring_init(&queue, queue_buf, sizeof queue_buf[0], ACQUISITION_QUEUE_SIZE);
+
+    if(xTaskCreate(acquisition_task, "acquisition_task", 2048, (void *)driver, ACQUISITION_TASK_PRIORITY,
+        &acquisition_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create acquisition task");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t acquisition_read(struct acquisition_sample *sample)
+{
+    const struct sensor_driver *driver = &SENSOR_DRIVER;
+    esp_err_t err;
+    int32_t raw;
+
+    err = acquisition_init_driver(driver);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    sample->timestamp_ms = esp_timer_get_time() / 1000;
+    if(sensor_read_average(driver, ACQUISITION_OVERSAMPLING, &raw) == 0) {
+        ESP_LOGW(TAG, "Failed to read %s temperature sensor", driver->name);
+        return ESP_FAIL;
+    }
+
+    sample->channel = TELEMETRY_CHANNEL_TEMPERATURE;
+    sample->temperature = driver->convert(raw);
+    return ESP_OK;
+}
+
+bool acquisition_get_sample(struct acquisition_sample *sample)
+{
+    return spsc_ring_pop(&queue, sample);
+}
+
+uint32_t acquisition_dropped(void)
+{
+    return dropped;
+}
+
+static void acquisition_task( void * pvParameters )
+{
+    const struct sensor_driver *driver = (const struct sensor_driver *)pvParameters;
+    const TickType_t xPeriod = TELEMETRY_SAMPLE_PERIOD_MS / portTICK_PERIOD_MS;
+    TickType_t xLastWakeTime = xTaskGetTickCount();
+    struct acquisition_sample sample;
+    int32_t raw;
+
+    for( ;; ) {
+        sample.timestamp_ms = esp_timer_get_time() / 1000;
+
+        if(sensor_read_average(driver, ACQUISITION_OVERSAMPLING, &raw) > 0) {
+            sample.channel = TELEMETRY_CHANNEL_TEMPERATURE;
+            sample.temperature = driver->convert(raw);
+
+            if(!spsc_ring_push(&queue, &sample)) {
+                // Publisher is behind, newest sample is lost
+                dropped++;
+            }
+        } else {
+            ESP_LOGW(TAG, "Failed to read %s temperature sensor", driver->name);
+        }
+
+        // Fixed period from the last wake up, so time spent reading does not add up as drift
+        vTaskDelayUntil(&xLastWakeTime, xPeriod);
+    }
+}
+
+static esp_err_t acquisition_init_driver(const struct sensor_driver *driver)
+{
+    esp_err_t err;
+
+    if(driver_ready) {
+        return ESP_OK;
+    }
+
+    printf("Initializing %s temperature sensor... ", driver->name);
+    err = driver->init();
+    if(err != ESP_OK) {
+        printf("Failed.\n");
+        return err;
+    }
+    printf("Done.\n");
+
+    driver_ready = true;
+    return ESP_OK;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Raw readings averaged into one sample
+#define ACQUISITION_OVERSAMPLING    CONFIG_SENSOR_OVERSAMPLING
+// Samples buffered between the acquisition task and the publisher, has to be a power of two
+#define ACQUISITION_QUEUE_SIZE      32
+// Above the publisher, so sampling keeps its period while the publisher waits on the network
+#define ACQUISITION_TASK_PRIORITY   11
+
+/// Decimated reading handed from the acquisition task to the publisher
+struct acquisition_sample {
+    int64_t timestamp_ms;   // time of the first raw reading, ms since boot
+    uint8_t channel;
+    float temperature;      // celsius
+};
+
+/**
+ *  Initialize the configured sensor driver and start the acquisition task.
+ *  Every TELEMETRY_SAMPLE_PERIOD_MS it averages ACQUISITION_OVERSAMPLING raw readings into one sample
+ *  and queues it for the publisher.
+ * @return  ESP_OK on success or if already started,
+ *          error of the sensor driver or ESP_FAIL if the task could not be created
+*/
+esp_err_t acquisition_start(void);
+
+/**
+ *  Read one sample on the calling task, without the acquisition task, e.g. once per wake up in low power mode.
+ *  Averages ACQUISITION_OVERSAMPLING raw readings like the task does.
+ * @return  ESP_OK on success,
+ *          error of the sensor driver or ESP_FAIL if no reading succeeded
+*/
+esp_err_t acquisition_read(struct acquisition_sample *sample);
+
+/**
+ *  Take the oldest queued sample, only to be called from a single consumer task
+ * @return false if no sample is queued
+*/
+bool acquisition_get_sample(struct acquisition_sample *sample);
+
+/// Samples lost because the queue was full
+uint32_t acquisition_dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,40 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+esp_err_t arena_create(struct arena *a, size_t size)
+{
+    a->base = malloc(size);
+    if(a->base == NULL) {
+        a->size = 0;
+        a->used = 0;
+        return ESP_ERR_NO_MEM;
+    }
+
+    a->size = size;
+    a->used = 0;
+    return ESP_OK;
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+    void *ptr;
+    size_t start = (a->used + ARENA_ALIGNMENT - 1) & ~((size_t)ARENA_ALIGNMENT - 1);
+
+    if(a->base == NULL || start > a->size || size > a->size - start) {
+        return NULL;
+    }
+
+    ptr = a->base + start;
+    a->used = start + size;
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+void arena_destroy(struct arena *a)
+{
+    free(a->base);
+    a->base = NULL;
+    a->size = 0;
+    a->used = 0;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Alignment of every allocation made from an arena
+#define ARENA_ALIGNMENT     8
+
+/**
+ *  Bump allocator for buffers that share a lifetime.
+ *  One heap allocation is made when the arena is created, allocations just move the offset
+ *  and everything is given back at once when the arena is destroyed.
+*/
+struct arena {
+    uint8_t *base;      // start of the arena
+    size_t size;        // size of the arena
+    size_t used;        // bytes handed out so far, including alignment padding
+};
+
+/**
+ *  Create arena
+ * @return  ESP_OK on success,
+ *          ESP_ERR_NO_MEM when the arena could not be allocated
+*/
+esp_err_t arena_create(struct arena *a, size_t size);
+
+/**
+ *  Allocate zeroed memory from arena
+ * @return  pointer to the memory, NULL when the arena is full
+*/
+void *arena_alloc(struct arena *a, size_t size);
+
+/// Free arena and everything allocated from it
+void arena_destroy(struct arena *a);
+
+#ifdef __cplusplus
+}
+#endif
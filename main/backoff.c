@@ -0,0 +1,37 @@
+#include "backoff.h"
+
+void backoff_init(struct backoff *b, uint32_t base_ms, uint32_t max_ms)
+{
+    b->base_ms = base_ms;
+    b->max_ms = max_ms < base_ms ? base_ms : max_ms;
+    b->attempt = 0;
+}
+
+uint32_t backoff_next(struct backoff *b, uint32_t random)
+{
+    uint32_t delay = b->base_ms;
+    uint32_t i;
+
+    // Doubled one step at a time so a large attempt count can't overflow
+    for(i = 0; i < b->attempt && delay < b->max_ms; i++) {
+        delay = delay > b->max_ms / 2 ? b->max_ms : delay * 2;
+    }
+    if(delay > b->max_ms) {
+        delay = b->max_ms;
+    }
+
+    b->attempt++;
+    return backoff_jitter(delay, random);
+}
+
+uint32_t backoff_jitter(uint32_t delay_ms, uint32_t random)
+{
+    uint32_t half = delay_ms / 2;
+
+    return half + random % (delay_ms - half + 1);
+}
+
+void backoff_reset(struct backoff *b)
+{
+    b->attempt = 0;
+}
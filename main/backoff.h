@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  Exponential backoff with jitter, no platform dependencies.
+ *  The delay doubles with every failed attempt up to max_ms, and a random delay between half of it and all of it
+ *  is taken, so devices that lost the connection at the same moment don't retry at the same moment.
+*/
+struct backoff {
+    uint32_t base_ms;       // delay before the first retry, without jitter
+    uint32_t max_ms;        // cap of the delay, without jitter
+    uint32_t attempt;       // failed attempts since the last backoff_reset()
+};
+
+/// Initialize backoff
+void backoff_init(struct backoff *b, uint32_t base_ms, uint32_t max_ms);
+
+/**
+ *  Delay before the next attempt, counts the attempt
+ * @param random random value, e.g. esp_random()
+ * @return  delay in ms, between half of and the full min(max_ms, base_ms * 2^attempt)
+*/
+uint32_t backoff_next(struct backoff *b, uint32_t random);
+
+/// Random delay between half of @param delay_ms and all of it
+uint32_t backoff_jitter(uint32_t delay_ms, uint32_t random);
+
+/// Start over from base_ms, call after a successful attempt
+void backoff_reset(struct backoff *b);
+
+#ifdef __cplusplus
+}
+#endif
@@ -5,11 +5,13 @@
 #include "host/ble_uuid.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "esp_system.h"
 #include "services/gap/ble_svc_gap.h"
 #include "services/gatt/ble_svc_gatt.h"
 #include "ble_prov_gatt.h"
 #include "ble_prov.h"
 #include "wifi.h"
+#include "prov_tlv.h"
 
 /**
  * 
@@ -20,6 +22,19 @@
 /// Holds data gotten through ble
 static struct prov_data pdata;
 
+/// Provisioning progress, value of the status characteristic, see enum prov_status
+static uint8_t prov_status[PROV_STATUS_SIZE];
+static uint16_t prov_status_handle;
+
+/// Connection that wrote the provisioning data, notified about the progress
+static uint16_t prov_conn_handle = BLE_HS_CONN_HANDLE_NONE;
+
+/// Set once the wifi data is being tested, it is only tested once per boot
+static bool prov_started = false;
+
+/// Value of a write to the bulk provisioning characteristic, static so it does not have to fit on the host stack
+static uint8_t prov_tlv_buf[PROV_TLV_MAX_SIZE];
+
 static int gatt_svr_prov_access_cb(uint16_t conn_handle, uint16_t attr_handle,
                              struct ble_gatt_access_ctxt *ctxt,
                              void *arg);
@@ -27,6 +42,21 @@ static int gatt_svr_prov_access_cb(uint16_t conn_handle, uint16_t attr_handle,
 static int gatt_svr_chr_write(struct os_mbuf *om, uint16_t min_len, uint16_t max_len,
                    void *dst, uint16_t *len);
 
+/// Parse a bulk provisioning blob into pdata and test the wifi data, see prov_tlv.h
+static int gatt_svr_prov_tlv_write(uint16_t conn_handle, struct os_mbuf *om);
+
+/// Test wifi data of pdata on a new task, the access callback has to return
+static void gatt_svr_prov_start(uint16_t conn_handle);
+
+/// Task testing the wifi data, restarts when done
+static void gatt_svr_prov_task(void *arg);
+
+/// Set the status characteristic and notify the provisioning connection
+static void gatt_svr_prov_notify(enum prov_status status);
+
+/// wifi_state_callback_t of the wifi test, runs on the event loop task
+static void gatt_svr_prov_wifi_state(enum wifi_state state, void *arg);
+
 /* Sensor provisioning service */
 /* c4b21f63-e59e-44af-a637-5c05f58ac6a3 */
 static const ble_uuid128_t gatt_svr_svc_prov_uuid = PROV_SENSOR_SERVICE;
@@ -61,6 +91,18 @@ static const ble_uuid128_t gatt_svr_char_prov_cpl_uuid =
     BLE_UUID128_INIT(0xa8, 0xc6, 0x8a, 0xf5, 0x05, 0x5c, 0x37, 0xa6,
                      0xaf, 0x44, 0x9e, 0xe5, 0x63, 0x1f, 0xb2, 0xc4);
 
+/* Provisioning status characteristic, see enum prov_status */
+/* c4b21f63-e59e-44af-a637-5c05f58ac6aa */
+static const ble_uuid128_t gatt_svr_char_prov_status_uuid =
+    BLE_UUID128_INIT(0xaa, 0xc6, 0x8a, 0xf5, 0x05, 0x5c, 0x37, 0xa6,
+                     0xaf, 0x44, 0x9e, 0xe5, 0x63, 0x1f, 0xb2, 0xc4);
+
+/* Bulk provisioning characteristic, all fields as one TLV blob */
+/* c4b21f63-e59e-44af-a637-5c05f58ac6a9 */
+static const ble_uuid128_t gatt_svr_char_prov_tlv_uuid =
+    BLE_UUID128_INIT(0xa9, 0xc6, 0x8a, 0xf5, 0x05, 0x5c, 0x37, 0xa6,
+                     0xaf, 0x44, 0x9e, 0xe5, 0x63, 0x1f, 0xb2, 0xc4);
+
 
 static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
     {
@@ -93,6 +135,17 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
                 .uuid = &gatt_svr_char_prov_cpl_uuid.u,
                 .access_cb = gatt_svr_prov_access_cb,
                 .flags = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_ENC,
+            }, {
+                /*** Characteristic: Bulk provisioning, replaces the ones above in one long write. */
+                .uuid = &gatt_svr_char_prov_tlv_uuid.u,
+                .access_cb = gatt_svr_prov_access_cb,
+                .flags = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_ENC,
+            }, {
+                /*** Characteristic: Provisioning status, subscribe before completing. */
+                .uuid = &gatt_svr_char_prov_status_uuid.u,
+                .access_cb = gatt_svr_prov_access_cb,
+                .val_handle = &prov_status_handle,
+                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC | BLE_GATT_CHR_F_NOTIFY,
             }, {
                 0, /* No more characteristics in this service. */
             }
@@ -141,23 +194,23 @@ static int gatt_svr_prov_access_cb(uint16_t conn_handle, uint16_t attr_handle,
     uuid = ctxt->chr->uuid;
 
     /* Determine which characteristic is being accessed by examining its
-     * 128-bit UUID.
+     * 128-bit UUID. The fields are strings, their last byte stays NUL.
      */
     if(ble_uuid_cmp(uuid, &gatt_svr_char_wifi_ssid_uuid.u) == 0) {
         /// Write wifi ssid to buffer
-        rc = gatt_svr_chr_write(ctxt->om, 1, sizeof pdata.ssid, pdata.ssid, NULL);
+        rc = gatt_svr_chr_write(ctxt->om, 1, sizeof pdata.ssid - 1, pdata.ssid, NULL);
         return rc; // return return code of write top buffer operation
     } else if(ble_uuid_cmp(uuid, &gatt_svr_char_wifi_pwd_uuid.u) == 0) {
         /// Write wifi password to buffer
-        rc = gatt_svr_chr_write(ctxt->om, 1, sizeof pdata.pwd, pdata.pwd, NULL);
+        rc = gatt_svr_chr_write(ctxt->om, 1, sizeof pdata.pwd - 1, pdata.pwd, NULL);
         return rc;
     } else if(ble_uuid_cmp(uuid, &gatt_svr_char_aws_acc_name_uuid.u) == 0) {
         /// Write aws uuid to buffer
-        rc = gatt_svr_chr_write(ctxt->om, 1, sizeof pdata.aws_uuid, pdata.aws_uuid, NULL);
+        rc = gatt_svr_chr_write(ctxt->om, 1, sizeof pdata.aws_uuid - 1, pdata.aws_uuid, NULL);
         return rc;
     } else if(ble_uuid_cmp(uuid, &gatt_svr_char_aws_thing_name_uuid.u) == 0) {
         /// Write aws thing name to buffer
-        rc = gatt_svr_chr_write(ctxt->om, 1, sizeof pdata.aws_thing, pdata.aws_thing, NULL);
+        rc = gatt_svr_chr_write(ctxt->om, 1, sizeof pdata.aws_thing - 1, pdata.aws_thing, NULL);
         return rc;
     } else if(ble_uuid_cmp(uuid, &gatt_svr_char_prov_cpl_uuid.u) == 0) {
         rc = gatt_svr_chr_write(ctxt->om, 1, sizeof cpl, &cpl, NULL);
@@ -173,16 +226,19 @@ static int gatt_svr_prov_access_cb(uint16_t conn_handle, uint16_t attr_handle,
 
             // Test wifi data if relevant fields are not empty
             if(pdata.ssid[0] != '\0' && pdata.aws_thing[0] != '\0') {
-                // Test wifi credentials, a new task will be create for this as 
-                // we want this callback function to return
-                xTaskCreate(wifi_task, "wifi_task", 4096, &pdata, 10, NULL);
+                gatt_svr_prov_start(conn_handle);
             } else {
-                /// TODO: INFORM USER THAT SOME REQUIRED FIELD ARE EMPTY, 
-                /// can be achieved using for example a ble notification
+                prov_conn_handle = conn_handle;
+                gatt_svr_prov_notify(PROV_STATUS_FIELDS_MISSING);
             }
         }
 
         return rc;
+    } else if(ble_uuid_cmp(uuid, &gatt_svr_char_prov_tlv_uuid.u) == 0) {
+        return gatt_svr_prov_tlv_write(conn_handle, ctxt->om);
+    } else if(ble_uuid_cmp(uuid, &gatt_svr_char_prov_status_uuid.u) == 0) {
+        rc = os_mbuf_append(ctxt->om, prov_status, sizeof prov_status);
+        return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
     } else {
         MODLOG_DFLT(INFO, "Unknown characteristic");
         assert(0);
@@ -196,6 +252,123 @@ static int gatt_svr_prov_access_cb(uint16_t conn_handle, uint16_t attr_handle,
     return BLE_ATT_ERR_UNLIKELY;
 }
 
+static int gatt_svr_prov_tlv_write(uint16_t conn_handle, struct os_mbuf *om)
+{
+    struct prov_data tlv_data;
+    enum prov_tlv_status status;
+    uint16_t len;
+    int rc;
+
+    // A long write arrives here once, after NimBLE executed the queued prepared writes
+    rc = gatt_svr_chr_write(om, PROV_TLV_HEADER_SIZE + PROV_TLV_CRC_SIZE, sizeof prov_tlv_buf,
+        prov_tlv_buf, &len);
+    if(rc != 0) {
+        return rc;
+    }
+
+    status = prov_tlv_parse(prov_tlv_buf, len, &tlv_data);
+    if(status == PROV_TLV_ERR_MISSING) {
+        prov_conn_handle = conn_handle;
+        gatt_svr_prov_notify(PROV_STATUS_FIELDS_MISSING);
+    }
+    if(status != PROV_TLV_OK) {
+        MODLOG_DFLT(INFO, "Provisioning blob of %d bytes rejected: 0x%02x", len, status);
+        return status;
+    }
+
+    // pdata is read by the task testing it
+    if(prov_started) {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    pdata = tlv_data;
+    printf("Provisioning blob of %d bytes received, SSID: %s, THING: %s\n", len, pdata.ssid, pdata.aws_thing);
+    gatt_svr_prov_start(conn_handle);
+    return 0;
+}
+
+static void gatt_svr_prov_start(uint16_t conn_handle)
+{
+    prov_conn_handle = conn_handle;
+
+    // Wifi can only be started once, a repeated complete only gets the current status
+    if(prov_started) {
+        gatt_svr_prov_notify(prov_status[0]);
+        return;
+    }
+    prov_started = true;
+
+    // Test wifi credentials, a new task will be create for this as 
+    // we want this callback function to return
+    xTaskCreate(gatt_svr_prov_task, "wifi_task", 4096, NULL, 10, NULL);
+}
+
+static void gatt_svr_prov_task(void *arg)
+{
+    esp_err_t err;
+
+    printf("Wifi task created!\n");
+
+    // wait for 1 second
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+    err = wifi_test_prov_data(&pdata, gatt_svr_prov_wifi_state, NULL);
+    if(err == ESP_OK) {
+        gatt_svr_prov_notify(PROV_STATUS_SAVED);
+    } else if(prov_status[0] == PROV_STATUS_WIFI_GOT_IP) {
+        gatt_svr_prov_notify(PROV_STATUS_SAVE_FAILED);
+    }
+
+    // Reboot either way, provisioned or back to advertising with nothing saved
+    vTaskDelay(PROV_STATUS_RESTART_DELAY_MS / portTICK_PERIOD_MS);
+    printf("Restarting...\n");
+    esp_restart();
+}
+
+static void gatt_svr_prov_notify(enum prov_status status)
+{
+    struct os_mbuf *om;
+    int rc;
+
+    prov_status[0] = status;
+    if(status == PROV_STATUS_WIFI_CONNECTING && prov_status[1] < UINT8_MAX) {
+        prov_status[1]++;
+    }
+
+    if(prov_conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+        return;
+    }
+
+    om = ble_hs_mbuf_from_flat(prov_status, sizeof prov_status);
+    if(om == NULL) {
+        return;
+    }
+
+    // Consumes om, fails if the phone disconnected meanwhile
+    rc = ble_gatts_notify_custom(prov_conn_handle, prov_status_handle, om);
+    if(rc != 0) {
+        MODLOG_DFLT(INFO, "Provisioning status %d not notified; rc=%d\n", status, rc);
+    }
+}
+
+static void gatt_svr_prov_wifi_state(enum wifi_state state, void *arg)
+{
+    switch(state) {
+    case WIFI_STATE_CONNECTING:
+    case WIFI_STATE_DISCONNECTED:
+    case WIFI_STATE_NO_AP:
+    case WIFI_STATE_AUTH_FAILED:
+        // Disconnects while testing are retried up to WIFI_MAX_RETRY times
+        gatt_svr_prov_notify(PROV_STATUS_WIFI_CONNECTING);
+        break;
+    case WIFI_STATE_CONNECTED:
+        gatt_svr_prov_notify(PROV_STATUS_WIFI_GOT_IP);
+        break;
+    case WIFI_STATE_FAILED:
+        gatt_svr_prov_notify(PROV_STATUS_WIFI_FAILED);
+        break;
+    }
+}
+
 int ble_prov_gatt_svr_init(void)
 {
     int rc;
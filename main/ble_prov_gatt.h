@@ -24,6 +24,26 @@ struct prov_data {
     uint8_t aws_thing[AWS_THING_NAME_MAX_SIZE];
 };
 
+/**
+ *  Provisioning progress, pushed by the status characteristic as two bytes: status and attempt.
+ *  Attempt counts the connection attempts to the wifi being tested, the first one is 1.
+*/
+enum prov_status {
+    PROV_STATUS_IDLE = 0,           // nothing received yet
+    PROV_STATUS_FIELDS_MISSING,     // ssid or thing name empty, write them and complete again
+    PROV_STATUS_WIFI_CONNECTING,    // testing the wifi data, again for every retry
+    PROV_STATUS_WIFI_GOT_IP,
+    PROV_STATUS_WIFI_FAILED,        // wrong ssid or password, the device restarts
+    PROV_STATUS_SAVED,              // provisioned, the device restarts
+    PROV_STATUS_SAVE_FAILED,        // connected but NVS failed, the device restarts
+};
+
+// Size of the status characteristic value
+#define PROV_STATUS_SIZE            2
+
+// Time given to the last notification before restarting
+#define PROV_STATUS_RESTART_DELAY_MS    500
+
 /* Callback function to show which services/characteristics/descriptors get registered */
 // TODO:
 void ble_prov_gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg);
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "main.h"
+#include "boot_timeline.h"
+
+// Marks come from app_main, the MQTT task and the publish task
+static portMUX_TYPE timeline_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static struct boot_mark marks[BOOT_TIMELINE_MAX_MARKS];
+static unsigned int num_marks;
+
+/// Check if @param stage has already been marked, caller holds timeline_lock
+static bool boot_timeline_has(const char *stage);
+
+/// Copy marks out of the lock, returns number of marks
+static unsigned int boot_timeline_snapshot(struct boot_mark *out);
+
+void boot_timeline_mark(const char *stage)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&timeline_lock);
+    if(num_marks < BOOT_TIMELINE_MAX_MARKS && !boot_timeline_has(stage)) {
+        marks[num_marks].stage = stage;
+        marks[num_marks].time_us = now_us;
+        num_marks++;
+    }
+    portEXIT_CRITICAL(&timeline_lock);
+}
+
+void boot_timeline_log(void)
+{
+    struct boot_mark copy[BOOT_TIMELINE_MAX_MARKS];
+    unsigned int n = boot_timeline_snapshot(copy);
+    int64_t prev_us = 0;
+    unsigned int i;
+
+    ESP_LOGI(TAG, "Boot timeline, %u marks:", n);
+    for(i = 0; i < n; i++) {
+        ESP_LOGI(TAG, "  %8lld ms  +%6lld ms  %s", (long long)(copy[i].time_us / 1000),
+            (long long)((copy[i].time_us - prev_us) / 1000), copy[i].stage);
+        prev_us = copy[i].time_us;
+    }
+}
+
+int boot_timeline_format(char *payload, size_t size)
+{
+    struct boot_mark copy[BOOT_TIMELINE_MAX_MARKS];
+    unsigned int n = boot_timeline_snapshot(copy);
+    size_t len;
+    unsigned int i;
+    int ret;
+
+    ret = snprintf(payload, size, "{\"marks\":[");
+    if(ret < 0 || (size_t)ret >= size) {
+        return -1;
+    }
+    len = ret;
+
+    for(i = 0; i < n; i++) {
+        ret = snprintf(payload + len, size - len, "%s{\"stage\":\"%s\",\"ms\":%lld}",
+            i > 0 ? "," : "", copy[i].stage, (long long)(copy[i].time_us / 1000));
+        if(ret < 0 || (size_t)ret >= size - len) {
+            return -1;
+        }
+        len += ret;
+    }
+
+    ret = snprintf(payload + len, size - len, "]}");
+    if(ret < 0 || (size_t)ret >= size - len) {
+        return -1;
+    }
+    return len + ret;
+}
+
+static bool boot_timeline_has(const char *stage)
+{
+    unsigned int i;
+
+    for(i = 0; i < num_marks; i++) {
+        if(strcmp(marks[i].stage, stage) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static unsigned int boot_timeline_snapshot(struct boot_mark *out)
+{
+    unsigned int n;
+
+    portENTER_CRITICAL(&timeline_lock);
+    n = num_marks;
+    memcpy(out, marks, n * sizeof marks[0]);
+    portEXIT_CRITICAL(&timeline_lock);
+
+    return n;
+}
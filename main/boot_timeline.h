@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Marks kept per boot, later marks are dropped
+#define BOOT_TIMELINE_MAX_MARKS     16
+
+// Diagnostics topic the timeline is published to once per boot
+#define BOOT_TIMELINE_TOPIC_FORMAT  "device/%s/diagnostics/boot"
+
+// Payload of the timeline, {"marks":[{"stage":"...","ms":...},...]}
+#define BOOT_TIMELINE_PAYLOAD_SIZE  (32 + BOOT_TIMELINE_MAX_MARKS * 64)
+
+/// One boot stage
+struct boot_mark {
+    const char *stage;      // name of the stage, string literal
+    int64_t time_us;        // esp_timer time when the stage was reached, the timer starts at reset
+};
+
+/**
+ *  Mark that a boot stage was reached, safe to call from any task.
+ *  Only the first mark of every stage is kept, so marks in code that runs again (e.g. on reconnect) are ignored.
+ * @param stage string literal, the pointer is kept
+*/
+void boot_timeline_mark(const char *stage);
+
+/// Log all marks with the time since reset and since the previous mark
+void boot_timeline_log(void);
+
+/**
+ *  Format marks as json
+ * @return  length of the payload on success,
+ *          -1 if it does not fit @param size
+*/
+int boot_timeline_format(char *payload, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,94 @@
+#include <string.h>
+#include "cbor.h"
+
+// Major types
+#define CBOR_UINT       0
+#define CBOR_ARRAY      4
+#define CBOR_SIMPLE     7
+
+// Additional information of a single precision float
+#define CBOR_FLOAT32    26
+
+/// Write bytes, or only count them if there is no buffer
+static void cbor_put(struct cbor_writer *w, const uint8_t *data, size_t len);
+
+/// Write major type with argument using the shortest encoding
+static void cbor_write_head(struct cbor_writer *w, uint8_t major, uint64_t arg);
+
+void cbor_writer_init(struct cbor_writer *w, uint8_t *buf, size_t size)
+{
+    w->buf = buf;
+    w->size = size;
+    w->len = 0;
+    w->overflow = false;
+}
+
+void cbor_write_uint(struct cbor_writer *w, uint64_t value)
+{
+    cbor_write_head(w, CBOR_UINT, value);
+}
+
+void cbor_write_float(struct cbor_writer *w, float value)
+{
+    uint8_t out[5];
+    uint32_t bits;
+
+    memcpy(&bits, &value, sizeof bits);
+    out[0] = (CBOR_SIMPLE << 5) | CBOR_FLOAT32;
+    out[1] = bits >> 24;
+    out[2] = bits >> 16;
+    out[3] = bits >> 8;
+    out[4] = bits;
+    cbor_put(w, out, sizeof out);
+}
+
+void cbor_write_array(struct cbor_writer *w, size_t num_items)
+{
+    cbor_write_head(w, CBOR_ARRAY, num_items);
+}
+
+static void cbor_put(struct cbor_writer *w, const uint8_t *data, size_t len)
+{
+    if(w->buf != NULL) {
+        if(w->overflow || len > w->size - w->len) {
+            w->overflow = true;
+            return;
+        }
+        memcpy(w->buf + w->len, data, len);
+    }
+    w->len += len;
+}
+
+static void cbor_write_head(struct cbor_writer *w, uint8_t major, uint64_t arg)
+{
+    uint8_t out[9];
+    size_t num_bytes;
+    size_t i;
+
+    major <<= 5;
+    if(arg < 24) {
+        out[0] = major | arg;
+        cbor_put(w, out, 1);
+        return;
+    }
+
+    if(arg <= 0xFF) {
+        out[0] = major | 24;
+        num_bytes = 1;
+    } else if(arg <= 0xFFFF) {
+        out[0] = major | 25;
+        num_bytes = 2;
+    } else if(arg <= 0xFFFFFFFF) {
+        out[0] = major | 26;
+        num_bytes = 4;
+    } else {
+        out[0] = major | 27;
+        num_bytes = 8;
+    }
+
+    // Big endian
+    for(i = 0; i < num_bytes; i++) {
+        out[1 + i] = arg >> (8 * (num_bytes - 1 - i));
+    }
+    cbor_put(w, out, 1 + num_bytes);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  Minimal CBOR (RFC 8949) encoder writing straight to a caller-provided buffer, no allocations.
+ *  Only the types of the telemetry payload (see telemetry.h): unsigned integers, floats and arrays.
+ *  With a NULL buffer nothing is written and only the length is counted.
+ *  Writes past the end of the buffer are dropped and mark the writer as overflowed.
+*/
+struct cbor_writer {
+    uint8_t *buf;       // output buffer, may be NULL to only count
+    size_t size;        // size of buf
+    size_t len;         // bytes written (or needed)
+    bool overflow;      // true if buf was too small
+};
+
+void cbor_writer_init(struct cbor_writer *w, uint8_t *buf, size_t size);
+
+/// Unsigned integer
+void cbor_write_uint(struct cbor_writer *w, uint64_t value);
+
+/// Single precision float
+void cbor_write_float(struct cbor_writer *w, float value);
+
+/// Header of a definite length array, followed by @param num_items items
+void cbor_write_array(struct cbor_writer *w, size_t num_items);
+
+#ifdef __cplusplus
+}
+#endif
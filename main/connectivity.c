@@ -0,0 +1,190 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "main.h"
+#include "wifi.h"
+#include "boot_timeline.h"
+#include "connectivity.h"
+
+// Progress of the bring up
+#define CONNECTIVITY_WIFI_UP        BIT0    // got an ip
+#define CONNECTIVITY_PREPARED       BIT1    // prepare() succeeded
+#define CONNECTIVITY_CONNECTED      BIT2    // connect() has been called
+
+// Bits of the event group connectivity_wait() waits on
+#define CONNECTIVITY_ONLINE_BIT     BIT0
+#define CONNECTIVITY_FAILED_BIT     BIT1
+
+static const struct connectivity_config *s_config;
+static EventGroupHandle_t s_event_group;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t s_progress = 0;
+static enum connectivity_state s_state = CONNECTIVITY_IDLE;
+static bool s_wifi_stats_logged = false;
+
+/// Wifi state callback
+static void connectivity_wifi_state(enum wifi_state state, void *arg);
+
+/// Log how the first wifi connection was made, see wifi_get_connect_stats()
+static void connectivity_log_wifi_stats(void);
+
+/// Set or clear progress bits, calls connect() when wifi and prepare() are both done
+static void connectivity_update(uint32_t set, uint32_t clear);
+
+/// Change state and tell the callback
+static void connectivity_set_state(enum connectivity_state state);
+
+esp_err_t connectivity_start(const uint8_t *ssid, const uint8_t *pwd, const struct connectivity_config *config)
+{
+    esp_err_t err;
+
+    s_config = config;
+    s_event_group = xEventGroupCreate();
+    connectivity_set_state(CONNECTIVITY_CONNECTING);
+
+    err = wifi_start_sta(ssid, pwd, connectivity_wifi_state, NULL);
+    if(err != ESP_OK) {
+        connectivity_set_state(CONNECTIVITY_FAILED);
+        return err;
+    }
+
+    // Overlaps with the association
+    err = s_config->prepare();
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "Error (%s) preparing connection", esp_err_to_name(err));
+        connectivity_set_state(CONNECTIVITY_FAILED);
+        return err;
+    }
+    boot_timeline_mark("connection_prepared");
+
+    connectivity_update(CONNECTIVITY_PREPARED, 0);
+    return ESP_OK;
+}
+
+enum connectivity_state connectivity_wait(TickType_t timeout)
+{
+    EventBits_t bits = xEventGroupWaitBits(s_event_group,
+            CONNECTIVITY_ONLINE_BIT | CONNECTIVITY_FAILED_BIT,
+            pdFALSE,
+            pdFALSE,
+            timeout);
+
+    if(bits & CONNECTIVITY_ONLINE_BIT) {
+        wifi_save_ap_cache();
+        return CONNECTIVITY_ONLINE;
+    } else if(bits & CONNECTIVITY_FAILED_BIT) {
+        return CONNECTIVITY_FAILED;
+    }
+
+    return CONNECTIVITY_CONNECTING;
+}
+
+enum connectivity_state connectivity_get_state(void)
+{
+    return s_state;
+}
+
+const char *connectivity_state_name(enum connectivity_state state)
+{
+    switch(state) {
+    case CONNECTIVITY_IDLE:         return "idle";
+    case CONNECTIVITY_CONNECTING:   return "connecting";
+    case CONNECTIVITY_ONLINE:       return "online";
+    case CONNECTIVITY_OFFLINE:      return "offline";
+    case CONNECTIVITY_FAILED:       return "failed";
+    }
+
+    return "unknown";
+}
+
+static void connectivity_wifi_state(enum wifi_state state, void *arg)
+{
+    switch(state) {
+    case WIFI_STATE_CONNECTING:
+        // Already CONNECTIVITY_CONNECTING
+        break;
+    case WIFI_STATE_CONNECTED:
+        boot_timeline_mark("wifi_connected");
+        connectivity_log_wifi_stats();
+        connectivity_update(CONNECTIVITY_WIFI_UP, 0);
+        break;
+    case WIFI_STATE_DISCONNECTED:
+    case WIFI_STATE_NO_AP:
+    case WIFI_STATE_AUTH_FAILED:
+        // Wifi keeps retrying, the connection is only offline
+        connectivity_update(0, CONNECTIVITY_WIFI_UP);
+        break;
+    case WIFI_STATE_FAILED:
+        connectivity_update(0, CONNECTIVITY_WIFI_UP);
+        connectivity_set_state(CONNECTIVITY_FAILED);
+        break;
+    }
+}
+
+static void connectivity_log_wifi_stats(void)
+{
+    struct wifi_connect_stats stats;
+
+    // Reconnects are not timed from the start of wifi
+    if(s_wifi_stats_logged) {
+        return;
+    }
+    s_wifi_stats_logged = true;
+
+    wifi_get_connect_stats(&stats);
+    ESP_LOGI(TAG, "connected to ap in %d ms (%s)", (int)stats.connect_ms,
+        stats.fast_connect ? "cached AP" : (stats.fast_connect_failed ? "scan, cached AP failed" : "scan"));
+}
+
+static void connectivity_update(uint32_t set, uint32_t clear)
+{
+    bool connect = false;
+    uint32_t progress;
+    esp_err_t err;
+
+    portENTER_CRITICAL(&s_lock);
+    s_progress = (s_progress | set) & ~clear;
+    if((s_progress & (CONNECTIVITY_WIFI_UP | CONNECTIVITY_PREPARED)) == (CONNECTIVITY_WIFI_UP | CONNECTIVITY_PREPARED)
+        && !(s_progress & CONNECTIVITY_CONNECTED)) {
+        // Claimed here so only one of wifi and prepare() calls connect()
+        s_progress |= CONNECTIVITY_CONNECTED;
+        connect = true;
+    }
+    progress = s_progress;
+    portEXIT_CRITICAL(&s_lock);
+
+    if(connect) {
+        err = s_config->connect();
+        if(err != ESP_OK) {
+            ESP_LOGE(TAG, "Error (%s) connecting", esp_err_to_name(err));
+            connectivity_set_state(CONNECTIVITY_FAILED);
+            return;
+        }
+    }
+
+    // Once connected the client reconnects by itself when wifi comes back
+    if(!(progress & CONNECTIVITY_CONNECTED) || s_state == CONNECTIVITY_FAILED) {
+        return;
+    }
+    connectivity_set_state((progress & CONNECTIVITY_WIFI_UP) ? CONNECTIVITY_ONLINE : CONNECTIVITY_OFFLINE);
+}
+
+static void connectivity_set_state(enum connectivity_state state)
+{
+    if(state == s_state) {
+        return;
+    }
+
+    s_state = state;
+    ESP_LOGI(TAG, "Connectivity %s", connectivity_state_name(state));
+
+    if(state == CONNECTIVITY_ONLINE) {
+        xEventGroupSetBits(s_event_group, CONNECTIVITY_ONLINE_BIT);
+    } else if(state == CONNECTIVITY_FAILED) {
+        xEventGroupSetBits(s_event_group, CONNECTIVITY_FAILED_BIT);
+    }
+
+    if(s_config->callback != NULL) {
+        s_config->callback(state, s_config->arg);
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    Brings the connection up without waiting on wifi:
+    - wifi is started and associates in the background,
+    - meanwhile prepare() runs on the caller, e.g. loading credentials and initialising the mqtt client,
+    - connect() runs once both are done, from whichever finished last.
+    Boot to connected then takes the longer of the two instead of their sum.
+ */
+
+/// State of the connection
+enum connectivity_state {
+    CONNECTIVITY_IDLE = 0,
+    CONNECTIVITY_CONNECTING,        // wifi associating and/or prepare() running
+    CONNECTIVITY_ONLINE,            // got an ip and connect() was called
+    CONNECTIVITY_OFFLINE,           // lost wifi after being online, wifi is retrying
+    CONNECTIVITY_FAILED,            // prepare() or connect() failed, wifi itself keeps retrying
+};
+
+/// Called on every state change, from the task that caused it, must not block
+typedef void (*connectivity_callback_t)(enum connectivity_state state, void *arg);
+
+struct connectivity_config {
+    esp_err_t (*prepare)(void);         // runs on the caller of connectivity_start() while wifi associates
+    esp_err_t (*connect)(void);         // runs once, when there is an ip and prepare() succeeded
+    connectivity_callback_t callback;   // may be NULL
+    void *arg;                          // passed to callback
+};
+
+/**
+ *  Start wifi and run prepare(), returns once prepare() is done, not when connected
+ * @param config kept, has to stay valid
+ * @return  ESP_OK on success,
+ *          error of prepare() on failure, the state is then CONNECTIVITY_FAILED
+*/
+esp_err_t connectivity_start(const uint8_t *ssid, const uint8_t *pwd, const struct connectivity_config *config);
+
+/**
+ *  Wait until the connection is CONNECTIVITY_ONLINE or CONNECTIVITY_FAILED.
+ *  Also does the work that can't be done from the event loop, i.e. caching the AP in NVS.
+ * @return state after waiting, CONNECTIVITY_CONNECTING on timeout
+*/
+enum connectivity_state connectivity_wait(TickType_t timeout);
+
+/// Current state
+enum connectivity_state connectivity_get_state(void);
+
+/// Name of @param state for logs
+const char *connectivity_state_name(enum connectivity_state state);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,88 @@
+#include <string.h>
+#include "esp_tls.h"
+#include "esp_log.h"
+#include "main.h"
+#include "nvs_batch.h"
+#include "cred_cache.h"
+
+static struct tls_certs certs;          // certs.buf is NULL when nothing is cached
+static const char *cert_key;            // NVS keys the cached client certificate and key were loaded with
+static const char *key_key;
+static uint32_t certs_gen;              // generation of the tls set the credentials were loaded from
+static struct cred_cache_stats stats;
+
+esp_err_t cred_cache_get(const char *client_cert_nvs_key, const char *client_key_nvs_key,
+    const struct tls_certs **out)
+{
+    uint32_t gen;
+    esp_err_t err;
+
+    err = nvs_batch_get_generation(NVS_SET_TLS, &gen);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    if(certs.buf != NULL && gen == certs_gen
+        && strcmp(cert_key, client_cert_nvs_key) == 0 && strcmp(key_key, client_key_nvs_key) == 0) {
+        stats.hits++;
+        *out = &certs;
+        return ESP_OK;
+    }
+
+    cred_cache_clear();
+    err = nvs_get_tls_certs(&certs, NVS_KEY_SERVER_CERT, client_cert_nvs_key, client_key_nvs_key);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    // Parses PEM (length includes the NUL) and DER alike
+    err = esp_tls_set_global_ca_store((const unsigned char *)certs.server_cert, certs.server_cert_len);
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "Error (%s) parsing server certificate", esp_err_to_name(err));
+        cred_cache_clear();
+        return ESP_FAIL;
+    }
+
+    cert_key = client_cert_nvs_key;
+    key_key = client_key_nvs_key;
+    certs_gen = gen;
+    stats.loads++;
+    ESP_LOGI(TAG, "Credentials %s loaded, tls generation %u", client_cert_nvs_key, (unsigned)gen);
+
+    *out = &certs;
+    return ESP_OK;
+}
+
+bool cred_cache_stale(void)
+{
+    uint32_t gen;
+
+    if(certs.buf == NULL) {
+        return false;
+    }
+
+    // Can't tell while NVS fails, keep using the cached credentials
+    return nvs_batch_get_generation(NVS_SET_TLS, &gen) == ESP_OK && gen != certs_gen;
+}
+
+void cred_cache_clear(void)
+{
+    if(certs.buf == NULL) {
+        return;
+    }
+
+    esp_tls_free_global_ca_store();
+    nvs_free_tls_certs(&certs);
+    cert_key = NULL;
+    key_key = NULL;
+}
+
+void cred_cache_get_stats(struct cred_cache_stats *out)
+{
+    *out = stats;
+}
+
+void cred_cache_log(void)
+{
+    ESP_LOGI(TAG, "Credential cache: %u loads, %u hits", (unsigned)stats.loads, (unsigned)stats.hits);
+}
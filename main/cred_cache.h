@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "my_nvs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    TLS credentials loaded from NVS once and reused by every connection attempt of the mqtt client.
+    The server certificate chain is parsed once into the global CA store of esp-tls, the client uses it
+    with use_global_ca_store instead of parsing the chain again on every connect.
+    The client certificate and key stay loaded as buffers (as DER when CONFIG_MQTT_CREDENTIALS_DER is set),
+    tls_transport parses them once per client, the built in transport of esp-mqtt per connection.
+    The cache is keyed by the generation of the tls set (see nvs_batch.h), it is only reloaded
+    when the credentials in NVS have been committed again.
+ */
+
+/// Reuse of the cache since boot
+struct cred_cache_stats {
+    uint32_t loads;     // credentials read from NVS and CA chain parsed
+    uint32_t hits;      // requests served from the cache
+};
+
+/**
+ *  Get the server certificate and the client certificate and key stored under the given NVS keys.
+ *  Loads them and fills the global CA store unless they are cached for the current generation of the tls set.
+ *  Not thread safe, the credentials are only loaded while preparing or reconnecting the client.
+ * @param certs set to the cached credentials, valid until the next load or cred_cache_clear()
+ * @return  ESP_OK on success,
+ *          error of nvs_get_tls_certs() on failure,
+ *          ESP_FAIL if the server certificate could not be parsed
+*/
+esp_err_t cred_cache_get(const char *client_cert_nvs_key, const char *client_key_nvs_key,
+    const struct tls_certs **certs);
+
+/// Check if the credentials in NVS changed since they were cached, false when nothing is cached
+bool cred_cache_stale(void);
+
+/// Free the cached credentials and the global CA store
+void cred_cache_clear(void);
+
+/// Copy reuse statistics
+void cred_cache_get_stats(struct cred_cache_stats *stats);
+
+/// Log reuse statistics, every reconnect of the client should be a hit
+void cred_cache_log(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,74 @@
+#include <string.h>
+#include "mbedtls/base64.h"
+#include "esp_rom_crc.h"
+#include "credentials.h"
+
+#define PEM_BEGIN   "-----BEGIN "
+#define PEM_END     "-----END "
+
+int credentials_pem_to_der(const char *pem, uint8_t *out, size_t size)
+{
+    struct credentials_header header;
+    const char *body;
+    const char *end;
+    size_t der_len;
+
+    if(size < sizeof header) {
+        return -1;
+    }
+
+    // Body starts on the line after "-----BEGIN ...-----" and ends before "-----END ...-----"
+    body = strstr(pem, PEM_BEGIN);
+    if(body == NULL) {
+        return -1;
+    }
+    body = strchr(body, '\n');
+    if(body == NULL) {
+        return -1;
+    }
+    body++;
+    end = strstr(body, PEM_END);
+    if(end == NULL) {
+        return -1;
+    }
+
+    // Base64 decoder skips the line breaks
+    if(mbedtls_base64_decode(out + sizeof header, size - sizeof header, &der_len,
+        (const unsigned char *)body, end - body) != 0) {
+        return -1;
+    }
+
+    memset(&header, 0, sizeof header);
+    header.magic = CREDENTIALS_MAGIC;
+    header.format = CREDENTIALS_FORMAT_DER;
+    header.len = der_len;
+    header.crc = esp_rom_crc32_le(0, out + sizeof header, der_len);
+    memcpy(out, &header, sizeof header);
+
+    return sizeof header + der_len;
+}
+
+int credentials_check(const void *blob, size_t blob_len, const uint8_t **der, size_t *der_len)
+{
+    struct credentials_header header;
+    const uint8_t *data = (const uint8_t *)blob + sizeof header;
+
+    if(blob_len < sizeof header) {
+        return CREDENTIALS_FORMAT_PEM;
+    }
+
+    // Blob is not aligned, copy header out of it
+    memcpy(&header, blob, sizeof header);
+    if(header.magic != CREDENTIALS_MAGIC) {
+        return CREDENTIALS_FORMAT_PEM;
+    }
+
+    if(header.format != CREDENTIALS_FORMAT_DER || header.len != blob_len - sizeof header
+        || header.crc != esp_rom_crc32_le(0, data, header.len)) {
+        return -1;
+    }
+
+    *der = data;
+    *der_len = header.len;
+    return CREDENTIALS_FORMAT_DER;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// "CRED", first word of a credential stored as DER, PEM text never starts with it
+#define CREDENTIALS_MAGIC       0x44455243
+
+/// Format of a stored credential
+enum credentials_format {
+    CREDENTIALS_FORMAT_PEM = 0,     // PEM text without header, as saved before DER storage existed
+    CREDENTIALS_FORMAT_DER = 1,
+};
+
+/**
+ *  Header in front of a credential stored as DER.
+ *  DER is about 3/4 the size of the PEM body, and mbedTLS parses it without base64 decoding on every connect.
+*/
+struct credentials_header {
+    uint32_t magic;         // CREDENTIALS_MAGIC
+    uint8_t format;         // enum credentials_format
+    uint8_t reserved[3];
+    uint32_t len;           // length of the DER that follows
+    uint32_t crc;           // crc32 of the DER
+};
+
+/**
+ *  Convert a PEM certificate or key to DER with a header in front
+ * @param pem NUL-terminated PEM text, everything outside the first BEGIN/END block is ignored
+ * @param out header and DER, a buffer the size of the PEM text is always large enough
+ * @return  length of header and DER on success,
+ *          -1 if the PEM is malformed or does not fit @param size
+*/
+int credentials_pem_to_der(const char *pem, uint8_t *out, size_t size);
+
+/**
+ *  Check a stored credential for a DER header
+ * @param der set to the DER that follows the header
+ * @param der_len set to the length of @param der
+ * @return  CREDENTIALS_FORMAT_DER if the blob holds valid DER,
+ *          CREDENTIALS_FORMAT_PEM if it has no header,
+ *          -1 if the header is there but the length or crc does not match
+*/
+int credentials_check(const void *blob, size_t blob_len, const uint8_t **der, size_t *der_len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,47 @@
+#include <string.h>
+#include "json_parser.h"
+#include "device_cmd.h"
+
+/// Name of every command, indexed by enum device_cmd_type
+static const char *const cmd_names[] = {
+    [DEVICE_CMD_BOOT_TIMELINE] = DEVICE_CMD_NAME_BOOT_TIMELINE,
+    [DEVICE_CMD_ADD_AP] = DEVICE_CMD_NAME_ADD_AP,
+};
+
+int device_cmd_parse(const char *json, size_t json_len, struct device_cmd *cmd)
+{
+    struct json_field fields[] = {
+        { .key = JSON_KEY_CMD },
+        { .key = JSON_KEY_SSID },
+        { .key = JSON_KEY_PWD },
+    };
+    size_t i;
+
+    memset(cmd, 0, sizeof *cmd);
+
+    if(json_parse_fields(json, json_len, fields, sizeof fields / sizeof fields[0]) != 0 || !fields[0].found) {
+        return -1;
+    }
+
+    for(i = 0; i < sizeof cmd_names / sizeof cmd_names[0]; i++) {
+        if(fields[0].value_len == strlen(cmd_names[i]) && memcmp(fields[0].value, cmd_names[i], fields[0].value_len) == 0) {
+            cmd->type = i;
+            break;
+        }
+    }
+    if(i == sizeof cmd_names / sizeof cmd_names[0]) {
+        return -1;
+    }
+
+    if(cmd->type == DEVICE_CMD_ADD_AP) {
+        // Cut credentials would never connect, reject what does not fit
+        if(json_decode_field(&fields[1], cmd->ssid, sizeof cmd->ssid) <= 0) {
+            return -1;
+        }
+        if(fields[2].found && json_decode_field(&fields[2], cmd->pwd, sizeof cmd->pwd) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
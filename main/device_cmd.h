@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include "wifi_aps.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    Commands sent to a provisioned device over MQTT, a json object with the command name and its arguments:
+    {"cmd":"<name>", ...}
+    Who may publish to the command topic is up to the AWS IoT policy of the backend.
+    Only depends on the C library, json_parser and the sizes of wifi_aps.h, so it can be compiled and run off-target.
+ */
+
+// Topic the device subscribes to while sending temperature data
+#define DEVICE_CMD_TOPIC_FORMAT     "device/%s/cmd"
+
+// Json keys of a command
+#define JSON_KEY_CMD                "cmd"
+#define JSON_KEY_SSID               "ssid"
+#define JSON_KEY_PWD                "pwd"
+
+// Command names
+#define DEVICE_CMD_NAME_BOOT_TIMELINE   "boot_timeline"
+#define DEVICE_CMD_NAME_ADD_AP          "add_ap"
+
+enum device_cmd_type {
+    DEVICE_CMD_BOOT_TIMELINE = 0,   // publish the boot timeline to the diagnostics topic again
+    DEVICE_CMD_ADD_AP,              // remember an other AP, {"cmd":"add_ap","ssid":"...","pwd":"..."}
+};
+
+/// A parsed command
+struct device_cmd {
+    enum device_cmd_type type;
+    char ssid[WIFI_APS_SSID_SIZE];  // DEVICE_CMD_ADD_AP, not empty
+    char pwd[WIFI_APS_PWD_SIZE];    // DEVICE_CMD_ADD_AP, empty for an open network or when left out
+};
+
+/**
+ *  Parse a command
+ * @param json command, does not need to be NUL-terminated
+ * @return  0 on success,
+ *          -1 if the json is malformed, the command is unknown or an argument is missing or does not fit
+*/
+int device_cmd_parse(const char *json, size_t json_len, struct device_cmd *cmd);
+
+#ifdef __cplusplus
+}
+#endif
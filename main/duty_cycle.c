@@ -0,0 +1,114 @@
+#include <string.h>
+#include "duty_cycle.h"
+
+/// True when @param temperature crossed a threshold coming from @param last
+static bool duty_cycle_crossed(const struct duty_cycle_config *config, float last, float temperature);
+
+bool duty_cycle_init(struct duty_cycle_state *state, int64_t now_ms)
+{
+    if(state->magic == DUTY_CYCLE_MAGIC && state->head < DUTY_CYCLE_MAX_SAMPLES
+        && state->count <= DUTY_CYCLE_MAX_SAMPLES) {
+        return false;
+    }
+
+    memset(state, 0, sizeof *state);
+    state->magic = DUTY_CYCLE_MAGIC;
+    state->next_sample_ms = now_ms;
+    return true;
+}
+
+bool duty_cycle_add_sample(
+    struct duty_cycle_state *state, const struct duty_cycle_config *config, uint8_t channel, float temperature,
+    int64_t now_ms
+)
+{
+    struct telemetry_sample *sample;
+    bool crossed = false;
+
+    if(state->count == DUTY_CYCLE_MAX_SAMPLES) {
+        // Publishing failed for a while, the oldest sample makes room
+        state->head = (state->head + 1) % DUTY_CYCLE_MAX_SAMPLES;
+        state->count--;
+        state->stats.dropped++;
+    }
+
+    sample = &state->samples[(state->head + state->count) % DUTY_CYCLE_MAX_SAMPLES];
+    sample->timestamp_ms = now_ms;
+    sample->seq = state->seq++;
+    sample->channel = channel;
+    sample->temperature = temperature;
+    state->count++;
+    state->since_attempt++;
+    state->stats.wakes++;
+
+    if(state->has_last) {
+        crossed = duty_cycle_crossed(config, state->last_temperature, temperature);
+    }
+    state->last_temperature = temperature;
+    state->has_last = true;
+
+    if(crossed) {
+        state->stats.threshold_publishes++;
+        return true;
+    }
+
+    // Counted from the last attempt, a failed publish is not retried on every wake
+    return state->since_attempt >= config->publish_every;
+}
+
+size_t duty_cycle_peek(const struct duty_cycle_state *state, struct telemetry_sample *samples, size_t max_samples)
+{
+    size_t n;
+
+    for(n = 0; n < max_samples && n < state->count; n++) {
+        samples[n] = state->samples[(state->head + n) % DUTY_CYCLE_MAX_SAMPLES];
+    }
+
+    return n;
+}
+
+void duty_cycle_published(struct duty_cycle_state *state, size_t num_published)
+{
+    if(num_published > state->count) {
+        num_published = state->count;
+    }
+
+    state->stats.publishes++;
+    if(num_published < state->count) {
+        state->stats.failed_publishes++;
+    }
+    state->stats.published += num_published;
+
+    state->head = (state->head + num_published) % DUTY_CYCLE_MAX_SAMPLES;
+    state->count -= num_published;
+    state->since_attempt = 0;
+}
+
+size_t duty_cycle_pending(const struct duty_cycle_state *state)
+{
+    return state->count;
+}
+
+uint32_t duty_cycle_sleep_ms(struct duty_cycle_state *state, const struct duty_cycle_config *config, int64_t now_ms)
+{
+    int64_t missed;
+
+    state->next_sample_ms += config->sample_period_ms;
+    if(state->next_sample_ms <= now_ms) {
+        // Overran the period, skip to the next sample on the grid instead of catching up
+        missed = (now_ms - state->next_sample_ms) / config->sample_period_ms + 1;
+        state->next_sample_ms += missed * config->sample_period_ms;
+    }
+
+    return (uint32_t)(state->next_sample_ms - now_ms);
+}
+
+static bool duty_cycle_crossed(const struct duty_cycle_config *config, float last, float temperature)
+{
+    if(!config->threshold_enabled) {
+        return false;
+    }
+
+    return (last <= config->threshold_high && temperature > config->threshold_high)
+        || (last >= config->threshold_low && temperature < config->threshold_low);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "telemetry_sample.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Samples buffered across deep sleep, the state lives in RTC memory so keep it small
+#define DUTY_CYCLE_MAX_SAMPLES      64
+
+// Marks an initialized state, RTC memory holds garbage after power on
+#define DUTY_CYCLE_MAGIC            0x44555459
+
+/*
+    Schedule and sample buffer of the duty cycled low power mode, no platform dependencies.
+    The device wakes every sample_period_ms, adds one sample and goes back to sleep. Only when a publish is due
+    it brings up wifi and mqtt. Time is passed in by the caller, so the schedule can be run against a simulated
+    clock to count wakes and publishes per sample.
+ */
+
+/// Policy of the low power mode
+struct duty_cycle_config {
+    uint32_t sample_period_ms;      // time between samples
+    uint32_t publish_every;         // samples per publish, at most DUTY_CYCLE_MAX_SAMPLES
+    bool threshold_enabled;
+    float threshold_low;            // a sample crossing below publishes at once
+    float threshold_high;           // a sample crossing above publishes at once
+};
+
+/// Counters since the state was initialized, enough to model the energy per sample
+struct duty_cycle_stats {
+    uint32_t wakes;                 // samples taken
+    uint32_t publishes;             // publish attempts, every one brings up wifi and mqtt
+    uint32_t failed_publishes;      // attempts that left samples unpublished
+    uint32_t threshold_publishes;   // attempts caused by a threshold crossing
+    uint32_t published;             // samples published
+    uint32_t dropped;               // samples overwritten before they could be published
+};
+
+/// Kept across deep sleep
+struct duty_cycle_state {
+    uint32_t magic;
+    uint32_t seq;                   // sequence number of the next sample
+    int64_t next_sample_ms;         // when the next sample is due
+    uint32_t head;                  // index of the oldest sample
+    uint32_t count;                 // samples buffered
+    uint32_t since_attempt;         // samples added since the last publish attempt
+    bool has_last;
+    float last_temperature;         // previous sample, to detect a threshold crossing
+    struct duty_cycle_stats stats;
+    struct telemetry_sample samples[DUTY_CYCLE_MAX_SAMPLES];
+};
+
+/**
+ *  Initialize @param state unless it already holds a valid state, e.g. after waking up from deep sleep
+ * @return true when the state was initialized, sequence numbers start at 0 again
+*/
+bool duty_cycle_init(struct duty_cycle_state *state, int64_t now_ms);
+
+/**
+ *  Add a sample taken at @param now_ms, the oldest sample is dropped when the buffer is full
+ * @return true when a publish is due
+*/
+bool duty_cycle_add_sample(
+    struct duty_cycle_state *state, const struct duty_cycle_config *config, uint8_t channel, float temperature,
+    int64_t now_ms
+);
+
+/// Copy up to @param max_samples buffered samples, oldest first, returns the number copied
+size_t duty_cycle_peek(const struct duty_cycle_state *state, struct telemetry_sample *samples, size_t max_samples);
+
+/**
+ *  End a publish attempt
+ * @param num_published oldest samples that were published and are removed,
+ *        fewer than buffered counts as a failed attempt
+*/
+void duty_cycle_published(struct duty_cycle_state *state, size_t num_published);
+
+/// Samples waiting to be published
+size_t duty_cycle_pending(const struct duty_cycle_state *state);
+
+/**
+ *  Time to sleep until the next sample, samples that were missed (e.g. by a long publish) are skipped
+ *  so the schedule stays on its grid
+ * @return sleep time in ms
+*/
+uint32_t duty_cycle_sleep_ms(struct duty_cycle_state *state, const struct duty_cycle_config *config, int64_t now_ms);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include "json_parser.h"
+#include "fleet_prov.h"
+
+/// @brief Decode a parsed json string to PEM format 
+/// @param field, parsed json field holding the escaped PEM
+/// @param out_value, buffer to store formatted value
+/// @param size_of_out_value
+/// @return 0 for success; -1 for failure
+static int json_parse_and_format_pem(const struct json_field *field, char *out_value, size_t size_of_out_value);
+
+/// Copy string of a parsed json field
+static int json_parse(const struct json_field *field, char *out_value, size_t size_of_out_value);
+
+int fleet_prov_parse_create_keys_response(const char *json, size_t json_len, const struct fleet_prov_keys *keys)
+{
+    int ret;
+    // Filled in by a single pass over the response
+    struct json_field fields[] = {
+        { .key = JSON_KEY_CERTIFICATE_ID },
+        { .key = JSON_KEY_CERTIFICATE_PEM },
+        { .key = JSON_KEY_PRIVATE_KEY },
+        { .key = JSON_KEY_CERTIFICATE_OWNERSHIP_TOKEN },
+    };
+
+    printf("Parsing CreateKeysAndCertificate response... ");
+    ret = json_parse_fields(json, json_len, fields, sizeof fields / sizeof fields[0]);
+    if(ret != 0) {
+        printf("Malformed json.\n");
+        return ret;
+    }
+    printf("Done.\n");
+
+    // parse certificateId
+    ret = json_parse(&fields[0], keys->certificate_id, keys->certificate_id_size);
+    if(ret != 0) {
+        return ret;
+    }
+
+    // parse certificatePem
+    ret = json_parse_and_format_pem(&fields[1], keys->certificate_pem, keys->certificate_pem_size);
+    if(ret != 0) {
+        return ret;
+    }
+
+    // parse privateKey
+    ret = json_parse_and_format_pem(&fields[2], keys->private_key, keys->private_key_size);
+    if(ret != 0) {
+        return ret;
+    }
+
+    // parse certificateOwnershipToken
+    ret = json_parse(&fields[3], keys->certificate_ownership_token, keys->certificate_ownership_token_size);
+    if(ret != 0) {
+        return ret;
+    }
+
+    return 0;
+}
+
+int fleet_prov_format_register_thing(char *payload, size_t size, const char *certificate_ownership_token,
+    const char *thing_name)
+{
+    int ret;
+
+    ret = snprintf(payload, size,
+        "{\"%s\":\"%s\", \"parameters\":{\"ThingName\":\"%s\"}}", 
+        JSON_KEY_CERTIFICATE_OWNERSHIP_TOKEN, certificate_ownership_token, thing_name);
+
+    // A cut payload would still be sent, treat it as an error
+    if(ret < 0 || (size_t)ret >= size) {
+        return -1;
+    }
+
+    return ret;
+}
+
+static int json_parse_and_format_pem(const struct json_field *field, char *out_value, size_t size_of_out_value)
+{
+    int len;
+
+    // Decode \\n to \n for correct PEM format, straight into out_value in a single pass
+    printf("Formatting %s json string to PEM... ", field->key);
+    len = json_decode_field(field, out_value, size_of_out_value);
+    if(len < 0) {
+        printf("Failed to decode %s.\n", field->key);
+        return -1;
+    }
+
+    // replace last newline ('\n') with \0, if it exists
+    if(len > 0 && out_value[len - 1] == '\n') {
+        out_value[len - 1] = '\0';
+    }
+
+    printf("Done.\n");
+    return 0;
+}
+
+static int json_parse(const struct json_field *field, char *out_value, size_t size_of_out_value)
+{
+    int ret;
+    printf("Getting %s... ", field->key);
+
+    ret = json_copy_field(field, out_value, size_of_out_value);
+    if(ret < 0) {
+        printf("Failed to parse %s.\n", field->key);
+        return -1;
+    }
+
+    printf("Done.\n");
+    return 0;
+}
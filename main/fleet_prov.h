@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    Payloads of the AWS IoT fleet provisioning MQTT API.
+    Only depends on the C library and json_parser, so it can be compiled and run off-target.
+ */
+
+// Json keys of CreateKeysAndCertificate MQTT API response
+#define JSON_KEY_CERTIFICATE_ID                 "certificateId"
+#define JSON_KEY_CERTIFICATE_PEM                "certificatePem"
+#define JSON_KEY_PRIVATE_KEY                    "privateKey"
+#define JSON_KEY_CERTIFICATE_OWNERSHIP_TOKEN    "certificateOwnershipToken"
+
+/// Caller supplied buffers for the CreateKeysAndCertificate response
+struct fleet_prov_keys {
+    char *certificate_id;
+    size_t certificate_id_size;
+    char *certificate_pem;
+    size_t certificate_pem_size;
+    char *private_key;
+    size_t private_key_size;
+    char *certificate_ownership_token;
+    size_t certificate_ownership_token_size;
+};
+
+/**
+ *  Parse response of CreateKeysAndCertificate MQTT API call.
+ *  The certificate and key are decoded to PEM, the ownership token is copied as is (still json escaped)
+ *  so it can be put back into the RegisterThing payload.
+ * @param json response, does not need to be NUL-terminated
+ * @return  0 on success,
+ *          -1 if the response is malformed, a field is missing or does not fit its buffer
+*/
+int fleet_prov_parse_create_keys_response(const char *json, size_t json_len, const struct fleet_prov_keys *keys);
+
+/**
+ *  Format payload of RegisterThing MQTT API call
+ * @return  length of the payload on success,
+ *          -1 if it does not fit @param size
+*/
+int fleet_prov_format_register_thing(char *payload, size_t size, const char *certificate_ownership_token,
+    const char *thing_name);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,276 @@
+#include <string.h>
+#include "json_parser.h"
+
+/// Skip whitespace, returns position of the next non whitespace character
+static size_t json_skip_ws(const char *json, size_t len, size_t pos);
+
+/// Skip a string starting at the opening quote, returns position after the closing quote or 0 on failure
+static size_t json_skip_string(const char *json, size_t len, size_t pos);
+
+/// Skip any value (string, number, literal, object or array), returns position after it or 0 on failure
+static size_t json_skip_value(const char *json, size_t len, size_t pos);
+
+/// Convert a hex digit to its value, returns -1 if the character is not a hex digit
+static int json_hex_value(char c);
+
+/// Find the field matching the key that has not been found yet
+static struct json_field *json_find_field(
+    struct json_field *fields, size_t num_fields, const char *key, size_t key_len
+);
+
+int json_parse_fields(const char *json, size_t json_len, struct json_field *fields, size_t num_fields)
+{
+    struct json_field *field;
+    const char *key;
+    size_t key_len;
+    size_t pos, end;
+    size_t i;
+
+    for(i = 0; i < num_fields; i++) {
+        fields[i].value = NULL;
+        fields[i].value_len = 0;
+        fields[i].found = false;
+    }
+
+    pos = json_skip_ws(json, json_len, 0);
+    if(pos >= json_len || json[pos] != '{') {
+        return -1;
+    }
+    pos = json_skip_ws(json, json_len, pos + 1);
+
+    // Empty object
+    if(pos < json_len && json[pos] == '}') {
+        return 0;
+    }
+
+    while(pos < json_len) {
+        // KEY
+        if(json[pos] != '\"') {
+            return -1;
+        }
+        end = json_skip_string(json, json_len, pos);
+        if(end == 0) {
+            return -1;
+        }
+        key = json + pos + 1;
+        key_len = end - pos - 2;
+
+        // SEPARATOR
+        pos = json_skip_ws(json, json_len, end);
+        if(pos >= json_len || json[pos] != ':') {
+            return -1;
+        }
+        pos = json_skip_ws(json, json_len, pos + 1);
+        if(pos >= json_len) {
+            return -1;
+        }
+
+        // VALUE
+        end = json_skip_value(json, json_len, pos);
+        if(end == 0) {
+            return -1;
+        }
+        if(json[pos] == '\"') {
+            field = json_find_field(fields, num_fields, key, key_len);
+            if(field != NULL) {
+                field->value = json + pos + 1;
+                field->value_len = end - pos - 2;
+                field->found = true;
+            }
+        }
+
+        // NEXT MEMBER OR END OF OBJECT
+        pos = json_skip_ws(json, json_len, end);
+        if(pos >= json_len) {
+            return -1;
+        }
+        if(json[pos] == '}') {
+            return 0;
+        }
+        if(json[pos] != ',') {
+            return -1;
+        }
+        pos = json_skip_ws(json, json_len, pos + 1);
+    }
+
+    // Ran out of data before the object was closed
+    return -1;
+}
+
+int json_copy_field(const struct json_field *field, char *out_value, size_t size_of_out_value)
+{
+    if(!field->found || field->value_len >= size_of_out_value) {
+        return -1;
+    }
+
+    memcpy(out_value, field->value, field->value_len);
+    out_value[field->value_len] = '\0';
+    return field->value_len;
+}
+
+int json_unescape(const char *value, size_t value_len, char *out_value, size_t size_of_out_value)
+{
+    size_t in = 0;
+    size_t out = 0;
+    unsigned int code;
+    int digit;
+    int i;
+    char c;
+
+    while(in < value_len) {
+        // Need room for this character and the terminating NUL
+        if(out + 1 >= size_of_out_value) {
+            return -1;
+        }
+
+        c = value[in++];
+        if(c != '\\') {
+            out_value[out++] = c;
+            continue;
+        }
+
+        if(in >= value_len) {
+            return -1;
+        }
+
+        c = value[in++];
+        switch(c) {
+        case 'n':   out_value[out++] = '\n'; break;
+        case 'r':   out_value[out++] = '\r'; break;
+        case 't':   out_value[out++] = '\t'; break;
+        case 'b':   out_value[out++] = '\b'; break;
+        case 'f':   out_value[out++] = '\f'; break;
+        case '\"':  out_value[out++] = '\"'; break;
+        case '\\':  out_value[out++] = '\\'; break;
+        case '/':   out_value[out++] = '/'; break;
+        case 'u':
+            // \uXXXX, only code points that fit a single byte are expected in certificates and tokens
+            if(in + 4 > value_len) {
+                return -1;
+            }
+            code = 0;
+            for(i = 0; i < 4; i++) {
+                digit = json_hex_value(value[in++]);
+                if(digit < 0) {
+                    return -1;
+                }
+                code = (code << 4) | digit;
+            }
+            if(code > 0xFF) {
+                return -1;
+            }
+            out_value[out++] = (char)code;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    out_value[out] = '\0';
+    return out;
+}
+
+int json_decode_field(const struct json_field *field, char *out_value, size_t size_of_out_value)
+{
+    if(!field->found) {
+        return -1;
+    }
+
+    return json_unescape(field->value, field->value_len, out_value, size_of_out_value);
+}
+
+static int json_hex_value(char c)
+{
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if(c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if(c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static size_t json_skip_ws(const char *json, size_t len, size_t pos)
+{
+    while(pos < len && (json[pos] == ' ' || json[pos] == '\t' || json[pos] == '\n' || json[pos] == '\r')) {
+        pos++;
+    }
+    return pos;
+}
+
+static size_t json_skip_string(const char *json, size_t len, size_t pos)
+{
+    // Skip opening quote
+    pos++;
+
+    while(pos < len) {
+        if(json[pos] == '\\') {
+            // Skip escaped character, whatever it is
+            pos += 2;
+        } else if(json[pos] == '\"') {
+            return pos + 1;
+        } else {
+            pos++;
+        }
+    }
+
+    // Unterminated string
+    return 0;
+}
+
+static size_t json_skip_value(const char *json, size_t len, size_t pos)
+{
+    int depth = 0;
+
+    if(json[pos] == '\"') {
+        return json_skip_string(json, len, pos);
+    }
+
+    // Objects and arrays, strings inside are skipped as a whole so brackets in them don't count
+    if(json[pos] == '{' || json[pos] == '[') {
+        while(pos < len) {
+            if(json[pos] == '\"') {
+                pos = json_skip_string(json, len, pos);
+                if(pos == 0) {
+                    return 0;
+                }
+                continue;
+            }
+            if(json[pos] == '{' || json[pos] == '[') {
+                depth++;
+            } else if(json[pos] == '}' || json[pos] == ']') {
+                depth--;
+                if(depth == 0) {
+                    return pos + 1;
+                }
+            }
+            pos++;
+        }
+        return 0;
+    }
+
+    // Numbers and literals (true, false, null) end at the next delimiter
+    while(pos < len && json[pos] != ',' && json[pos] != '}' && json[pos] != ']' &&
+          json[pos] != ' ' && json[pos] != '\t' && json[pos] != '\n' && json[pos] != '\r') {
+        pos++;
+    }
+    return pos;
+}
+
+static struct json_field *json_find_field(
+    struct json_field *fields, size_t num_fields, const char *key, size_t key_len
+)
+{
+    size_t i;
+
+    for(i = 0; i < num_fields; i++) {
+        if(!fields[i].found && strlen(fields[i].key) == key_len && memcmp(fields[i].key, key, key_len) == 0) {
+            return &fields[i];
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  Describes a top-level string field that json_parse_fields() should look for.
+ *  The caller sets key, the parser fills in the rest.
+*/
+struct json_field {
+    const char *key;        // json key to look for
+    const char *value;      // start of the value inside the json buffer (still escaped, without quotes)
+    size_t value_len;       // exact length of the escaped value
+    bool found;             // true if the key was found with a string value
+};
+
+/**
+ *  Walks a json object once and fills in every field of the table whose key is found at the top level.
+ *  Only keys of the outermost object are matched, so a key name inside a value (e.g. a PEM body)
+ *  or inside a nested object is never picked up. Escaped quotes inside strings are handled.
+ * @param json json object, does not need to be NUL-terminated
+ * @param json_len length of @param json
+ * @param fields table of fields to fill
+ * @param num_fields number of entries in @param fields
+ * @return  0 on success (check found of each field),
+ *          -1 if the json is malformed
+*/
+int json_parse_fields(const char *json, size_t json_len, struct json_field *fields, size_t num_fields);
+
+/**
+ *  Copies the value of a parsed field to a NUL-terminated buffer as is
+ * @return  length of the copied value on success,
+ *          -1 if the field was not found or does not fit
+*/
+int json_copy_field(const struct json_field *field, char *out_value, size_t size_of_out_value);
+
+/**
+ *  Decodes json escapes (\n, \", \\, \/, \t, ...) of a string value in a single pass and NUL-terminates it.
+ *  @param out_value may be the same buffer as @param value, the write position never passes the read position,
+ *  so a value can be decoded in place without a temporary buffer.
+ * @return  decoded length on success,
+ *          -1 on an invalid escape or if the decoded value does not fit
+*/
+int json_unescape(const char *value, size_t value_len, char *out_value, size_t size_of_out_value);
+
+/**
+ *  Decodes the value of a parsed field straight into a NUL-terminated buffer, see json_unescape()
+ * @return  decoded length on success,
+ *          -1 if the field was not found, does not fit or contains an invalid escape
+*/
+int json_decode_field(const struct json_field *field, char *out_value, size_t size_of_out_value);
+
+#ifdef __cplusplus
+}
+#endif
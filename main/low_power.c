@@ -0,0 +1,114 @@
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_sleep.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "main.h"
+#include "acquisition.h"
+#include "telemetry.h"
+#include "duty_cycle.h"
+#include "connectivity.h"
+#include "mqtt.h"
+#include "my_nvs.h"
+#include "low_power.h"
+
+#if CONFIG_LOW_POWER_MODE
+
+// Survives deep sleep, lost on power loss
+RTC_DATA_ATTR static struct duty_cycle_state rtc_state;
+
+// End of the sequence numbers reserved in NVS, rtc_state.seq continues after earlier power cycles
+RTC_DATA_ATTR static uint32_t rtc_seq_limit;
+
+static const struct duty_cycle_config duty_cycle_config = {
+    .sample_period_ms = TELEMETRY_SAMPLE_PERIOD_MS,
+    .publish_every = LOW_POWER_PUBLISH_EVERY,
+#if CONFIG_LOW_POWER_THRESHOLD
+    .threshold_enabled = true,
+    .threshold_low = CONFIG_LOW_POWER_THRESHOLD_LOW / 10.0f,
+    .threshold_high = CONFIG_LOW_POWER_THRESHOLD_HIGH / 10.0f,
+#endif
+};
+
+// Wifi and mqtt bring up of a publish, see connectivity.h
+static const struct connectivity_config connectivity_config = {
+    .prepare = mqtt_prepare_on_demand,
+    .connect = mqtt_connect,
+};
+
+// Copy of the buffered samples being published, static so it does not have to fit on the main task stack
+static struct telemetry_sample publish_samples[DUTY_CYCLE_MAX_SAMPLES];
+
+/// Time in ms on the RTC clock, which keeps running in deep sleep
+static int64_t low_power_now_ms(void);
+
+/// Bring up wifi and mqtt and publish the buffered samples, returns the number published
+static size_t low_power_publish(const uint8_t *ssid, const uint8_t *pwd);
+
+void low_power_run(const uint8_t *ssid, const uint8_t *pwd)
+{
+    const struct duty_cycle_stats *stats = &rtc_state.stats;
+    struct acquisition_sample sample;
+    int64_t now_ms = low_power_now_ms();
+    bool publish = false;
+    size_t num_published;
+    uint32_t sleep_ms;
+
+    if(duty_cycle_init(&rtc_state, now_ms)) {
+        rtc_seq_limit = 0;
+    }
+
+    // One NVS write per power cycle and per NVS_SEQ_BLOCK samples, not per wake
+    if(rtc_state.seq >= rtc_seq_limit && nvs_seq_reserve(&rtc_state.seq, &rtc_seq_limit) != ESP_OK) {
+        printf("Error reserving sequence numbers.\n");
+    }
+
+    if(acquisition_read(&sample) == ESP_OK) {
+        publish = duty_cycle_add_sample(&rtc_state, &duty_cycle_config, sample.channel, sample.temperature, now_ms);
+    }
+
+    if(publish) {
+        num_published = low_power_publish(ssid, pwd);
+        duty_cycle_published(&rtc_state, num_published);
+        ESP_LOGI(TAG, "Low power: %u wakes, %u publishes (%u failed, %u by threshold), %u samples published, %u dropped",
+            (unsigned)stats->wakes, (unsigned)stats->publishes, (unsigned)stats->failed_publishes,
+            (unsigned)stats->threshold_publishes, (unsigned)stats->published, (unsigned)stats->dropped);
+    }
+
+    sleep_ms = duty_cycle_sleep_ms(&rtc_state, &duty_cycle_config, low_power_now_ms());
+    ESP_LOGI(TAG, "Sleeping %u ms, %d samples buffered", (unsigned)sleep_ms, (int)duty_cycle_pending(&rtc_state));
+
+    esp_sleep_enable_timer_wakeup((uint64_t)sleep_ms * 1000);
+    esp_deep_sleep_start();
+}
+
+static int64_t low_power_now_ms(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static size_t low_power_publish(const uint8_t *ssid, const uint8_t *pwd)
+{
+    size_t num_samples;
+    size_t num_published = 0;
+
+    num_samples = duty_cycle_peek(&rtc_state, publish_samples, DUTY_CYCLE_MAX_SAMPLES);
+    ESP_LOGI(TAG, "Publishing %d buffered samples", (int)num_samples);
+
+    if(connectivity_start(ssid, pwd, &connectivity_config) != ESP_OK) {
+        return 0;
+    }
+
+    if(connectivity_wait(pdMS_TO_TICKS(LOW_POWER_CONNECT_TIMEOUT_MS)) == CONNECTIVITY_ONLINE) {
+        num_published = mqtt_publish_samples(publish_samples, num_samples, LOW_POWER_CONNECT_TIMEOUT_MS);
+    }
+
+    // Unpublished samples stay buffered for the next attempt
+    mqtt_stop();
+    return num_published;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if CONFIG_LOW_POWER_MODE
+
+// Samples per publish, wifi and mqtt are only brought up this often
+#define LOW_POWER_PUBLISH_EVERY         CONFIG_LOW_POWER_PUBLISH_EVERY
+// Time a publish may take, from starting wifi to the last ack
+#define LOW_POWER_CONNECT_TIMEOUT_MS    CONFIG_LOW_POWER_CONNECT_TIMEOUT_MS
+
+/**
+ *  Run one wake up of the duty cycled low power mode, never returns.
+ *  Takes a sample, adds it to the buffer in RTC memory, publishes the buffer when it is due (see duty_cycle.h)
+ *  and deep sleeps until the next sample.
+ *  The thing has to be registered, registering needs the always on mode.
+*/
+void low_power_run(const uint8_t *ssid, const uint8_t *pwd);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
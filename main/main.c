@@ -7,6 +7,18 @@
 #include "wifi.h"
 #include "my_nvs.h"
 #include "mqtt.h"
+#include "boot_timeline.h"
+#include "connectivity.h"
+#include "low_power.h"
+#if CONFIG_LOW_POWER_MODE
+#include "esp_sleep.h"
+#endif
+
+// Wifi and mqtt bring up, see connectivity.h
+static const struct connectivity_config connectivity_config = {
+    .prepare = mqtt_prepare,
+    .connect = mqtt_connect,
+};
 
 
 void app_main(void)
@@ -14,6 +26,8 @@ void app_main(void)
     uint8_t ssid[WIFI_SSID_MAX_SIZE];
     uint8_t pwd[WIFI_PWD_MAX_SIZE];
 
+    boot_timeline_mark("app_main");
+
     /* Initialize NVS — it is used to store PHY calibration data */
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -21,6 +35,15 @@ void app_main(void)
         ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
+    boot_timeline_mark("nvs_init");
+
+    // Device config is loaded with one NVS open, later lookups are served from RAM
+    ret = nvs_config_load();
+    if(ret != ESP_OK) {
+        printf("Error while loading device config from nvs!\n");
+        return;
+    }
+    boot_timeline_mark("config_loaded");
 
     ret = nvs_get_wifi_data(ssid, pwd);
     if(ret == ESP_FAIL) {
@@ -37,34 +60,27 @@ void app_main(void)
         return;
     }
 
+#if CONFIG_LOW_POWER_MODE
+    // Registering thing needs the always on mode, it reboots once done
+    if(esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER || mqtt_thing_registered()) {
+        low_power_run(ssid, pwd);
+    }
+#endif
+
     printf("Wifi has been provisioned. Connecting to Wi-Fi.\n");
 
-    /// TODO: REMOVE COMMENT
-    ret = /*ESP_FAIL;*/ wifi_init_sta(ssid, pwd);
+    // Credentials are loaded and the mqtt client is set up while wifi associates
+    ret = connectivity_start(ssid, pwd, &connectivity_config);
     if(ret != ESP_OK) {
-        printf("Error while connecting to wifi, clearing wifi data!\n");
-        /// CLEAR WIFI DATA FROM NVS
-        ret = nvs_erase_wifi_data();
-        assert(ret == ESP_OK);
-        printf("Wifi data erasure succeeded, restarting...\n");
-        esp_restart();
+        printf("Error while preparing the connection!\n");
+        return;
     }
 
-    printf("Wifi successfully connected.\n");
-
-    // Check if thing has been registered.
-    ret = mqtt_get_tls_certificates(NVS_KEY_SERVER_CERT, NVS_KEY_CON_CLIENT_CERT, NVS_KEY_CON_CLIENT_KEY);
-    if(ret == ESP_ERR_NVS_NOT_FOUND) {
-        // Thing has not been registered yet, do so.
-        printf("Register thing.\n");
-        mqtt_register_thing();
-    } else if(ret == ESP_OK) {
-        // Thing has been registered, start sending temperature data to aws.
-        printf("Start sending temperature data.\n");
-        mqtt_start_sending_data();
-    } else {
-        // An unexpected error occurred
-        printf("An error occurred while getting tls certificates.\n");
+    // Wifi and mqtt keep retrying with backoff, only a failure to set up the client ends up here
+    if(connectivity_wait(portMAX_DELAY) != CONNECTIVITY_ONLINE) {
+        printf("Error while connecting!\n");
         return;
     }
-}
\ No newline at end of file
+
+    printf("Wifi successfully connected.\n");
+}
@@ -1,36 +1,112 @@
 #include "mqtt_client.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include <stdlib.h>
 #include <string.h>
 #include "mqtt.h"
 #include "main.h"
 #include "my_nvs.h"
+#include "nvs_ops.h"
 #include "ble_prov_gatt.h" 
+#include "fleet_prov.h"
+#include "credentials.h"
+#include "cred_cache.h"
+#include "mqtt_reassembly.h"
+#include "arena.h"
+#include "telemetry.h"
+#include "sample_store.h"
+#include "device_cmd.h"
+#include "acquisition.h"
+#include "mqtt_stats.h"
+#include "boot_timeline.h"
+#include "reconnect.h"
+#include "wifi.h"
+#include "tls_transport.h"
 
 // THINGNAME
 static char thing_name[AWS_THING_NAME_MAX_SIZE];
 
-// PEM certificates
-static char server_cert[SERVER_CERT_MAX_SIZE];
-static char client_cert[CLIENT_CERT_MAX_SIZE];
-static char client_key[CLIENT_KEY_SIZE];
+// Certificates of cred_cache, esp-mqtt keeps pointers to them so they live as long as the client
+static const struct tls_certs *tls_certs;
 
 // CERTIFICATES GOTTEN FROM CreateKeysAndCertificate MQTT API CALL's response
-static char certificate_id[CERTIFICATE_ID_SIZE];
-static char certificate_pem[CERTIFICATE_PEM_SIZE];
-static char private_key[PRIVATE_KEY_SIZE];
-static char certificate_ownership_token[CERTIFICATE_OWNERSHIP_TOKEN];
+// Only needed while registering thing, allocated from prov_arena
+static struct arena prov_arena;
+static struct fleet_prov_keys prov_keys;
 
-// tmp_buf will be used for string replacement
-static char tmp_buf[TMPBUFFER_SIZE];
+// Gathers fragmented responses of the fleet provisioning MQTT API calls
+static struct mqtt_reassembly claim_reassembly;
 
-// json buffer
-static char json_buffer[CREATE_KEYS_AND_CERT_RESPONSE_SIZE];
+// Gathers fragmented messages received while sending temperature data
+static struct mqtt_reassembly data_reassembly;
+
+// Command topic of the thing, see device_cmd.h
+static char cmd_topic[256];
 
 // temperature task handle
 TaskHandle_t xHandle = NULL;
 
-static void mqtt_start(esp_event_handler_t event_handler, char *clientId);
+// Set while connected to send temperature data, samples are stored to flash while it is not set
+static volatile bool mqtt_connected = false;
+
+// Payload of a batch of temperature data, static so it does not have to fit on the task stack
+static char telemetry_payload[TELEMETRY_BATCH_MAX_BYTES];
+
+// Boot timeline, published once per boot after the first temperature data
+static char boot_timeline_payload[BOOT_TIMELINE_PAYLOAD_SIZE];
+static bool boot_timeline_published = false;
+
+// Samples read back from flash to be replayed
+static struct telemetry_sample replay_samples[SAMPLE_STORE_REPLAY_MAX_SAMPLES];
+
+// Replayed message waiting for its ack, only used by the publish task
+static int replay_msg_id = -1;
+static size_t replay_num_samples;
+static int64_t replay_sent_ms;
+
+/*
+    Last acks of the data client, written by the event handler and looked up by the publish task.
+    The ack of a message can be handled before esp_mqtt_client_publish() returned its msg_id,
+    so acks are kept for a while instead of being matched as they arrive.
+ */
+#define RECENT_ACKS_SIZE    8
+static volatile int recent_acks[RECENT_ACKS_SIZE];
+static volatile uint32_t recent_acks_next;
+
+// End of the block of sample sequence numbers reserved in NVS, see nvs_seq_reserve()
+static uint32_t seq_limit;
+
+// Client created by mqtt_prepare(), started by mqtt_connect()
+static esp_mqtt_client_handle_t mqtt_client = NULL;
+
+/// Create the client with the cached tls_certs, it is started by mqtt_connect()
+static esp_err_t mqtt_client_create(esp_event_handler_t event_handler, char *clientId);
+
+// Set by mqtt_prepare_on_demand(), only samples given to mqtt_publish_samples() are published
+static bool mqtt_on_demand = false;
+
+// Set by mqtt_stop(), a disconnect is not retried anymore
+static volatile bool mqtt_stopped = false;
+
+// Set when the broker refused the connection, picks the retry policy of the disconnect that follows
+static volatile bool mqtt_refused = false;
+
+/// Scheduled by reconnect_schedule(), the client does not reconnect by itself
+static void mqtt_reconnect(void);
+
+/// Schedule a retry after a lost connection or a failed attempt
+static void mqtt_schedule_reconnect(void);
+
+/// Load connection certificates unless cached
+static esp_err_t load_connection_certs(void);
+
+/// Load claim certificates and registration buffers, the client registers thing once started
+static esp_err_t prepare_register_thing(void);
+
+/// Load thing name, start acquisition, the client sends temperature data once started
+static esp_err_t prepare_sending_data(void);
 static void con_mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data);
 static void claim_mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data);
 
@@ -39,40 +115,45 @@ static void claim_mqtt_event_handler(void *handler_args, esp_event_base_t base,
 */
 static int register_thing(esp_mqtt_client_handle_t client, const char *thing_name, const char *certificate_ownership_token);
 
-/**
- * Parse response of CreateKeysAndCertificate MQTT API call
-*/
-static int parse_create_keys_and_certificates_response(
-    const char* json_buffer, char *certificate_id, char *certificate_pem,
-     char *private_key, char *certificate_ownership_token
-);
-
-/// @brief Get string from json and format it to PEM format 
-/// @param json, json object that will be parsed
-/// @param key, json key of value 
-/// @param out_value, buffer to store parsed value
-/// @param size_of_out_value
-/// @return 0 for success; -1 for failure
-static int json_parse_and_format_pem(const char *json, const char *key, char *out_value, int size_of_out_value);
-
-/// Get string from json
-static int json_parse(const char *json, const char *key, char *out_value);
+/// Save certificate and key of the registered thing to NVS, as DER when CONFIG_MQTT_CREDENTIALS_DER is set
+static esp_err_t save_connection_certs(void);
 
-/**
- *  Get value of key from json object
-*/
-static int json_get_string(const char *json, const char *key, char *value);
+/// @brief Task that publishes temperature data to AWS IoT Core
+/// @param pvParameters 
+static void temperature_publish_task( void * pvParameters );
+
+/// Publish pending samples of the ring buffer as one batch, returns 0 on success
+static int publish_pending_samples(esp_mqtt_client_handle_t client, const char *topic);
+
+/// Publish boot timeline to the diagnostics topic, returns 0 on success
+static int publish_boot_timeline(esp_mqtt_client_handle_t client);
+
+/// Move pending samples of the ring buffer to flash
+static void store_pending_samples(void);
 
 /**
- *  Credit to jmucchiello from stackoverflow
- *  https://stackoverflow.com/questions/779875/what-function-is-to-replace-a-substring-from-a-string-in-c
- *  I edited it a bit to eliminate the dynamic allocation
+ *  Publish up to SAMPLE_STORE_REPLAY_MAX_SAMPLES samples stored while offline.
+ *  One replayed message is in flight at a time, its samples are consumed once it is acked.
 */
-static int str_replace(char *dest, int size_of_dest, char *orig, char *rep, char *with);
+static void replay_stored_samples(esp_mqtt_client_handle_t client, const char *topic, int64_t now_ms);
 
-/// @brief Task that publishes temperature data to AWS IoT Core
-/// @param pvParameters 
-static void temperature_publish_task( void * pvParameters );
+/// Run a command received on the command topic, see device_cmd.h
+static void handle_command(esp_mqtt_client_handle_t client, const char *json, size_t json_len);
+
+/// Check if the ack of @param msg_id is among the recent acks
+static bool msg_id_acked(int msg_id);
+
+/// Reserve sample sequence numbers in NVS once the reserved ones run out
+static void reserve_seq(void);
+
+/// Log free heap and size of .bss, shows the memory given back after registering thing
+static void log_memory_usage(const char *stage);
+
+/// Create prov_arena and allocate the CreateKeysAndCertificate response buffers from it
+static esp_err_t prov_arena_create(void);
+
+/// Release prov_arena, the response buffers are invalid after this
+static void prov_arena_release(void);
 
 static void log_error_if_nonzero(const char *message, int error_code)
 {
@@ -81,83 +162,284 @@ static void log_error_if_nonzero(const char *message, int error_code)
     }
 }
 
-esp_err_t mqtt_get_tls_certificates(
-    const char *server_cert_nvs_key, const char *client_cert_nvs_key, const char *client_key_nvs_key
-)
+// Linker symbols marking the .bss section
+extern int _bss_start;
+extern int _bss_end;
+
+static void log_memory_usage(const char *stage)
 {
-    return nvs_get_tls_certs(
-        server_cert, server_cert_nvs_key,
-        client_cert, client_cert_nvs_key,
-        client_key, client_key_nvs_key
-    );
+    ESP_LOGI(TAG, "[%s] Free heap: %u bytes, largest free block: %u bytes, .bss: %u bytes", stage,
+        (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+        (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+        (unsigned)((char *)&_bss_end - (char *)&_bss_start));
 }
 
-void mqtt_register_thing(void)
+static esp_err_t prov_arena_create(void)
 {
-    // GET CLAIM CERTS
-    esp_err_t err = nvs_get_tls_certs(
-        server_cert, NVS_KEY_SERVER_CERT,
-        client_cert, NVS_KEY_CLAIM_CLIENT_CERT,
-        client_key, NVS_KEY_CLAIM_CLIENT_KEY
-    );
+    esp_err_t err;
+
+    err = arena_create(&prov_arena, PROV_ARENA_SIZE);
     if(err != ESP_OK) {
-        printf("Error getting claim certs.\n");
-        return;
+        return err;
+    }
+
+    prov_keys.certificate_id = arena_alloc(&prov_arena, CERTIFICATE_ID_SIZE);
+    prov_keys.certificate_id_size = CERTIFICATE_ID_SIZE;
+    prov_keys.certificate_pem = arena_alloc(&prov_arena, CERTIFICATE_PEM_SIZE);
+    prov_keys.certificate_pem_size = CERTIFICATE_PEM_SIZE;
+    prov_keys.private_key = arena_alloc(&prov_arena, PRIVATE_KEY_SIZE);
+    prov_keys.private_key_size = PRIVATE_KEY_SIZE;
+    prov_keys.certificate_ownership_token = arena_alloc(&prov_arena, CERTIFICATE_OWNERSHIP_TOKEN);
+    prov_keys.certificate_ownership_token_size = CERTIFICATE_OWNERSHIP_TOKEN;
+    if(prov_keys.certificate_id == NULL || prov_keys.certificate_pem == NULL || prov_keys.private_key == NULL
+        || prov_keys.certificate_ownership_token == NULL) {
+        prov_arena_release();
+        return ESP_ERR_NO_MEM;
     }
 
-    // start MQTT to register thing
-    mqtt_start(claim_mqtt_event_handler, CLAIM_THINGNAME);
+    return ESP_OK;
+}
+
+static void prov_arena_release(void)
+{
+    arena_destroy(&prov_arena);
+    memset(&prov_keys, 0, sizeof prov_keys);
 }
 
-void mqtt_start_sending_data(void)
+esp_err_t mqtt_prepare(void)
 {
     esp_err_t err;
 
-    // if any are empty, get them from nvs storage
-    if(server_cert[0] == '\0' || client_cert[0] == '\0' || client_key[0] == '\0') {
-        // GET CONNECTION CERTS
-        err = nvs_get_tls_certs(
-            server_cert, NVS_KEY_SERVER_CERT,
-            client_cert, NVS_KEY_CON_CLIENT_CERT,
-            client_key, NVS_KEY_CON_CLIENT_KEY
-        );
-        if(err != ESP_OK) {
-            printf("Error getting connection certs.\n");
-            return;
-        }
+    // Check if thing has been registered.
+    err = load_connection_certs();
+    nvs_ops_log("boot");
+    if(err == ESP_ERR_NVS_NOT_FOUND) {
+        // Thing has not been registered yet, do so.
+        printf("Register thing.\n");
+        return prepare_register_thing();
+    } else if(err != ESP_OK) {
+        // An unexpected error occurred
+        printf("An error occurred while getting tls certificates.\n");
+        return err;
+    }
+
+    boot_timeline_mark("certs_loaded");
+    // Thing has been registered, send temperature data to aws.
+    printf("Start sending temperature data.\n");
+    return prepare_sending_data();
+}
+
+esp_err_t mqtt_prepare_on_demand(void)
+{
+    esp_err_t err;
+
+    err = load_connection_certs();
+    if(err != ESP_OK) {
+        printf("Error getting connection certs.\n");
+        return err;
     }
+    boot_timeline_mark("certs_loaded");
 
     err = nvs_get_thing_name(thing_name);
     if(err != ESP_OK) {
         printf("Error getting thingname.\n");
+        return err;
+    }
+
+    mqtt_on_demand = true;
+    mqtt_reassembly_init(&data_reassembly, MQTT_DATA_MAX_SIZE);
+    return mqtt_client_create(con_mqtt_event_handler, thing_name);
+}
+
+bool mqtt_thing_registered(void)
+{
+    // Connection certificates are only saved once RegisterThing succeeded, they stay loaded for mqtt_prepare()
+    return load_connection_certs() == ESP_OK;
+}
+
+size_t mqtt_publish_samples(const struct telemetry_sample *samples, size_t num_samples, uint32_t timeout_ms)
+{
+    int64_t deadline_us = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+    struct mqtt_stats stats;
+    char topic[256];
+    size_t published = 0;
+    size_t num_encoded;
+    int payload_len;
+    int msg_id;
+
+    snprintf(topic, sizeof topic, TELEMETRY_TOPIC_FORMAT, thing_name);
+
+    while(published < num_samples) {
+        // Connection is made by the client task, wait for it
+        while(!mqtt_connected) {
+            if(esp_timer_get_time() > deadline_us) {
+                ESP_LOGW(TAG, "Timed out waiting for mqtt, %d samples published", (int)published);
+                return published;
+            }
+            vTaskDelay(10 / portTICK_PERIOD_MS);
+        }
+
+        payload_len = telemetry_encode_array(samples + published, num_samples - published,
+            telemetry_payload, sizeof telemetry_payload, &num_encoded);
+        if(payload_len < 0) {
+            printf("Failed to encode temperature data.\n");
+            return published;
+        }
+
+        msg_id = mqtt_stats_publish(mqtt_client, topic, telemetry_payload, payload_len, MQTT_ON_DEMAND_QOS, 0);
+        if(msg_id < 0) {
+            if(esp_timer_get_time() > deadline_us) {
+                ESP_LOGW(TAG, "Timed out publishing, %d samples published", (int)published);
+                return published;
+            }
+            // Connection was lost while publishing, wait for the reconnect
+            vTaskDelay(10 / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        // Samples only count as published once acked, the radio goes off right after this
+        for(;;) {
+            mqtt_stats_get(&stats);
+            if(stats.in_flight == 0) {
+                break;
+            }
+            if(esp_timer_get_time() > deadline_us) {
+                ESP_LOGW(TAG, "Timed out waiting for ack, %d samples published", (int)published);
+                return published;
+            }
+            vTaskDelay(10 / portTICK_PERIOD_MS);
+        }
+
+        published += num_encoded;
+        boot_timeline_mark("first_publish");
+        ESP_LOGI(TAG, "temperature data published successfully, msg_id=%d, samples=%d, bytes=%d",
+            msg_id, (int)num_encoded, payload_len);
+    }
+
+    return published;
+}
+
+void mqtt_stop(void)
+{
+    if(mqtt_client == NULL) {
         return;
     }
 
-    // start MQTT to send temperature data
-    mqtt_start(con_mqtt_event_handler, thing_name);
+    mqtt_stopped = true;
+    mqtt_connected = false;
+    esp_mqtt_client_stop(mqtt_client);
+}
+
+esp_err_t mqtt_connect(void)
+{
+    if(mqtt_client == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    boot_timeline_mark("mqtt_start");
+    return esp_mqtt_client_start(mqtt_client);
+}
+
+static esp_err_t load_connection_certs(void)
+{
+    return cred_cache_get(NVS_KEY_CON_CLIENT_CERT, NVS_KEY_CON_CLIENT_KEY, &tls_certs);
 }
 
-static void mqtt_start(esp_event_handler_t event_handler, char *clientId)
+static esp_err_t prepare_register_thing(void)
+{
+    // GET CLAIM CERTS
+    esp_err_t err = cred_cache_get(NVS_KEY_CLAIM_CLIENT_CERT, NVS_KEY_CLAIM_CLIENT_KEY, &tls_certs);
+    if(err != ESP_OK) {
+        printf("Error getting claim certs.\n");
+        return err;
+    }
+
+    log_memory_usage("before registering thing");
+    err = prov_arena_create();
+    if(err != ESP_OK) {
+        printf("Error allocating registration buffers.\n");
+        return err;
+    }
+    log_memory_usage("registering thing");
+
+    mqtt_reassembly_init(&claim_reassembly, CREATE_KEYS_AND_CERT_RESPONSE_SIZE);
+
+    // MQTT to register thing
+    return mqtt_client_create(claim_mqtt_event_handler, CLAIM_THINGNAME);
+}
+
+static esp_err_t prepare_sending_data(void)
+{
+    esp_err_t err;
+
+    err = nvs_get_thing_name(thing_name);
+    if(err != ESP_OK) {
+        printf("Error getting thingname.\n");
+        return err;
+    }
+
+    log_memory_usage("sending data");
+    mqtt_reassembly_init(&data_reassembly, MQTT_DATA_MAX_SIZE);
+
+    // Samples stored while offline are replayed once connected
+    sample_store_init();
+
+    // Sensor is sampled on its own task from now on, independent of the connection
+    err = acquisition_start();
+    if(err != ESP_OK) {
+        printf("Error starting temperature acquisition.\n");
+        return err;
+    }
+
+    // MQTT to send temperature data
+    return mqtt_client_create(con_mqtt_event_handler, thing_name);
+}
+
+static esp_err_t mqtt_client_create(esp_event_handler_t event_handler, char *clientId)
 {
     // printf("MQTT_URL=%s\n", MQTT_URL);
 
-    const esp_mqtt_client_config_t mqtt_cfg = {
+    esp_mqtt_client_config_t mqtt_cfg = {
         .broker.address.uri = MQTT_URL,
-        .broker.verification.certificate = (const char *)server_cert,
+        // Server certificate chain was parsed once into the global CA store by cred_cache
+        .broker.verification.use_global_ca_store = true,
         .credentials = {
             .client_id = clientId,
             .authentication = {
-                .certificate = (const char *)client_cert,
-                .key = (const char *)client_key,
+                .certificate = tls_certs->client_cert,
+                .certificate_len = tls_certs->client_cert_len,
+                .key = tls_certs->client_key,
+                .key_len = tls_certs->client_key_len,
             },
-        }
+        },
+        // Retried with the jittered backoff of reconnect.h instead of a fixed delay
+        .network.disable_auto_reconnect = true,
     };
+    esp_err_t err;
+
+    err = reconnect_init(RECONNECT_MQTT, mqtt_reconnect);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+#if CONFIG_MQTT_TLS_SESSION_RESUMPTION
+    // Resumes the TLS session on reconnect, the built in transport does a full handshake every time
+    mqtt_cfg.network.transport = tls_transport_create(tls_certs);
+    if(mqtt_cfg.network.transport == NULL) {
+        ESP_LOGW(TAG, "TLS transport not available, connecting without session resumption");
+    }
+#endif
 
     ESP_LOGI(TAG, "[APP] Free memory: %ld bytes", esp_get_free_heap_size());
-    esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg);
+    mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
+    if(mqtt_client == NULL) {
+        if(mqtt_cfg.network.transport != NULL) {
+            esp_transport_destroy(mqtt_cfg.network.transport);
+        }
+        return ESP_FAIL;
+    }
     /* The last argument may be used to pass data to the event handler */
-    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, event_handler, clientId);
-    esp_mqtt_client_start(client);
+    return esp_mqtt_client_register_event(mqtt_client, ESP_EVENT_ANY_ID, event_handler, clientId);
 }
 
 /*
@@ -176,6 +458,9 @@ static void con_mqtt_event_handler(void *handler_args, esp_event_base_t base, in
     ESP_LOGD(TAG, "Event dispatched from event loop base=%s, event_id=%ld", base, event_id);
     esp_mqtt_event_handle_t event = event_data;
     esp_mqtt_client_handle_t client = event->client;
+    int msg_id;
+
+    mqtt_stats_event(event);
 
     // char *thingName =  (char *)handler_args;
     // char temperature_topic[1024];
@@ -183,8 +468,27 @@ static void con_mqtt_event_handler(void *handler_args, esp_event_base_t base, in
 
 
     switch ((esp_mqtt_event_id_t)event_id) {
+    case MQTT_EVENT_BEFORE_CONNECT:
+        // TCP and TLS handshake start after this
+        boot_timeline_mark("mqtt_connecting");
+        break;
     case MQTT_EVENT_CONNECTED:
         ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+        boot_timeline_mark("mqtt_connected");
+        reconnect_connected(RECONNECT_MQTT);
+        reconnect_log();
+        cred_cache_log();
+        mqtt_connected = true;
+
+        // Samples are published by mqtt_publish_samples()
+        if(mqtt_on_demand) {
+            break;
+        }
+
+        // Commands, e.g. dump the boot timeline on request
+        snprintf(cmd_topic, sizeof cmd_topic, DEVICE_CMD_TOPIC_FORMAT, thing_name);
+        msg_id = esp_mqtt_client_subscribe(client, cmd_topic, 1);
+        ESP_LOGI(TAG, "Subscribed to %s topic, msg_id=%d", cmd_topic, msg_id);
 
         // PUBLISH Temperature data
         // msg_id = esp_mqtt_client_publish(client, temperature_topic, "{ \"temperature\": 31}", 0, 0, 0);
@@ -201,6 +505,8 @@ static void con_mqtt_event_handler(void *handler_args, esp_event_base_t base, in
         break;
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+        mqtt_connected = false;
+        mqtt_schedule_reconnect();
         break;
 
     case MQTT_EVENT_SUBSCRIBED:
@@ -212,16 +518,32 @@ static void con_mqtt_event_handler(void *handler_args, esp_event_base_t base, in
         break;
     case MQTT_EVENT_PUBLISHED:
         ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+        recent_acks[recent_acks_next % RECENT_ACKS_SIZE] = event->msg_id;
+        recent_acks_next++;
         break;
     case MQTT_EVENT_DATA:
         ESP_LOGI(TAG, "MQTT_EVENT_DATA");
 
-        printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
-        printf("DATA=%.*s\r\n", event->data_len, event->data);
+        // Gather fragmented message, handle it once it is complete
+        if(mqtt_reassembly_feed(&data_reassembly, event) != MQTT_REASSEMBLY_COMPLETE) {
+            break;
+        }
+
+        // Commands are not printed, add_ap carries a wifi password, handle_command() logs what it did
+        if(mqtt_reassembly_topic_is(&data_reassembly, cmd_topic)) {
+            handle_command(client, data_reassembly.data, data_reassembly.len);
+        } else {
+            printf("TOPIC=%s\r\n", data_reassembly.topic);
+            printf("DATA=%.*s\r\n", (int)data_reassembly.len, data_reassembly.data);
+        }
+        mqtt_reassembly_reset(&data_reassembly);
 
         break;
     case MQTT_EVENT_ERROR:
         ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
+        if (event->error_handle->error_type == MQTT_ERROR_TYPE_CONNECTION_REFUSED) {
+            mqtt_refused = true;
+        }
         if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
             log_error_if_nonzero("reported from esp-tls", event->error_handle->esp_tls_last_esp_err);
             log_error_if_nonzero("reported from tls stack", event->error_handle->esp_tls_stack_err);
@@ -253,11 +575,13 @@ static void claim_mqtt_event_handler(void *handler_args, esp_event_base_t base,
     esp_mqtt_client_handle_t client = event->client;
     int msg_id;
     int ret;
-    int json_buffer_len;
+
+    mqtt_stats_event(event);
 
     switch ((esp_mqtt_event_id_t)event_id) {
     case MQTT_EVENT_CONNECTED:
         ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+        reconnect_connected(RECONNECT_MQTT);
 
         /// TODO: CHANGE QOS TO 1 AND ACCOUNT FOR DUPLICATES
 
@@ -277,12 +601,13 @@ static void claim_mqtt_event_handler(void *handler_args, esp_event_base_t base,
         ESP_LOGI(TAG, "Subscribed to %s topic, msg_id=%d", TOPIC_REGISTER_THING_REJECTED, msg_id);
 
         // PUBLISH CreateKeysAndCertificate MQTT API with empty payload
-        msg_id = esp_mqtt_client_publish(client, TOPIC_CREATE_KEYS_AND_CERT, "{}", 0, 0, 0);
+        msg_id = mqtt_stats_publish(client, TOPIC_CREATE_KEYS_AND_CERT, "{}", 0, 0, 0);
         ESP_LOGI(TAG, "Sent publish successful to %s topic, msg_id=%d", TOPIC_CREATE_KEYS_AND_CERT, msg_id);
         break;
         
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+        mqtt_schedule_reconnect();
         break;
 
     case MQTT_EVENT_SUBSCRIBED:
@@ -300,65 +625,72 @@ static void claim_mqtt_event_handler(void *handler_args, esp_event_base_t base,
     case MQTT_EVENT_DATA:
         ESP_LOGI(TAG, "MQTT_EVENT_DATA");
 
-        printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
+        // Gather fragmented response, handle it once it is complete
+        ret = mqtt_reassembly_feed(&claim_reassembly, event);
+        if(ret == MQTT_REASSEMBLY_INCOMPLETE) {
+            break;
+        } else if(ret == MQTT_REASSEMBLY_ERROR) {
+            printf("Failed to gather response.\n");
+            break;
+        }
+
+        printf("TOPIC=%s\r\n", claim_reassembly.topic);
 
         // CreateKeysAndCertificate MQTT API call successful
-        if(strncmp(TOPIC_CREATE_KEYS_AND_CERT_ACCEPTED, event->topic, event->topic_len) == 0) {
-
-            // Gather fragmented response to buffer
-            strncpy(json_buffer+event->current_data_offset, event->data, event->data_len);
-
-            json_buffer_len = strlen(json_buffer);
-            // When response has been gathered parse it
-            if(json_buffer_len >= event->total_data_len) {
-                // parse response
-                ret = parse_create_keys_and_certificates_response(
-                    json_buffer, certificate_id, certificate_pem, private_key, certificate_ownership_token
-                );
-                if(ret != 0) {
-                    printf("Function parse_create_keys_and_certificates_response() failed.\n");
-                    return;
-                }
-
-                // GET THINGNAME not from NVS
-                ret = nvs_get_thing_name(thing_name);
-                if(ret != ESP_OK) {
-                    printf("Error getting thingname.\n");
-                    return;
-                }
-
-                // RegisterThing MQTT API call
-                ret = register_thing(client, thing_name, certificate_ownership_token);
-                if(ret != ESP_OK) {
-                    printf("Function create_thing() failed.\n");
-                    return;
-                } else {
-                    printf("Successfully RegisteredThing!\n");
-                }
+        if(mqtt_reassembly_topic_is(&claim_reassembly, TOPIC_CREATE_KEYS_AND_CERT_ACCEPTED)) {
+            // parse response
+            ret = fleet_prov_parse_create_keys_response(claim_reassembly.data, claim_reassembly.len, &prov_keys);
+            mqtt_reassembly_reset(&claim_reassembly);
+            if(ret != 0) {
+                printf("Function fleet_prov_parse_create_keys_response() failed.\n");
+                return;
             }
-        } else if(strncmp(TOPIC_REGISTER_THING_ACCEPTED, event->topic, event->topic_len) == 0) {
+
+            // GET THINGNAME not from NVS
+            ret = nvs_get_thing_name(thing_name);
+            if(ret != ESP_OK) {
+                printf("Error getting thingname.\n");
+                return;
+            }
+
+            // RegisterThing MQTT API call
+            ret = register_thing(client, thing_name, prov_keys.certificate_ownership_token);
+            if(ret != ESP_OK) {
+                printf("Function create_thing() failed.\n");
+                return;
+            } else {
+                printf("Successfully RegisteredThing!\n");
+            }
+        } else if(mqtt_reassembly_topic_is(&claim_reassembly, TOPIC_REGISTER_THING_ACCEPTED)) {
             // RegisterThing MQTT API call successful
+            mqtt_reassembly_reset(&claim_reassembly);
 
             // SAVE CERTIFICATES TO NVS STORAGE
-            ret = nvs_set_tls_certs(
-                certificate_pem, NVS_KEY_CON_CLIENT_CERT,
-                private_key, NVS_KEY_CON_CLIENT_KEY
-            );
+            ret = save_connection_certs();
             if(ret != ESP_OK) {
                 printf("Error setting connection certs.\n");
                 return;
             }
 
+            // Registration buffers are not needed anymore
+            prov_arena_release();
+            log_memory_usage("thing registered");
+            nvs_ops_log("thing registered");
+
             /// TODO: REBOOT?
             esp_restart();
         } else {
             // CreateKeysAndCertificate or RegisterThing failed
-            printf("DATA=%.*s\r\n", event->data_len, event->data);
+            printf("DATA=%.*s\r\n", (int)claim_reassembly.len, claim_reassembly.data);
+            mqtt_reassembly_reset(&claim_reassembly);
         }
 
         break;
     case MQTT_EVENT_ERROR:
         ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
+        if (event->error_handle->error_type == MQTT_ERROR_TYPE_CONNECTION_REFUSED) {
+            mqtt_refused = true;
+        }
         if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
             log_error_if_nonzero("reported from esp-tls", event->error_handle->esp_tls_last_esp_err);
             log_error_if_nonzero("reported from tls stack", event->error_handle->esp_tls_stack_err);
@@ -373,16 +705,80 @@ static void claim_mqtt_event_handler(void *handler_args, esp_event_base_t base,
     }
 }
 
+static void mqtt_reconnect(void)
+{
+    esp_err_t err;
+
+    // The client and the publish task hold on to the old credentials, start over like after registering thing
+    if(cred_cache_stale()) {
+        ESP_LOGW(TAG, "TLS credentials in NVS changed, restarting");
+        esp_restart();
+    }
+
+    err = esp_mqtt_client_reconnect(mqtt_client);
+    if(err != ESP_OK) {
+        ESP_LOGW(TAG, "Error (%s) reconnecting mqtt", esp_err_to_name(err));
+    }
+}
+
+static void mqtt_schedule_reconnect(void)
+{
+    enum reconnect_reason reason = mqtt_refused ? RECONNECT_REASON_AUTH : RECONNECT_REASON_OTHER;
+    uint32_t delay_ms;
+
+    if(mqtt_stopped) {
+        return;
+    }
+
+    mqtt_refused = false;
+    delay_ms = reconnect_schedule(RECONNECT_MQTT, reason);
+    ESP_LOGI(TAG, "Reconnecting mqtt in %d ms", (int)delay_ms);
+}
+
+static esp_err_t save_connection_certs(void)
+{
+    size_t cert_size = strlen(prov_keys.certificate_pem);
+    size_t key_size = strlen(prov_keys.private_key);
+#if CONFIG_MQTT_CREDENTIALS_DER
+    uint8_t *der;
+    int cert_len, key_len;
+    esp_err_t err;
+
+    // DER with its header is always smaller than the PEM text, one buffer holds both
+    der = malloc(cert_size + key_size);
+    if(der != NULL) {
+        printf("Converting certificate and key to DER... ");
+        cert_len = credentials_pem_to_der(prov_keys.certificate_pem, der, cert_size);
+        key_len = credentials_pem_to_der(prov_keys.private_key, der + cert_size, key_size);
+        if(cert_len > 0 && key_len > 0) {
+            printf("Done, %d + %d bytes instead of %d + %d.\n", cert_len, key_len, (int)cert_size, (int)key_size);
+            err = nvs_set_tls_certs(
+                der, cert_len, NVS_KEY_CON_CLIENT_CERT,
+                der + cert_size, key_len, NVS_KEY_CON_CLIENT_KEY
+            );
+            free(der);
+            return err;
+        }
+        printf("Failed.\n");
+        free(der);
+    }
+
+    // Fall back to PEM, the loader handles both
+    printf("Saving certificate and key as PEM.\n");
+#endif
+    return nvs_set_tls_certs(
+        prov_keys.certificate_pem, cert_size, NVS_KEY_CON_CLIENT_CERT,
+        prov_keys.private_key, key_size, NVS_KEY_CON_CLIENT_KEY
+    );
+}
+
 static int register_thing(esp_mqtt_client_handle_t client, const char *thing_name, const char *certificate_ownership_token)
 {
     char payload[REGISTER_THING_PAYLOAD_SIZE];
     int ret;
 
     // Format payload
-    ret = snprintf(payload, REGISTER_THING_PAYLOAD_SIZE,
-        "{\"%s\":\"%s\", \"parameters\":{\"ThingName\":\"%s\"}}", 
-        JSON_KEY_CERTIFICATE_OWNERSHIP_TOKEN, certificate_ownership_token, thing_name);
-    
+    ret = fleet_prov_format_register_thing(payload, sizeof payload, certificate_ownership_token, thing_name);
     if(ret < 0) {
         printf("Failed to create payload\n");
         return -1;
@@ -390,187 +786,223 @@ static int register_thing(esp_mqtt_client_handle_t client, const char *thing_nam
     // printf("payload=%s\n", payload);
 
     // RegisterThing MQTT API call
-    int msg_id = esp_mqtt_client_publish(client, TOPIC_REGISTER_THING, payload, 0, 0, 0);
+    int msg_id = mqtt_stats_publish(client, TOPIC_REGISTER_THING, payload, ret, 0, 0);
     ESP_LOGI(TAG, "Sent publish successful to %s topic, msg_id=%d", TOPIC_REGISTER_THING, msg_id);
     return 0;
 }
 
-static int parse_create_keys_and_certificates_response(
-    const char* json_buffer, char *certificate_id, char *certificate_pem, char *private_key, char *certificate_ownership_token
-)
+#include "esp_wifi.h"
+
+static void temperature_publish_task( void * pvParameters )
 {
-    int ret;
+    esp_mqtt_client_handle_t client = (esp_mqtt_client_handle_t)pvParameters;
+    const TickType_t xDelay = TELEMETRY_SAMPLE_PERIOD_MS / portTICK_PERIOD_MS;
+    struct acquisition_sample sample;
+    char temperature_topic[256];
+    int64_t now_ms;
 
-    // parse certificateId
-    ret = json_parse(json_buffer, JSON_KEY_CERTIFICATE_ID, certificate_id);
-    if(ret != 0) {
-        return ret;
-    }
+    // Create topic form thing_name, temperature data will be published to this topic
+    snprintf(temperature_topic, 256, TELEMETRY_TOPIC_FORMAT, thing_name);
+
+    // Sequence numbers continue after those of earlier boots
+    reserve_seq();
+
+    for( ;; ) {
+        // Move samples taken by the acquisition task to the batch
+        while(acquisition_get_sample(&sample)) {
+            telemetry_add_sample(sample.channel, sample.temperature, sample.timestamp_ms);
+            reserve_seq();
+            boot_timeline_mark("first_sample");
+        }
+        now_ms = esp_timer_get_time() / 1000;
+
+        if(!mqtt_connected && sample_store_ready()) {
+            // Offline, keep samples in flash until connected again
+            store_pending_samples();
+        } else if(telemetry_should_flush(now_ms)) {
+            // Publish pending samples as one batch once flush policy is met
+            if(publish_pending_samples(client, temperature_topic) == 0 && !boot_timeline_published) {
+                // Timeline is complete with the first published sample
+                boot_timeline_published = publish_boot_timeline(client) == 0;
+            }
+        }
 
-    // parse certificatePem
-    ret = json_parse_and_format_pem(json_buffer, JSON_KEY_CERTIFICATE_PEM, certificate_pem, CERTIFICATE_PEM_SIZE);
-    if(ret != 0) {
-        return ret;
+        // Replay a limited amount of the backlog every period, live data goes first
+        if(mqtt_connected && sample_store_pending() > 0) {
+            replay_stored_samples(client, temperature_topic, now_ms);
+        }
+
+        mqtt_stats_log_periodic(now_ms);
+        // Reconnects since the last save changed the history of the APs
+        wifi_save_aps_periodic(now_ms);
+
+        vTaskDelay( xDelay );
     }
+}
 
-    // parse privateKey
-    ret = json_parse_and_format_pem(json_buffer, JSON_KEY_PRIVATE_KEY, private_key, PRIVATE_KEY_SIZE);
-    if(ret != 0) {
-        return ret;
+static int publish_pending_samples(esp_mqtt_client_handle_t client, const char *topic)
+{
+    int msg_id;
+    int payload_len;
+    size_t num_samples;
+
+    payload_len = telemetry_encode(telemetry_payload, sizeof telemetry_payload, &num_samples);
+    if(payload_len < 0) {
+        printf("Failed to encode temperature data.\n");
+        return -1;
     }
 
-    // parse certificateOwnershipToken
-    ret = json_parse(json_buffer, JSON_KEY_CERTIFICATE_OWNERSHIP_TOKEN, certificate_ownership_token);
-    if(ret != 0) {
-        return ret;
+    // Publish temperature with the configured QoS
+    msg_id = mqtt_stats_publish(client, topic, telemetry_payload, payload_len, TELEMETRY_QOS, 0);
+    if(msg_id < 0) {
+        // Keep samples, they are published with the next batch or stored if the connection is lost
+        ESP_LOGI(TAG, "Failed to publish temperature data, %d samples pending", (int)telemetry_pending());
+        return -1;
     }
 
+    telemetry_consume(num_samples);
+    boot_timeline_mark("first_publish");
+    ESP_LOGI(TAG, "temperature data published successfully, msg_id=%d, samples=%d, bytes=%d",
+        msg_id, (int)num_samples, payload_len);
     return 0;
 }
 
-static int json_parse_and_format_pem(const char *json, const char *key, char *out_value, int size_of_out_value)
+static int publish_boot_timeline(esp_mqtt_client_handle_t client)
 {
-    int ret;
-    char *tmp;
+    char topic[256];
+    int payload_len;
+    int msg_id;
 
-    ret = json_parse(json, key, tmp_buf);
-    if(ret != 0) {
-        return ret;
-    }
+    boot_timeline_log();
 
-    // Replace \\n with \n for correct PEM format
-    printf("Formatting %s json string to PEM... ", key);
-    ret = str_replace(out_value, size_of_out_value, tmp_buf, "\\n", "\n");
-    if(ret != 0) {
-        printf("Failed to perform str_replace()\n");
-        return ret;
+    payload_len = boot_timeline_format(boot_timeline_payload, sizeof boot_timeline_payload);
+    if(payload_len < 0) {
+        printf("Failed to format boot timeline.\n");
+        return -1;
     }
 
-    // replace last newline ('\n') with \0, assuming it exists
-    tmp = strrchr(out_value, '\n');
-    *tmp = '\0';
+    snprintf(topic, sizeof topic, BOOT_TIMELINE_TOPIC_FORMAT, thing_name);
+    msg_id = mqtt_stats_publish(client, topic, boot_timeline_payload, payload_len, 0, 0);
+    if(msg_id < 0) {
+        return -1;
+    }
 
-    printf("Done.\n");
+    ESP_LOGI(TAG, "Boot timeline published, msg_id=%d", msg_id);
     return 0;
 }
 
-static int json_parse(const char *json, const char *key, char *out_value)
+static void store_pending_samples(void)
 {
-    int ret;
-    printf("Parsing %s... ", key);
+    const struct telemetry_sample *sample;
 
-    ret = json_get_string(json, key, out_value);
-    if(ret != 0) {
-        printf("Failed to parse %s.\n", key);
-        return -1;
+    while((sample = telemetry_oldest()) != NULL) {
+        if(sample_store_append(sample) != ESP_OK) {
+            // Leave the rest in the ring buffer
+            return;
+        }
+        telemetry_consume(1);
     }
 
-    printf("Done.\n");
-    return ret;
+    ESP_LOGI(TAG, "Offline, %d samples stored", (int)sample_store_pending());
 }
 
-static int json_get_string(const char *json, const char *key, char *value)
+static void replay_stored_samples(esp_mqtt_client_handle_t client, const char *topic, int64_t now_ms)
 {
-    char *pch;
-    int len;
-    // GET KEY IN JSON
-    pch = strstr(json, key);
-
-    // IF KEY EXISTS IN json
-    if(pch != NULL) {
-        // Locate end of key
-        pch = strchr(pch, ':');
-
-        // Locate start of value
-        pch = strchr(pch, '\"');
-        // printf("%s\n", pch);
-        
-        // Locate end of value
-        len = strcspn(pch+1, "\"");
-        // printf("value=%.*s\n", len, pch+1);
+    int msg_id;
+    int payload_len;
+    size_t num_read;
+    size_t num_samples;
+
+    if(replay_msg_id >= 0) {
+        if(msg_id_acked(replay_msg_id)) {
+            sample_store_consume(replay_num_samples);
+            ESP_LOGI(TAG, "stored temperature data acked, msg_id=%d, samples=%d, %d left",
+                replay_msg_id, (int)replay_num_samples, (int)sample_store_pending());
+            replay_msg_id = -1;
+        } else if(now_ms - replay_sent_ms < SAMPLE_STORE_REPLAY_TIMEOUT_MS) {
+            return;
+        } else {
+            // Never acked, the backend drops the duplicates by seq if it was received after all
+            ESP_LOGW(TAG, "No ack for stored temperature data, msg_id=%d, sending again", replay_msg_id);
+            replay_msg_id = -1;
+        }
+    }
 
-        // +1 to not include the "
-        strncpy(value, pch+1, len);
-        value[len] = '\0';
-        return 0;
+    num_read = sample_store_peek(replay_samples, SAMPLE_STORE_REPLAY_MAX_SAMPLES);
+    if(num_read == 0) {
+        return;
     }
-    else {
-        return -1;
+
+    payload_len = telemetry_encode_array(
+        replay_samples, num_read, telemetry_payload, sizeof telemetry_payload, &num_samples
+    );
+    if(payload_len < 0) {
+        printf("Failed to encode stored temperature data.\n");
+        return;
     }
+
+    msg_id = mqtt_stats_publish(client, topic, telemetry_payload, payload_len, SAMPLE_STORE_REPLAY_QOS, 0);
+    if(msg_id < 0) {
+        return;
+    }
+
+    replay_msg_id = msg_id;
+    replay_num_samples = num_samples;
+    replay_sent_ms = now_ms;
+    ESP_LOGI(TAG, "stored temperature data replayed, msg_id=%d, samples=%d", msg_id, (int)num_samples);
 }
 
-static int str_replace(char *dest, int size_of_dest, char *orig, char *rep, char *with)
+static void handle_command(esp_mqtt_client_handle_t client, const char *json, size_t json_len)
 {
-    char result[STR_REPLACE_BUFFER_SIZE];   // the return string
-    char *ins;                              // the next insert point
-    char *tmp;                              // varies
-    int len_rep;                            // length of rep (the string to remove)
-    int len_with;                           // length of with (the string to replace rep with)
-    int len_front;                          // distance between rep and end of last rep
-    int count;                              // number of replacements
-
-    // sanity checks and initialization
-    if (!orig || !rep)
-        return -1;
-    len_rep = strlen(rep);
-    if (len_rep == 0)
-        return -1; // empty rep causes infinite loop during count
-    if (!with)
-        with = "";
-    len_with = strlen(with);
-
-    // count the number of replacements needed
-    ins = orig;
-    for (count = 0; (tmp = strstr(ins, rep)); ++count) {
-        ins = tmp + len_rep;
-    }
-
-    tmp = result;
-
-    // first time through the loop, all the variable are set correctly
-    // from here on,
-    //    tmp points to the end of the result string
-    //    ins points to the next occurrence of rep in orig
-    //    orig points to the remainder of orig after "end of rep"
-    while (count--) {
-        ins = strstr(orig, rep);
-        len_front = ins - orig;
-        tmp = strncpy(tmp, orig, len_front) + len_front;
-        tmp = strcpy(tmp, with) + len_with;
-        orig += len_front + len_rep; // move to next "end of rep"
-    }
-    strcpy(tmp, orig);
-    
-    strncpy(dest, result, size_of_dest);
-    
-    return 0;
-}
+    struct device_cmd cmd;
 
-#include "esp_wifi.h"
+    if(device_cmd_parse(json, json_len, &cmd) != 0) {
+        printf("Invalid command.\n");
+        return;
+    }
 
-static void temperature_publish_task( void * pvParameters )
+    switch(cmd.type) {
+    case DEVICE_CMD_BOOT_TIMELINE:
+        if(publish_boot_timeline(client) != 0) {
+            printf("Failed to publish boot timeline.\n");
+        }
+        break;
+    case DEVICE_CMD_ADD_AP:
+        if(wifi_add_ap(cmd.ssid, cmd.pwd) != ESP_OK) {
+            printf("Failed to add AP.\n");
+            break;
+        }
+        ESP_LOGI(TAG, "AP %s added", cmd.ssid);
+        break;
+    }
+}
+
+static bool msg_id_acked(int msg_id)
 {
-    esp_mqtt_client_handle_t client = (esp_mqtt_client_handle_t)pvParameters;
-    const TickType_t xDelay = 10000 / portTICK_PERIOD_MS;
-    // Temperature is in celsius
-    int msg_id, temperature = 30, min_temp = 20, max_temp = 32;
-    char temperature_topic[256];
-    char payload[128];
+    size_t i;
 
-    // Create topic form thing_name, temperature data will be published to this topic
-    snprintf(temperature_topic, 256, "device/%s/temperature/data", thing_name);
+    for(i = 0; i < RECENT_ACKS_SIZE; i++) {
+        if(recent_acks[i] == msg_id) {
+            return true;
+        }
+    }
 
-    for( ;; ) {
-        // Simulate temperature to send variety of temperatures
-        if(temperature >= max_temp)
-            temperature = min_temp;
-        // Create payload from temperature
-        snprintf(payload, 128, "{ \"temperature\": %d}", temperature);
-        // Publish temperature with QoS of 0
-        msg_id = esp_mqtt_client_publish(client, temperature_topic, payload, 0, 0, 0);
-        ESP_LOGI(TAG, "temperature data published successfully, msg_id=%d", msg_id);
-        temperature++;
+    return false;
+}
 
-        vTaskDelay( xDelay );
+static void reserve_seq(void)
+{
+    uint32_t next = telemetry_next_seq();
+
+    if(seq_limit != 0 && next < seq_limit) {
+        return;
+    }
+
+    if(nvs_seq_reserve(&next, &seq_limit) != ESP_OK) {
+        // Retried with the next sample, a reboot before that may repeat sequence numbers
+        printf("Error reserving sequence numbers.\n");
+        return;
     }
-}
\ No newline at end of file
+
+    telemetry_set_seq(next);
+}
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <stdio.h>
+#include <stdbool.h>
 #include "esp_err.h"
+#include "arena.h"
+#include "telemetry.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -21,56 +24,71 @@ extern "C" {
 #define TOPIC_REGISTER_THING_ACCEPTED         "$aws/provisioning-templates/" CONFIG_AWS_TEMPLATE_NAME "/provision/json/accepted"
 #define TOPIC_REGISTER_THING_REJECTED         "$aws/provisioning-templates/" CONFIG_AWS_TEMPLATE_NAME "/provision/json/rejected"
 
-// CERTIFICATES FOR TLS
-#define SERVER_CERT_MAX_SIZE    4096
-#define CLIENT_CERT_MAX_SIZE    4096
-#define CLIENT_KEY_SIZE         4096
-
 // CERTIFICATES GOTTEN FROM CreateKeysAndCertificate MQTT API CALL's response
-#define CERTIFICATE_ID_SIZE         64
-#define CERTIFICATE_PEM_SIZE        CLIENT_CERT_MAX_SIZE
-#define PRIVATE_KEY_SIZE            CLIENT_KEY_SIZE
+#define CERTIFICATE_ID_SIZE         65  // 64 hex digits and the NUL
+#define CERTIFICATE_PEM_SIZE        4096
+#define PRIVATE_KEY_SIZE            4096
 #define CERTIFICATE_OWNERSHIP_TOKEN 1024
 
-// tmpBuf will be used for string replacement
-#define TMPBUFFER_SIZE  CERTIFICATE_PEM_SIZE
+// Arena holding the above buffers while registering thing, + alignment padding of each buffer
+#define PROV_ARENA_SIZE (CERTIFICATE_ID_SIZE + CERTIFICATE_PEM_SIZE + PRIVATE_KEY_SIZE + CERTIFICATE_OWNERSHIP_TOKEN + 4 * ARENA_ALIGNMENT)
 
 /* 
-    This buffer will hold the responce of CreateKeysAndCertificate
+    Largest response of CreateKeysAndCertificate that will be accepted.
     Since there is a limit to how much data a mqtt (or wifi) message can contain,
-    the response is cut to smaller pieces (fragments), this buffer will be used to store the
-    combined message. 
+    the response is cut to smaller pieces (fragments), these are gathered to a buffer of
+    the exact size of the response, up to this size.
  */
-#define CREATE_KEYS_AND_CERT_RESPONSE_SIZE  4096
+#define CREATE_KEYS_AND_CERT_RESPONSE_SIZE  8192
 
-// Json keys of CreateKeysAndCertificate MQTT API response
-#define JSON_KEY_CERTIFICATE_ID                 "certificateId"
-#define JSON_KEY_CERTIFICATE_PEM                "certificatePem"
-#define JSON_KEY_PRIVATE_KEY                    "privateKey"
-#define JSON_KEY_CERTIFICATE_OWNERSHIP_TOKEN    "certificateOwnershipToken"
+// Largest message that will be gathered while sending temperature data (e.g. config or shadow documents)
+#define MQTT_DATA_MAX_SIZE  8192
 
 // The payload size of the RegisterThing MQTT API call
 #define REGISTER_THING_PAYLOAD_SIZE 2048
 
-// buffer size of the str_replace function, it needs to be large enough to hold a pem certificate
-#define STR_REPLACE_BUFFER_SIZE CLIENT_CERT_MAX_SIZE
+// QoS of mqtt_publish_samples(), whatever TELEMETRY_QOS is: the caller deletes the samples it reports as published,
+// so they have to be acked by the broker before the radio goes off
+#define MQTT_ON_DEMAND_QOS  1
+
+/**
+ *  Load tls certificates from nvs storage and initialise the mqtt client, does not need a connection.
+ *  When the thing has no connection certificates yet the client registers thing with the claim certificates,
+ *  otherwise it sends temperature data.
+ * @return  ESP_OK on success,
+ *          error of NVS or ESP_ERR_NO_MEM on failure
+*/
+esp_err_t mqtt_prepare(void);
 
 /**
- *  Used to get tls certificates from nvs storage
+ *  Like mqtt_prepare() for the low power mode, no acquisition task and no publish task are started.
+ *  The client only publishes the samples given to mqtt_publish_samples().
+ * @return  ESP_OK on success,
+ *          ESP_ERR_NVS_NOT_FOUND when the thing has not been registered yet
+ *          other error of NVS on failure
 */
-esp_err_t mqtt_get_tls_certificates(
-    const char *server_cert_nvs_key, const char *client_cert_nvs_key, const char *client_key_nvs_key
-);
+esp_err_t mqtt_prepare_on_demand(void);
+
+/// Check if thing has been registered, loads the connection certificates
+bool mqtt_thing_registered(void);
 
 /**
- *  Start MQTT to register thing
+ *  Publish samples with the client of mqtt_prepare_on_demand(), in as many batches as needed.
+ *  Batches are sent with MQTT_ON_DEMAND_QOS, a batch only counts as published once it is acked.
+ * @param timeout_ms time to wait for all of it
+ * @return number of samples published, oldest first
 */
-void mqtt_register_thing(void);
+size_t mqtt_publish_samples(const struct telemetry_sample *samples, size_t num_samples, uint32_t timeout_ms);
+
+/// Disconnect and stop the client, e.g. before deep sleep
+void mqtt_stop(void);
 
 /**
- * Start mqtt to send temperature data
+ *  Start the client initialised by mqtt_prepare(), needs an ip
+ * @return  ESP_OK on success,
+ *          ESP_ERR_INVALID_STATE if mqtt_prepare() has not succeeded
 */
-void mqtt_start_sending_data(void);
+esp_err_t mqtt_connect(void);
 
 #ifdef __cplusplus
 }
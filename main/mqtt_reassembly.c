@@ -0,0 +1,89 @@
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "main.h"
+#include "mqtt_reassembly.h"
+
+void mqtt_reassembly_init(struct mqtt_reassembly *r, size_t max_len)
+{
+    memset(r, 0, sizeof *r);
+    r->max_len = max_len;
+}
+
+enum mqtt_reassembly_status mqtt_reassembly_feed(struct mqtt_reassembly *r, esp_mqtt_event_handle_t event)
+{
+    size_t offset = event->current_data_offset;
+    size_t data_len = event->data_len;
+    size_t total_len = event->total_data_len;
+
+    // FIRST FRAGMENT, start a new message
+    if(offset == 0) {
+        mqtt_reassembly_reset(r);
+
+        if(event->topic_len >= MQTT_REASSEMBLY_TOPIC_SIZE) {
+            ESP_LOGW(TAG, "Topic of msg_id=%d too long, dropping message", event->msg_id);
+            return MQTT_REASSEMBLY_ERROR;
+        }
+        if(total_len > r->max_len) {
+            ESP_LOGW(TAG, "Message %.*s of %d bytes exceeds budget of %d bytes, dropping message",
+                event->topic_len, event->topic, (int)total_len, (int)r->max_len);
+            return MQTT_REASSEMBLY_ERROR;
+        }
+
+        memcpy(r->topic, event->topic, event->topic_len);
+        r->topic[event->topic_len] = '\0';
+        r->topic_len = event->topic_len;
+        r->msg_id = event->msg_id;
+        r->total_len = total_len;
+
+        // Whole message in one fragment, hand out the event data as is
+        if(data_len == total_len) {
+            r->received = total_len;
+            r->data = event->data;
+            r->len = total_len;
+            return MQTT_REASSEMBLY_COMPLETE;
+        }
+
+        // +1 so the gathered message can be NUL-terminated
+        r->buf = malloc(total_len + 1);
+        if(r->buf == NULL) {
+            ESP_LOGW(TAG, "Out of memory gathering %d byte message, dropping message", (int)total_len);
+            return MQTT_REASSEMBLY_ERROR;
+        }
+    } else if(r->buf == NULL || event->msg_id != r->msg_id || total_len != r->total_len
+        || offset != r->received || offset + data_len > r->total_len) {
+        // Fragment does not continue the current message
+        ESP_LOGW(TAG, "Unexpected fragment msg_id=%d offset=%d, dropping message", event->msg_id, (int)offset);
+        mqtt_reassembly_reset(r);
+        return MQTT_REASSEMBLY_ERROR;
+    }
+
+    memcpy(r->buf + offset, event->data, data_len);
+    r->received += data_len;
+
+    if(r->received < r->total_len) {
+        return MQTT_REASSEMBLY_INCOMPLETE;
+    }
+
+    r->buf[r->total_len] = '\0';
+    r->data = r->buf;
+    r->len = r->total_len;
+    return MQTT_REASSEMBLY_COMPLETE;
+}
+
+bool mqtt_reassembly_topic_is(const struct mqtt_reassembly *r, const char *topic)
+{
+    return r->topic_len == (int)strlen(topic) && memcmp(r->topic, topic, r->topic_len) == 0;
+}
+
+void mqtt_reassembly_reset(struct mqtt_reassembly *r)
+{
+    free(r->buf);
+    r->buf = NULL;
+    r->data = NULL;
+    r->len = 0;
+    r->received = 0;
+    r->total_len = 0;
+    r->topic_len = 0;
+    r->topic[0] = '\0';
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "mqtt_client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Topic of a message being gathered, long enough for the fleet provisioning topics
+#define MQTT_REASSEMBLY_TOPIC_SIZE  256
+
+/// Result of mqtt_reassembly_feed()
+enum mqtt_reassembly_status {
+    MQTT_REASSEMBLY_INCOMPLETE = 0,     // waiting for more fragments
+    MQTT_REASSEMBLY_COMPLETE,           // message complete, data and len are valid
+    MQTT_REASSEMBLY_ERROR,              // message dropped (over budget, out of memory or a gap in the fragments)
+};
+
+/**
+ *  Gathers the fragments of MQTT_EVENT_DATA events into one contiguous message.
+ *  Esp-mqtt only sets the topic on the first fragment, the message is keyed by that topic and msg_id
+ *  and every following fragment has to continue exactly where the last one ended.
+ *  A message that arrives in a single fragment is not copied, data then points to the event data.
+*/
+struct mqtt_reassembly {
+    size_t max_len;                             // budget, largest message that will be gathered
+    char topic[MQTT_REASSEMBLY_TOPIC_SIZE];     // topic of the current message
+    int topic_len;
+    int msg_id;                                 // msg_id of the current message
+    size_t total_len;                           // total length of the current message
+    size_t received;                            // bytes received, always contiguous from offset 0
+    char *buf;                                  // exact size buffer, only allocated for fragmented messages
+    const char *data;                           // contiguous view of the complete message
+    size_t len;                                 // length of data
+};
+
+/**
+ *  Initialize reassembly
+ * @param max_len largest message that will be accepted
+*/
+void mqtt_reassembly_init(struct mqtt_reassembly *r, size_t max_len);
+
+/**
+ *  Feed an MQTT_EVENT_DATA event
+ * @return  MQTT_REASSEMBLY_COMPLETE when the message is complete, the view (data, len) is valid until the next
+ *          call to mqtt_reassembly_feed() or mqtt_reassembly_reset(),
+ *          MQTT_REASSEMBLY_INCOMPLETE when more fragments are needed,
+ *          MQTT_REASSEMBLY_ERROR when the message was dropped
+*/
+enum mqtt_reassembly_status mqtt_reassembly_feed(struct mqtt_reassembly *r, esp_mqtt_event_handle_t event);
+
+/// Check if the topic of the current message is @param topic
+bool mqtt_reassembly_topic_is(const struct mqtt_reassembly *r, const char *topic);
+
+/// Drop the current message and free its buffer
+void mqtt_reassembly_reset(struct mqtt_reassembly *r);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,291 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "main.h"
+#include "mqtt_stats.h"
+
+/**
+ *  Outgoing message waiting for its ack.
+ *  The MQTT task can handle the ack before esp_mqtt_client_publish() returned the msg_id to the publishing task,
+ *  such an ack is kept as an entry of its own until mqtt_stats_publish() matches it.
+*/
+struct tracked_msg {
+    int msg_id;                     // 0 when the slot is free
+    int64_t publish_us;             // time of the ack when acked is set
+    bool acked;                     // ack arrived before the publish was recorded
+};
+
+static const uint32_t bucket_limits_ms[MQTT_STATS_NUM_BUCKETS - 1] = {
+    5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000
+};
+
+// Publish is called from the telemetry task, events come from the MQTT task
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static struct mqtt_stats stats;
+static struct tracked_msg tracked[MQTT_STATS_MAX_TRACKED];
+static int64_t last_log_ms;
+static int64_t connect_start_us;    // 0 when no connection attempt is pending
+
+/// Add latency to histogram, caller holds stats_lock
+static void mqtt_stats_record(uint32_t *hist, uint32_t *max_ms, int64_t latency_us);
+
+/// Start tracking a message or an early ack, evicts the oldest entry when all slots are used, caller holds stats_lock
+static void mqtt_stats_track(int msg_id, int64_t time_us, bool acked);
+
+/// Find the slot of a tracked message, returns NULL if it is not tracked, caller holds stats_lock
+static struct tracked_msg *mqtt_stats_find(int msg_id);
+
+/// Log one histogram
+static void mqtt_stats_log_hist(const char *name, const uint32_t *hist, uint32_t max_ms);
+
+int mqtt_stats_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain)
+{
+    struct tracked_msg *msg;
+    int64_t start_us;
+    int64_t end_us;
+    int msg_id;
+
+    // Same as esp_mqtt_client_publish(), length 0 means a NUL-terminated string
+    if(len == 0 && data != NULL) {
+        len = strlen(data);
+    }
+
+    start_us = esp_timer_get_time();
+    msg_id = esp_mqtt_client_publish(client, topic, data, len, qos, retain);
+    end_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&stats_lock);
+    if(msg_id < 0) {
+        stats.failed++;
+    } else {
+        stats.published++;
+        stats.bytes_sent += len;
+        mqtt_stats_record(stats.write_hist, &stats.write_max_ms, end_us - start_us);
+
+        // QoS 0 has no ack, msg_id is 0
+        if(qos > 0 && msg_id > 0) {
+            msg = mqtt_stats_find(msg_id);
+            if(msg != NULL && msg->acked) {
+                // Acked while esp_mqtt_client_publish() was returning
+                stats.acked++;
+                mqtt_stats_record(stats.ack_hist, &stats.ack_max_ms, msg->publish_us - start_us);
+                msg->msg_id = 0;
+            } else {
+                mqtt_stats_track(msg_id, start_us, false);
+            }
+        }
+    }
+    portEXIT_CRITICAL(&stats_lock);
+
+    return msg_id;
+}
+
+void mqtt_stats_event(esp_mqtt_event_handle_t event)
+{
+    int64_t now_us = esp_timer_get_time();
+    struct tracked_msg *msg;
+
+    portENTER_CRITICAL(&stats_lock);
+    switch(event->event_id) {
+    case MQTT_EVENT_PUBLISHED:
+        msg = mqtt_stats_find(event->msg_id);
+        if(msg == NULL) {
+            // Matched by mqtt_stats_publish(), or counted as untracked once evicted
+            if(event->msg_id > 0) {
+                mqtt_stats_track(event->msg_id, now_us, true);
+            }
+            break;
+        }
+        if(msg->acked) {
+            // Duplicate ack
+            break;
+        }
+        stats.acked++;
+        mqtt_stats_record(stats.ack_hist, &stats.ack_max_ms, now_us - msg->publish_us);
+        msg->msg_id = 0;
+        stats.in_flight--;
+        break;
+    case MQTT_EVENT_DELETED:
+        // Outbox expired the message, it will never be acked
+        msg = mqtt_stats_find(event->msg_id);
+        if(msg != NULL && !msg->acked) {
+            stats.expired++;
+            msg->msg_id = 0;
+            stats.in_flight--;
+        }
+        break;
+    case MQTT_EVENT_BEFORE_CONNECT:
+        stats.connect_attempts++;
+        connect_start_us = now_us;
+        break;
+    case MQTT_EVENT_CONNECTED:
+        if(connect_start_us != 0) {
+            stats.connects++;
+            mqtt_stats_record(stats.connect_hist, &stats.connect_max_ms, now_us - connect_start_us);
+            stats.connect_last_ms = (now_us - connect_start_us) / 1000;
+            connect_start_us = 0;
+        }
+        break;
+    case MQTT_EVENT_DISCONNECTED:
+        // Messages in flight stay in the outbox and are resent after reconnecting, their ack latency includes
+        // the reconnect. Those that expire meanwhile are counted by MQTT_EVENT_DELETED.
+        stats.disconnects++;
+        stats.interrupted += stats.in_flight;
+        // A failed attempt is not timed
+        connect_start_us = 0;
+        break;
+    case MQTT_EVENT_ERROR:
+        stats.errors++;
+        break;
+    default:
+        break;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void mqtt_stats_tls_handshake(bool resumed, int64_t duration_us)
+{
+    portENTER_CRITICAL(&stats_lock);
+    if(resumed) {
+        stats.tls_resumed++;
+        stats.tls_resumed_last_ms = duration_us / 1000;
+    } else {
+        stats.tls_full++;
+        stats.tls_full_last_ms = duration_us / 1000;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void mqtt_stats_get(struct mqtt_stats *out)
+{
+    portENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void mqtt_stats_reset(void)
+{
+    uint32_t in_flight;
+
+    portENTER_CRITICAL(&stats_lock);
+    in_flight = stats.in_flight;
+    memset(&stats, 0, sizeof stats);
+    stats.in_flight = in_flight;
+    stats.in_flight_max = in_flight;
+    stats.since_us = esp_timer_get_time();
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+void mqtt_stats_log(void)
+{
+    struct mqtt_stats s;
+    int64_t elapsed_ms;
+
+    mqtt_stats_get(&s);
+    elapsed_ms = (esp_timer_get_time() - s.since_us) / 1000;
+
+    ESP_LOGI(TAG, "MQTT stats over %lld s: published=%u failed=%u acked=%u expired=%u untracked=%u "
+        "in_flight=%u (max %u) disconnects=%u (interrupted %u) errors=%u connects=%u/%u (last %u ms)",
+        (long long)(elapsed_ms / 1000), (unsigned)s.published, (unsigned)s.failed, (unsigned)s.acked,
+        (unsigned)s.expired, (unsigned)s.untracked, (unsigned)s.in_flight, (unsigned)s.in_flight_max,
+        (unsigned)s.disconnects, (unsigned)s.interrupted, (unsigned)s.errors, (unsigned)s.connects, (unsigned)s.connect_attempts,
+        (unsigned)s.connect_last_ms);
+    ESP_LOGI(TAG, "MQTT stats: bytes_sent=%llu (%llu B/s)", (unsigned long long)s.bytes_sent,
+        (unsigned long long)(elapsed_ms > 0 ? s.bytes_sent * 1000 / elapsed_ms : 0));
+    ESP_LOGI(TAG, "MQTT stats: tls handshakes full=%u (last %u ms) resumed=%u (last %u ms)",
+        (unsigned)s.tls_full, (unsigned)s.tls_full_last_ms, (unsigned)s.tls_resumed, (unsigned)s.tls_resumed_last_ms);
+
+    mqtt_stats_log_hist("write", s.write_hist, s.write_max_ms);
+    mqtt_stats_log_hist("ack", s.ack_hist, s.ack_max_ms);
+    mqtt_stats_log_hist("connect", s.connect_hist, s.connect_max_ms);
+}
+
+void mqtt_stats_log_periodic(int64_t now_ms)
+{
+    if(MQTT_STATS_LOG_INTERVAL_MS == 0 || now_ms - last_log_ms < MQTT_STATS_LOG_INTERVAL_MS) {
+        return;
+    }
+
+    last_log_ms = now_ms;
+    mqtt_stats_log();
+}
+
+static void mqtt_stats_record(uint32_t *hist, uint32_t *max_ms, int64_t latency_us)
+{
+    uint32_t latency_ms = latency_us / 1000;
+    int i;
+
+    for(i = 0; i < MQTT_STATS_NUM_BUCKETS - 1; i++) {
+        if(latency_ms < bucket_limits_ms[i]) {
+            break;
+        }
+    }
+
+    hist[i]++;
+    if(latency_ms > *max_ms) {
+        *max_ms = latency_ms;
+    }
+}
+
+static void mqtt_stats_track(int msg_id, int64_t time_us, bool acked)
+{
+    struct tracked_msg *slot = NULL;
+    int i;
+
+    for(i = 0; i < MQTT_STATS_MAX_TRACKED; i++) {
+        if(tracked[i].msg_id == 0) {
+            slot = &tracked[i];
+            break;
+        }
+        // Remember the oldest in case there is no free slot
+        if(slot == NULL || tracked[i].publish_us < slot->publish_us) {
+            slot = &tracked[i];
+        }
+    }
+
+    if(slot->msg_id != 0) {
+        stats.untracked++;
+        if(!slot->acked) {
+            stats.in_flight--;
+        }
+    }
+
+    slot->msg_id = msg_id;
+    slot->publish_us = time_us;
+    slot->acked = acked;
+    if(acked) {
+        return;
+    }
+    stats.in_flight++;
+    if(stats.in_flight > stats.in_flight_max) {
+        stats.in_flight_max = stats.in_flight;
+    }
+}
+
+static struct tracked_msg *mqtt_stats_find(int msg_id)
+{
+    int i;
+
+    if(msg_id == 0) {
+        return NULL;
+    }
+
+    for(i = 0; i < MQTT_STATS_MAX_TRACKED; i++) {
+        if(tracked[i].msg_id == msg_id) {
+            return &tracked[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void mqtt_stats_log_hist(const char *name, const uint32_t *hist, uint32_t max_ms)
+{
+    ESP_LOGI(TAG, "MQTT %s latency ms <5:%u <10:%u <25:%u <50:%u <100:%u <250:%u <500:%u <1000:%u <2500:%u "
+        "<5000:%u >=5000:%u max:%u", name,
+        (unsigned)hist[0], (unsigned)hist[1], (unsigned)hist[2], (unsigned)hist[3], (unsigned)hist[4],
+        (unsigned)hist[5], (unsigned)hist[6], (unsigned)hist[7], (unsigned)hist[8], (unsigned)hist[9],
+        (unsigned)hist[10], (unsigned)max_ms);
+}
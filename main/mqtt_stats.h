@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "mqtt_client.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Outgoing QoS 1/2 messages that are tracked until acked, the oldest is evicted when more are in flight
+#define MQTT_STATS_MAX_TRACKED      16
+// Latency buckets, upper limits in ms: 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000 and everything above
+#define MQTT_STATS_NUM_BUCKETS      11
+// Interval of the periodic log dump, 0 disables it
+#define MQTT_STATS_LOG_INTERVAL_MS  CONFIG_MQTT_STATS_LOG_INTERVAL_MS
+
+/**
+ *  Publish statistics since boot or the last mqtt_stats_reset().
+ *  Write latency is the time spent in esp_mqtt_client_publish(), the only latency there is for QoS 0.
+ *  Ack latency is from publish to MQTT_EVENT_PUBLISHED for QoS 1/2, a message that is resent after a
+ *  reconnect keeps its original publish time. An ack that arrives before esp_mqtt_client_publish() returned
+ *  is matched once the publish is recorded.
+ *  Connect latency is from MQTT_EVENT_BEFORE_CONNECT to MQTT_EVENT_CONNECTED: TCP connect, the TLS handshake and
+ *  the MQTT CONNECT. With tls_transport.h a reconnect offers the session of the last handshake, the handshake
+ *  counters and their last duration show how many were resumed and what that saved.
+*/
+struct mqtt_stats {
+    uint32_t published;             // messages accepted by esp_mqtt_client_publish()
+    uint32_t failed;                // publish calls that returned an error, message not sent
+    uint32_t acked;                 // MQTT_EVENT_PUBLISHED matched to a tracked message
+    uint32_t expired;               // tracked messages deleted from the outbox before they were acked
+    uint32_t untracked;             // tracked messages evicted or acks that matched no published message
+    uint32_t disconnects;
+    uint32_t interrupted;           // messages in flight at a disconnect, resent from the outbox after reconnecting
+    uint32_t errors;                // MQTT_EVENT_ERROR
+    uint32_t connect_attempts;      // MQTT_EVENT_BEFORE_CONNECT
+    uint32_t connects;              // attempts that reached MQTT_EVENT_CONNECTED
+    uint32_t connect_last_ms;       // latency of the last connection
+    uint32_t tls_full;              // TLS handshakes with certificate exchange
+    uint32_t tls_resumed;           // TLS handshakes that resumed the previous session
+    uint32_t tls_full_last_ms;      // duration of the last handshake of each kind
+    uint32_t tls_resumed_last_ms;
+    uint32_t in_flight;             // tracked messages waiting for an ack
+    uint32_t in_flight_max;
+    uint64_t bytes_sent;            // payload bytes of published messages
+    uint32_t write_hist[MQTT_STATS_NUM_BUCKETS];
+    uint32_t ack_hist[MQTT_STATS_NUM_BUCKETS];
+    uint32_t connect_hist[MQTT_STATS_NUM_BUCKETS];
+    uint32_t write_max_ms;
+    uint32_t ack_max_ms;
+    uint32_t connect_max_ms;
+    int64_t since_us;               // esp_timer time the statistics were reset
+};
+
+/**
+ *  Drop-in replacement for esp_mqtt_client_publish() that records the message
+ * @return  msg_id returned by esp_mqtt_client_publish()
+*/
+int mqtt_stats_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain);
+
+/// Feed every event of the client, matches acks, outbox deletions, connects, disconnects and errors
+void mqtt_stats_event(esp_mqtt_event_handle_t event);
+
+/// Count a completed TLS handshake that took @param duration_us, called by the transport
+void mqtt_stats_tls_handshake(bool resumed, int64_t duration_us);
+
+/// Copy a consistent snapshot of the statistics
+void mqtt_stats_get(struct mqtt_stats *stats);
+
+/// Clear counters and histograms, messages in flight stay tracked
+void mqtt_stats_reset(void);
+
+/// Log the statistics
+void mqtt_stats_log(void);
+
+/// Log the statistics if MQTT_STATS_LOG_INTERVAL_MS has passed since the last time, call periodically
+void mqtt_stats_log_periodic(int64_t now_ms);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,203 +1,414 @@
+#include <stdlib.h>
 #include <string.h>
 #include "nvs_flash.h"
+#include "esp_timer.h"
 #include "my_nvs.h"
 #include "mqtt.h"
 #include "ble_prov_gatt.h"
+#include "credentials.h"
+#include "nvs_batch.h"
+#include "nvs_ops.h"
 
-esp_err_t nvs_get_wifi_data(uint8_t *ssid_output, uint8_t *pwd_output)
+static struct device_config config;
+static bool config_loaded = false;
+
+/// Read string to the cache, a key that is not set reads as an empty string
+static esp_err_t nvs_config_read_str(nvs_handle_t handle, const char *key, char *out_value, size_t size);
+
+/// Stage string of the cache, an empty string erases the key
+static void nvs_config_stage_str(struct nvs_batch *batch, const char *key, const char *in_value);
+
+esp_err_t nvs_config_load(void)
 {
+    int64_t start_us = esp_timer_get_time();
+    struct device_config loaded;
     nvs_handle_t nvs_handle;
     esp_err_t err;
-    size_t output_len;
 
-    err = nvs_open_and_print(&nvs_handle, NVS_NAMESPACE, NVS_READWRITE);
-    if(err != ESP_OK) {
+    memset(&loaded, 0, sizeof loaded);
+
+    printf("Loading device config... ");
+    err = nvs_batch_open(NVS_SET_CONFIG, &nvs_handle);
+    if(err == ESP_ERR_NVS_NOT_FOUND) {
+        // Namespace is created by the first write, nothing provisioned yet
+        config = loaded;
+        config_loaded = true;
+        printf("Not provisioned.\n");
+        return ESP_OK;
+    } else if(err != ESP_OK) {
+        printf("Error (%s) opening NVS handle %s!\n", esp_err_to_name(err), NVS_SET_CONFIG);
         return err;
     }
 
-    output_len = WIFI_SSID_MAX_SIZE;
-    err = nvs_get_str_and_print(nvs_handle, NVS_KEY_WIFI_SSID, (char *)ssid_output, &output_len);
-    if(err != ESP_OK) {
-        nvs_close(nvs_handle);
-        return err;
+    err = nvs_config_read_str(nvs_handle, NVS_KEY_WIFI_SSID, loaded.ssid, sizeof loaded.ssid);
+    if(err == ESP_OK) {
+        err = nvs_config_read_str(nvs_handle, NVS_KEY_WIFI_PWD, loaded.pwd, sizeof loaded.pwd);
+    }
+    if(err == ESP_OK) {
+        err = nvs_config_read_str(nvs_handle, NVS_KEY_AWS_UUID, loaded.aws_uuid, sizeof loaded.aws_uuid);
+    }
+    if(err == ESP_OK) {
+        err = nvs_config_read_str(nvs_handle, NVS_KEY_AWS_THING_NAME, loaded.thing_name, sizeof loaded.thing_name);
     }
 
-    output_len = WIFI_PWD_MAX_SIZE;
-    err = nvs_get_str_and_print(nvs_handle, NVS_KEY_WIFI_PWD, (char *)pwd_output, &output_len);
+    // CLOSE NVS HANDLE
+    nvs_close(nvs_handle);
     if(err != ESP_OK) {
-        nvs_close(nvs_handle);
         return err;
     }
 
-    // CLOSE NVS HANDLE
-    nvs_close(nvs_handle);
+    config = loaded;
+    config_loaded = true;
+    printf("Done in %lld us.\n", (long long)(esp_timer_get_time() - start_us));
     return ESP_OK;
 }
 
-esp_err_t nvs_erase_wifi_data()
+const struct device_config *nvs_config_get(void)
 {
-    nvs_handle_t nvs_handle;
+    if(!config_loaded) {
+        nvs_config_load();
+    }
+
+    return &config;
+}
+
+esp_err_t nvs_config_flush(const struct device_config *new_config)
+{
+    struct nvs_batch batch;
     esp_err_t err;
 
-    err = nvs_open_and_print(&nvs_handle, NVS_NAMESPACE, NVS_READWRITE);
+    // Whole config is one set, a failed write leaves the previous config in place
+    nvs_batch_begin(&batch, NVS_SET_CONFIG);
+    nvs_config_stage_str(&batch, NVS_KEY_WIFI_SSID, new_config->ssid);
+    nvs_config_stage_str(&batch, NVS_KEY_WIFI_PWD, new_config->pwd);
+    nvs_config_stage_str(&batch, NVS_KEY_AWS_UUID, new_config->aws_uuid);
+    nvs_config_stage_str(&batch, NVS_KEY_AWS_THING_NAME, new_config->thing_name);
+
+    err = nvs_batch_commit(&batch);
     if(err != ESP_OK) {
+        printf("Error (%s) committing device config!\n", esp_err_to_name(err));
         return err;
     }
 
-    err = nvs_erase_key(nvs_handle, NVS_KEY_WIFI_SSID);
-    if(err != ESP_OK) {
-        printf("Error (%s) erasing %s key!\n", esp_err_to_name(err), NVS_KEY_WIFI_SSID);
-        nvs_close(nvs_handle);
-        return err;
+    if(new_config != &config) {
+        config = *new_config;
     }
+    config_loaded = true;
+    return ESP_OK;
+}
 
-    err = nvs_erase_key(nvs_handle, NVS_KEY_WIFI_PWD);
-    if(err != ESP_OK) {
-        printf("Error (%s) erasing %s key!\n", esp_err_to_name(err), NVS_KEY_WIFI_PWD);
-        nvs_close(nvs_handle);
-        return err;
+esp_err_t nvs_get_wifi_data(uint8_t *ssid_output, uint8_t *pwd_output)
+{
+    const struct device_config *cfg = nvs_config_get();
+
+    // ssid can't be empty, an open network has an empty pwd
+    if(cfg->ssid[0] == '\0') {
+        return ESP_ERR_NVS_NOT_FOUND;
     }
 
-    // CLOSE NVS HANDLE
-    nvs_close(nvs_handle);
+    memcpy(ssid_output, cfg->ssid, WIFI_SSID_MAX_SIZE);
+    memcpy(pwd_output, cfg->pwd, WIFI_PWD_MAX_SIZE);
     return ESP_OK;
 }
 
 esp_err_t nvs_set_prov_data(struct prov_data *pdata)
 {
+    struct device_config new_config;
+
+    memset(&new_config, 0, sizeof new_config);
+    memcpy(new_config.ssid, pdata->ssid, sizeof new_config.ssid - 1);
+    memcpy(new_config.pwd, pdata->pwd, sizeof new_config.pwd - 1);
+    memcpy(new_config.aws_uuid, pdata->aws_uuid, sizeof new_config.aws_uuid - 1);
+    memcpy(new_config.thing_name, pdata->aws_thing, sizeof new_config.thing_name - 1);
+    return nvs_config_flush(&new_config);
+}
+
+esp_err_t nvs_get_tls_certs(
+    struct tls_certs *certs, const char* server_cert_nvs_key,
+    const char* client_cert_nvs_key, const char* client_key_nvs_key
+)
+{
+    const char *keys[] = { server_cert_nvs_key, client_cert_nvs_key, client_key_nvs_key };
+    const uint8_t *der[3];
+    size_t der_len[3];
+    size_t lens[3];
+    char *blobs[3];
+    int ret;
     nvs_handle_t nvs_handle;
+    nvs_handle_t set_handle;
+    nvs_handle_t handles[3];
     esp_err_t err;
+    size_t total = 0;
+    size_t output_len;
+    char *buf;
+    int i;
 
-    err = nvs_open_and_print(&nvs_handle, NVS_NAMESPACE, NVS_READWRITE);
+    err = nvs_open_and_print(&nvs_handle, NVS_NAMESPACE, NVS_READONLY);
     if(err != ESP_OK) {
         return err;
     }
 
-    err = nvs_set_str_and_print(nvs_handle, NVS_KEY_WIFI_SSID, (char *)(pdata->ssid));
+    // Connection certificate and key are in the tls set, server and claim certificates are stored before app's execution
+    err = nvs_batch_open(NVS_SET_TLS, &set_handle);
     if(err != ESP_OK) {
         nvs_close(nvs_handle);
         return err;
     }
 
-    err = nvs_set_str_and_print(nvs_handle, NVS_KEY_WIFI_PWD, (char *)(pdata->pwd));
-    if(err != ESP_OK) {
-        nvs_close(nvs_handle);
-        return err;
+    // Probe lengths, a NULL buffer only returns the length of the blob
+    for(i = 0; i < 3; i++) {
+        lens[i] = 0;
+        handles[i] = set_handle;
+        err = nvs_ops_get_blob(set_handle, keys[i], NULL, &lens[i]);
+        if(err == ESP_ERR_NVS_NOT_FOUND) {
+            handles[i] = nvs_handle;
+            err = nvs_ops_get_blob(nvs_handle, keys[i], NULL, &lens[i]);
+        }
+        if(err != ESP_OK) {
+            printf("Error (%s) getting %s!\n", esp_err_to_name(err), keys[i]);
+            nvs_close(set_handle);
+            nvs_close(nvs_handle);
+            return err;
+        }
+        total += lens[i] + 1;
     }
 
-    err = nvs_set_str_and_print(nvs_handle, NVS_KEY_AWS_UUID, (char *)(pdata->aws_uuid));
-    if(err != ESP_OK) {
+    buf = malloc(total);
+    if(buf == NULL) {
+        printf("Error allocating %d bytes for certificates!\n", (int)total);
+        nvs_close(set_handle);
         nvs_close(nvs_handle);
-        return err;
+        return ESP_ERR_NO_MEM;
     }
 
-    err = nvs_set_str_and_print(nvs_handle, NVS_KEY_AWS_THING_NAME, (char *)(pdata->aws_thing));
-    if(err != ESP_OK) {
-        nvs_close(nvs_handle);
-        return err;
+    blobs[0] = buf;
+    for(i = 0; i < 3; i++) {
+        output_len = lens[i];
+        err = nvs_get_blob_and_print(handles[i], keys[i], blobs[i], &output_len);
+        if(err != ESP_OK) {
+            free(buf);
+            nvs_close(set_handle);
+            nvs_close(nvs_handle);
+            return err;
+        }
+        blobs[i][lens[i]] = '\0';
+        if(i < 2) {
+            blobs[i + 1] = blobs[i] + lens[i] + 1;
+        }
     }
 
-    // CLOSE NVS HANDLE
+    // SUCCESS!
+    // Close handles
+    nvs_close(set_handle);
     nvs_close(nvs_handle);
+
+    // Stored as DER or PEM, DER is used as is
+    for(i = 0; i < 3; i++) {
+        ret = credentials_check(blobs[i], lens[i], &der[i], &der_len[i]);
+        if(ret < 0) {
+            printf("Error %s is corrupted!\n", keys[i]);
+            free(buf);
+            return ESP_FAIL;
+        } else if(ret == CREDENTIALS_FORMAT_DER) {
+            blobs[i] = (char *)der[i];
+            lens[i] = der_len[i];
+        } else {
+            // A blob may have been stored with its NUL, only count up to the first one
+            lens[i] = strnlen(blobs[i], lens[i]) + 1;
+        }
+    }
+
+    nvs_free_tls_certs(certs);
+    certs->buf = buf;
+    certs->server_cert = blobs[0];
+    certs->server_cert_len = lens[0];
+    certs->client_cert = blobs[1];
+    certs->client_cert_len = lens[1];
+    certs->client_key = blobs[2];
+    certs->client_key_len = lens[2];
     return ESP_OK;
 }
 
-esp_err_t nvs_get_tls_certs(
-    char *server_cert, const char* server_cert_nvs_key,
-    char *client_cert, const char* client_cert_nvs_key,
-    char *client_key, const char* client_key_nvs_key
+void nvs_free_tls_certs(struct tls_certs *certs)
+{
+    free(certs->buf);
+    memset(certs, 0, sizeof *certs);
+}
+
+esp_err_t nvs_set_tls_certs(
+    const void *client_cert, size_t client_cert_len, const char* client_cert_nvs_key,
+    const void *client_key, size_t client_key_len, const char* client_key_nvs_key
 )
 {
+    struct nvs_batch batch;
+
+    // Certificate and key are one set, a key never gets paired with the certificate of an other generation
+    nvs_batch_begin(&batch, NVS_SET_TLS);
+    nvs_batch_set_blob(&batch, client_cert_nvs_key, client_cert, client_cert_len);
+    nvs_batch_set_blob(&batch, client_key_nvs_key, client_key, client_key_len);
+    return nvs_batch_commit(&batch);
+}
+
+esp_err_t nvs_get_wifi_ap_cache(struct wifi_ap_cache *ap)
+{
+    size_t length = sizeof *ap;
     nvs_handle_t nvs_handle;
     esp_err_t err;
-    size_t output_len;
 
-    err = nvs_open_and_print(&nvs_handle, NVS_NAMESPACE, NVS_READWRITE);
+    err = nvs_ops_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle);
     if(err != ESP_OK) {
         return err;
     }
 
-    output_len = SERVER_CERT_MAX_SIZE;
-    err = nvs_get_blob_and_print(nvs_handle, server_cert_nvs_key, server_cert, &output_len);
-    if(err != ESP_OK) {
-        nvs_close(nvs_handle);
-        return err;
-    } 
+    err = nvs_ops_get_blob(nvs_handle, NVS_KEY_WIFI_AP, ap, &length);
+    nvs_close(nvs_handle);
+    if(err == ESP_OK && length != sizeof *ap) {
+        // Written by an other version of the struct
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
 
-    output_len = CLIENT_CERT_MAX_SIZE;
-    err = nvs_get_blob_and_print(nvs_handle, client_cert_nvs_key, client_cert, &output_len);
+    return err;
+}
+
+esp_err_t nvs_set_wifi_ap_cache(const struct wifi_ap_cache *ap)
+{
+    struct wifi_ap_cache current;
+    nvs_handle_t nvs_handle;
+    esp_err_t err;
+
+    // Same AP on every boot is the common case, don't wear the flash with it
+    if(nvs_get_wifi_ap_cache(&current) == ESP_OK && memcmp(&current, ap, sizeof current) == 0) {
+        return ESP_OK;
+    }
+
+    err = nvs_ops_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
     if(err != ESP_OK) {
-        nvs_close(nvs_handle);
         return err;
     }
 
-    output_len = CLIENT_KEY_SIZE;
-    err = nvs_get_blob_and_print(nvs_handle, client_key_nvs_key, client_key, &output_len);
-    if(err != ESP_OK) {
+    err = nvs_ops_set_blob(nvs_handle, NVS_KEY_WIFI_AP, ap, sizeof *ap);
+    if(err == ESP_OK) {
+        err = nvs_ops_commit(nvs_handle);
+    }
+
+    nvs_close(nvs_handle);
+    return err;
+}
+
+esp_err_t nvs_get_wifi_aps(struct wifi_aps *aps)
+{
+    const struct device_config *cfg = nvs_config_get();
+    size_t length = sizeof *aps;
+    nvs_handle_t nvs_handle;
+    esp_err_t err;
+
+    memset(aps, 0, sizeof *aps);
+
+    err = nvs_ops_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle);
+    if(err == ESP_OK) {
+        err = nvs_ops_get_blob(nvs_handle, NVS_KEY_WIFI_APS, aps, &length);
         nvs_close(nvs_handle);
+    }
+
+    if(err == ESP_ERR_NVS_NOT_FOUND || (err == ESP_OK && (length != sizeof *aps || aps->count > WIFI_APS_MAX))) {
+        // No list yet, or one of an other WIFI_APS_MAX
+        memset(aps, 0, sizeof *aps);
+    } else if(err != ESP_OK) {
         return err;
     }
 
-    // SUCCESS!
-    // Close handle
-    nvs_close(nvs_handle);
+    if(cfg->ssid[0] == '\0') {
+        return aps->count > 0 ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    wifi_aps_add(aps, cfg->ssid, cfg->pwd);
     return ESP_OK;
 }
 
-esp_err_t nvs_set_tls_certs(
-    const char *client_cert, const char* client_cert_nvs_key,
-    const char *client_key, const char* client_key_nvs_key
-)
+esp_err_t nvs_set_wifi_aps(const struct wifi_aps *aps)
 {
+    struct wifi_aps *current;
     nvs_handle_t nvs_handle;
+    size_t length = sizeof *current;
     esp_err_t err;
-    size_t input_len;
 
-    err = nvs_open_and_print(&nvs_handle, NVS_NAMESPACE, NVS_READWRITE);
+    err = nvs_ops_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
     if(err != ESP_OK) {
         return err;
     }
 
-    input_len = strlen((char*)client_cert);
-    err = nvs_set_blob_and_print(nvs_handle, client_cert_nvs_key, client_cert, input_len);
-    if(err != ESP_OK) {
+    // Connection history changes slowly, don't rewrite an unchanged list
+    current = malloc(sizeof *current);
+    if(current != NULL && nvs_ops_get_blob(nvs_handle, NVS_KEY_WIFI_APS, current, &length) == ESP_OK
+        && length == sizeof *current && memcmp(current, aps, sizeof *current) == 0) {
+        free(current);
         nvs_close(nvs_handle);
-        return err;
+        return ESP_OK;
     }
+    free(current);
 
-    input_len = strlen((char*)client_key);
-    err = nvs_set_blob_and_print(nvs_handle, client_key_nvs_key, client_key, input_len);
-    if(err != ESP_OK) {
-        nvs_close(nvs_handle);
-        return err;
+    err = nvs_ops_set_blob(nvs_handle, NVS_KEY_WIFI_APS, aps, sizeof *aps);
+    if(err == ESP_OK) {
+        err = nvs_ops_commit(nvs_handle);
     }
 
-    // SUCCESS!
-    // Close handle
     nvs_close(nvs_handle);
-    return ESP_OK;
+    return err;
 }
 
-esp_err_t nvs_get_thing_name(char *thing_name)
+esp_err_t nvs_seq_reserve(uint32_t *next, uint32_t *limit)
 {
+    size_t length = sizeof(uint32_t);
     nvs_handle_t nvs_handle;
+    uint32_t stored = 0;
+    uint32_t new_limit;
     esp_err_t err;
-    size_t output_len;
 
-    err = nvs_open_and_print(&nvs_handle, NVS_NAMESPACE, NVS_READWRITE);
+    err = nvs_ops_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
     if(err != ESP_OK) {
         return err;
     }
 
-    output_len = AWS_THING_NAME_MAX_SIZE;
-    err = nvs_get_str_and_print(nvs_handle, NVS_KEY_AWS_THING_NAME, thing_name, &output_len);
+    if(*limit == 0) {
+        // First reservation of this boot, continue after everything an earlier boot reserved
+        err = nvs_ops_get_blob(nvs_handle, NVS_KEY_SEQ_NEXT, &stored, &length);
+        if(err == ESP_ERR_NVS_NOT_FOUND) {
+            stored = 0;
+        } else if(err != ESP_OK || length != sizeof stored) {
+            nvs_close(nvs_handle);
+            return err != ESP_OK ? err : ESP_FAIL;
+        }
+        new_limit = stored + NVS_SEQ_BLOCK;
+    } else {
+        new_limit = *limit + NVS_SEQ_BLOCK;
+    }
+
+    err = nvs_ops_set_blob(nvs_handle, NVS_KEY_SEQ_NEXT, &new_limit, sizeof new_limit);
+    if(err == ESP_OK) {
+        err = nvs_ops_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+
     if(err != ESP_OK) {
-        nvs_close(nvs_handle);
         return err;
     }
 
-    // CLOSE NVS HANDLE
-    nvs_close(nvs_handle);
+    if(*limit == 0) {
+        *next = stored;
+    }
+    *limit = new_limit;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_thing_name(char *thing_name)
+{
+    const struct device_config *cfg = nvs_config_get();
+
+    if(cfg->thing_name[0] == '\0') {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    memcpy(thing_name, cfg->thing_name, AWS_THING_NAME_MAX_SIZE);
     return ESP_OK;
 }
 
@@ -207,7 +418,7 @@ esp_err_t nvs_open_and_print(nvs_handle_t *out_handle, const char *nvs_namespace
 
     printf("Opening Non-Volatile Storage (NVS) handle %s... ", nvs_namespace);
 
-    err = nvs_open(nvs_namespace, open_mode, out_handle);
+    err = nvs_ops_open(nvs_namespace, open_mode, out_handle);
     if (err != ESP_OK) {
         printf("Error (%s) opening NVS handle %s!\n", esp_err_to_name(err), nvs_namespace);
     } else {
@@ -223,7 +434,7 @@ esp_err_t nvs_set_str_and_print(nvs_handle_t handle, const char *key, const char
 
     printf("Setting %s... ", key);
 
-    err = nvs_set_str(handle, key, in_value);
+    err = nvs_ops_set_str(handle, key, in_value);
     if(err != ESP_OK) {
         printf("Error (%s) setting %s!\n", esp_err_to_name(err), key);
     } else {
@@ -239,7 +450,7 @@ esp_err_t nvs_get_str_and_print(nvs_handle_t handle, const char *key, char *out_
 
     printf("Getting %s... ", key);
 
-    err = nvs_get_str(handle, key, out_value, max_length);
+    err = nvs_ops_get_str(handle, key, out_value, max_length);
     if (err != ESP_OK) {
         printf("Error (%s) getting %s!\n", esp_err_to_name(err), key);
     } else {
@@ -255,7 +466,7 @@ esp_err_t nvs_set_blob_and_print(nvs_handle_t handle, const char *key, const voi
 
     printf("Setting %s... ", key);
 
-    err = nvs_set_blob(handle, key, in_value, length);
+    err = nvs_ops_set_blob(handle, key, in_value, length);
     if(err != ESP_OK) {
         printf("Error (%s) setting %s!\n", esp_err_to_name(err), key);
     } else {
@@ -271,7 +482,7 @@ esp_err_t nvs_get_blob_and_print(nvs_handle_t handle, const char *key, char *out
 
     printf("Getting %s... ", key);
 
-    err = nvs_get_blob(handle, key, out_value, max_length);
+    err = nvs_ops_get_blob(handle, key, out_value, max_length);
     if (err != ESP_OK) {
         printf("Error (%s) getting %s!\n", esp_err_to_name(err), key);
     } else {
@@ -279,4 +490,29 @@ esp_err_t nvs_get_blob_and_print(nvs_handle_t handle, const char *key, char *out
     }
 
     return err;
-}
\ No newline at end of file
+}
+
+static esp_err_t nvs_config_read_str(nvs_handle_t handle, const char *key, char *out_value, size_t size)
+{
+    esp_err_t err;
+
+    err = nvs_ops_get_str(handle, key, out_value, &size);
+    if(err == ESP_ERR_NVS_NOT_FOUND) {
+        out_value[0] = '\0';
+        return ESP_OK;
+    } else if(err != ESP_OK) {
+        printf("Error (%s) getting %s!\n", esp_err_to_name(err), key);
+    }
+
+    return err;
+}
+
+static void nvs_config_stage_str(struct nvs_batch *batch, const char *key, const char *in_value)
+{
+    // The batch holds at most four config keys, staging can't fail
+    if(in_value[0] != '\0') {
+        nvs_batch_set_str(batch, key, in_value);
+    } else {
+        nvs_batch_erase(batch, key);
+    }
+}
@@ -5,6 +5,7 @@
 #include "nvs_flash.h"
 #include "main.h"
 #include "ble_prov_gatt.h"
+#include "wifi_aps.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -16,6 +17,21 @@ extern "C" {
 #define NVS_KEY_AWS_UUID            "aws_uuid"
 #define NVS_KEY_AWS_THING_NAME      "aws_thing"
 
+// Last AP the device got an ip from, see struct wifi_ap_cache
+#define NVS_KEY_WIFI_AP             "wifi_ap"
+
+// Known APs with their connection history, see wifi_aps.h
+#define NVS_KEY_WIFI_APS            "wifi_aps"
+
+// First sample sequence number no boot has used yet, see nvs_seq_reserve()
+#define NVS_KEY_SEQ_NEXT            "seq_next"
+// Sequence numbers reserved with one write
+#define NVS_SEQ_BLOCK               1024
+
+// Sets of keys that are always written together, see nvs_batch.h
+#define NVS_SET_CONFIG              "config"
+#define NVS_SET_TLS                 "tls"
+
 // AmazonCA1.pem
 #define NVS_KEY_SERVER_CERT         "server_cert"
 
@@ -28,62 +44,157 @@ extern "C" {
 #define NVS_KEY_CON_CLIENT_KEY      "con_client_key"
 
 /**
- * Gets wifi ssid and pwd that are stored in nvs 
+ *  Device configuration, loaded from NVS with a single open at boot and served from RAM afterwards.
+ *  This saves opens, not reads: the load reads every key, including aws_uuid which the boot does not need.
+ *  A string is empty when its key is not set.
+*/
+struct device_config {
+    char ssid[WIFI_SSID_MAX_SIZE];
+    char pwd[WIFI_PWD_MAX_SIZE];
+    char aws_uuid[AWS_UUID_MAX_SIZE];
+    char thing_name[AWS_THING_NAME_MAX_SIZE];
+};
+
+/**
+ *  Load device configuration from NVS, call once at boot after nvs_flash_init()
+ * @return  ESP_OK on success, also when nothing has been provisioned yet,
+ *          error of NVS on failure
+*/
+esp_err_t nvs_config_load(void);
+
+/// Device configuration cache, loads it first if that has not been done yet
+const struct device_config *nvs_config_get(void);
+
+/**
+ *  Write device configuration to NVS as one batch, empty strings erase their key.
+ *  Readers see either the old or the new configuration, the cache is only updated once the write succeeded.
+ * @return  ESP_OK on success,
+ *          error of NVS on failure
+*/
+esp_err_t nvs_config_flush(const struct device_config *config);
+
+/**
+ * Gets wifi ssid and pwd from the device configuration cache
  * @return  ESP_OK on success,
  *          ESP_ERR_NVS_NOT_FOUND when no value for either key (ssid and pwd not set)
  *          ESP_fail on failure
 */
 esp_err_t nvs_get_wifi_data(uint8_t *ssid_output, uint8_t *pwd_output);
 
-
-/// @brief Erases wifi data from nvs storage
-/// @return ESP_OK on success, ESP_FAIL on failure
-esp_err_t nvs_erase_wifi_data();
-
 /**
- * Saves provisioning data to nvs 
+ * Saves provisioning data to nvs with nvs_config_flush()
  * @return  ESP_OK on success,
  *          ESP_fail on failure
 */
 esp_err_t nvs_set_prov_data(struct prov_data *pdata);
 
 /**
- * Gets tls certificates from stored in nvs
- * @param server_cert buffer capable holding a pem certificate
- * @param server_cert_nvs_key nvs key of @param server_cert
- * 
- * @param client_cert buffer capable holding a pem certificate
- * @param client_cert_nvs_key nvs key of @param client_cert
- * 
- * @param client_key buffer capable holding a pem certificate
- * @param client_key_nvs_key nvs key of @param client_key
+ *  TLS credentials loaded by nvs_get_tls_certs().
+ *  All three live in one allocation of the exact size, each NUL-terminated since the blobs are stored without one.
+ *  Lengths of PEM include the NUL, which is what esp-mqtt expects for PEM,
+ *  a credential stored as DER (see credentials.h) points past its header and has the exact DER length.
+*/
+struct tls_certs {
+    char *buf;                  // the allocation, NULL when nothing is loaded
+    const char *server_cert;
+    size_t server_cert_len;
+    const char *client_cert;
+    size_t client_cert_len;
+    const char *client_key;
+    size_t client_key_len;
+};
+
+/**
+ * Gets tls certificates from stored in nvs, the length of every blob is probed first
+ * @param certs filled in on success, free with nvs_free_tls_certs()
+ * @param server_cert_nvs_key nvs key of the server certificate
+ * @param client_cert_nvs_key nvs key of the client certificate
+ * @param client_key_nvs_key nvs key of the client key
  * 
  * @return  ESP_OK on successful retrieval of certificates
  *          ESP_ERR_NVS_NOT_FOUND when any nvs key has no value
+ *          ESP_ERR_NO_MEM when the certificates could not be allocated
  *          ESP_FAIL on failure
 */
 esp_err_t nvs_get_tls_certs(
-    char *server_cert, const char* server_cert_nvs_key,
-    char *client_cert, const char* client_cert_nvs_key,
-    char *client_key, const char* client_key_nvs_key);
+    struct tls_certs *certs, const char* server_cert_nvs_key,
+    const char* client_cert_nvs_key, const char* client_key_nvs_key);
+
+/// Free certificates loaded by nvs_get_tls_certs()
+void nvs_free_tls_certs(struct tls_certs *certs);
 
 /**
- * Sets tls cetificates to nvs storage
- * @param client_cert buffer containing the pem certificate
+ * Sets tls cetificates to nvs storage as one batch, readers never see a certificate with the key of an other one
+ * @param client_cert buffer containing the certificate, PEM text or DER with a credentials_header
+ * @param client_cert_len length of @param client_cert
  * @param client_cert_nvs_key nvs key of @param client_cert
  * 
- * @param client_key buffer containing the pem certificate
+ * @param client_key buffer containing the key, PEM text or DER with a credentials_header
+ * @param client_key_len length of @param client_key
  * @param client_key_nvs_key nvs key of @param client_key
  * 
  * @return  ESP_OK on success
  *          ESP_FAIL on failure
 */
 esp_err_t nvs_set_tls_certs(
-    const char *client_cert, const char* client_cert_nvs_key,
-    const char *client_key, const char* client_key_nvs_key);
+    const void *client_cert, size_t client_cert_len, const char* client_cert_nvs_key,
+    const void *client_key, size_t client_key_len, const char* client_key_nvs_key);
+
+/**
+ *  AP of the last successful connection, used to connect without scanning every channel.
+ *  Stored as a blob in NVS_NAMESPACE, only valid while the ssid it was found with is the provisioned ssid.
+*/
+struct wifi_ap_cache {
+    uint32_t ssid_crc;          // crc of the ssid the AP was found with
+    uint8_t bssid[6];
+    uint8_t channel;            // primary channel
+    uint8_t authmode;           // wifi_auth_mode_t of the AP
+};
+
+/**
+ *  Gets the cached AP
+ * @return  ESP_OK on success,
+ *          ESP_ERR_NVS_NOT_FOUND when no AP has been cached
+ *          error of NVS on failure
+*/
+esp_err_t nvs_get_wifi_ap_cache(struct wifi_ap_cache *ap);
+
+/**
+ *  Sets the cached AP, nothing is written when it did not change
+ * @return  ESP_OK on success,
+ *          error of NVS on failure
+*/
+esp_err_t nvs_set_wifi_ap_cache(const struct wifi_ap_cache *ap);
+
+/**
+ *  Gets the known APs. The provisioned ssid and password are always part of the list,
+ *  a device provisioned before the list existed starts with just that AP.
+ * @return  ESP_OK on success,
+ *          ESP_ERR_NVS_NOT_FOUND when wifi has not been provisioned
+ *          error of NVS on failure
+*/
+esp_err_t nvs_get_wifi_aps(struct wifi_aps *aps);
+
+/**
+ *  Sets the known APs, nothing is written when they did not change
+ * @return  ESP_OK on success,
+ *          error of NVS on failure
+*/
+esp_err_t nvs_set_wifi_aps(const struct wifi_aps *aps);
+
+/**
+ *  Reserve the next block of NVS_SEQ_BLOCK sample sequence numbers, so the numbers keep increasing across reboots
+ *  and power loss and the backend can drop duplicates by seq. The rest of a block is skipped on reboot,
+ *  which costs one NVS write per boot plus one per NVS_SEQ_BLOCK samples.
+ * @param next when @param limit is 0 (first call of a boot) set to the first number no earlier boot can have used
+ * @param limit end of the reserved numbers, pass it again once the numbers reach it
+ * @return  ESP_OK on success,
+ *          error of NVS on failure, nothing is reserved past @param limit
+*/
+esp_err_t nvs_seq_reserve(uint32_t *next, uint32_t *limit);
 
 /**
- *  Get thingname from NVS storage
+ *  Get thingname from the device configuration cache
  * @return  ESP_OK on success,
  *          ESP_ERR_NVS_NOT_FOUND when no value for key
  *          ESP_fail on failure
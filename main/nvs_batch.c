@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <string.h>
+#include "nvs_flash.h"
+#include "my_nvs.h"
+#include "nvs_batch.h"
+#include "nvs_ops.h"
+
+// NVS limits namespaces and keys to 15 characters
+#define NVS_NAME_SIZE   16
+
+/// Current slot of a set, remembered after the first lookup
+struct nvs_batch_current {
+    const char *set;        // NULL when the entry is free
+    bool known;             // slot and gen are valid
+    uint8_t slot;           // 0 for <set>_a, 1 for <set>_b
+    uint32_t gen;           // 0 if the set was never committed
+};
+
+static struct nvs_batch_current current[NVS_BATCH_MAX_SETS];
+static struct nvs_batch_stats stats;
+
+/// Remembered slot of @param set, a free (or the oldest) entry is taken for a set that was not looked up yet
+static struct nvs_batch_current *nvs_batch_current(const char *set);
+
+/**
+ *  Find the current slot of @param set, the generation records are only read when it is not remembered
+ *  or, with @param handle, when the remembered slot no longer has the remembered generation.
+ * @param handle when not NULL, set to the current slot opened read only, or not opened if gen is 0
+*/
+static esp_err_t nvs_batch_find(const char *set, nvs_handle_t *handle, struct nvs_batch_current **cur);
+
+/// Open slot namespace read only and read its generation, 0 if a commit to it did not finish
+static esp_err_t nvs_batch_open_slot(const char *set, uint8_t slot, nvs_handle_t *handle, uint32_t *gen);
+
+/// Erase keys of the batch that were stored in NVS_NAMESPACE before the set existed
+static void nvs_batch_erase_legacy(const struct nvs_batch *batch);
+
+/// Name of the slot namespace of @param set
+static void nvs_batch_slot_name(const char *set, uint8_t slot, char *name);
+
+/// Add staged entry
+static esp_err_t nvs_batch_add(struct nvs_batch *batch, const char *key, enum nvs_batch_type type,
+    const void *value, size_t len);
+
+void nvs_batch_begin(struct nvs_batch *batch, const char *set)
+{
+    memset(batch, 0, sizeof *batch);
+    batch->set = set;
+}
+
+esp_err_t nvs_batch_set_str(struct nvs_batch *batch, const char *key, const char *value)
+{
+    return nvs_batch_add(batch, key, NVS_BATCH_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_batch_set_blob(struct nvs_batch *batch, const char *key, const void *value, size_t len)
+{
+    return nvs_batch_add(batch, key, NVS_BATCH_BLOB, value, len);
+}
+
+esp_err_t nvs_batch_erase(struct nvs_batch *batch, const char *key)
+{
+    return nvs_batch_add(batch, key, NVS_BATCH_ERASE, NULL, 0);
+}
+
+esp_err_t nvs_batch_commit(struct nvs_batch *batch)
+{
+    const struct nvs_batch_entry *entry;
+    struct nvs_batch_current *cur;
+    nvs_handle_t nvs_handle;
+    char name[NVS_NAME_SIZE];
+    uint32_t bytes = 0;
+    uint32_t gen;
+    uint8_t slot;
+    esp_err_t err;
+    size_t i;
+
+    err = nvs_batch_find(batch->set, NULL, &cur);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    // NEW GENERATION TO THE OTHER SLOT
+    slot = cur->gen == 0 ? 0 : cur->slot ^ 1;
+    gen = cur->gen + 1;
+    nvs_batch_slot_name(batch->set, slot, name);
+
+    err = nvs_open_and_print(&nvs_handle, name, NVS_READWRITE);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    // Slot is invalid until the new generation record is written
+    err = nvs_ops_erase_key(nvs_handle, NVS_BATCH_GEN_KEY);
+    if(err == ESP_ERR_NVS_NOT_FOUND) {
+        err = ESP_OK;
+    }
+    for(i = 0; err == ESP_OK && i < batch->count; i++) {
+        entry = &batch->entries[i];
+        if(entry->type == NVS_BATCH_STR) {
+            err = nvs_set_str_and_print(nvs_handle, entry->key, entry->value);
+        } else if(entry->type == NVS_BATCH_BLOB) {
+            err = nvs_set_blob_and_print(nvs_handle, entry->key, entry->value, entry->len);
+        } else {
+            err = nvs_ops_erase_key(nvs_handle, entry->key);
+            if(err == ESP_ERR_NVS_NOT_FOUND) {
+                err = ESP_OK;
+            }
+            continue;
+        }
+        bytes += strlen(entry->key) + entry->len;
+    }
+
+    // SWITCH GENERATION, this single write makes the new set current
+    if(err == ESP_OK) {
+        err = nvs_ops_set_blob(nvs_handle, NVS_BATCH_GEN_KEY, &gen, sizeof gen);
+    }
+    if(err == ESP_OK) {
+        err = nvs_ops_commit(nvs_handle);
+    }
+
+    // CLOSE NVS HANDLE
+    nvs_close(nvs_handle);
+    if(err != ESP_OK) {
+        // The generation record may be on flash already, look the slots up again
+        cur->known = false;
+        printf("Error (%s) writing %s, keeping previous generation!\n", esp_err_to_name(err), name);
+        return err;
+    }
+    bytes += strlen(NVS_BATCH_GEN_KEY) + sizeof gen;
+
+    if(cur->gen == 0) {
+        nvs_batch_erase_legacy(batch);
+    }
+    cur->slot = slot;
+    cur->gen = gen;
+
+    stats.commits++;
+    stats.bytes_written += bytes;
+
+    printf("Committed %s generation %u: %u bytes.\n", batch->set, (unsigned)gen, (unsigned)bytes);
+    return ESP_OK;
+}
+
+esp_err_t nvs_batch_open(const char *set, nvs_handle_t *handle)
+{
+    struct nvs_batch_current *cur;
+    esp_err_t err;
+
+    err = nvs_batch_find(set, handle, &cur);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    if(cur->gen == 0) {
+        // Never committed, keys are where older firmware stored them
+        return nvs_ops_open(NVS_NAMESPACE, NVS_READONLY, handle);
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_batch_get_generation(const char *set, uint32_t *gen)
+{
+    struct nvs_batch_current *cur;
+    esp_err_t err;
+
+    err = nvs_batch_find(set, NULL, &cur);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    *gen = cur->gen;
+    return ESP_OK;
+}
+
+void nvs_batch_get_stats(struct nvs_batch_stats *out)
+{
+    *out = stats;
+}
+
+static struct nvs_batch_current *nvs_batch_current(const char *set)
+{
+    struct nvs_batch_current *cur;
+    int i;
+
+    for(i = 0; i < NVS_BATCH_MAX_SETS; i++) {
+        if(current[i].set != NULL && strcmp(current[i].set, set) == 0) {
+            return &current[i];
+        }
+    }
+
+    // Only a cache, an entry that is taken over is looked up again when its set is used next
+    for(i = 0; i < NVS_BATCH_MAX_SETS - 1 && current[i].set != NULL; i++) {
+    }
+    cur = &current[i];
+    memset(cur, 0, sizeof *cur);
+    cur->set = set;
+    return cur;
+}
+
+static esp_err_t nvs_batch_find(const char *set, nvs_handle_t *handle, struct nvs_batch_current **out)
+{
+    struct nvs_batch_current *cur = nvs_batch_current(set);
+    nvs_handle_t handles[2];
+    uint32_t gens[2];
+    bool opened[2];
+    uint8_t slot;
+    esp_err_t err;
+
+    *out = cur;
+    if(cur->known && (handle == NULL || cur->gen == 0)) {
+        return ESP_OK;
+    }
+
+    // Remembered slot, a single namespace is opened
+    if(cur->known) {
+        err = nvs_batch_open_slot(set, cur->slot, handle, &gens[0]);
+        if(err == ESP_OK && gens[0] == cur->gen) {
+            return ESP_OK;
+        } else if(err == ESP_OK) {
+            nvs_close(*handle);
+        } else if(err != ESP_ERR_NVS_NOT_FOUND) {
+            return err;
+        }
+        // NVS was erased since, look again
+        cur->known = false;
+    }
+
+    for(slot = 0; slot < 2; slot++) {
+        err = nvs_batch_open_slot(set, slot, &handles[slot], &gens[slot]);
+        opened[slot] = err == ESP_OK;
+        if(err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+            if(slot == 1 && opened[0]) {
+                nvs_close(handles[0]);
+            }
+            return err;
+        }
+    }
+
+    slot = gens[1] > gens[0];
+    if(opened[slot ^ 1]) {
+        nvs_close(handles[slot ^ 1]);
+    }
+    if(opened[slot] && (handle == NULL || gens[slot] == 0)) {
+        nvs_close(handles[slot]);
+    } else if(opened[slot]) {
+        *handle = handles[slot];
+    }
+
+    cur->known = true;
+    cur->slot = slot;
+    cur->gen = gens[slot];
+    return ESP_OK;
+}
+
+static esp_err_t nvs_batch_open_slot(const char *set, uint8_t slot, nvs_handle_t *handle, uint32_t *gen)
+{
+    char name[NVS_NAME_SIZE];
+    size_t len = sizeof *gen;
+    esp_err_t err;
+
+    *gen = 0;
+    nvs_batch_slot_name(set, slot, name);
+    err = nvs_ops_open(name, NVS_READONLY, handle);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    err = nvs_ops_get_blob(*handle, NVS_BATCH_GEN_KEY, gen, &len);
+    if(err == ESP_ERR_NVS_NOT_FOUND || (err == ESP_OK && len != sizeof *gen)) {
+        *gen = 0;
+        err = ESP_OK;
+    } else if(err != ESP_OK) {
+        nvs_close(*handle);
+    }
+
+    return err;
+}
+
+static void nvs_batch_erase_legacy(const struct nvs_batch *batch)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err;
+    size_t i;
+
+    if(nvs_ops_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle) != ESP_OK) {
+        return;
+    }
+
+    // The set is current now, left over keys would only waste entries
+    for(i = 0; i < batch->count; i++) {
+        err = nvs_ops_erase_key(nvs_handle, batch->entries[i].key);
+        if(err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+            printf("Error (%s) erasing %s key!\n", esp_err_to_name(err), batch->entries[i].key);
+        }
+    }
+    nvs_ops_commit(nvs_handle);
+
+    // CLOSE NVS HANDLE
+    nvs_close(nvs_handle);
+}
+
+static void nvs_batch_slot_name(const char *set, uint8_t slot, char *name)
+{
+    snprintf(name, NVS_NAME_SIZE, "%s_%c", set, slot ? 'b' : 'a');
+}
+
+static esp_err_t nvs_batch_add(struct nvs_batch *batch, const char *key, enum nvs_batch_type type,
+    const void *value, size_t len)
+{
+    struct nvs_batch_entry *entry;
+
+    if(batch->count >= NVS_BATCH_MAX_ENTRIES) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    entry = &batch->entries[batch->count++];
+    entry->key = key;
+    entry->type = type;
+    entry->value = value;
+    entry->len = len;
+    return ESP_OK;
+}
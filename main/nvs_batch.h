@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "nvs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Entries one batch can stage
+#define NVS_BATCH_MAX_ENTRIES       8
+
+// Sets whose current slot is remembered, see nvs_batch_open()
+#define NVS_BATCH_MAX_SETS          4
+
+// Key of the generation record inside a slot namespace
+#define NVS_BATCH_GEN_KEY           "batch_gen"
+
+/*
+    A set is a group of keys that is always written as a whole, e.g. the wifi and thing config.
+    Every set has two slot namespaces, <set>_a and <set>_b, each with a generation record next to the keys.
+    The slot with the higher generation holds the current set, a commit writes the other slot:
+    - its generation record is erased first, the slot is invalid from then on,
+    - the staged keys are written over the ones of the generation before, NVS skips values that did not change,
+    - the generation record is written last with the current generation + 1 and committed.
+    The generation record is one NVS item, so readers see either the old set or the new set, never a mix.
+    Keys that were written to NVS_NAMESPACE before the set existed are erased by the first commit.
+ */
+
+/// Type of a staged entry
+enum nvs_batch_type {
+    NVS_BATCH_STR = 0,
+    NVS_BATCH_BLOB,
+    NVS_BATCH_ERASE,        // not part of the new set, erased from the slot
+};
+
+struct nvs_batch_entry {
+    const char *key;
+    enum nvs_batch_type type;
+    const void *value;
+    size_t len;
+};
+
+/// Staged writes of one set, values are not copied and have to stay valid until nvs_batch_commit()
+struct nvs_batch {
+    const char *set;        // name of the set, at most 13 characters
+    size_t count;
+    struct nvs_batch_entry entries[NVS_BATCH_MAX_ENTRIES];
+};
+
+/// Commits since boot
+struct nvs_batch_stats {
+    uint32_t commits;
+    uint32_t bytes_written;     // keys and values handed to NVS, values that did not change are not written by NVS
+};
+
+/// Start a batch for @param set
+void nvs_batch_begin(struct nvs_batch *batch, const char *set);
+
+/**
+ *  Stage a string
+ * @return  ESP_OK on success,
+ *          ESP_ERR_NO_MEM if the batch is full
+*/
+esp_err_t nvs_batch_set_str(struct nvs_batch *batch, const char *key, const char *value);
+
+/// Stage a blob, see nvs_batch_set_str()
+esp_err_t nvs_batch_set_blob(struct nvs_batch *batch, const char *key, const void *value, size_t len);
+
+/**
+ *  Stage removal of a key that is not part of the new set, see nvs_batch_set_str().
+ *  The slot still holds the keys of the generation before the current one, a key that is neither written
+ *  nor erased keeps that value.
+*/
+esp_err_t nvs_batch_erase(struct nvs_batch *batch, const char *key);
+
+/**
+ *  Write the staged entries as the new generation of the set
+ * @return  ESP_OK on success,
+ *          error of NVS on failure, the previous generation stays current
+*/
+esp_err_t nvs_batch_commit(struct nvs_batch *batch);
+
+/**
+ *  Open the current generation of @param set read only.
+ *  The first lookup of a set reads the generation record of both slots, the current slot is remembered
+ *  afterwards and opened directly, as long as its generation record still matches.
+ *  Before the set is committed for the first time its keys are still in NVS_NAMESPACE, that is opened instead.
+ * @return  ESP_OK on success,
+ *          ESP_ERR_NVS_NOT_FOUND if there is nothing stored yet,
+ *          error of NVS on failure
+*/
+esp_err_t nvs_batch_open(const char *set, nvs_handle_t *handle);
+
+/**
+ *  Get the generation of @param set, it changes with every commit of the set.
+ *  Served from memory once the set has been looked up, all commits go through nvs_batch_commit().
+ * @param gen set to 0 if the set was never committed
+ * @return  ESP_OK on success,
+ *          error of NVS on failure
+*/
+esp_err_t nvs_batch_get_generation(const char *set, uint32_t *gen);
+
+/// Copy commit statistics
+void nvs_batch_get_stats(struct nvs_batch_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,168 @@
+#include <string.h>
+#include "nvs_flash.h"
+#include "esp_log.h"
+#include "main.h"
+#include "nvs_ops.h"
+
+static const char *op_names[NVS_OP_MAX] = { "open", "read", "write", "erase", "commit" };
+
+static struct nvs_ops_stats stats;
+
+#if CONFIG_NVS_FAULT_INJECTION
+/// Pending injected failure of every kind of operation
+static struct {
+    bool armed;
+    uint32_t skip;
+    esp_err_t err;
+} faults[NVS_OP_MAX];
+#endif
+
+/// Check for an injected failure, returns ESP_OK if the operation should go to NVS
+static esp_err_t nvs_ops_fault(enum nvs_op op);
+
+/// Count operation and its result
+static esp_err_t nvs_ops_count(enum nvs_op op, esp_err_t err);
+
+esp_err_t nvs_ops_open(const char *nvs_namespace, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    esp_err_t err = nvs_ops_fault(NVS_OP_OPEN);
+
+    if(err == ESP_OK) {
+        err = nvs_open(nvs_namespace, open_mode, out_handle);
+    }
+    return nvs_ops_count(NVS_OP_OPEN, err);
+}
+
+esp_err_t nvs_ops_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+{
+    esp_err_t err = nvs_ops_fault(NVS_OP_READ);
+
+    if(err == ESP_OK) {
+        err = nvs_get_str(handle, key, out_value, length);
+    }
+    if(err == ESP_OK && out_value != NULL) {
+        stats.bytes_read += *length;
+    }
+    return nvs_ops_count(NVS_OP_READ, err);
+}
+
+esp_err_t nvs_ops_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    esp_err_t err = nvs_ops_fault(NVS_OP_READ);
+
+    if(err == ESP_OK) {
+        err = nvs_get_blob(handle, key, out_value, length);
+    }
+    if(err == ESP_OK && out_value != NULL) {
+        stats.bytes_read += *length;
+    }
+    return nvs_ops_count(NVS_OP_READ, err);
+}
+
+esp_err_t nvs_ops_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    esp_err_t err = nvs_ops_fault(NVS_OP_WRITE);
+
+    if(err == ESP_OK) {
+        err = nvs_set_str(handle, key, value);
+    }
+    if(err == ESP_OK) {
+        stats.bytes_written += strlen(value) + 1;
+    }
+    return nvs_ops_count(NVS_OP_WRITE, err);
+}
+
+esp_err_t nvs_ops_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    esp_err_t err = nvs_ops_fault(NVS_OP_WRITE);
+
+    if(err == ESP_OK) {
+        err = nvs_set_blob(handle, key, value, length);
+    }
+    if(err == ESP_OK) {
+        stats.bytes_written += length;
+    }
+    return nvs_ops_count(NVS_OP_WRITE, err);
+}
+
+esp_err_t nvs_ops_erase_key(nvs_handle_t handle, const char *key)
+{
+    esp_err_t err = nvs_ops_fault(NVS_OP_ERASE);
+
+    if(err == ESP_OK) {
+        err = nvs_erase_key(handle, key);
+    }
+    return nvs_ops_count(NVS_OP_ERASE, err);
+}
+
+esp_err_t nvs_ops_erase_all(nvs_handle_t handle)
+{
+    esp_err_t err = nvs_ops_fault(NVS_OP_ERASE);
+
+    if(err == ESP_OK) {
+        err = nvs_erase_all(handle);
+    }
+    return nvs_ops_count(NVS_OP_ERASE, err);
+}
+
+esp_err_t nvs_ops_commit(nvs_handle_t handle)
+{
+    esp_err_t err = nvs_ops_fault(NVS_OP_COMMIT);
+
+    if(err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    return nvs_ops_count(NVS_OP_COMMIT, err);
+}
+
+void nvs_ops_get_stats(struct nvs_ops_stats *out)
+{
+    *out = stats;
+}
+
+void nvs_ops_log(const char *stage)
+{
+    int i;
+
+    ESP_LOGI(TAG, "[%s] NVS operations, bytes read: %u, bytes written: %u", stage,
+        (unsigned)stats.bytes_read, (unsigned)stats.bytes_written);
+    for(i = 0; i < NVS_OP_MAX; i++) {
+        ESP_LOGI(TAG, "[%s]   %-6s %u (%u failed)", stage, op_names[i],
+            (unsigned)stats.count[i], (unsigned)stats.failed[i]);
+    }
+}
+
+#if CONFIG_NVS_FAULT_INJECTION
+void nvs_ops_inject_failure(enum nvs_op op, uint32_t skip, esp_err_t err)
+{
+    faults[op].armed = true;
+    faults[op].skip = skip;
+    faults[op].err = err;
+}
+#endif
+
+static esp_err_t nvs_ops_fault(enum nvs_op op)
+{
+#if CONFIG_NVS_FAULT_INJECTION
+    if(faults[op].armed) {
+        if(faults[op].skip > 0) {
+            faults[op].skip--;
+        } else {
+            faults[op].armed = false;
+            ESP_LOGW(TAG, "Injected NVS %s failure (%s)", op_names[op], esp_err_to_name(faults[op].err));
+            return faults[op].err;
+        }
+    }
+#endif
+    return ESP_OK;
+}
+
+static esp_err_t nvs_ops_count(enum nvs_op op, esp_err_t err)
+{
+    stats.count[op]++;
+    // Missing keys are expected (unprovisioned device, length probes), they are not failures
+    if(err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        stats.failed[op]++;
+    }
+    return err;
+}
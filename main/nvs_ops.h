@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    Counted NVS calls, every NVS access of my_nvs.c and nvs_batch.c goes through these
+    so the operations of one boot (provisioning, certificate storage, reconnects) can be counted on the device.
+    With CONFIG_NVS_FAULT_INJECTION an operation can be made to fail to exercise the error paths.
+ */
+
+/// Kind of NVS operation
+enum nvs_op {
+    NVS_OP_OPEN = 0,
+    NVS_OP_READ,            // nvs_get_str, nvs_get_blob, also length probes
+    NVS_OP_WRITE,           // nvs_set_str, nvs_set_blob
+    NVS_OP_ERASE,           // nvs_erase_key, nvs_erase_all
+    NVS_OP_COMMIT,
+    NVS_OP_MAX,
+};
+
+/// Operations since boot
+struct nvs_ops_stats {
+    uint32_t count[NVS_OP_MAX];
+    uint32_t failed[NVS_OP_MAX];
+    uint32_t bytes_read;
+    uint32_t bytes_written;
+};
+
+esp_err_t nvs_ops_open(const char *nvs_namespace, nvs_open_mode_t open_mode, nvs_handle_t *out_handle);
+esp_err_t nvs_ops_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length);
+esp_err_t nvs_ops_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length);
+esp_err_t nvs_ops_set_str(nvs_handle_t handle, const char *key, const char *value);
+esp_err_t nvs_ops_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length);
+esp_err_t nvs_ops_erase_key(nvs_handle_t handle, const char *key);
+esp_err_t nvs_ops_erase_all(nvs_handle_t handle);
+esp_err_t nvs_ops_commit(nvs_handle_t handle);
+
+/// Copy operation counts
+void nvs_ops_get_stats(struct nvs_ops_stats *stats);
+
+/// Log operation counts, @param stage tells where in the boot they were taken
+void nvs_ops_log(const char *stage);
+
+#if CONFIG_NVS_FAULT_INJECTION
+/**
+ *  Make an operation fail once without touching NVS
+ * @param op kind of operation to fail
+ * @param skip number of operations of that kind that still succeed before the failure
+ * @param err error to return, e.g. ESP_ERR_NVS_NOT_FOUND or ESP_ERR_NVS_NOT_ENOUGH_SPACE
+*/
+void nvs_ops_inject_failure(enum nvs_op op, uint32_t skip, esp_err_t err);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,83 @@
+#include <string.h>
+#include "esp_rom_crc.h"
+#include "prov_tlv.h"
+
+enum prov_tlv_status prov_tlv_parse(const uint8_t *blob, size_t len, struct prov_data *pdata)
+{
+    const uint8_t *tlv;
+    const uint8_t *end;
+    uint8_t *dst;
+    size_t dst_size;
+    size_t tlvs_len;
+    uint32_t crc;
+    uint8_t seen = 0;
+    uint8_t type;
+    uint8_t value_len;
+
+    memset(pdata, 0, sizeof *pdata);
+
+    if(len < PROV_TLV_HEADER_SIZE + PROV_TLV_CRC_SIZE) {
+        return PROV_TLV_ERR_LENGTH;
+    }
+
+    tlvs_len = blob[1] | (blob[2] << 8);
+    if(PROV_TLV_HEADER_SIZE + tlvs_len + PROV_TLV_CRC_SIZE != len) {
+        return PROV_TLV_ERR_LENGTH;
+    }
+
+    end = blob + PROV_TLV_HEADER_SIZE + tlvs_len;
+    crc = end[0] | (end[1] << 8) | (end[2] << 16) | ((uint32_t)end[3] << 24);
+    if(crc != esp_rom_crc32_le(0, blob, PROV_TLV_HEADER_SIZE + tlvs_len)) {
+        return PROV_TLV_ERR_CRC;
+    }
+
+    if(blob[0] != PROV_TLV_VERSION) {
+        return PROV_TLV_ERR_MALFORMED;
+    }
+
+    for(tlv = blob + PROV_TLV_HEADER_SIZE; tlv < end; tlv += 2 + value_len) {
+        if(end - tlv < 2) {
+            return PROV_TLV_ERR_MALFORMED;
+        }
+        type = tlv[0];
+        value_len = tlv[1];
+        if(end - tlv - 2 < value_len) {
+            return PROV_TLV_ERR_MALFORMED;
+        }
+
+        switch(type) {
+        case PROV_TLV_SSID:
+            dst = pdata->ssid;
+            dst_size = sizeof pdata->ssid;
+            break;
+        case PROV_TLV_PWD:
+            dst = pdata->pwd;
+            dst_size = sizeof pdata->pwd;
+            break;
+        case PROV_TLV_AWS_UUID:
+            dst = pdata->aws_uuid;
+            dst_size = sizeof pdata->aws_uuid;
+            break;
+        case PROV_TLV_AWS_THING:
+            dst = pdata->aws_thing;
+            dst_size = sizeof pdata->aws_thing;
+            break;
+        default:
+            // Field of a newer version
+            continue;
+        }
+
+        // Same limits as the single field characteristics, values are copied without NUL so one byte is left for it
+        if(value_len >= dst_size || (seen & (1 << type))) {
+            return PROV_TLV_ERR_MALFORMED;
+        }
+        seen |= 1 << type;
+        memcpy(dst, tlv + 2, value_len);
+    }
+
+    if(pdata->ssid[0] == '\0' || pdata->aws_thing[0] == '\0') {
+        return PROV_TLV_ERR_MISSING;
+    }
+
+    return PROV_TLV_OK;
+}
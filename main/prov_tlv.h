@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ble_prov_gatt.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    Bulk provisioning blob, all fields of struct prov_data in one write of the TLV characteristic.
+    The phone sends it as an ATT long write (prepared writes), NimBLE hands the whole value to one callback.
+
+    Layout, multi byte integers little endian:
+        version     1 byte, PROV_TLV_VERSION
+        length      2 bytes, length of the TLVs that follow
+        TLVs        type 1 byte, length 1 byte, value (not NUL-terminated)
+        crc         4 bytes, crc32 of version, length and TLVs
+    Unknown types are skipped, a field may appear only once.
+ */
+
+#define PROV_TLV_VERSION        1
+
+// Version and length in front of the TLVs, crc after them
+#define PROV_TLV_HEADER_SIZE    3
+#define PROV_TLV_CRC_SIZE       4
+
+// Largest blob, every known field at its maximum size with room to spare for future fields
+#define PROV_TLV_MAX_SIZE       512
+
+/// TLV types, the fields of struct prov_data
+enum prov_tlv_type {
+    PROV_TLV_SSID = 1,
+    PROV_TLV_PWD = 2,
+    PROV_TLV_AWS_UUID = 3,
+    PROV_TLV_AWS_THING = 4,
+};
+
+/// Result of prov_tlv_parse(), the errors are returned as ATT application errors
+enum prov_tlv_status {
+    PROV_TLV_OK = 0,
+    PROV_TLV_ERR_LENGTH = 0x80,     // length field does not match the blob
+    PROV_TLV_ERR_CRC = 0x81,
+    PROV_TLV_ERR_MALFORMED = 0x82,  // unknown version, truncated or repeated TLV, value too long
+    PROV_TLV_ERR_MISSING = 0x83,    // ssid or thing name missing
+};
+
+/**
+ *  Parse a provisioning blob
+ * @param pdata cleared and filled in, only valid when PROV_TLV_OK is returned
+ * @return  PROV_TLV_OK on success,
+ *          error of enum prov_tlv_status on failure
+*/
+enum prov_tlv_status prov_tlv_parse(const uint8_t *blob, size_t len, struct prov_data *pdata);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,165 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_log.h"
+#include "main.h"
+#include "backoff.h"
+#include "reconnect.h"
+
+struct reconnect_layer_state {
+    reconnect_fn_t reconnect;
+    esp_timer_handle_t timer;       // one shot, fires the scheduled retry
+    struct backoff backoff;
+    struct reconnect_stats stats;
+};
+
+static const char *layer_names[RECONNECT_LAYER_MAX] = { "wifi", "mqtt" };
+
+static struct reconnect_layer_state layers[RECONNECT_LAYER_MAX];
+static portMUX_TYPE reconnect_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/// esp_timer callback, @param arg is the reconnect_layer_state
+static void reconnect_timer_cb(void *arg);
+
+/// (Re)start the retry timer of @param layer
+static void reconnect_start_timer(struct reconnect_layer_state *layer, uint32_t delay_ms);
+
+esp_err_t reconnect_init(enum reconnect_layer layer, reconnect_fn_t reconnect)
+{
+    struct reconnect_layer_state *state = &layers[layer];
+    esp_err_t err;
+
+    if(state->timer != NULL) {
+        state->reconnect = reconnect;
+        return ESP_OK;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = reconnect_timer_cb,
+        .arg = state,
+        .name = layer_names[layer],
+    };
+
+    err = esp_timer_create(&timer_args, &state->timer);
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "Error (%s) creating %s reconnect timer", esp_err_to_name(err), layer_names[layer]);
+        return err;
+    }
+
+    state->reconnect = reconnect;
+    backoff_init(&state->backoff, RECONNECT_BACKOFF_BASE_MS, RECONNECT_BACKOFF_MAX_MS);
+    return ESP_OK;
+}
+
+uint32_t reconnect_schedule(enum reconnect_layer layer, enum reconnect_reason reason)
+{
+    struct reconnect_layer_state *state = &layers[layer];
+    uint32_t delay_ms;
+
+    portENTER_CRITICAL(&reconnect_lock);
+    state->stats.disconnects++;
+    state->stats.consecutive_failures++;
+    if(reason == RECONNECT_REASON_NO_AP) {
+        state->stats.no_ap++;
+    } else if(reason == RECONNECT_REASON_AUTH) {
+        state->stats.auth_failures++;
+    }
+
+    if(reason == RECONNECT_REASON_AUTH && state->stats.consecutive_failures >= RECONNECT_AUTH_FAIL_LIMIT) {
+        // Wrong credentials don't fix themselves, retry slowly in case they were changed back on the other side
+        delay_ms = backoff_jitter(RECONNECT_AUTH_FAIL_DELAY_MS, esp_random());
+    } else {
+        delay_ms = backoff_next(&state->backoff, esp_random());
+    }
+    state->stats.last_delay_ms = delay_ms;
+    portEXIT_CRITICAL(&reconnect_lock);
+
+    reconnect_start_timer(state, delay_ms);
+    return delay_ms;
+}
+
+void reconnect_connected(enum reconnect_layer layer)
+{
+    struct reconnect_layer_state *state = &layers[layer];
+    struct reconnect_layer_state *upper;
+    uint32_t delay_ms = 0;
+    int i;
+
+    portENTER_CRITICAL(&reconnect_lock);
+    state->stats.connects++;
+    state->stats.consecutive_failures = 0;
+    backoff_reset(&state->backoff);
+    portEXIT_CRITICAL(&reconnect_lock);
+
+    if(state->timer != NULL) {
+        esp_timer_stop(state->timer);
+    }
+
+    // Upper layers failed because this one was down, retry them soon instead of after their backoff
+    for(i = layer + 1; i < RECONNECT_LAYER_MAX; i++) {
+        upper = &layers[i];
+        if(upper->timer == NULL || !esp_timer_is_active(upper->timer)) {
+            continue;
+        }
+
+        portENTER_CRITICAL(&reconnect_lock);
+        backoff_reset(&upper->backoff);
+        delay_ms = backoff_next(&upper->backoff, esp_random());
+        upper->stats.last_delay_ms = delay_ms;
+        portEXIT_CRITICAL(&reconnect_lock);
+
+        reconnect_start_timer(upper, delay_ms);
+    }
+}
+
+bool reconnect_auth_failed(enum reconnect_layer layer)
+{
+    const struct reconnect_stats *stats = &layers[layer].stats;
+
+    return stats->auth_failures > 0 && stats->consecutive_failures >= RECONNECT_AUTH_FAIL_LIMIT;
+}
+
+void reconnect_get_stats(enum reconnect_layer layer, struct reconnect_stats *stats)
+{
+    portENTER_CRITICAL(&reconnect_lock);
+    *stats = layers[layer].stats;
+    portEXIT_CRITICAL(&reconnect_lock);
+}
+
+void reconnect_log(void)
+{
+    struct reconnect_stats stats;
+    int i;
+
+    for(i = 0; i < RECONNECT_LAYER_MAX; i++) {
+        reconnect_get_stats(i, &stats);
+        ESP_LOGI(TAG, "Reconnect %s: %u connects, %u disconnects (%u no AP, %u auth), %u retries, last delay %u ms",
+            layer_names[i], (unsigned)stats.connects, (unsigned)stats.disconnects, (unsigned)stats.no_ap,
+            (unsigned)stats.auth_failures, (unsigned)stats.attempts, (unsigned)stats.last_delay_ms);
+    }
+}
+
+static void reconnect_timer_cb(void *arg)
+{
+    struct reconnect_layer_state *state = arg;
+
+    portENTER_CRITICAL(&reconnect_lock);
+    state->stats.attempts++;
+    portEXIT_CRITICAL(&reconnect_lock);
+
+    if(state->reconnect != NULL) {
+        state->reconnect();
+    }
+}
+
+static void reconnect_start_timer(struct reconnect_layer_state *state, uint32_t delay_ms)
+{
+    if(state->timer == NULL) {
+        return;
+    }
+
+    // Restarting an active timer fails, a newer schedule replaces the pending one
+    esp_timer_stop(state->timer);
+    esp_timer_start_once(state->timer, (uint64_t)delay_ms * 1000);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Delay before the first retry and cap of the exponential backoff, both get jitter, see backoff.h
+#define RECONNECT_BACKOFF_BASE_MS       CONFIG_RECONNECT_BACKOFF_BASE_MS
+#define RECONNECT_BACKOFF_MAX_MS        CONFIG_RECONNECT_BACKOFF_MAX_MS
+
+// Consecutive authentication failures after which the credentials are assumed wrong
+#define RECONNECT_AUTH_FAIL_LIMIT       CONFIG_WIFI_MAXIMUM_RETRY
+// Delay between retries once the credentials are assumed wrong, with jitter
+#define RECONNECT_AUTH_FAIL_DELAY_MS    CONFIG_RECONNECT_AUTH_FAIL_DELAY_MS
+
+/*
+    Reconnects wifi and mqtt after a connection is lost, never gives up and never reboots.
+    Every layer retries with its own jittered exponential backoff, a fleet that lost power at once
+    spreads its reconnects instead of hitting the AP and the broker at the same moment.
+    When wifi comes back a pending mqtt retry is brought forward, it does not wait out the backoff
+    it built up while there was no network.
+ */
+
+/// Connection layers, lower layers first
+enum reconnect_layer {
+    RECONNECT_WIFI = 0,
+    RECONNECT_MQTT,
+    RECONNECT_LAYER_MAX,
+};
+
+/// Why the connection was lost, picks the retry policy
+enum reconnect_reason {
+    RECONNECT_REASON_OTHER = 0,     // exponential backoff
+    RECONNECT_REASON_NO_AP,         // AP not found (e.g. router rebooting), exponential backoff
+    RECONNECT_REASON_AUTH,          // wrong password or refused by the broker, slow retries after RECONNECT_AUTH_FAIL_LIMIT
+};
+
+/// Counters of one layer since boot
+struct reconnect_stats {
+    uint32_t disconnects;           // lost connections and failed attempts
+    uint32_t attempts;              // retries made
+    uint32_t connects;              // successful connections, the first one included
+    uint32_t no_ap;                 // disconnects with RECONNECT_REASON_NO_AP
+    uint32_t auth_failures;         // disconnects with RECONNECT_REASON_AUTH
+    uint32_t consecutive_failures;  // disconnects since the last connection
+    uint32_t last_delay_ms;         // delay of the last scheduled retry
+};
+
+/// Retries a layer, called from the esp_timer task
+typedef void (*reconnect_fn_t)(void);
+
+/**
+ *  Initialize a layer
+ * @param reconnect starts a new connection attempt of the layer
+ * @return  ESP_OK on success, also when already initialized,
+ *          error of esp_timer on failure
+*/
+esp_err_t reconnect_init(enum reconnect_layer layer, reconnect_fn_t reconnect);
+
+/**
+ *  Count a lost connection or failed attempt and schedule the retry, safe to call from an event handler
+ * @return  delay of the retry in ms
+*/
+uint32_t reconnect_schedule(enum reconnect_layer layer, enum reconnect_reason reason);
+
+/// Count a successful connection, the backoff of the layer starts over
+void reconnect_connected(enum reconnect_layer layer);
+
+/// Credentials of the layer failed RECONNECT_AUTH_FAIL_LIMIT times in a row
+bool reconnect_auth_failed(enum reconnect_layer layer);
+
+/// Copy counters of a layer
+void reconnect_get_stats(enum reconnect_layer layer, struct reconnect_stats *stats);
+
+/// Log counters of all layers
+void reconnect_log(void);
+
+#ifdef __cplusplus
+}
+#endif
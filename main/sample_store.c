@@ -0,0 +1,276 @@
+#include <string.h>
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_log.h"
+#include "main.h"
+#include "sample_store.h"
+
+#define RECORDS_PER_SECTOR  (SAMPLE_STORE_SECTOR_SIZE / sizeof(struct sample_record))
+
+static const esp_partition_t *partition;
+static size_t num_slots;        // number of records that fit in the partition
+
+static size_t write_slot;       // slot of the next append
+static size_t read_slot;        // slot of the oldest pending sample, equals write_slot when nothing is pending
+static size_t pending;
+static uint32_t next_log_seq;
+static uint32_t dropped;
+
+/// crc of the record fields that follow state
+static uint32_t sample_record_crc(const struct sample_record *record);
+
+/// Read record, returns false when it can't be read or fails the crc
+static bool sample_store_read(size_t slot, struct sample_record *record);
+
+/// Erase the sector starting at @param slot, pending samples in it are dropped
+static esp_err_t sample_store_erase_sector(size_t slot);
+
+/**
+ *  Find the next VALID record from @param slot up to write_slot.
+ *  A full ring has its oldest record at write_slot, so the scan may start there.
+ * @return  slot of the record, num_slots if there is none
+*/
+static size_t sample_store_next_valid(size_t slot, struct sample_record *record);
+
+esp_err_t sample_store_init(void)
+{
+    struct sample_record record;
+    uint32_t min_valid_seq = 0;
+    bool found = false;
+    size_t last_slot = 0;
+    size_t slot;
+
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, SAMPLE_STORE_PARTITION_SUBTYPE,
+        SAMPLE_STORE_PARTITION_LABEL);
+    if(partition == NULL) {
+        ESP_LOGW(TAG, "No %s partition, samples are not stored while offline", SAMPLE_STORE_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    num_slots = (partition->size / SAMPLE_STORE_SECTOR_SIZE) * RECORDS_PER_SECTOR;
+    pending = 0;
+    next_log_seq = 0;
+    read_slot = 0;
+
+    // Find newest record (end of the log) and oldest pending record
+    for(slot = 0; slot < num_slots; slot++) {
+        if(!sample_store_read(slot, &record)) {
+            continue;
+        }
+
+        if(!found || (int32_t)(record.log_seq - next_log_seq) >= 0) {
+            next_log_seq = record.log_seq + 1;
+            last_slot = slot;
+            found = true;
+        }
+
+        if(record.state == SAMPLE_RECORD_VALID) {
+            if(pending == 0 || (int32_t)(record.log_seq - min_valid_seq) < 0) {
+                min_valid_seq = record.log_seq;
+                read_slot = slot;
+            }
+            pending++;
+        }
+    }
+
+    write_slot = found ? (last_slot + 1) % num_slots : 0;
+
+    // Skip anything left by a torn write after the end of the log, the next sector is erased before it is used
+    while(write_slot % RECORDS_PER_SECTOR != 0) {
+        esp_partition_read(partition, write_slot * sizeof record, &record.state, sizeof record.state);
+        if(record.state == SAMPLE_RECORD_EMPTY) {
+            break;
+        }
+        write_slot = (write_slot + 1) % num_slots;
+    }
+
+    if(pending == 0) {
+        read_slot = write_slot;
+    }
+
+    ESP_LOGI(TAG, "Sample store: %d slots, %d samples pending", (int)num_slots, (int)pending);
+    return ESP_OK;
+}
+
+bool sample_store_ready(void)
+{
+    return partition != NULL;
+}
+
+esp_err_t sample_store_append(const struct telemetry_sample *sample)
+{
+    struct sample_record record;
+    esp_err_t err;
+
+    if(partition == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Entering a sector, it may still hold the oldest records of the ring
+    if(write_slot % RECORDS_PER_SECTOR == 0) {
+        err = sample_store_erase_sector(write_slot);
+        if(err != ESP_OK) {
+            return err;
+        }
+    }
+
+    memset(&record, 0, sizeof record);
+    record.state = SAMPLE_RECORD_VALID;
+    record.log_seq = next_log_seq;
+    record.seq = sample->seq;
+    record.channel = sample->channel;
+    record.timestamp_ms = sample->timestamp_ms;
+    record.temperature = sample->temperature;
+    record.crc = sample_record_crc(&record);
+
+    err = esp_partition_write(partition, write_slot * sizeof record, &record, sizeof record);
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "Error (%s) writing sample to store", esp_err_to_name(err));
+        return err;
+    }
+
+    if(pending == 0) {
+        read_slot = write_slot;
+    }
+    pending++;
+    next_log_seq++;
+    write_slot = (write_slot + 1) % num_slots;
+    return ESP_OK;
+}
+
+size_t sample_store_peek(struct telemetry_sample *samples, size_t max_samples)
+{
+    struct sample_record record;
+    size_t slot = read_slot;
+    size_t n = 0;
+
+    while(n < max_samples && n < pending) {
+        slot = sample_store_next_valid(slot, &record);
+        if(slot == num_slots) {
+            break;
+        }
+
+        samples[n].seq = record.seq;
+        samples[n].channel = record.channel;
+        samples[n].timestamp_ms = record.timestamp_ms;
+        samples[n].temperature = record.temperature;
+        n++;
+        slot = (slot + 1) % num_slots;
+    }
+
+    return n;
+}
+
+esp_err_t sample_store_consume(size_t num_samples)
+{
+    struct sample_record record;
+    uint32_t state = SAMPLE_RECORD_SENT;
+    esp_err_t err;
+
+    while(num_samples-- && pending > 0) {
+        read_slot = sample_store_next_valid(read_slot, &record);
+        if(read_slot == num_slots) {
+            pending = 0;
+            break;
+        }
+
+        // Only clears bits, no erase needed
+        err = esp_partition_write(partition, read_slot * sizeof record, &state, sizeof state);
+        if(err != ESP_OK) {
+            ESP_LOGE(TAG, "Error (%s) marking sample as sent", esp_err_to_name(err));
+            return err;
+        }
+
+        pending--;
+        read_slot = (read_slot + 1) % num_slots;
+    }
+
+    if(pending == 0) {
+        read_slot = write_slot;
+    }
+    return ESP_OK;
+}
+
+size_t sample_store_pending(void)
+{
+    return pending;
+}
+
+uint32_t sample_store_dropped(void)
+{
+    return dropped;
+}
+
+static uint32_t sample_record_crc(const struct sample_record *record)
+{
+    const uint8_t *start = (const uint8_t *)&record->log_seq;
+    const uint8_t *end = (const uint8_t *)&record->crc;
+
+    return esp_rom_crc32_le(0, start, end - start);
+}
+
+static bool sample_store_read(size_t slot, struct sample_record *record)
+{
+    esp_err_t err;
+
+    err = esp_partition_read(partition, slot * sizeof *record, record, sizeof *record);
+    if(err != ESP_OK || record->state == SAMPLE_RECORD_EMPTY) {
+        return false;
+    }
+
+    if(record->state != SAMPLE_RECORD_VALID && record->state != SAMPLE_RECORD_SENT) {
+        return false;
+    }
+
+    return record->crc == sample_record_crc(record);
+}
+
+static esp_err_t sample_store_erase_sector(size_t slot)
+{
+    struct sample_record record;
+    size_t lost = 0;
+    size_t i;
+    esp_err_t err;
+
+    // Count pending samples that are about to be lost
+    if(pending > 0) {
+        for(i = 0; i < RECORDS_PER_SECTOR; i++) {
+            if(sample_store_read(slot + i, &record) && record.state == SAMPLE_RECORD_VALID) {
+                lost++;
+            }
+        }
+    }
+
+    err = esp_partition_erase_range(partition, slot * sizeof record, SAMPLE_STORE_SECTOR_SIZE);
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "Error (%s) erasing sample store sector", esp_err_to_name(err));
+        return err;
+    }
+
+    if(lost > 0) {
+        ESP_LOGW(TAG, "Sample store full, dropped %d samples", (int)lost);
+        dropped += lost;
+        pending -= lost;
+        // Oldest pending samples were in this sector, continue after it
+        read_slot = (slot + RECORDS_PER_SECTOR) % num_slots;
+    }
+
+    return ESP_OK;
+}
+
+static size_t sample_store_next_valid(size_t slot, struct sample_record *record)
+{
+    size_t i;
+
+    for(i = 0; i < num_slots; i++) {
+        if(i > 0 && slot == write_slot) {
+            break;
+        }
+        if(sample_store_read(slot, record) && record->state == SAMPLE_RECORD_VALID) {
+            return slot;
+        }
+        slot = (slot + 1) % num_slots;
+    }
+
+    return num_slots;
+}
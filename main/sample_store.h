@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "telemetry.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Data partition holding the store, see partitions.csv
+#define SAMPLE_STORE_PARTITION_LABEL    "telemetry"
+#define SAMPLE_STORE_PARTITION_SUBTYPE  0x40
+
+// Flash is erased one sector at a time
+#define SAMPLE_STORE_SECTOR_SIZE        4096
+
+// Most stored samples replayed in one message, one message is replayed per sample period
+#define SAMPLE_STORE_REPLAY_MAX_SAMPLES CONFIG_SAMPLE_STORE_REPLAY_MAX_SAMPLES
+
+// Stored samples are replayed with QoS 1 whatever TELEMETRY_QOS is, they are only consumed once the broker acked them
+#define SAMPLE_STORE_REPLAY_QOS         1
+// Time to wait for the ack of a replayed message before it is sent again, e.g. after it expired from the outbox
+#define SAMPLE_STORE_REPLAY_TIMEOUT_MS  60000
+
+/*
+    RECORD STATES
+    Flash bits can only be cleared without an erase, so a record goes from VALID to SENT
+    by overwriting its state word in place.
+ */
+#define SAMPLE_RECORD_EMPTY     0xFFFFFFFF
+#define SAMPLE_RECORD_VALID     0xFFFF5A5A
+#define SAMPLE_RECORD_SENT      0x00005A5A
+
+/**
+ *  One sample as stored in flash, the store is a ring of these written in log order.
+ *  A record that was torn by a power loss fails the crc and is skipped.
+*/
+struct sample_record {
+    uint32_t state;         // SAMPLE_RECORD_*
+    uint32_t log_seq;       // position in the log, orders records across reboots
+    uint32_t seq;           // sequence number of the sample, used by the backend to drop duplicates
+    uint8_t channel;
+    uint8_t reserved[3];
+    int64_t timestamp_ms;
+    float temperature;
+    uint32_t crc;           // crc32 of everything between state and crc
+};
+
+/**
+ *  Find the partition and recover the store after a reboot or power loss
+ * @return  ESP_OK on success,
+ *          ESP_ERR_NOT_FOUND when there is no store partition
+*/
+esp_err_t sample_store_init(void);
+
+/// Check if the store is available
+bool sample_store_ready(void);
+
+/**
+ *  Append sample to the store.
+ *  When the store is full the oldest sector is erased and its pending samples are dropped.
+ *  Costs one record write, plus one sector erase every SAMPLE_STORE_SECTOR_SIZE / sizeof(struct sample_record) samples.
+*/
+esp_err_t sample_store_append(const struct telemetry_sample *sample);
+
+/**
+ *  Read the oldest pending samples without removing them
+ * @return number of samples read
+*/
+size_t sample_store_peek(struct telemetry_sample *samples, size_t max_samples);
+
+/**
+ *  Mark the oldest @param num_samples pending samples as sent.
+ *  Costs one state word write per sample.
+*/
+esp_err_t sample_store_consume(size_t num_samples);
+
+/// Number of samples waiting to be replayed
+size_t sample_store_pending(void);
+
+/// Number of samples lost because the store was full
+uint32_t sample_store_dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,22 @@
+#include "sensor.h"
+
+int sensor_read_average(const struct sensor_driver *driver, int count, int32_t *raw)
+{
+    int64_t sum = 0;
+    int32_t reading;
+    int n = 0;
+    int i;
+
+    for(i = 0; i < count; i++) {
+        if(driver->read(&reading) == ESP_OK) {
+            sum += reading;
+            n++;
+        }
+    }
+
+    if(n > 0) {
+        // Round to nearest
+        *raw = (int32_t)((sum + (sum >= 0 ? n / 2 : -n / 2)) / n);
+    }
+    return n;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  Temperature sensor driver.
+ *  read() returns a raw reading so oversampling can average raw values,
+ *  convert() turns an (averaged) raw value to celsius.
+*/
+struct sensor_driver {
+    const char *name;
+    esp_err_t (*init)(void);
+    esp_err_t (*read)(int32_t *raw);
+    float (*convert)(int32_t raw);
+};
+
+/// Simulated temperature, cycles from 20 to 32 celsius one degree per sample period
+extern const struct sensor_driver sensor_mock_driver;
+
+#if CONFIG_SENSOR_BACKEND_INTERNAL
+/// Internal temperature sensor of the chip
+extern const struct sensor_driver sensor_internal_driver;
+#define SENSOR_DRIVER   sensor_internal_driver
+#else
+#define SENSOR_DRIVER   sensor_mock_driver
+#endif
+
+/**
+ *  Average @param count raw readings of @param driver, rounded to nearest
+ * @return number of readings that succeeded, @param raw is only set when there was at least one
+*/
+int sensor_read_average(const struct sensor_driver *driver, int count, int32_t *raw);
+
+#ifdef __cplusplus
+}
+#endif
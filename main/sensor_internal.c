@@ -0,0 +1,57 @@
+#include "sdkconfig.h"
+
+#if CONFIG_SENSOR_BACKEND_INTERNAL
+
+#include "driver/temperature_sensor.h"
+#include "esp_log.h"
+#include "main.h"
+#include "sensor.h"
+
+// Measurement range, the sensor is most accurate in the range that includes the expected temperature
+#define SENSOR_INTERNAL_MIN_TEMP    -10
+#define SENSOR_INTERNAL_MAX_TEMP    80
+
+static temperature_sensor_handle_t handle;
+
+static esp_err_t sensor_internal_init(void)
+{
+    temperature_sensor_config_t config = TEMPERATURE_SENSOR_CONFIG_DEFAULT(SENSOR_INTERNAL_MIN_TEMP, SENSOR_INTERNAL_MAX_TEMP);
+    esp_err_t err;
+
+    err = temperature_sensor_install(&config, &handle);
+    if(err != ESP_OK) {
+        ESP_LOGE(TAG, "Error (%s) installing temperature sensor", esp_err_to_name(err));
+        return err;
+    }
+
+    return temperature_sensor_enable(handle);
+}
+
+static esp_err_t sensor_internal_read(int32_t *raw)
+{
+    float celsius;
+    esp_err_t err;
+
+    err = temperature_sensor_get_celsius(handle, &celsius);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    // Raw values are in 1/100 celsius so averaging keeps the resolution
+    *raw = (int32_t)(celsius * 100.0f);
+    return ESP_OK;
+}
+
+static float sensor_internal_convert(int32_t raw)
+{
+    return raw / 100.0f;
+}
+
+const struct sensor_driver sensor_internal_driver = {
+    .name = "internal",
+    .init = sensor_internal_init,
+    .read = sensor_internal_read,
+    .convert = sensor_internal_convert,
+};
+
+#endif
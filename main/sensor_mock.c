@@ -0,0 +1,40 @@
+#include "esp_timer.h"
+#include "sensor.h"
+
+// Raw values are in 1/100 celsius
+#define MOCK_MIN_TEMP   2000
+#define MOCK_MAX_TEMP   3200
+#define MOCK_START_TEMP 3000
+#define MOCK_STEP       100
+
+// One step per sample period, whatever the number of readings oversampling averages in it
+#define MOCK_STEP_US    ((int64_t)CONFIG_TELEMETRY_SAMPLE_PERIOD_MS * 1000)
+
+static int64_t start_us;
+
+static esp_err_t sensor_mock_init(void)
+{
+    start_us = esp_timer_get_time();
+    return ESP_OK;
+}
+
+static esp_err_t sensor_mock_read(int32_t *raw)
+{
+    const int64_t steps = (MOCK_MAX_TEMP - MOCK_MIN_TEMP) / MOCK_STEP + 1;
+    int64_t step = (esp_timer_get_time() - start_us) / MOCK_STEP_US;
+
+    *raw = MOCK_MIN_TEMP + ((MOCK_START_TEMP - MOCK_MIN_TEMP) / MOCK_STEP + step) % steps * MOCK_STEP;
+    return ESP_OK;
+}
+
+static float sensor_mock_convert(int32_t raw)
+{
+    return raw / 100.0f;
+}
+
+const struct sensor_driver sensor_mock_driver = {
+    .name = "mock",
+    .init = sensor_mock_init,
+    .read = sensor_mock_read,
+    .convert = sensor_mock_convert,
+};
@@ -0,0 +1,56 @@
+#include <string.h>
+#include "spsc_ring.h"
+
+int spsc_ring_init(struct spsc_ring *ring, void *buf, size_t elem_size, size_t capacity)
+{
+    if(capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return -1;
+    }
+
+    ring->buf = buf;
+    ring->elem_size = elem_size;
+    ring->capacity = capacity;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return 0;
+}
+
+bool spsc_ring_push(struct spsc_ring *ring, const void *elem)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if(head - tail >= ring->capacity) {
+        return false;
+    }
+
+    memcpy(ring->buf + (head & (ring->capacity - 1)) * ring->elem_size, elem, ring->elem_size);
+
+    // Publish the element, the consumer sees the new head only after the copy
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+bool spsc_ring_pop(struct spsc_ring *ring, void *elem)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if(head == tail) {
+        return false;
+    }
+
+    memcpy(elem, ring->buf + (tail & (ring->capacity - 1)) * ring->elem_size, ring->elem_size);
+
+    // Hand the slot back to the producer only after the copy
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+size_t spsc_ring_count(struct spsc_ring *ring)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    return head - tail;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  Lock-free ring buffer for exactly one producer task and one consumer task.
+ *  Only the producer writes head and only the consumer writes tail, so no lock or critical section is needed,
+ *  the release/acquire pairs make sure an element is completely written before the other side can see it.
+ *  Head and tail run freely and wrap on overflow, capacity has to be a power of two.
+*/
+struct spsc_ring {
+    unsigned char *buf;         // capacity * elem_size bytes
+    size_t elem_size;
+    size_t capacity;
+    atomic_size_t head;         // next element to write, producer only
+    atomic_size_t tail;         // next element to read, consumer only
+};
+
+/**
+ *  Initialize ring on a caller supplied buffer
+ * @param buf buffer of @param capacity * @param elem_size bytes
+ * @param capacity number of elements, has to be a power of two
+ * @return  0 on success,
+ *          -1 if capacity is not a power of two
+*/
+int spsc_ring_init(struct spsc_ring *ring, void *buf, size_t elem_size, size_t capacity);
+
+/**
+ *  Copy an element to the ring, producer only
+ * @return false if the ring is full, the element is not added
+*/
+bool spsc_ring_push(struct spsc_ring *ring, const void *elem);
+
+/**
+ *  Copy the oldest element out of the ring, consumer only
+ * @return false if the ring is empty
+*/
+bool spsc_ring_pop(struct spsc_ring *ring, void *elem);
+
+/// Number of elements in the ring, a snapshot that may already be outdated when used from the other side
+size_t spsc_ring_count(struct spsc_ring *ring);
+
+#ifdef __cplusplus
+}
+#endif
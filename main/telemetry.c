@@ -0,0 +1,238 @@
+#include <math.h>
+#include <stdio.h>
+#include "telemetry.h"
+#include "cbor.h"
+
+// Ring buffer of samples waiting to be published
+static struct telemetry_sample samples[TELEMETRY_BATCH_MAX_SAMPLES];
+static size_t head;     // index of the oldest sample
+static size_t count;    // number of samples in the ring buffer
+
+// Size of the encoded samples in the ring buffer, with json every sample is counted with its
+// separating comma so this overestimates the payload by at most one byte
+static size_t pending_bytes;
+
+static uint32_t next_seq;
+static uint32_t dropped;
+
+/// Samples to encode, either the ring buffer or a plain array (first = 0, capacity = count)
+struct sample_view {
+    const struct telemetry_sample *samples;
+    size_t first;
+    size_t capacity;
+    size_t count;
+};
+
+/// Get the i-th oldest sample of a view
+static const struct telemetry_sample *telemetry_sample_at(const struct sample_view *view, size_t i);
+
+/// Encode samples of a view with the configured encoding
+static int telemetry_encode_view(const struct sample_view *view, char *payload, size_t size_of_payload, size_t *num_samples);
+
+/// Encoded length of one sample
+static size_t telemetry_sample_len(const struct telemetry_sample *sample);
+
+#if CONFIG_TELEMETRY_ENCODING_CBOR
+/// Encode one sample as [timestamp_ms, seq, channel, temperature]
+static void telemetry_cbor_sample(struct cbor_writer *w, const struct telemetry_sample *sample);
+#else
+/// Encode one sample as a json object, with a NULL buffer only returns the length
+static int telemetry_json_sample(char *out, size_t size, const struct telemetry_sample *sample, bool first);
+#endif
+
+void telemetry_add_sample(uint8_t channel, float temperature, int64_t now_ms)
+{
+    struct telemetry_sample *sample;
+
+    // Ring buffer full, overwrite oldest sample
+    if(count == TELEMETRY_BATCH_MAX_SAMPLES) {
+        telemetry_consume(1);
+        dropped++;
+    }
+
+    sample = &samples[(head + count) % TELEMETRY_BATCH_MAX_SAMPLES];
+    sample->timestamp_ms = now_ms;
+    sample->seq = next_seq++;
+    sample->channel = channel;
+    sample->temperature = temperature;
+
+    pending_bytes += telemetry_sample_len(sample);
+    count++;
+}
+
+bool telemetry_should_flush(int64_t now_ms)
+{
+    if(count == 0) {
+        return false;
+    }
+
+    return count >= TELEMETRY_BATCH_MAX_SAMPLES
+        // Next sample might not fit in the payload
+        || TELEMETRY_PAYLOAD_OVERHEAD + pending_bytes + TELEMETRY_SAMPLE_MAX_LEN > TELEMETRY_BATCH_MAX_BYTES
+        || now_ms - samples[head].timestamp_ms >= TELEMETRY_BATCH_MAX_AGE_MS;
+}
+
+int telemetry_encode(char *payload, size_t size_of_payload, size_t *num_samples)
+{
+    struct sample_view view = { samples, head, TELEMETRY_BATCH_MAX_SAMPLES, count };
+
+    return telemetry_encode_view(&view, payload, size_of_payload, num_samples);
+}
+
+int telemetry_encode_array(
+    const struct telemetry_sample *array, size_t num_array, char *payload, size_t size_of_payload, size_t *num_samples
+)
+{
+    struct sample_view view = { array, 0, num_array, num_array };
+
+    return telemetry_encode_view(&view, payload, size_of_payload, num_samples);
+}
+
+#if CONFIG_TELEMETRY_ENCODING_CBOR
+static int telemetry_encode_view(const struct sample_view *view, char *payload, size_t size_of_payload, size_t *num_samples)
+{
+    struct cbor_writer w;
+    size_t len = 0;
+    size_t n;
+    size_t i;
+
+    *num_samples = 0;
+
+    // Number of samples has to be known up front for the array head
+    for(n = 0; n < view->count; n++) {
+        len += telemetry_sample_len(telemetry_sample_at(view, n));
+        if(TELEMETRY_PAYLOAD_OVERHEAD + len > size_of_payload) {
+            break;
+        }
+    }
+    if(n == 0) {
+        return -1;
+    }
+
+    cbor_writer_init(&w, (uint8_t *)payload, size_of_payload);
+    cbor_write_array(&w, n);
+    for(i = 0; i < n; i++) {
+        telemetry_cbor_sample(&w, telemetry_sample_at(view, i));
+    }
+    if(w.overflow) {
+        return -1;
+    }
+
+    *num_samples = n;
+    return w.len;
+}
+#else
+static int telemetry_encode_view(const struct sample_view *view, char *payload, size_t size_of_payload, size_t *num_samples)
+{
+    size_t len;
+    size_t i;
+    int ret;
+
+    *num_samples = 0;
+
+    ret = snprintf(payload, size_of_payload, "{\"samples\":[");
+    if(ret < 0 || (size_t)ret >= size_of_payload) {
+        return -1;
+    }
+    len = ret;
+
+    for(i = 0; i < view->count; i++) {
+        // Leave room for closing ]}
+        ret = telemetry_json_sample(payload + len, size_of_payload - len - 2, telemetry_sample_at(view, i), i == 0);
+        if(ret < 0 || len + ret + 2 >= size_of_payload) {
+            break;
+        }
+        len += ret;
+    }
+
+    if(i == 0) {
+        return -1;
+    }
+
+    len += snprintf(payload + len, size_of_payload - len, "]}");
+    *num_samples = i;
+    return len;
+}
+#endif
+
+void telemetry_consume(size_t num_samples)
+{
+    if(num_samples > count) {
+        num_samples = count;
+    }
+
+    while(num_samples--) {
+        pending_bytes -= telemetry_sample_len(&samples[head]);
+        head = (head + 1) % TELEMETRY_BATCH_MAX_SAMPLES;
+        count--;
+    }
+}
+
+const struct telemetry_sample *telemetry_oldest(void)
+{
+    return count > 0 ? &samples[head] : NULL;
+}
+
+size_t telemetry_pending(void)
+{
+    return count;
+}
+
+void telemetry_set_seq(uint32_t seq)
+{
+    next_seq = seq;
+}
+
+uint32_t telemetry_next_seq(void)
+{
+    return next_seq;
+}
+
+uint32_t telemetry_dropped(void)
+{
+    return dropped;
+}
+
+static const struct telemetry_sample *telemetry_sample_at(const struct sample_view *view, size_t i)
+{
+    return &view->samples[(view->first + i) % view->capacity];
+}
+
+#if CONFIG_TELEMETRY_ENCODING_CBOR
+static size_t telemetry_sample_len(const struct telemetry_sample *sample)
+{
+    struct cbor_writer w;
+
+    // Count only
+    cbor_writer_init(&w, NULL, 0);
+    telemetry_cbor_sample(&w, sample);
+    return w.len;
+}
+
+static void telemetry_cbor_sample(struct cbor_writer *w, const struct telemetry_sample *sample)
+{
+    cbor_write_array(w, 4);
+    cbor_write_uint(w, sample->timestamp_ms);
+    cbor_write_uint(w, sample->seq);
+    cbor_write_uint(w, sample->channel);
+    cbor_write_float(w, sample->temperature);
+}
+#else
+static size_t telemetry_sample_len(const struct telemetry_sample *sample)
+{
+    return telemetry_json_sample(NULL, 0, sample, false);
+}
+
+static int telemetry_json_sample(char *out, size_t size, const struct telemetry_sample *sample, bool first)
+{
+    // nan and inf are not json, the sample is kept as null so its seq is not missing
+    if(!isfinite(sample->temperature)) {
+        return snprintf(out, size, "%s{\"ts\":%lld,\"seq\":%lu,\"ch\":%u,\"temperature\":null}",
+            first ? "" : ",", (long long)sample->timestamp_ms, (unsigned long)sample->seq, (unsigned)sample->channel);
+    }
+
+    return snprintf(out, size, "%s{\"ts\":%lld,\"seq\":%lu,\"ch\":%u,\"temperature\":%.2f}",
+        first ? "" : ",", (long long)sample->timestamp_ms, (unsigned long)sample->seq,
+        (unsigned)sample->channel, sample->temperature);
+}
+#endif
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "telemetry_sample.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Interval between temperature samples
+#define TELEMETRY_SAMPLE_PERIOD_MS      CONFIG_TELEMETRY_SAMPLE_PERIOD_MS
+
+// FLUSH POLICY, a batch is published as soon as any of these is reached
+// Samples in one batch, also the capacity of the sample ring buffer
+#define TELEMETRY_BATCH_MAX_SAMPLES     CONFIG_TELEMETRY_BATCH_MAX_SAMPLES
+// Size of the payload of one batch
+#define TELEMETRY_BATCH_MAX_BYTES       CONFIG_TELEMETRY_BATCH_MAX_BYTES
+// Age of the oldest sample in a batch
+#define TELEMETRY_BATCH_MAX_AGE_MS      CONFIG_TELEMETRY_BATCH_MAX_AGE_MS
+
+#if CONFIG_TELEMETRY_ENCODING_CBOR
+/*
+    CBOR payload, an array of samples where every sample is an array with a fixed schema:
+    [[timestamp_ms, seq, channel, temperature], ...]
+ */
+#define TELEMETRY_ENCODING              "cbor"
+// Longest encoding of a single sample: array head, uint64, uint32, uint8 and float32
+#define TELEMETRY_SAMPLE_MAX_LEN        (1 + 9 + 5 + 2 + 5)
+// Array head around the samples
+#define TELEMETRY_PAYLOAD_OVERHEAD      3
+#else
+/*
+    Json payload:
+    {"samples":[{"ts":timestamp_ms,"seq":seq,"ch":channel,"temperature":temperature}, ...]}
+ */
+#define TELEMETRY_ENCODING              "json"
+// Longest encoding of a single sample, including the separating comma
+#define TELEMETRY_SAMPLE_MAX_LEN        96
+// Json around the samples, {"samples":[ and ]}
+#define TELEMETRY_PAYLOAD_OVERHEAD      14
+#endif
+
+/*
+    Temperature data is published to device/<thingname>/temperature/<encoding>,
+    json keeps the original data topic so existing rules keep working.
+ */
+#if CONFIG_TELEMETRY_ENCODING_CBOR
+#define TELEMETRY_TOPIC_FORMAT          "device/%s/temperature/" TELEMETRY_ENCODING
+#else
+#define TELEMETRY_TOPIC_FORMAT          "device/%s/temperature/data"
+#endif
+
+// QoS of temperature data, with QoS 1 esp-mqtt keeps a batch in its outbox until it is acked
+#define TELEMETRY_QOS                   CONFIG_TELEMETRY_QOS
+
+// Channel id of the on-board temperature sensor
+#define TELEMETRY_CHANNEL_TEMPERATURE   0
+
+/**
+ *  Add sample to the ring buffer.
+ *  When the ring buffer is full the oldest sample is overwritten and counted as dropped.
+*/
+void telemetry_add_sample(uint8_t channel, float temperature, int64_t now_ms);
+
+/**
+ *  Check flush policy
+ * @return true when the pending samples should be published
+*/
+bool telemetry_should_flush(int64_t now_ms);
+
+/**
+ *  Encode the pending samples, oldest first, to a payload with the configured encoding.
+ *  The payload is binary with CBOR, use the returned length instead of strlen().
+ *  Samples are not removed, call telemetry_consume() once the payload has been published.
+ * @param num_samples set to the number of samples that fit in the payload
+ * @return  length of the payload on success,
+ *          -1 if not even one sample fits
+*/
+int telemetry_encode(char *payload, size_t size_of_payload, size_t *num_samples);
+
+/**
+ *  Encode samples of an array, e.g. samples replayed from flash, the same way as telemetry_encode()
+ * @param num_samples set to the number of samples that fit in the payload
+ * @return  length of the payload on success,
+ *          -1 if not even one sample fits
+*/
+int telemetry_encode_array(
+    const struct telemetry_sample *array, size_t num_array, char *payload, size_t size_of_payload, size_t *num_samples
+);
+
+/// Oldest sample in the ring buffer, NULL if it is empty
+const struct telemetry_sample *telemetry_oldest(void);
+
+/// Remove the oldest @param num_samples samples from the ring buffer
+void telemetry_consume(size_t num_samples);
+
+/// Number of samples waiting to be published
+size_t telemetry_pending(void);
+
+/// Continue sequence numbers at @param seq, e.g. the first number of a block reserved with nvs_seq_reserve()
+void telemetry_set_seq(uint32_t seq);
+
+/// Sequence number the next sample gets
+uint32_t telemetry_next_seq(void);
+
+/// Number of samples overwritten before they could be published
+uint32_t telemetry_dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    The sample type on its own, without the configuration of telemetry.h,
+    so modules that only buffer samples (e.g. duty_cycle) have no dependency on sdkconfig.h.
+ */
+
+/// One temperature reading
+struct telemetry_sample {
+    int64_t timestamp_ms;   // time of the reading, ms since boot
+    uint32_t seq;           // sequence number, increases with every sample and across reboots
+    uint8_t channel;        // channel id of the sensor
+    float temperature;      // celsius
+};
+
+#ifdef __cplusplus
+}
+#endif
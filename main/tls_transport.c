@@ -0,0 +1,348 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lwip/sockets.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_tls.h"
+#include "esp_rom_crc.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/pk.h"
+#include "main.h"
+#include "mqtt_stats.h"
+#include "tls_transport.h"
+
+/// Context of a transport, allocated by tls_transport_create()
+struct tls_transport {
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctr_drbg;
+    mbedtls_x509_crt client_cert;
+    mbedtls_pk_context client_key;
+    mbedtls_ssl_config conf;
+    mbedtls_ssl_context ssl;
+    mbedtls_net_context net;        // fd is -1 while not connected
+    uint32_t cert_crc;              // crc of the client certificate, the saved session belongs to it
+    bool cert_verified;             // server certificate went through verification in this handshake
+};
+
+// Session of the last handshake, offered on the next connect
+static mbedtls_ssl_session saved_session;
+static bool session_saved = false;
+static uint32_t session_cert_crc;
+
+/// Called for every certificate of the chain the server sends, only a full handshake sends one
+static int tls_verify(void *arg, mbedtls_x509_crt *crt, int depth, uint32_t *flags);
+
+/// Drop the saved session
+static void session_forget(void);
+
+/// Keep the session of the connection for the next connect
+static void session_save(struct tls_transport *tls);
+
+/// Free the connection, the transport can connect again
+static void tls_disconnect(struct tls_transport *tls);
+
+/// Free the transport context
+static void tls_free(struct tls_transport *tls);
+
+/// Wait until the socket is readable or writable, @return > 0 when ready, 0 on timeout, -1 on error
+static int tls_poll(struct tls_transport *tls, int timeout_ms, bool write);
+
+static int tls_connect(esp_transport_handle_t t, const char *host, int port, int timeout_ms);
+static int tls_read(esp_transport_handle_t t, char *buffer, int len, int timeout_ms);
+static int tls_write(esp_transport_handle_t t, const char *buffer, int len, int timeout_ms);
+static int tls_poll_read(esp_transport_handle_t t, int timeout_ms);
+static int tls_poll_write(esp_transport_handle_t t, int timeout_ms);
+static int tls_close(esp_transport_handle_t t);
+static int tls_destroy(esp_transport_handle_t t);
+
+esp_transport_handle_t tls_transport_create(const struct tls_certs *certs)
+{
+    mbedtls_x509_crt *ca = esp_tls_get_global_ca_store();
+    struct tls_transport *tls;
+    esp_transport_handle_t t;
+    int ret;
+
+    if(ca == NULL) {
+        printf("TLS transport needs the global CA store.\n");
+        return NULL;
+    }
+
+    tls = calloc(1, sizeof *tls);
+    if(tls == NULL) {
+        return NULL;
+    }
+    mbedtls_entropy_init(&tls->entropy);
+    mbedtls_ctr_drbg_init(&tls->ctr_drbg);
+    mbedtls_x509_crt_init(&tls->client_cert);
+    mbedtls_pk_init(&tls->client_key);
+    mbedtls_ssl_config_init(&tls->conf);
+    mbedtls_ssl_init(&tls->ssl);
+    mbedtls_net_init(&tls->net);
+
+    // Parsed once here instead of on every connect, PEM lengths include the NUL
+    ret = mbedtls_ctr_drbg_seed(&tls->ctr_drbg, mbedtls_entropy_func, &tls->entropy, NULL, 0);
+    if(ret == 0) {
+        ret = mbedtls_x509_crt_parse(&tls->client_cert, (const unsigned char *)certs->client_cert,
+            certs->client_cert_len);
+    }
+    if(ret == 0) {
+        ret = mbedtls_pk_parse_key(&tls->client_key, (const unsigned char *)certs->client_key, certs->client_key_len,
+            NULL, 0, mbedtls_ctr_drbg_random, &tls->ctr_drbg);
+    }
+    if(ret == 0) {
+        ret = mbedtls_ssl_config_defaults(&tls->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+            MBEDTLS_SSL_PRESET_DEFAULT);
+    }
+    if(ret == 0) {
+        ret = mbedtls_ssl_conf_own_cert(&tls->conf, &tls->client_cert, &tls->client_key);
+    }
+    if(ret != 0) {
+        printf("Error -0x%x setting up TLS transport.\n", -ret);
+        tls_free(tls);
+        return NULL;
+    }
+
+    mbedtls_ssl_conf_authmode(&tls->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(&tls->conf, ca, NULL);
+    mbedtls_ssl_conf_rng(&tls->conf, mbedtls_ctr_drbg_random, &tls->ctr_drbg);
+    mbedtls_ssl_conf_verify(&tls->conf, tls_verify, tls);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(&tls->conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+    tls->cert_crc = esp_rom_crc32_le(0, (const uint8_t *)certs->client_cert, certs->client_cert_len);
+
+    t = esp_transport_init();
+    if(t == NULL) {
+        tls_free(tls);
+        return NULL;
+    }
+    esp_transport_set_context_data(t, tls);
+    esp_transport_set_func(t, tls_connect, tls_read, tls_write, tls_close, tls_poll_read, tls_poll_write, tls_destroy);
+    return t;
+}
+
+static int tls_verify(void *arg, mbedtls_x509_crt *crt, int depth, uint32_t *flags)
+{
+    struct tls_transport *tls = arg;
+
+    // Verification itself is left to mbedTLS, flags are kept as they are
+    tls->cert_verified = true;
+    return 0;
+}
+
+static void session_forget(void)
+{
+    if(session_saved) {
+        mbedtls_ssl_session_free(&saved_session);
+        session_saved = false;
+    }
+}
+
+static void session_save(struct tls_transport *tls)
+{
+    session_forget();
+
+    // A resumed handshake may come with a new ticket, always keep the latest
+    mbedtls_ssl_session_init(&saved_session);
+    if(mbedtls_ssl_get_session(&tls->ssl, &saved_session) != 0) {
+        mbedtls_ssl_session_free(&saved_session);
+        return;
+    }
+    session_saved = true;
+    session_cert_crc = tls->cert_crc;
+}
+
+static int tls_connect(esp_transport_handle_t t, const char *host, int port, int timeout_ms)
+{
+    struct tls_transport *tls = esp_transport_get_context_data(t);
+    esp_tls_cfg_t cfg = { .timeout_ms = timeout_ms };
+    esp_tls_last_error_t tcp_error = { 0 };
+    int64_t start_us = esp_timer_get_time();
+    int64_t duration_us;
+    bool resumed;
+    int ret;
+
+    tls_disconnect(tls);
+
+    if(esp_tls_plain_tcp_connect(host, strlen(host), port, &cfg, &tcp_error, &tls->net.fd) != ESP_OK) {
+        ESP_LOGE(TAG, "TCP connect to %s:%d failed", host, port);
+        tls->net.fd = -1;
+        return -1;
+    }
+
+    ret = mbedtls_ssl_setup(&tls->ssl, &tls->conf);
+    if(ret == 0) {
+        ret = mbedtls_ssl_set_hostname(&tls->ssl, host);
+    }
+    if(ret == 0 && session_saved && session_cert_crc == tls->cert_crc) {
+        // Only offered, a server that no longer knows the session falls back to a full handshake
+        ret = mbedtls_ssl_set_session(&tls->ssl, &saved_session);
+    }
+    if(ret != 0) {
+        ESP_LOGE(TAG, "Error -0x%x setting up TLS connection", -ret);
+        session_forget();
+        tls_disconnect(tls);
+        return -1;
+    }
+
+    mbedtls_ssl_set_bio(&tls->ssl, &tls->net, mbedtls_net_send, NULL, mbedtls_net_recv_timeout);
+    mbedtls_ssl_conf_read_timeout(&tls->conf, timeout_ms);
+    tls->cert_verified = false;
+
+    do {
+        ret = mbedtls_ssl_handshake(&tls->ssl);
+    } while((ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+        && esp_timer_get_time() - start_us < (int64_t)timeout_ms * 1000);
+
+    if(ret != 0) {
+        ESP_LOGE(TAG, "TLS handshake with %s failed: -0x%x", host, -ret);
+        session_forget();
+        tls_disconnect(tls);
+        return -1;
+    }
+
+    duration_us = esp_timer_get_time() - start_us;
+    resumed = !tls->cert_verified;
+    mqtt_stats_tls_handshake(resumed, duration_us);
+    ESP_LOGI(TAG, "TLS %s handshake in %d ms", resumed ? "resumed" : "full", (int)(duration_us / 1000));
+
+    session_save(tls);
+    return 0;
+}
+
+static int tls_read(esp_transport_handle_t t, char *buffer, int len, int timeout_ms)
+{
+    struct tls_transport *tls = esp_transport_get_context_data(t);
+    int ret;
+
+    // A read timeout of 0 would block in mbedTLS, wait on the socket instead
+    if(mbedtls_ssl_get_bytes_avail(&tls->ssl) == 0) {
+        ret = tls_poll(tls, timeout_ms, false);
+        if(ret <= 0) {
+            return ret;
+        }
+    }
+
+    // Rest of a record that has not fully arrived, mbedTLS keeps what it read for the next call
+    mbedtls_ssl_conf_read_timeout(&tls->conf, timeout_ms > 0 ? timeout_ms : 1);
+    ret = mbedtls_ssl_read(&tls->ssl, (unsigned char *)buffer, len);
+    if(ret == MBEDTLS_ERR_SSL_TIMEOUT || ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+        return 0;
+    }
+    if(ret <= 0) {
+        // 0 and MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY are the end of the connection
+        ESP_LOGW(TAG, "TLS read failed: -0x%x", -ret);
+        return -1;
+    }
+
+    return ret;
+}
+
+static int tls_write(esp_transport_handle_t t, const char *buffer, int len, int timeout_ms)
+{
+    struct tls_transport *tls = esp_transport_get_context_data(t);
+    int written = 0;
+    int ret;
+
+    while(written < len) {
+        ret = mbedtls_ssl_write(&tls->ssl, (const unsigned char *)buffer + written, len - written);
+        if(ret > 0) {
+            written += ret;
+            continue;
+        }
+        if(ret != MBEDTLS_ERR_SSL_WANT_WRITE && ret != MBEDTLS_ERR_SSL_WANT_READ) {
+            ESP_LOGW(TAG, "TLS write failed: -0x%x", -ret);
+            return -1;
+        }
+        if(tls_poll(tls, timeout_ms, true) <= 0) {
+            break;
+        }
+    }
+
+    return written > 0 ? written : -1;
+}
+
+static int tls_poll(struct tls_transport *tls, int timeout_ms, bool write)
+{
+    struct timeval timeout = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    fd_set fds;
+    fd_set error_fds;
+    int ret;
+
+    if(tls->net.fd < 0) {
+        return -1;
+    }
+
+    FD_ZERO(&fds);
+    FD_SET(tls->net.fd, &fds);
+    FD_ZERO(&error_fds);
+    FD_SET(tls->net.fd, &error_fds);
+
+    ret = select(tls->net.fd + 1, write ? NULL : &fds, write ? &fds : NULL, &error_fds,
+        timeout_ms >= 0 ? &timeout : NULL);
+    if(ret > 0 && FD_ISSET(tls->net.fd, &error_fds)) {
+        return -1;
+    }
+
+    return ret;
+}
+
+static int tls_poll_read(esp_transport_handle_t t, int timeout_ms)
+{
+    struct tls_transport *tls = esp_transport_get_context_data(t);
+
+    // Decrypted data waiting in mbedTLS does not show on the socket
+    if(mbedtls_ssl_get_bytes_avail(&tls->ssl) > 0) {
+        return 1;
+    }
+
+    return tls_poll(tls, timeout_ms, false);
+}
+
+static int tls_poll_write(esp_transport_handle_t t, int timeout_ms)
+{
+    return tls_poll(esp_transport_get_context_data(t), timeout_ms, true);
+}
+
+static void tls_disconnect(struct tls_transport *tls)
+{
+    mbedtls_ssl_free(&tls->ssl);
+    mbedtls_ssl_init(&tls->ssl);
+    mbedtls_net_free(&tls->net);
+}
+
+static int tls_close(esp_transport_handle_t t)
+{
+    struct tls_transport *tls = esp_transport_get_context_data(t);
+
+    if(tls->net.fd >= 0) {
+        mbedtls_ssl_close_notify(&tls->ssl);
+    }
+    tls_disconnect(tls);
+    return 0;
+}
+
+static void tls_free(struct tls_transport *tls)
+{
+    tls_disconnect(tls);
+    mbedtls_ssl_free(&tls->ssl);
+    mbedtls_ssl_config_free(&tls->conf);
+    mbedtls_pk_free(&tls->client_key);
+    mbedtls_x509_crt_free(&tls->client_cert);
+    mbedtls_ctr_drbg_free(&tls->ctr_drbg);
+    mbedtls_entropy_free(&tls->entropy);
+    free(tls);
+}
+
+static int tls_destroy(esp_transport_handle_t t)
+{
+    struct tls_transport *tls = esp_transport_get_context_data(t);
+
+    // The saved session outlives the transport, a new client resumes it
+    tls_free(tls);
+    return 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "esp_transport.h"
+#include "my_nvs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    TLS transport for esp-mqtt (network.transport) that resumes the previous TLS session on reconnect.
+    The built in transport of esp-mqtt starts every connection with a full handshake: certificate chain,
+    client certificate and a signature with the device key. This one keeps the mbedtls_ssl_session of the last
+    handshake and offers it on the next connect, a server that still knows the session id or accepts the
+    session ticket skips the certificate exchange.
+    A handshake that ran the server certificate through verification was a full one, anything else was resumed,
+    every handshake is counted with mqtt_stats_tls_handshake().
+    The session is kept in RAM for the client certificate it was established with, a wake from deep sleep
+    starts with a full handshake. It is dropped after a failed handshake.
+    The client certificate and key are parsed once when the transport is created. The server is verified against
+    the global CA store of cred_cache, both have to stay loaded as long as the client exists.
+ */
+
+/**
+ *  Create the transport, esp-mqtt destroys it with the client
+ * @param certs client certificate and key, PEM with the NUL counted in the length or DER
+ * @return  transport handle on success,
+ *          NULL if the CA store is empty, the credentials could not be parsed or on out of memory
+*/
+esp_transport_handle_t tls_transport_create(const struct tls_certs *certs);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,16 +1,23 @@
+#include <stdlib.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
+#include "esp_mac.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_err.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
 #include "wifi.h"
 #include "ble_prov.h"
 #include "my_nvs.h"
+#include "boot_timeline.h"
+#include "reconnect.h"
+#include "wifi_aps.h"
 
 #include "ble_prov_gatt.h"
 
@@ -26,37 +33,191 @@ static EventGroupHandle_t s_wifi_event_group;
 // Keeps track of retries
 static int s_retry_num = 0;
 
+// Set by wifi_start_sta(), wifi_init_sta() gives up after WIFI_MAX_RETRY retries
+static bool s_retry_forever = false;
+
+// Config of the connection, kept to fall back from a directed connect to a scan
+static wifi_config_t s_wifi_config;
+
+// Directed connect to the cached AP in progress, its first failure falls back to a scan
+static bool s_fast_connect = false;
+
+// esp_wifi_start() time and AP of the connection
+static int64_t s_start_us;
+static wifi_ap_record_t s_ap_info;
+static struct wifi_connect_stats s_connect_stats;
+
+// Known APs, with more than one every connection starts with a scan to pick the best
+static struct wifi_aps s_aps;
+static bool s_multi_ap = false;
+static bool s_aps_dirty = false;
+static int64_t s_aps_saved_ms = 0;
+static portMUX_TYPE s_aps_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Ranked APs of the last scan and the one being tried, s_ap_index is -1 when not trying one.
+// s_scan_aps is a copy of s_aps taken under s_aps_lock, wifi_add_ap() may change s_aps while it is in use
+static struct wifi_aps s_scan_aps;
+static wifi_ap_record_t s_scan_records[WIFI_SCAN_MAX_RECORDS];
+static wifi_ap_record_t s_candidate_records[WIFI_APS_MAX];
+static uint8_t s_candidates[WIFI_APS_MAX];
+static size_t s_num_candidates = 0;
+static size_t s_candidate = 0;
+static int s_ap_index = -1;
+
+// Told about connection changes, see wifi_start_sta()
+static wifi_state_callback_t s_state_callback = NULL;
+static void *s_state_callback_arg = NULL;
+
 // Function declarations
+
+/// Start wifi, @param retry_forever selects between the backoff of reconnect.h and giving up after WIFI_MAX_RETRY
+static esp_err_t wifi_start(const uint8_t *ssid, const uint8_t *pwd, wifi_state_callback_t callback, void *arg,
+    bool retry_forever);
+
+/// wifi_init_sta() telling @param callback about the connection
+static esp_err_t wifi_wait_sta(const uint8_t *ssid, const uint8_t *pwd, wifi_state_callback_t callback, void *arg);
+
 static void wifi_event_handler(void* arg, esp_event_base_t event_base,
                                 int32_t event_id, void* event_data);
 
+/// crc of @param ssid, ties a cached AP to the ssid it was found with
+static uint32_t wifi_ssid_crc(const uint8_t *ssid);
+
+/// Set up a directed connect when an AP is cached for the ssid of @param wifi_config
+static void wifi_load_ap_cache(wifi_config_t *wifi_config);
+
+/// Tell the state callback, if any
+static void wifi_notify_state(enum wifi_state state);
+
+/// Connect, with several known APs scan first and try the best one
+static void wifi_connect_best(void);
+
+/// Rank the known APs that the scan found and try the best one
+static void wifi_scan_done(void);
+
+/// Try the AP at s_candidate of the ranking
+static void wifi_connect_candidate(void);
+
+/// Count an attempt of the AP being tried
+static void wifi_record_attempt(bool success);
+
+/// Write the AP history to NVS if it changed
+static void wifi_save_aps(void);
+
+/// Retry policy of a disconnect reason
+static enum reconnect_reason wifi_reconnect_reason(uint8_t reason);
+
+/// Scheduled by reconnect_schedule()
+static void wifi_reconnect(void);
+
 static void wifi_event_handler(void* arg, esp_event_base_t event_base,
                                 int32_t event_id, void* event_data)
 {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        esp_wifi_connect();
+        wifi_notify_state(WIFI_STATE_CONNECTING);
+        wifi_connect_best();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE) {
+        wifi_scan_done();
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        if (s_retry_num < WIFI_MAX_RETRY) {
+        wifi_event_sta_disconnected_t* disconnected = (wifi_event_sta_disconnected_t*) event_data;
+        enum reconnect_reason reason = wifi_reconnect_reason(disconnected->reason);
+        enum wifi_state state;
+        uint32_t delay_ms;
+
+        if (s_fast_connect) {
+            // Cached AP is gone or moved to an other channel, scan for the ssid instead
+            ESP_LOGI(TAG, "fast connect failed, scanning");
+            s_fast_connect = false;
+            s_connect_stats.fast_connect_failed = true;
+            s_wifi_config.sta.bssid_set = false;
+            memset(s_wifi_config.sta.bssid, 0, sizeof s_wifi_config.sta.bssid);
+            s_wifi_config.sta.channel = 0;
+            esp_wifi_set_config(WIFI_IF_STA, &s_wifi_config);
+            esp_wifi_connect();
+        } else if (s_ap_index >= 0 && s_candidate + 1 < s_num_candidates) {
+            // Next AP of the ranking right away, the backoff is for when none of them connects
+            ESP_LOGI(TAG, "connect to %s failed, reason %d", s_scan_aps.entries[s_ap_index].ssid, disconnected->reason);
+            wifi_record_attempt(false);
+            s_candidate++;
+            wifi_connect_candidate();
+        } else if (s_retry_forever) {
+            wifi_record_attempt(false);
+            // Never give up, a router reboot must not de-provision the device
+            delay_ms = reconnect_schedule(RECONNECT_WIFI, reason);
+            ESP_LOGI(TAG, "retry to connect to the AP in %d ms, reason %d", (int)delay_ms, disconnected->reason);
+
+            if (reason == RECONNECT_REASON_AUTH && reconnect_auth_failed(RECONNECT_WIFI)) {
+                ESP_LOGW(TAG, "wifi password looks wrong, retrying slowly");
+                state = WIFI_STATE_AUTH_FAILED;
+            } else if (reason == RECONNECT_REASON_NO_AP) {
+                state = WIFI_STATE_NO_AP;
+            } else {
+                state = WIFI_STATE_DISCONNECTED;
+            }
+            xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+            wifi_notify_state(state);
+            return;
+        } else if (s_retry_num < WIFI_MAX_RETRY) {
             esp_wifi_connect();
             s_retry_num++;
             ESP_LOGI(TAG, "retry to connect to the AP");
         } else {
             // Failed to connect to wifi
             xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+            wifi_notify_state(WIFI_STATE_FAILED);
+            ESP_LOGI(TAG,"connect to the AP fail");
+            return;
         }
+        xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+        wifi_notify_state(WIFI_STATE_DISCONNECTED);
         ESP_LOGI(TAG,"connect to the AP fail");
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+        // Stats are of the first connection, reconnects are not timed from esp_wifi_start()
+        if (s_connect_stats.connect_ms == 0) {
+            s_connect_stats.connect_ms = (uint32_t)((esp_timer_get_time() - s_start_us) / 1000);
+            s_connect_stats.fast_connect = s_fast_connect;
+        }
+        s_fast_connect = false;
+        if (esp_wifi_sta_get_ap_info(&s_ap_info) != ESP_OK) {
+            memset(&s_ap_info, 0, sizeof s_ap_info);
+        }
         s_retry_num = 0;
+        wifi_record_attempt(true);
+        reconnect_connected(RECONNECT_WIFI);
         // Successfully connected to wifi
+        xEventGroupClearBits(s_wifi_event_group, WIFI_FAIL_BIT);
         xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+        wifi_notify_state(WIFI_STATE_CONNECTED);
     }
 }
 
-esp_err_t wifi_init_sta(uint8_t *ssid, uint8_t *pwd)
+esp_err_t wifi_start_sta(const uint8_t *ssid, const uint8_t *pwd, wifi_state_callback_t callback, void *arg)
+{
+    esp_err_t err;
+
+    err = reconnect_init(RECONNECT_WIFI, wifi_reconnect);
+    if(err != ESP_OK) {
+        return err;
+    }
+
+    // The provisioned ssid is part of the list, a list of one connects like before
+    if(nvs_get_wifi_aps(&s_aps) == ESP_OK && s_aps.count > 1) {
+        ESP_LOGI(TAG, "%d known APs, picking the best by scan", (int)s_aps.count);
+        s_multi_ap = true;
+    }
+
+    return wifi_start(ssid, pwd, callback, arg, true);
+}
+
+static esp_err_t wifi_start(const uint8_t *ssid, const uint8_t *pwd, wifi_state_callback_t callback, void *arg,
+    bool retry_forever)
 {
+    s_retry_forever = retry_forever;
     s_wifi_event_group = xEventGroupCreate();
+    s_state_callback = callback;
+    s_state_callback_arg = arg;
 
     // Initialize the underlying TCP/IP stack
     ESP_ERROR_CHECK(esp_netif_init());
@@ -92,11 +253,32 @@ esp_err_t wifi_init_sta(uint8_t *ssid, uint8_t *pwd)
     strncpy((char *)wifi_config.sta.ssid, (char *)ssid, sizeof wifi_config.sta.ssid);
     strncpy((char *)wifi_config.sta.password, (char *)pwd, sizeof wifi_config.sta.password);
 
+    memset(&s_connect_stats, 0, sizeof s_connect_stats);
+    memset(&s_ap_info, 0, sizeof s_ap_info);
+    if(!s_multi_ap) {
+        wifi_load_ap_cache(&wifi_config);
+    }
+    s_wifi_config = wifi_config;
+
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
+    boot_timeline_mark("wifi_start");
+    s_start_us = esp_timer_get_time();
     ESP_ERROR_CHECK(esp_wifi_start() );
 
-    ESP_LOGI(TAG, "wifi_init_sta finished.");
+    ESP_LOGI(TAG, "wifi_start_sta finished.");
+    return ESP_OK;
+}
+
+esp_err_t wifi_init_sta(uint8_t *ssid, uint8_t *pwd)
+{
+    return wifi_wait_sta(ssid, pwd, NULL, NULL);
+}
+
+static esp_err_t wifi_wait_sta(const uint8_t *ssid, const uint8_t *pwd, wifi_state_callback_t callback, void *arg)
+{
+    // Credentials are being tested, a wrong password has to fail quickly
+    wifi_start(ssid, pwd, callback, arg, false);
 
     /* Waiting until either the connection is established (WIFI_CONNECTED_BIT) or connection failed for the maximum
      * number of re-tries (WIFI_FAIL_BIT). The bits are set by event_handler() (see above) */
@@ -109,7 +291,9 @@ esp_err_t wifi_init_sta(uint8_t *ssid, uint8_t *pwd)
     /* xEventGroupWaitBits() returns the bits before the call returned, hence we can test which event actually
      * happened. */
     if (bits & WIFI_CONNECTED_BIT) {
-        ESP_LOGI(TAG, "connected to ap");
+        ESP_LOGI(TAG, "connected to ap in %d ms (%s)", (int)s_connect_stats.connect_ms,
+            s_connect_stats.fast_connect ? "cached AP" : "scan");
+        wifi_save_ap_cache();
         return ESP_OK;
     } else if (bits & WIFI_FAIL_BIT) {
         ESP_LOGI(TAG, "Failed to connect");
@@ -120,43 +304,290 @@ esp_err_t wifi_init_sta(uint8_t *ssid, uint8_t *pwd)
     }
 }
 
-void wifi_test_prov_data(struct prov_data *pdata)
+void wifi_get_connect_stats(struct wifi_connect_stats *stats)
+{
+    *stats = s_connect_stats;
+}
+
+esp_err_t wifi_test_prov_data(struct prov_data *pdata, wifi_state_callback_t callback, void *arg)
+{
+    esp_err_t ret = wifi_wait_sta(pdata->ssid, pdata->pwd, callback, arg);
+    if(ret != ESP_OK) {
+        ESP_LOGI(TAG, "Connection to wifi failed.");
+        return ret;
+    }
+
+    // SUCCESS; Save pdata to nvs, the caller reboots
+    ESP_LOGI(TAG, "Connection to wifi succeeded.");
+
+    // SAVE PROV DATA TO NVS
+    ESP_LOGI(TAG, "Saving of prov data...");
+    ret = nvs_set_prov_data(pdata);
+    if(ret != ESP_OK) {
+        printf("Error (%s) while setting wifi data!\n", esp_err_to_name(ret));
+        return ret;
+    }
+    ESP_LOGI(TAG, "Saving of prov data succeeded.");
+    return ESP_OK;
+}
+
+static uint32_t wifi_ssid_crc(const uint8_t *ssid)
+{
+    return esp_rom_crc32_le(0, ssid, strnlen((const char *)ssid, sizeof s_wifi_config.sta.ssid));
+}
+
+static void wifi_load_ap_cache(wifi_config_t *wifi_config)
+{
+#if CONFIG_WIFI_FAST_CONNECT
+    struct wifi_ap_cache ap;
+
+    if(nvs_get_wifi_ap_cache(&ap) != ESP_OK) {
+        return;
+    }
+
+    // Cached for an other network, or an AP weaker than the threshold allows
+    if(ap.ssid_crc != wifi_ssid_crc(wifi_config->sta.ssid) || ap.channel == 0
+        || ap.authmode < wifi_config->sta.threshold.authmode) {
+        return;
+    }
+
+    // Only the cached channel is probed, and only the cached AP answers
+    wifi_config->sta.bssid_set = true;
+    memcpy(wifi_config->sta.bssid, ap.bssid, sizeof ap.bssid);
+    wifi_config->sta.channel = ap.channel;
+    s_fast_connect = true;
+
+    ESP_LOGI(TAG, "fast connect to " MACSTR " on channel %d", MAC2STR(ap.bssid), ap.channel);
+#endif
+}
+
+void wifi_save_ap_cache(void)
+{
+    wifi_save_aps();
+
+#if CONFIG_WIFI_FAST_CONNECT
+    struct wifi_ap_cache ap;
+    esp_err_t err;
+
+    // Several known APs are picked by scan, the cache is not used
+    if(s_multi_ap || s_ap_info.primary == 0) {
+        return;
+    }
+
+    memset(&ap, 0, sizeof ap);
+    ap.ssid_crc = wifi_ssid_crc(s_wifi_config.sta.ssid);
+    memcpy(ap.bssid, s_ap_info.bssid, sizeof ap.bssid);
+    ap.channel = s_ap_info.primary;
+    ap.authmode = s_ap_info.authmode;
+
+    err = nvs_set_wifi_ap_cache(&ap);
+    if(err != ESP_OK) {
+        ESP_LOGW(TAG, "Error (%s) caching AP", esp_err_to_name(err));
+    }
+#endif
+}
+
+void wifi_save_aps_periodic(int64_t now_ms)
+{
+    if(!s_aps_dirty || (s_aps_saved_ms != 0 && now_ms - s_aps_saved_ms < WIFI_APS_SAVE_INTERVAL_MS)) {
+        return;
+    }
+
+    wifi_save_aps();
+}
+
+static void wifi_save_aps(void)
+{
+    struct wifi_aps *aps;
+    esp_err_t err;
+
+    if(!s_aps_dirty || (aps = malloc(sizeof *aps)) == NULL) {
+        return;
+    }
+
+    portENTER_CRITICAL(&s_aps_lock);
+    *aps = s_aps;
+    s_aps_dirty = false;
+    portEXIT_CRITICAL(&s_aps_lock);
+
+    err = nvs_set_wifi_aps(aps);
+    if(err != ESP_OK) {
+        ESP_LOGW(TAG, "Error (%s) saving AP history", esp_err_to_name(err));
+    }
+    s_aps_saved_ms = esp_timer_get_time() / 1000;
+    free(aps);
+}
+
+static void wifi_notify_state(enum wifi_state state)
 {
-    esp_err_t ret = wifi_init_sta(pdata->ssid, pdata->pwd);
-    if(ret == ESP_OK) {
-        // SUCCESS; Save pdata to nvs and reboot
-        ESP_LOGI(TAG, "Connection to wifi succeeded.");
+    if(s_state_callback != NULL) {
+        s_state_callback(state, s_state_callback_arg);
+    }
+}
+
+static enum reconnect_reason wifi_reconnect_reason(uint8_t reason)
+{
+    switch(reason) {
+    case WIFI_REASON_NO_AP_FOUND:
+        return RECONNECT_REASON_NO_AP;
+    // A wrong WPA2 passphrase shows up as a timed out 4-way handshake
+    case WIFI_REASON_AUTH_FAIL:
+    case WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT:
+    case WIFI_REASON_HANDSHAKE_TIMEOUT:
+        return RECONNECT_REASON_AUTH;
+    default:
+        return RECONNECT_REASON_OTHER;
+    }
+}
+
+static void wifi_reconnect(void)
+{
+    wifi_connect_best();
+}
 
-        // SAVE PROV DATA TO NVS
-        ESP_LOGI(TAG, "Saving of prov data...");
-        ret = nvs_set_prov_data(pdata);
-        if(ret != ESP_OK) {
-            printf("Error (%s) while setting wifi data!\n", esp_err_to_name(ret));
+static void wifi_connect_best(void)
+{
+    wifi_scan_config_t scan_config = {
+        .show_hidden = false,
+    };
+    esp_err_t err;
+
+    if(s_multi_ap) {
+        // One scan of all channels, WIFI_EVENT_SCAN_DONE ranks what it found
+        err = esp_wifi_scan_start(&scan_config, false);
+        if(err == ESP_OK) {
             return;
         }
-        ESP_LOGI(TAG, "Saving of prov data succeeded.");
-        ESP_LOGI(TAG, "Restarting...");
+        ESP_LOGW(TAG, "Error (%s) starting scan", esp_err_to_name(err));
+    }
 
-        esp_restart();
-    } else {
-        // FAILED; Reboot
-        ESP_LOGI(TAG, "Connection to wifi failed.");
-        ESP_LOGI(TAG, "Restarting...");
-        esp_restart();
+    err = esp_wifi_connect();
+    if(err != ESP_OK) {
+        ESP_LOGW(TAG, "Error (%s) connecting to the AP", esp_err_to_name(err));
+    }
+}
+
+static void wifi_scan_done(void)
+{
+    int8_t rssi[WIFI_APS_MAX];
+    uint16_t num_records = WIFI_SCAN_MAX_RECORDS;
+    uint32_t delay_ms;
+    int index;
+    int i;
+
+    if(!s_multi_ap) {
+        return;
+    }
+
+    if(esp_wifi_scan_get_ap_records(&num_records, s_scan_records) != ESP_OK) {
+        num_records = 0;
+    }
+
+    portENTER_CRITICAL(&s_aps_lock);
+    s_scan_aps = s_aps;
+    portEXIT_CRITICAL(&s_aps_lock);
+
+    // Strongest BSS of every known ssid
+    for(i = 0; i < WIFI_APS_MAX; i++) {
+        rssi[i] = WIFI_APS_RSSI_NONE;
+    }
+    for(i = 0; i < num_records; i++) {
+        index = wifi_aps_find(&s_scan_aps, (const char *)s_scan_records[i].ssid);
+        if(index >= 0 && s_scan_records[i].rssi > rssi[index]) {
+            rssi[index] = s_scan_records[i].rssi;
+            s_candidate_records[index] = s_scan_records[i];
+        }
+    }
+
+    s_num_candidates = wifi_aps_rank(&s_scan_aps, rssi, s_candidates);
+    s_candidate = 0;
+
+    if(s_num_candidates == 0) {
+        // Same as failing to find the AP, retried after the backoff
+        s_ap_index = -1;
+        delay_ms = reconnect_schedule(RECONNECT_WIFI, RECONNECT_REASON_NO_AP);
+        ESP_LOGI(TAG, "no known AP found, scanning again in %d ms", (int)delay_ms);
+        wifi_notify_state(WIFI_STATE_NO_AP);
+        return;
+    }
+
+    for(i = 0; i < s_num_candidates; i++) {
+        index = s_candidates[i];
+        ESP_LOGI(TAG, "AP %d: %s, rssi %d, %d/%d connects", i, s_scan_aps.entries[index].ssid, rssi[index],
+            s_scan_aps.entries[index].successes, s_scan_aps.entries[index].attempts);
+    }
+    wifi_connect_candidate();
+}
+
+static void wifi_connect_candidate(void)
+{
+    const wifi_ap_record_t *record;
+    const struct wifi_ap_entry *entry;
+
+    s_ap_index = s_candidates[s_candidate];
+    entry = &s_scan_aps.entries[s_ap_index];
+    record = &s_candidate_records[s_ap_index];
+
+    // Directed at the BSS the scan found, no second scan
+    memset(s_wifi_config.sta.ssid, 0, sizeof s_wifi_config.sta.ssid);
+    memset(s_wifi_config.sta.password, 0, sizeof s_wifi_config.sta.password);
+    strncpy((char *)s_wifi_config.sta.ssid, entry->ssid, sizeof s_wifi_config.sta.ssid);
+    strncpy((char *)s_wifi_config.sta.password, entry->pwd, sizeof s_wifi_config.sta.password);
+    s_wifi_config.sta.bssid_set = true;
+    memcpy(s_wifi_config.sta.bssid, record->bssid, sizeof s_wifi_config.sta.bssid);
+    s_wifi_config.sta.channel = record->primary;
+
+    esp_wifi_set_config(WIFI_IF_STA, &s_wifi_config);
+    esp_wifi_connect();
+}
+
+esp_err_t wifi_add_ap(const char *ssid, const char *pwd)
+{
+    struct wifi_aps *aps;
+    bool loaded;
+    esp_err_t err;
+
+    // Started by wifi_start_sta(), the list is in use, add to it and let wifi_save_ap_cache() write it
+    portENTER_CRITICAL(&s_aps_lock);
+    loaded = s_aps.count > 0;
+    if(loaded) {
+        wifi_aps_add(&s_aps, ssid, pwd);
+        s_multi_ap = s_aps.count > 1;
+        s_aps_dirty = true;
+    }
+    portEXIT_CRITICAL(&s_aps_lock);
+
+    if(loaded) {
+        wifi_save_ap_cache();
+        return ESP_OK;
+    }
+
+    aps = malloc(sizeof *aps);
+    if(aps == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    err = nvs_get_wifi_aps(aps);
+    if(err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) {
+        wifi_aps_add(aps, ssid, pwd);
+        err = nvs_set_wifi_aps(aps);
     }
+
+    free(aps);
+    return err;
 }
 
-void wifi_task(void* arg)
+static void wifi_record_attempt(bool success)
 {
-    ESP_LOGI(TAG, "Wifi task created!");
-    // Get pdata from passes parameter
-    struct prov_data *pdata = (struct prov_data *)arg;
+    if(s_ap_index < 0) {
+        return;
+    }
 
-    // wait for 1 second
-    vTaskDelay(1000 / portTICK_PERIOD_MS);
-    wifi_test_prov_data(pdata);
-    // Delete this task after, not really needed as above function will 
-    // always (almost) end in reboot
-    ESP_LOGI(TAG, "Error occurred while testing wifi data.");
-    vTaskDelete(NULL);
-}
\ No newline at end of file
+    // Looked up again, wifi_add_ap() may have replaced the entry since the scan
+    portENTER_CRITICAL(&s_aps_lock);
+    wifi_aps_record(&s_aps, wifi_aps_find(&s_aps, s_scan_aps.entries[s_ap_index].ssid), success);
+    s_aps_dirty = true;
+    portEXIT_CRITICAL(&s_aps_lock);
+
+    s_ap_index = -1;
+}
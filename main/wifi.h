@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "esp_err.h"
 #include "sdkconfig.h"
 #include "main.h"
@@ -12,6 +14,12 @@ extern "C" {
 // Maximum amount of tries wifi will try to connect to AP
 #define WIFI_MAX_RETRY  CONFIG_WIFI_MAXIMUM_RETRY
 
+// Scan results looked at when picking one of several known APs
+#define WIFI_SCAN_MAX_RECORDS   16
+
+// Least time between two writes of the AP history by wifi_save_aps_periodic(), a flapping AP must not wear the flash
+#define WIFI_APS_SAVE_INTERVAL_MS   (10 * 60 * 1000)
+
 /* Strength of authmodes */
 /* OPEN < WEP < WPA_PSK < OWE < WPA2_PSK = WPA_WPA2_PSK < WAPI_PSK < WPA2_ENTERPRISE < WPA3_PSK = WPA2_WPA3_PSK */
 #if CONFIG_ESP_WIFI_AUTH_OPEN
@@ -32,20 +40,80 @@ extern "C" {
 #define ESP_WIFI_SCAN_AUTH_MODE_THRESHOLD WIFI_AUTH_WAPI_PSK
 #endif
 
+/// Connection changes told to a wifi_state_callback_t
+enum wifi_state {
+    WIFI_STATE_CONNECTED = 0,       // got an ip
+    WIFI_STATE_DISCONNECTED,        // lost the AP or failed to connect, retrying
+    WIFI_STATE_NO_AP,               // AP not found, retrying
+    WIFI_STATE_AUTH_FAILED,         // password failed WIFI_MAX_RETRY times in a row, retrying slowly
+    WIFI_STATE_FAILED,              // wifi_init_sta() gave up after WIFI_MAX_RETRY retries
+    WIFI_STATE_CONNECTING,          // station started, first connection attempt
+};
+
+/// Called from the event loop task, must not block
+typedef void (*wifi_state_callback_t)(enum wifi_state state, void *arg);
+
+/// How the last connection was made
+struct wifi_connect_stats {
+    uint32_t connect_ms;            // esp_wifi_start() to got ip
+    bool fast_connect;              // connected to the cached AP without a scan
+    bool fast_connect_failed;       // cached AP did not answer, fell back to a scan
+};
+
 /**
- * Connect to wifi
+ * Start connecting to wifi without waiting for the connection.
+ * A lost connection is retried forever with the backoff of reconnect.h.
+ * @param callback told about connection changes, may be NULL
+ * @param arg passed to @param callback
+ * @return ESP_OK once the connection has been started
+*/
+esp_err_t wifi_start_sta(const uint8_t *ssid, const uint8_t *pwd, wifi_state_callback_t callback, void *arg);
+
+/**
+ * Connect to wifi, blocks until connected or WIFI_MAX_RETRY retries failed
  * @arg pdata: provisioning data
  * @return ESP_OK for success, ESP_FAIL for failure
 */
 esp_err_t wifi_init_sta(uint8_t *ssid, uint8_t *pwd);
 
 /**
- * Check wifi provisioning data
- * @arg pdata: Provisioning data
+ * Cache the AP of the connection for the next boot, see CONFIG_WIFI_FAST_CONNECT,
+ * and save the connection history of the known APs.
+ * Writes NVS, call it from a task and not from a wifi_state_callback_t.
+ * wifi_init_sta() does this by itself.
 */
-void wifi_test_prov_data(struct prov_data *pdata);
+void wifi_save_ap_cache(void);
 
-void wifi_task(void* arg);
+/**
+ * Remember an other AP, or update the password of a known one, and save the list to NVS.
+ * The AP is a candidate from the next connect on: once more than one AP is known every connect starts with a scan.
+ * Writes NVS, call it from a task and not from a wifi_state_callback_t.
+ * @return  ESP_OK on success,
+ *          ESP_ERR_NO_MEM or error of NVS on failure
+*/
+esp_err_t wifi_add_ap(const char *ssid, const char *pwd);
+
+/**
+ * Save the connection history of the known APs when reconnects changed it,
+ * at most once every WIFI_APS_SAVE_INTERVAL_MS.
+ * Writes NVS, call it from a task and not from a wifi_state_callback_t.
+ * @param now_ms current time, e.g. from esp_timer_get_time()
+*/
+void wifi_save_aps_periodic(int64_t now_ms);
+
+/// Get stats of the first connection since wifi was started, valid once WIFI_STATE_CONNECTED was told
+void wifi_get_connect_stats(struct wifi_connect_stats *stats);
+
+/**
+ * Check wifi provisioning data, blocks like wifi_init_sta() and saves the data to NVS once connected
+ * @arg pdata: Provisioning data
+ * @param callback told about connection changes while testing, may be NULL
+ * @param arg passed to @param callback
+ * @return  ESP_OK when connected and saved,
+ *          ESP_FAIL if the connection failed,
+ *          error of NVS if saving failed
+*/
+esp_err_t wifi_test_prov_data(struct prov_data *pdata, wifi_state_callback_t callback, void *arg);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,111 @@
+#include <string.h>
+#include "wifi_aps.h"
+
+/// Success rate in percent, an AP without history counts as 50%
+static int wifi_aps_success_rate(const struct wifi_ap_entry *entry);
+
+/// Rank score of an AP seen with @param rssi
+static int wifi_aps_score(const struct wifi_ap_entry *entry, int8_t rssi);
+
+int wifi_aps_find(const struct wifi_aps *aps, const char *ssid)
+{
+    uint32_t i;
+
+    for(i = 0; i < aps->count && i < WIFI_APS_MAX; i++) {
+        if(strncmp(aps->entries[i].ssid, ssid, WIFI_APS_SSID_SIZE) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int wifi_aps_add(struct wifi_aps *aps, const char *ssid, const char *pwd)
+{
+    struct wifi_ap_entry *entry;
+    int index;
+    uint32_t i;
+
+    index = wifi_aps_find(aps, ssid);
+    if(index >= 0) {
+        entry = &aps->entries[index];
+        if(strncmp(entry->pwd, pwd, WIFI_APS_PWD_SIZE) != 0) {
+            // New password, the old history says nothing about it
+            strncpy(entry->pwd, pwd, WIFI_APS_PWD_SIZE - 1);
+            entry->pwd[WIFI_APS_PWD_SIZE - 1] = '\0';
+            entry->attempts = 0;
+            entry->successes = 0;
+        }
+        return index;
+    }
+
+    if(aps->count < WIFI_APS_MAX) {
+        index = aps->count++;
+    } else {
+        index = 0;
+        for(i = 1; i < WIFI_APS_MAX; i++) {
+            if(wifi_aps_success_rate(&aps->entries[i]) < wifi_aps_success_rate(&aps->entries[index])) {
+                index = i;
+            }
+        }
+    }
+
+    entry = &aps->entries[index];
+    memset(entry, 0, sizeof *entry);
+    strncpy(entry->ssid, ssid, WIFI_APS_SSID_SIZE - 1);
+    strncpy(entry->pwd, pwd, WIFI_APS_PWD_SIZE - 1);
+    return index;
+}
+
+size_t wifi_aps_rank(const struct wifi_aps *aps, const int8_t *rssi, uint8_t *order)
+{
+    size_t n = 0;
+    size_t i, j;
+
+    for(i = 0; i < aps->count && i < WIFI_APS_MAX; i++) {
+        if(rssi[i] == WIFI_APS_RSSI_NONE) {
+            continue;
+        }
+
+        // Insertion sort, the list is a handful of APs
+        for(j = n; j > 0 && wifi_aps_score(&aps->entries[order[j - 1]], rssi[order[j - 1]])
+            < wifi_aps_score(&aps->entries[i], rssi[i]); j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+        n++;
+    }
+
+    return n;
+}
+
+void wifi_aps_record(struct wifi_aps *aps, int index, bool success)
+{
+    struct wifi_ap_entry *entry;
+
+    if(index < 0 || index >= (int)aps->count) {
+        return;
+    }
+
+    entry = &aps->entries[index];
+    if(entry->attempts >= WIFI_APS_HISTORY) {
+        entry->attempts /= 2;
+        entry->successes /= 2;
+    }
+
+    entry->attempts++;
+    if(success) {
+        entry->successes++;
+    }
+}
+
+static int wifi_aps_success_rate(const struct wifi_ap_entry *entry)
+{
+    // Laplace smoothing, one attempt does not make an AP perfect or useless
+    return (entry->successes + 1) * 100 / (entry->attempts + 2);
+}
+
+static int wifi_aps_score(const struct wifi_ap_entry *entry, int8_t rssi)
+{
+    return rssi + WIFI_APS_SUCCESS_WEIGHT_DB * wifi_aps_success_rate(entry) / 100;
+}
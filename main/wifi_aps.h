@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Access points that are remembered
+#define WIFI_APS_MAX                CONFIG_WIFI_AP_LIST_SIZE
+
+// ssid and password with NUL
+#define WIFI_APS_SSID_SIZE          33
+#define WIFI_APS_PWD_SIZE           65
+
+// Ranking bonus in dB of an AP that always connects over one that never does
+#define WIFI_APS_SUCCESS_WEIGHT_DB  20
+
+// Counters are halved once attempts reach this, recent attempts weigh more than old ones
+#define WIFI_APS_HISTORY            32
+
+// rssi of an AP that was not seen in the scan
+#define WIFI_APS_RSSI_NONE          INT8_MIN
+
+/*
+    Known access points with their connection history, no platform dependencies.
+    After a scan the APs that were seen are ranked by rssi plus a bonus for their success rate,
+    so a device does not stick to a distant AP, nor to a close one that keeps failing.
+ */
+
+struct wifi_ap_entry {
+    char ssid[WIFI_APS_SSID_SIZE];
+    char pwd[WIFI_APS_PWD_SIZE];
+    uint16_t attempts;
+    uint16_t successes;
+};
+
+/// Stored as one NVS blob, see nvs_get_wifi_aps()
+struct wifi_aps {
+    uint32_t count;
+    struct wifi_ap_entry entries[WIFI_APS_MAX];
+};
+
+/// Index of @param ssid, -1 if it is not known
+int wifi_aps_find(const struct wifi_aps *aps, const char *ssid);
+
+/**
+ *  Add an AP or update the password of a known one.
+ *  When the list is full the AP with the lowest success rate is replaced.
+ * @return  index of the AP
+*/
+int wifi_aps_add(struct wifi_aps *aps, const char *ssid, const char *pwd);
+
+/**
+ *  Rank the APs that were seen, best first
+ * @param rssi rssi of every AP in the scan, WIFI_APS_RSSI_NONE if it was not seen
+ * @param order filled with indexes of the APs, room for WIFI_APS_MAX
+ * @return number of indexes in @param order
+*/
+size_t wifi_aps_rank(const struct wifi_aps *aps, const int8_t *rssi, uint8_t *order);
+
+/// Count a connection attempt of the AP at @param index
+void wifi_aps_record(struct wifi_aps *aps, int index, bool success);
+
+#ifdef __cplusplus
+}
+#endif